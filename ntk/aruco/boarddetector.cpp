@@ -3,6 +3,8 @@
 #include <ctime>
 #include <cassert>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
 using namespace std;
 namespace aruco
 {
@@ -18,74 +20,122 @@ float BoardDetector::detect(const vector<Marker> &detectedMarkers,const  BoardCo
 *
 *
 */
+BoardDetector::BoardDetector()
+{
+    _cachedMarkerSizePix=_cachedMarkerDistancePix=-1;
+    _cachedMarkerSizeMeters=-1;
+    _usePreviousPose=false;
+    _hasPreviousPose=false;
+}
+/**
+*
+*
+*/
+void BoardDetector::updateBoardCache(const BoardConfiguration &BConf, float markerSizeMeters)
+{
+    const Mat &ids=BConf._markersId;
+    bool sameConf= _cachedMarkersId.size()==ids.size()
+                   && _cachedMarkersId.type()==ids.type()
+                   && _cachedMarkerSizePix==BConf._markerSizePix
+                   && _cachedMarkerDistancePix==BConf._markerDistancePix
+                   && _cachedMarkerSizeMeters==markerSizeMeters;
+    for (int y=0;y<ids.rows && sameConf;y++)
+        sameConf= memcmp(_cachedMarkersId.ptr(y),ids.ptr(y),ids.cols*ids.elemSize())==0;
+    if (sameConf) return;
+
+    ids.copyTo(_cachedMarkersId);
+    _cachedMarkerSizePix=BConf._markerSizePix;
+    _cachedMarkerDistancePix=BConf._markerDistancePix;
+    _cachedMarkerSizeMeters=markerSizeMeters;
+    _hasPreviousPose=false;
+
+    //marker ids are small integers (10 bits), a direct table is the cheapest hash
+    int maxId=-1;
+    for (int y=0;y<ids.rows;y++)
+        for (int x=0;x<ids.cols;x++)
+            maxId=std::max(maxId,ids.at<int>(y,x));
+    _cellFromId.assign(maxId+1,-1);
+    for (int y=0;y<ids.rows;y++)
+        for (int x=0;x<ids.cols;x++)
+            if (ids.at<int>(y,x)>=0 && _cellFromId[ids.at<int>(y,x)]==-1)
+                _cellFromId[ids.at<int>(y,x)]=y*ids.cols+x;
+
+    _detectedInCell.assign(ids.rows*ids.cols,-1);
+
+    _cellObjPoints.clear();
+    if (markerSizeMeters<=0) return;
+    //size in meters of inter-marker distance
+    double markerDistanceMeters= double(BConf._markerDistancePix) * markerSizeMeters / double(BConf._markerSizePix);
+    //tranaltion to make the Ref System be in center
+    float TX=-(  ((ids.rows-1)*(markerDistanceMeters+markerSizeMeters) +markerSizeMeters) /2) ;
+    float TY=-(  ((ids.cols-1)*(markerDistanceMeters+markerSizeMeters) +markerSizeMeters)/2);
+    _cellObjPoints.resize(4*ids.rows*ids.cols);
+    for (int y=0;y<ids.rows;y++)
+        for (int x=0;x<ids.cols;x++) {
+            //points in real refernce system. We se the center in the bottom-left corner
+            float AY=x*(markerDistanceMeters+markerSizeMeters ) +TY;
+            float AX=y*(markerDistanceMeters+markerSizeMeters )+TX;
+            Point3f *cell=&_cellObjPoints[4*(y*ids.cols+x)];
+            cell[0]=Point3f(AX,AY,0);
+            cell[1]=Point3f(AX,AY+markerSizeMeters,0);
+            cell[2]=Point3f(AX+markerSizeMeters,AY+markerSizeMeters,0);
+            cell[3]=Point3f(AX+markerSizeMeters,AY,0);
+        }
+}
+/**
+*
+*
+*/
 float BoardDetector::detect(const vector<Marker> &detectedMarkers,const  BoardConfiguration &BConf, Board &Bdetected, Mat camMatrix,Mat distCoeff,float markerSizeMeters)throw (cv::Exception)
 {
 // cout<<"markerSizeMeters="<<markerSizeMeters<<endl;
+    updateBoardCache(BConf,markerSizeMeters);
+
     ///find among detected markers these that belong to the board configuration
-    Mat detected(BConf._markersId.size(),CV_32SC1); //stores the indices of the makers
-    detected.setTo(Scalar(-1));//-1 mean not detected
     int nMarkInBoard=0;//total number of markers detected
+    vector<int> cellOfMarker(detectedMarkers.size(),-1);
     for (unsigned int i=0;i<detectedMarkers.size();i++) {
-        bool found=false;
         int id=detectedMarkers[i].id;
-        //find it
-        for (  int j=0;j<detected.size().height && ! found;j++)
-            for (  int k=0;k<detected.size().width && ! found;k++)
-                if ( BConf._markersId.at<int>(j,k)==id) {
-                    detected.at<int>(j,k)=i;
-                    nMarkInBoard++;
-                    found=true;
-                    Bdetected.push_back(detectedMarkers[i]);
-                    if (markerSizeMeters>0)
-                        Bdetected.back().ssize=markerSizeMeters;
-                }
+        if (id<0 || id>=int(_cellFromId.size())) continue;
+        int cell=_cellFromId[id];
+        //unknown id, or already seen in this image
+        if (cell==-1 || _detectedInCell[cell]!=-1) continue;
+        _detectedInCell[cell]=i;
+        cellOfMarker[i]=cell;
+        nMarkInBoard++;
+        Bdetected.push_back(detectedMarkers[i]);
+        if (markerSizeMeters>0)
+            Bdetected.back().ssize=markerSizeMeters;
     }
+    //clear the cells for the next call now, the extrinsics below may throw
+    for (unsigned int i=0;i<detectedMarkers.size();i++)
+        if (cellOfMarker[i]!=-1) _detectedInCell[cellOfMarker[i]]=-1;
+
     Bdetected.conf=BConf;
     if (markerSizeMeters!=-1)
         Bdetected.markerSizeMeters=markerSizeMeters;
 //calculate extrinsic if there is information for that
-    if (camMatrix.rows!=0 && markerSizeMeters>0 && detectedMarkers.size()>1) {
-        // now, create the matrices for finding the extrinsics
+    if (camMatrix.rows!=0 && markerSizeMeters>0 && detectedMarkers.size()>1 && nMarkInBoard>0) {
+        // now, create the matrices for finding the extrinsics, in a single pass
         Mat objPoints(4*nMarkInBoard,3,CV_32FC1);
         Mat imagePoints(4*nMarkInBoard,2,CV_32FC1);
-        //size in meters of inter-marker distance
-        double markerDistanceMeters= double(BConf._markerDistancePix) * markerSizeMeters / double(BConf._markerSizePix);
-
-
-
         int currIndex=0;
-        for (  int y=0;y<detected.size().height;y++)
-            for (  int x=0;x<detected.size().width;x++) {
-                if (  detected.at<int>(y,x)!=-1 ) {
-
-                    vector<Point2f> points =detectedMarkers[ detected.at<int>(y,x) ];
-                    //set first image points
-                    for (int p=0;p<4;p++) {
-                        imagePoints.at<float>(currIndex+p,0)=points[p].x;
-                        imagePoints.at<float>(currIndex+p,1)=points[p].y;
-                    }
-
-                    //tranaltion to make the Ref System be in center
-                    float TX=-(  ((detected.size().height-1)*(markerDistanceMeters+markerSizeMeters) +markerSizeMeters) /2) ;
-                    float TY=-(  ((detected.size().width-1)*(markerDistanceMeters+markerSizeMeters) +markerSizeMeters)/2);
-                    //points in real refernce system. We se the center in the bottom-left corner
-                    float AY=x*(markerDistanceMeters+markerSizeMeters ) +TY;
-                    float AX=y*(markerDistanceMeters+markerSizeMeters )+TX;
-                    objPoints.at<float>( currIndex,0)= AX;
-                    objPoints.at<float>( currIndex,1)= AY;
-                    objPoints.at<float>( currIndex,2)= 0;
-                    objPoints.at<float>( currIndex+1,0)= AX;
-                    objPoints.at<float>( currIndex+1,1)= AY+markerSizeMeters;
-                    objPoints.at<float>( currIndex+1,2)= 0;
-                    objPoints.at<float>( currIndex+2,0)= AX+markerSizeMeters;
-                    objPoints.at<float>( currIndex+2,1)= AY+markerSizeMeters;
-                    objPoints.at<float>( currIndex+2,2)= 0;
-                    objPoints.at<float>( currIndex+3,0)= AX+markerSizeMeters;
-                    objPoints.at<float>( currIndex+3,1)= AY;
-                    objPoints.at<float>( currIndex+3,2)= 0;
-                    currIndex+=4;
-                }
+        for (unsigned int i=0;i<detectedMarkers.size();i++) {
+            int cell=cellOfMarker[i];
+            if (cell==-1) continue;
+            const Marker &marker=detectedMarkers[i];
+            const Point3f *cellPoints=&_cellObjPoints[4*cell];
+            for (int p=0;p<4;p++) {
+                float *img=imagePoints.ptr<float>(currIndex+p);
+                img[0]=marker[p].x;
+                img[1]=marker[p].y;
+                float *obj=objPoints.ptr<float>(currIndex+p);
+                obj[0]=cellPoints[p].x;
+                obj[1]=cellPoints[p].y;
+                obj[2]=cellPoints[p].z;
             }
+            currIndex+=4;
+        }
 
         CvMat cvCamMatrix=camMatrix;
         CvMat cvDistCoeffs;
@@ -95,14 +145,28 @@ float BoardDetector::detect(const vector<Marker> &detectedMarkers,const  BoardCo
         CvMat cvImgPoints=imagePoints;
         CvMat cvObjPoints=objPoints;
 
+        int useGuess=0;
+        if (_usePreviousPose && _hasPreviousPose) {
+            _previousRvec.copyTo(Bdetected.Rvec);
+            _previousTvec.copyTo(Bdetected.Tvec);
+            useGuess=1;
+        }
         CvMat cvRvec=Bdetected.Rvec;
         CvMat cvTvec=Bdetected.Tvec;
-        cvFindExtrinsicCameraParams2(&cvObjPoints, &cvImgPoints, &cvCamMatrix, &cvDistCoeffs,&cvRvec,&cvTvec);
+        cvFindExtrinsicCameraParams2(&cvObjPoints, &cvImgPoints, &cvCamMatrix, &cvDistCoeffs,&cvRvec,&cvTvec,useGuess);
+        if (_usePreviousPose) {
+            Bdetected.Rvec.copyTo(_previousRvec);
+            Bdetected.Tvec.copyTo(_previousTvec);
+            _hasPreviousPose=true;
+        }
         //now, rotate 90 deg in X so that Y axis points up
         rotateXAxis(Bdetected.Rvec);
         //cout<<Bdetected.Rvec.at<float>(0,0)<<" "<<Bdetected.Rvec.at<float>(1,0)<<Bdetected.Rvec.at<float>(2,0)<<endl;
         //cout<<Bdetected.Tvec.at<float>(0,0)<<" "<<Bdetected.Tvec.at<float>(1,0)<<Bdetected.Tvec.at<float>(2,0)<<endl;
     }
+    else
+        _hasPreviousPose=false;
+
     return double(nMarkInBoard)/double( BConf._markersId.size().width*BConf._markersId.size().height);
 }
 
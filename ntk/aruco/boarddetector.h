@@ -26,6 +26,13 @@ namespace aruco
 class BoardDetector
 {
 public:
+    BoardDetector();
+
+    /** If enabled, the board pose found in the previous call is used as the initial
+    * guess of the extrinsics estimation, which converges faster on video sequences.
+    */
+    void setUsePreviousPoseAsGuess(bool use_it) { _usePreviousPose=use_it; _hasPreviousPose=false; }
+    bool usePreviousPoseAsGuess() const { return _usePreviousPose; }
 
     /** Given the markers detected, determines if there is the board passed
     * @param detectedMarkers result provided by aruco::ArMarkerDetector
@@ -42,6 +49,23 @@ public:
     float detect(const vector<Marker> &detectedMarkers,const  BoardConfiguration &BConf, Board &Bdetected, CameraParameters cp, float markerSizeMeters=-1 )throw (cv::Exception);
 private:
     void rotateXAxis(Mat &rotation);
+    /** Rebuilds the id to cell table and the board object points if BConf or the marker size changed.
+    */
+    void updateBoardCache(const BoardConfiguration &BConf, float markerSizeMeters);
+
+    //cached board configuration, to detect changes
+    cv::Mat _cachedMarkersId;
+    int _cachedMarkerSizePix, _cachedMarkerDistancePix;
+    float _cachedMarkerSizeMeters;
+    //marker id to cell index (row*width+col), -1 if the id is not in the board
+    vector<int> _cellFromId;
+    //4 object points per cell, in board coordinates
+    vector<Point3f> _cellObjPoints;
+    //index of the detected marker assigned to each cell during the current detection
+    vector<int> _detectedInCell;
+    //previous extrinsics, before the X axis rotation
+    bool _usePreviousPose, _hasPreviousPose;
+    cv::Mat _previousRvec, _previousTvec;
 };
 
 }
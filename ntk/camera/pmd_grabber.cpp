@@ -221,6 +221,10 @@ void PmdGrabber :: run()
     m_rgbd_image.setCameraSerial(cameraSerial());
     m_rgbd_image.setCalibration(m_calib_data);
 
+    m_tof_processor.setImageSize(m_image_size);
+    m_tof_processor.setFlipVertically(true);
+    m_tof_processor.setInvalidFlags(PMD_FLAG_INVALID);
+
     while (!threadShouldExit())
     {
         waitForNewEvent(-1); // Use infinite timeout in order to honor sync mode.
@@ -231,24 +235,16 @@ void PmdGrabber :: run()
         checkError(pmdGetAmplitudes(m_hnd, amplitude[0], sizeof(float)*m_image_size.width*m_image_size.height));
         checkError(pmdGetFlags(m_hnd, flags[0], sizeof(unsigned)*m_image_size.width*m_image_size.height));
 
-        const unsigned* flags_ptr = flags.ptr<unsigned>(0);
-        const unsigned* flags_end = flags_ptr + flags.rows*flags.cols;
-        float* distance_ptr = distance.ptr<float>(0);
-        while (flags_end != flags_ptr)
-        {
-            if (*flags_ptr & PMD_FLAG_INVALID)
-                *distance_ptr = 0.f;
-            ++flags_ptr;
-            ++distance_ptr;
-        }
-
         {
             QWriteLocker locker(&m_lock);
 
-            flip(distance, m_rgbd_image.rawDepthRef(), 0);
-            flip(amplitude, m_rgbd_image.rawAmplitudeRef(), 0);
-            // flip(intensity, m_rgbd_image.rawIntensityRef(), 0);
-            flip(toMat3b(normalize_toMat1b(amplitude)), m_rgbd_image.rawRgbRef(), 0);
+            // Flip, invalid pixels removal and amplitude to gray in one pass.
+            m_tof_processor.process(distance.ptr<float>(),
+                                    amplitude.ptr<float>(),
+                                    flags.ptr<unsigned>(),
+                                    m_rgbd_image.rawDepthRef(),
+                                    m_rgbd_image.rawAmplitudeRef(),
+                                    &m_rgbd_image.rawRgbRef());
         }
 
         advertiseNewFrame();
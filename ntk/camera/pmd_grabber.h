@@ -22,6 +22,7 @@
 
 #include <ntk/core.h>
 #include <ntk/camera/rgbd_grabber.h>
+#include <ntk/camera/tof_frame_processor.h>
 #include <map>
 
 #ifdef NESTK_USE_PMDSDK
@@ -60,6 +61,7 @@ private:
   unsigned m_frequency;
   float m_offset;
   cv::Size m_image_size;
+  ToFFrameProcessor m_tof_processor;
 };
 
 /*! RGBDProcessor with default parameters for Pmd. */
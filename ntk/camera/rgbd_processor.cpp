@@ -23,6 +23,7 @@
 #include <ntk/utils/time.h>
 #include <ntk/geometry/pose_3d.h>
 #include <ntk/image/bilateral_filter.h>
+#include <ntk/image/fixed_point_remap.h>
 #include <ntk/camera/rgbd_calibration.h>
 
 #ifdef NESTK_USE_PMDSDK
@@ -530,82 +531,69 @@ namespace ntk
 
     void RGBDProcessor :: undistortImages()
     {
-        cv::Mat3b tmp3b;
-        cv::Mat1f tmp1f;
+        const RGBDCalibration& calib = *m_image->calibration();
+        if ((!calib.zero_rgb_distortion && calib.rgb_undistort_map1.empty())
+            || (!calib.zero_depth_distortion && calib.depth_undistort_map1.empty()))
+            const_Ptr_cast<RGBDCalibration>(m_image->calibration())->updateDistortionMaps();
 
         cv::Mat3b& rgb_im = m_image->rgbRef();
         const cv::Mat3b& raw_rgb_im = m_image->rawRgb();
 
-        if (m_image->calibration()->rgbSize() != m_image->calibration()->rawRgbSize())
+        // Cut color image to the undistorted image size (not used for kinect).
+        cv::Rect rgb_roi (0, 0, raw_rgb_im.cols, raw_rgb_im.rows);
+        if (calib.rgbSize() != calib.rawRgbSize())
         {
-            // First cut color image to the undistorted image size (not used for kinect).
-            cv::Size rgb_size = m_image->calibration()->rgbSize();
-            cv::Mat roi = raw_rgb_im(cv::Rect((raw_rgb_im.cols-rgb_size.width)/2.0,
-                                              (raw_rgb_im.rows-rgb_size.height)/2.0,
-                                              rgb_size.width,
-                                              rgb_size.height));
-            roi.copyTo(rgb_im);
+            cv::Size rgb_size = calib.rgbSize();
+            rgb_roi = cv::Rect((raw_rgb_im.cols-rgb_size.width)/2.0,
+                               (raw_rgb_im.rows-rgb_size.height)/2.0,
+                               rgb_size.width,
+                               rgb_size.height);
         }
-        else
+
+        if (!raw_rgb_im.data)
         {
             raw_rgb_im.copyTo(rgb_im);
         }
-
-        if (!m_image->calibration()->zero_rgb_distortion)
+        else if (calib.zero_rgb_distortion)
         {
-            if (m_image->calibration()->rgb_undistort_map1.empty())
-                const_Ptr_cast<RGBDCalibration>(m_image->calibration())->updateDistortionMaps();
-            remap(rgb_im, tmp3b,
-                  m_image->calibration()->rgb_undistort_map1,
-                  m_image->calibration()->rgb_undistort_map2,
-                  CV_INTER_LINEAR);
-            tmp3b.copyTo(rgb_im);
+            raw_rgb_im(rgb_roi).copyTo(rgb_im);
         }
-
-        if (!m_image->calibration()->zero_depth_distortion)
+        else
         {
-            if (m_image->calibration()->depth_undistort_map1.empty())
-                const_Ptr_cast<RGBDCalibration>(m_image->calibration())->updateDistortionMaps();
-            remap(m_image->rawDepthRef(), m_image->depthRef(),
-                  m_image->calibration()->depth_undistort_map1,
-                  m_image->calibration()->depth_undistort_map2,
-                  CV_INTER_LINEAR);
-            ntk_assert(m_image->depth().data != 0, "Should be ok");
+            remapColor(calib.rgb_undistort_map1, calib.rgb_undistort_map2,
+                       raw_rgb_im, rgb_im, rgb_roi);
         }
-        else
+
+        if (m_image->rawDepth().empty())
         {
-            if (!m_image->rawDepthRef().empty())
-                m_image->rawDepthRef().copyTo(m_image->depthRef());
-            else
-            {
-                const float unit_in_meters = m_image->calibration() ? m_image->calibration()->rawDepthUnitInMeters() : 1.f/1000.f;
-                copy16bitsToFloat (m_image->rawDepth16bits(), m_image->rawDepthRef(), unit_in_meters);
-            }
+            const float unit_in_meters = calib.rawDepthUnitInMeters();
+            copy16bitsToFloat (m_image->rawDepth16bits(), m_image->rawDepthRef(), unit_in_meters);
         }
 
-        if (m_image->calibration()->zero_depth_distortion ||
-            hasFilterFlag(RGBDProcessorFlags::NoAmplitudeIntensityUndistort))
+        const bool undistort_amplitude_intensity = !calib.zero_depth_distortion
+                && !hasFilterFlag(RGBDProcessorFlags::NoAmplitudeIntensityUndistort);
+
+        if (calib.zero_depth_distortion)
         {
-            m_image->rawAmplitudeRef().copyTo(m_image->amplitudeRef());
-            m_image->rawIntensityRef().copyTo(m_image->intensityRef());
+            m_image->rawDepth().copyTo(m_image->depthRef());
         }
         else
         {
-            if (m_image->rawAmplitudeRef().data)
-            {
-                remap(m_image->rawAmplitudeRef(), m_image->amplitudeRef(),
-                      m_image->calibration()->depth_undistort_map1,
-                      m_image->calibration()->depth_undistort_map2,
-                      CV_INTER_LINEAR);
-            }
+            // Depth, amplitude and intensity in a single pass.
+            const cv::Mat1f no_image;
+            remapDepthPlanes(calib.depth_undistort_map1, calib.depth_undistort_map2,
+                             m_image->rawDepth(), m_image->depthRef(),
+                             undistort_amplitude_intensity ? m_image->rawAmplitude() : no_image,
+                             m_image->amplitudeRef(),
+                             undistort_amplitude_intensity ? m_image->rawIntensity() : no_image,
+                             m_image->intensityRef());
+            ntk_assert(m_image->depth().data != 0, "Should be ok");
+        }
 
-            if (m_image->rawIntensityRef().data)
-            {
-                remap(m_image->rawIntensityRef(), m_image->intensityRef(),
-                      m_image->calibration()->depth_undistort_map1,
-                      m_image->calibration()->depth_undistort_map2,
-                      CV_INTER_LINEAR);
-            }
+        if (!undistort_amplitude_intensity)
+        {
+            m_image->rawAmplitude().copyTo(m_image->amplitudeRef());
+            m_image->rawIntensity().copyTo(m_image->intensityRef());
         }
     }
 
@@ -0,0 +1,268 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#include "rgbd_sequence_evaluator.h"
+
+#include <ntk/utils/debug.h>
+#include <ntk/thread/parallel.h>
+
+#include <QDir>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <set>
+
+namespace ntk
+{
+
+double EvaluationResult :: latencyPercentile(double fraction) const
+{
+    if (latencies_ms.empty())
+        return std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> sorted = latencies_ms;
+    std::sort(sorted.begin(), sorted.end());
+    int index = int(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::max(0, std::min(int(sorted.size()) - 1, index))];
+}
+
+double EvaluationResult :: meanLatency() const
+{
+    if (latencies_ms.empty())
+        return std::numeric_limits<double>::quiet_NaN();
+    double sum = 0;
+    foreach_idx(i, latencies_ms)
+        sum += latencies_ms[i];
+    return sum / latencies_ms.size();
+}
+
+double EvaluationResult :: metricMean(const std::string& name) const
+{
+    std::map<std::string, std::vector<double> >::const_iterator it = metrics.find(name);
+    if (it == metrics.end() || it->second.empty())
+        return std::numeric_limits<double>::quiet_NaN();
+    double sum = 0;
+    foreach_idx(i, it->second)
+        sum += it->second[i];
+    return sum / it->second.size();
+}
+
+void RGBDProcessorEvaluationPipeline :: configure(const ParameterSet& parameters)
+{
+    if (parameters.hasParameter("filter_flags"))
+        m_processor.setFilterFlags(parameters.getParameter("filter_flags").toInt());
+    if (parameters.hasParameter("min_depth"))
+        m_processor.setMinDepth(parameters.getParameter("min_depth").toFloat());
+    if (parameters.hasParameter("max_depth"))
+        m_processor.setMaxDepth(parameters.getParameter("max_depth").toFloat());
+    if (parameters.hasParameter("max_spatial_delta"))
+        m_processor.setMaxSpacialDelta(parameters.getParameter("max_spatial_delta").toFloat());
+    if (parameters.hasParameter("max_time_delta"))
+        m_processor.setMaxTimeDelta(parameters.getParameter("max_time_delta").toFloat());
+}
+
+void RGBDProcessorEvaluationPipeline :: beginFrame(const RGBDImage& frame, int frame_index)
+{
+    frame.copyTo(m_image);
+}
+
+bool RGBDProcessorEvaluationPipeline :: processFrame(const RGBDImage& frame, int frame_index, EvaluationResult& result)
+{
+    m_processor.processImage(m_image);
+    const cv::Mat1b& mask = m_image.depthMask();
+    if (!mask.data)
+        return false;
+    result.addMetric("valid_depth_ratio", cv::countNonZero(mask) / double(mask.total()));
+    return true;
+}
+
+void RGBDSequenceEvaluator :: loadSequence(const std::string& directory,
+                                           RGBDCalibrationConstPtr calibration,
+                                           RGBDProcessor* processor)
+{
+    QDir path (directory.c_str());
+    QStringList views = path.entryList(QStringList("view????*"), QDir::Dirs, QDir::Name);
+    ntk_ensure(!views.empty(), "No view???? images in given directory.");
+    foreach(const QString& view, views)
+    {
+        RGBDImagePtr image (new RGBDImage);
+        image->loadFromDir(path.absoluteFilePath(view).toStdString(), calibration, processor);
+        m_frames.push_back(image);
+    }
+}
+
+void RGBDSequenceEvaluator :: addParameterValues(const QString& name, const QList<QVariant>& values)
+{
+    ntk_assert(!values.empty(), "At least one value is required.");
+    m_grid.append(qMakePair(name, values));
+}
+
+QStringList RGBDSequenceEvaluator :: parameterNames() const
+{
+    QStringList names;
+    for (int i = 0; i < m_grid.size(); ++i)
+        names.append(m_grid[i].first);
+    return names;
+}
+
+int RGBDSequenceEvaluator :: numConfigurations() const
+{
+    int n = 1;
+    for (int i = 0; i < m_grid.size(); ++i)
+        n *= m_grid[i].second.size();
+    return n;
+}
+
+void RGBDSequenceEvaluator :: getConfiguration(int index, ParameterSet& parameters) const
+{
+    // Mixed radix decomposition, the last parameter varies fastest.
+    for (int i = m_grid.size() - 1; i >= 0; --i)
+    {
+        const QList<QVariant>& values = m_grid[i].second;
+        parameters.setParameter(m_grid[i].first, values[index % values.size()]);
+        index /= values.size();
+    }
+}
+
+struct RGBDSequenceEvaluator::EvaluationBody
+{
+    EvaluationBody(RGBDSequenceEvaluator& evaluator, const RGBDEvaluationPipelineFactory& factory)
+        : evaluator(evaluator), factory(factory)
+    {}
+
+    void operator()(const IndexRange& range) const
+    {
+        for (int config = range.begin; config < range.end; ++config)
+            evaluateConfiguration(config);
+    }
+
+    void evaluateConfiguration(int config) const
+    {
+        ParameterSet parameters;
+        evaluator.getConfiguration(config, parameters);
+
+        EvaluationResult& result = evaluator.m_results[config];
+        result.configuration = config;
+        for (int i = 0; i < evaluator.m_grid.size(); ++i)
+            result.parameter_values.push_back(parameters.getParameter(evaluator.m_grid[i].first));
+
+        std::auto_ptr<RGBDEvaluationPipeline> pipeline (factory.createPipeline());
+        pipeline->configure(parameters);
+
+        const double ticks_to_ms = 1000.0 / cv::getTickFrequency();
+        foreach_idx(i, evaluator.m_frames)
+        {
+            const RGBDImage& frame = *evaluator.m_frames[i];
+            pipeline->beginFrame(frame, i);
+            int64 start = cv::getTickCount();
+            bool ok = pipeline->processFrame(frame, i, result);
+            result.latencies_ms.push_back((cv::getTickCount() - start) * ticks_to_ms);
+            if (!ok)
+                ++result.num_failed_frames;
+        }
+    }
+
+    RGBDSequenceEvaluator& evaluator;
+    const RGBDEvaluationPipelineFactory& factory;
+};
+
+void RGBDSequenceEvaluator :: evaluate(const RGBDEvaluationPipelineFactory& factory)
+{
+    const int num_configurations = numConfigurations();
+    m_results.clear();
+    m_results.resize(num_configurations);
+
+    int num_parallel_runs = m_num_parallel_runs > 0
+            ? m_num_parallel_runs
+            : parallel_num_chunks(num_configurations, 1);
+
+    // Each chunk evaluates its configurations one after the other.
+    std::vector<IndexRange> chunks;
+    split_range(0, num_configurations, num_parallel_runs, chunks);
+    parallel_for_chunks(chunks, EvaluationBody(*this, factory));
+}
+
+int RGBDSequenceEvaluator :: fastestConfiguration(const std::string& metric, double threshold,
+                                                  bool higher_is_better,
+                                                  double latency_fraction) const
+{
+    int best = -1;
+    double best_latency = std::numeric_limits<double>::max();
+    foreach_idx(i, m_results)
+    {
+        double value = m_results[i].metricMean(metric);
+        if (value != value)
+            continue;
+        if (higher_is_better ? value < threshold : value > threshold)
+            continue;
+        double latency = m_results[i].latencyPercentile(latency_fraction);
+        if (latency < best_latency)
+        {
+            best_latency = latency;
+            best = i;
+        }
+    }
+    return best;
+}
+
+void RGBDSequenceEvaluator :: writeCsv(std::ostream& output) const
+{
+    std::set<std::string> metric_names;
+    foreach_idx(i, m_results)
+    {
+        std::map<std::string, std::vector<double> >::const_iterator it;
+        for (it = m_results[i].metrics.begin(); it != m_results[i].metrics.end(); ++it)
+            metric_names.insert(it->first);
+    }
+
+    output << "configuration";
+    for (int i = 0; i < m_grid.size(); ++i)
+        output << "," << m_grid[i].first.toStdString();
+    output << ",num_frames,num_failed_frames,latency_mean_ms,latency_p50_ms,latency_p90_ms,latency_p99_ms";
+    for (std::set<std::string>::const_iterator it = metric_names.begin(); it != metric_names.end(); ++it)
+        output << "," << *it;
+    output << "\n";
+
+    foreach_idx(i, m_results)
+    {
+        const EvaluationResult& result = m_results[i];
+        output << result.configuration;
+        foreach_idx(k, result.parameter_values)
+            output << "," << result.parameter_values[k].toString().toStdString();
+        output << "," << result.latencies_ms.size()
+               << "," << result.num_failed_frames
+               << "," << result.meanLatency()
+               << "," << result.latencyPercentile(0.5)
+               << "," << result.latencyPercentile(0.9)
+               << "," << result.latencyPercentile(0.99);
+        for (std::set<std::string>::const_iterator it = metric_names.begin(); it != metric_names.end(); ++it)
+            output << "," << result.metricMean(*it);
+        output << "\n";
+    }
+}
+
+void RGBDSequenceEvaluator :: saveCsv(const std::string& filename) const
+{
+    std::ofstream output (filename.c_str());
+    ntk_ensure(output, ("Could not open " + filename).c_str());
+    writeCsv(output);
+}
+
+} // ntk
@@ -0,0 +1,183 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_CAMERA_RGBD_SEQUENCE_EVALUATOR_H
+#define NTK_CAMERA_RGBD_SEQUENCE_EVALUATOR_H
+
+#include <ntk/core.h>
+#include <ntk/camera/rgbd_image.h>
+#include <ntk/camera/rgbd_processor.h>
+#include <ntk/utils/parameter_set.h>
+
+#include <QList>
+#include <QPair>
+#include <QStringList>
+
+#include <iostream>
+#include <map>
+
+namespace ntk
+{
+
+/*! Latencies and accuracy values gathered by one configuration over a sequence. */
+struct EvaluationResult
+{
+    EvaluationResult() : configuration(-1), num_failed_frames(0) {}
+
+    /*! Record an accuracy value, e.g. an error with respect to ground truth. */
+    void addMetric(const std::string& name, double value) { metrics[name].push_back(value); }
+
+    /*! Value below which the given fraction of frame latencies fall. */
+    double latencyPercentile(double fraction) const;
+    double meanLatency() const;
+
+    /*! Mean of a metric, NaN if it was never recorded. */
+    double metricMean(const std::string& name) const;
+
+    int configuration;
+    std::vector<QVariant> parameter_values;
+    std::vector<double> latencies_ms;
+    std::map<std::string, std::vector<double> > metrics;
+    int num_failed_frames;
+};
+
+/*!
+ * Pipeline under evaluation. One instance is created per configuration,
+ * so it does not need to be reentrant.
+ */
+class RGBDEvaluationPipeline
+{
+public:
+    virtual ~RGBDEvaluationPipeline() {}
+
+    /*! Apply a configuration before the sequence is replayed. */
+    virtual void configure(const ParameterSet& parameters) = 0;
+
+    /*! Untimed preparation of a frame, e.g. copying it into a working image. */
+    virtual void beginFrame(const RGBDImage& frame, int frame_index) {}
+
+    /*!
+     * Timed processing of a frame. Frames are shared between configurations
+     * and must not be modified. Returns false if the frame failed.
+     */
+    virtual bool processFrame(const RGBDImage& frame, int frame_index, EvaluationResult& result) = 0;
+};
+
+class RGBDEvaluationPipelineFactory
+{
+public:
+    virtual ~RGBDEvaluationPipelineFactory() {}
+    virtual RGBDEvaluationPipeline* createPipeline() const = 0;
+};
+
+/*!
+ * Pipeline running an RGBDProcessor, configured from the parameters
+ * "filter_flags", "min_depth", "max_depth", "max_spatial_delta" and
+ * "max_time_delta" when present. Reports the fraction of valid depth pixels
+ * as the "valid_depth_ratio" metric.
+ */
+class RGBDProcessorEvaluationPipeline : public RGBDEvaluationPipeline
+{
+public:
+    virtual void configure(const ParameterSet& parameters);
+    virtual void beginFrame(const RGBDImage& frame, int frame_index);
+    virtual bool processFrame(const RGBDImage& frame, int frame_index, EvaluationResult& result);
+
+protected:
+    RGBDProcessor m_processor;
+    RGBDImage m_image;
+};
+
+template <class Pipeline>
+class RGBDEvaluationPipelineFactoryOf : public RGBDEvaluationPipelineFactory
+{
+public:
+    virtual RGBDEvaluationPipeline* createPipeline() const { return new Pipeline; }
+};
+
+/*!
+ * Offline evaluation of a pipeline over a grid of parameter values.
+ * The recorded frames are decoded once and shared by all the runs, and
+ * configurations are evaluated in parallel. Results can be written as CSV,
+ * with one line per configuration.
+ */
+class RGBDSequenceEvaluator
+{
+public:
+    RGBDSequenceEvaluator() : m_num_parallel_runs(-1) {}
+
+public:
+    /*!
+     * Load all the viewXXXX directories of a recorded sequence.
+     * The optional processor is applied once at loading time.
+     */
+    void loadSequence(const std::string& directory,
+                      RGBDCalibrationConstPtr calibration = RGBDCalibrationConstPtr(),
+                      RGBDProcessor* processor = 0);
+
+    void addFrame(RGBDImageConstPtr frame) { m_frames.push_back(frame); }
+    int numFrames() const { return m_frames.size(); }
+
+    /*! Add a grid dimension. Configurations are all the combinations of values. */
+    void addParameterValues(const QString& name, const QList<QVariant>& values);
+    QStringList parameterNames() const;
+    int numConfigurations() const;
+    void getConfiguration(int index, ParameterSet& parameters) const;
+
+    /*!
+     * Number of configurations evaluated simultaneously.
+     * Defaults to the number of threads of the global pool. Use 1 for the
+     * most reliable latencies.
+     */
+    void setNumParallelRuns(int n) { m_num_parallel_runs = n; }
+
+public:
+    /*! Replay the sequence for each configuration. */
+    void evaluate(const RGBDEvaluationPipelineFactory& factory);
+
+    const std::vector<EvaluationResult>& results() const { return m_results; }
+
+    /*!
+     * Configuration with the lowest latency percentile whose metric mean is at
+     * least (or at most if !higher_is_better) the given threshold. -1 if none.
+     */
+    int fastestConfiguration(const std::string& metric, double threshold,
+                             bool higher_is_better = true,
+                             double latency_fraction = 0.9) const;
+
+    /*!
+     * One line per configuration: parameter values, number of frames and failures,
+     * mean, 50th, 90th and 99th percentile latencies in ms, and metric means.
+     */
+    void writeCsv(std::ostream& output) const;
+    void saveCsv(const std::string& filename) const;
+
+private:
+    struct EvaluationBody;
+
+private:
+    std::vector<RGBDImageConstPtr> m_frames;
+    QList< QPair<QString, QList<QVariant> > > m_grid;
+    std::vector<EvaluationResult> m_results;
+    int m_num_parallel_runs;
+};
+
+} // ntk
+
+#endif // NTK_CAMERA_RGBD_SEQUENCE_EVALUATOR_H
@@ -238,29 +238,19 @@ void SoftKineticGrabber::onNewDepthSample(DepthNode::NewSampleReceivedData data)
         return;
     }
 
+    const int16_t* raw_depth = data.depthMap;
 #ifdef SOFTKINETIC_CONFIDENCE_AS_COLOR
-    const int16_t* confidence_map_values = data.confidenceMap;
-    const int16_t* last_confidence_value = data.confidenceMap + data.confidenceMap.size();
-    float* confidence_buffer = m_current_image.rawAmplitudeRef().ptr<float>();
-    while (confidence_map_values != last_confidence_value)
-    {
-        (*confidence_buffer++) = *confidence_map_values++;
-    }
-    m_current_image.rawRgbRef() = ntk::toMat3b(ntk::normalize_toMat1b(m_current_image.rawAmplitude()));
+    const int16_t* confidence = data.confidenceMap;
+    m_tof_processor.process(raw_depth, confidence,
+                            m_current_image.rawDepthRef(),
+                            m_current_image.rawAmplitudeRef(),
+                            &m_current_image.rawRgbRef());
     m_rgb_transmitted = false;
+#else
+    cv::Mat1f no_amplitude;
+    m_tof_processor.process(raw_depth, 0, m_current_image.rawDepthRef(), no_amplitude, 0);
 #endif
 
-    // std::clog << cv::format("Depth: %d\n", data.depthMap.size());
-    float* depth_buffer = m_current_image.rawDepthRef().ptr<float>(0);
-    const int16_t* raw_values = data.depthMap;
-    const int16_t* last_raw_value = data.depthMap + data.depthMap.size();
-    while (raw_values != last_raw_value)
-    {
-        int16_t saturated_value = *raw_values++;
-        if (saturated_value > 31999)
-            saturated_value = 0;
-        (*depth_buffer++) = saturated_value / 1000.f;
-    }
     m_depth_transmitted = false;
     handleNewFrame();
 #if 0
@@ -527,6 +517,11 @@ void SoftKineticGrabber :: run()
     m_current_image.rawAmplitudeRef() = Mat1f(depth_height, depth_width);
 #endif
 
+    // Depth is given in millimeters, values above 31999 are saturated.
+    m_tof_processor.setImageSize(cv::Size(depth_width, depth_height));
+    m_tof_processor.setRawDepthScale(1.f/1000.f);
+    m_tof_processor.setMaxRawDepth(31999);
+
     m_current_image.setCalibration(m_calib_data);
     m_rgbd_image.setCalibration(m_calib_data);
 
@@ -25,6 +25,7 @@
 #include <ntk/core.h>
 #include <ntk/utils/qt_utils.h>
 #include <ntk/camera/calibration.h>
+#include <ntk/camera/tof_frame_processor.h>
 #include <ntk/thread/event.h>
 
 #include <DepthSense.hxx>
@@ -74,6 +75,7 @@ protected:
 
 private:
   RGBDImage m_current_image;
+  ToFFrameProcessor m_tof_processor;
   bool m_depth_transmitted;
   bool m_rgb_transmitted;
   DepthSense::Context m_context;
@@ -0,0 +1,252 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#include "tof_frame_processor.h"
+
+#include <ntk/utils/debug.h>
+
+#include <vectorial/simd4f.h>
+
+#include <cfloat>
+#include <climits>
+
+namespace ntk
+{
+
+ToFFrameProcessor :: ToFFrameProcessor()
+  : m_radial_to_z(false),
+    m_flip_vertically(false),
+    m_min_amplitude(-FLT_MAX),
+    m_invalid_flags(0),
+    m_raw_depth_scale(1.f),
+    m_max_raw_depth(INT_MAX)
+{
+}
+
+void ToFFrameProcessor :: setImageSize(const cv::Size& size)
+{
+  if (size != m_image_size)
+    m_radial_to_z = false; // Factors have to be recomputed.
+  m_image_size = size;
+}
+
+void ToFFrameProcessor :: setRadialToZ(const cv::Mat1d& intrinsics, const cv::Mat1d& distortion)
+{
+  ntk_ensure(m_image_size.area() > 0, "Image size must be set first.");
+
+  std::vector<cv::Point2f> pixels;
+  pixels.reserve(m_image_size.area());
+  for (int r = 0; r < m_image_size.height; ++r)
+    for (int c = 0; c < m_image_size.width; ++c)
+      pixels.push_back(cv::Point2f(c, r));
+
+  // Normalized undistorted coordinates of each raw pixel.
+  std::vector<cv::Point2f> rays;
+  if (distortion.empty())
+    cv::undistortPoints(pixels, rays, intrinsics, cv::Mat());
+  else
+    cv::undistortPoints(pixels, rays, intrinsics, distortion);
+
+  m_z_factors.create(m_image_size);
+  float* factor = m_z_factors.ptr<float>();
+  foreach_idx(i, rays)
+    factor[i] = 1.0f / sqrt(rays[i].x*rays[i].x + rays[i].y*rays[i].y + 1.0f);
+
+  m_radial_to_z = true;
+}
+
+void ToFFrameProcessor :: computeAmplitudeRange(const float* amplitude, float& min_value, float& max_value) const
+{
+  const int n = m_image_size.area();
+  int i = 0;
+
+  simd4f min_v = simd4f_splat(FLT_MAX);
+  simd4f max_v = simd4f_splat(-FLT_MAX);
+  for (; i + 3 < n; i += 4)
+  {
+    simd4f a = simd4f_uload4(amplitude + i);
+    min_v = simd4f_min(min_v, a);
+    max_v = simd4f_max(max_v, a);
+  }
+
+  min_value = std::min(std::min(simd4f_get_x(min_v), simd4f_get_y(min_v)),
+                       std::min(simd4f_get_z(min_v), simd4f_get_w(min_v)));
+  max_value = std::max(std::max(simd4f_get_x(max_v), simd4f_get_y(max_v)),
+                       std::max(simd4f_get_z(max_v), simd4f_get_w(max_v)));
+
+  for (; i < n; ++i)
+  {
+    min_value = std::min(min_value, amplitude[i]);
+    max_value = std::max(max_value, amplitude[i]);
+  }
+}
+
+void ToFFrameProcessor :: processRow(int row,
+                                     const float* distance,
+                                     const float* amplitude,
+                                     const unsigned* flags,
+                                     float amplitude_offset,
+                                     float amplitude_scale,
+                                     cv::Mat1f& depth,
+                                     cv::Mat1f& amplitude_out,
+                                     cv::Mat3b* gray)
+{
+  const int width = m_image_size.width;
+  const int out_row = m_flip_vertically ? m_image_size.height - row - 1 : row;
+
+  float* depth_out = depth.ptr<float>(out_row);
+  float* amplitude_row_out = amplitude ? amplitude_out.ptr<float>(out_row) : 0;
+  const float* z_factors = m_radial_to_z ? m_z_factors.ptr<float>(row) : 0;
+
+  // Vectorized part: depth conversion and amplitude copy.
+  int c = 0;
+  for (; c + 3 < width; c += 4)
+  {
+    simd4f d = simd4f_uload4(distance + c);
+    if (z_factors)
+      d = simd4f_mul(d, simd4f_uload4(z_factors + c));
+    simd4f_ustore4(d, depth_out + c);
+
+    if (amplitude)
+      simd4f_ustore4(simd4f_uload4(amplitude + c), amplitude_row_out + c);
+  }
+
+  for (; c < width; ++c)
+  {
+    depth_out[c] = z_factors ? distance[c] * z_factors[c] : distance[c];
+    if (amplitude)
+      amplitude_row_out[c] = amplitude[c];
+  }
+
+  // Masking and gray conversion, while the row is still in cache.
+  if (flags && m_invalid_flags)
+  {
+    for (c = 0; c < width; ++c)
+      if (flags[c] & m_invalid_flags)
+        depth_out[c] = 0.f;
+  }
+
+  if (!amplitude)
+    return;
+
+  for (c = 0; c < width; ++c)
+    if (amplitude[c] < m_min_amplitude)
+      depth_out[c] = 0.f;
+
+  if (gray)
+  {
+    uchar* gray_out = gray->ptr<uchar>(out_row);
+    for (c = 0; c < width; ++c)
+    {
+      uchar v = cv::saturate_cast<uchar>((amplitude[c] - amplitude_offset) * amplitude_scale);
+      gray_out[3*c] = gray_out[3*c+1] = gray_out[3*c+2] = v;
+    }
+  }
+}
+
+void ToFFrameProcessor :: process(const float* distance,
+                                  const float* amplitude,
+                                  const unsigned* flags,
+                                  cv::Mat1f& depth,
+                                  cv::Mat1f& amplitude_out,
+                                  cv::Mat3b* gray)
+{
+  ntk_ensure(m_image_size.area() > 0, "Image size must be set first.");
+  ntk_ensure(distance && amplitude, "Distance and amplitude buffers are required.");
+
+  depth.create(m_image_size);
+  amplitude_out.create(m_image_size);
+  if (gray)
+    gray->create(m_image_size);
+
+  // Same mapping as cv::normalize with NORM_MINMAX into [0,255].
+  float min_amplitude = 0, max_amplitude = 0;
+  if (gray)
+    computeAmplitudeRange(amplitude, min_amplitude, max_amplitude);
+  float scale = (max_amplitude - min_amplitude) > FLT_EPSILON ? 255.f / (max_amplitude - min_amplitude) : 0.f;
+
+  const int width = m_image_size.width;
+  for (int r = 0; r < m_image_size.height; ++r)
+  {
+    processRow(r,
+               distance + r*width,
+               amplitude + r*width,
+               flags ? flags + r*width : 0,
+               min_amplitude, scale,
+               depth, amplitude_out, gray);
+  }
+}
+
+void ToFFrameProcessor :: process(const short* raw_depth,
+                                  const short* confidence,
+                                  cv::Mat1f& depth,
+                                  cv::Mat1f& amplitude_out,
+                                  cv::Mat3b* gray)
+{
+  ntk_ensure(m_image_size.area() > 0, "Image size must be set first.");
+
+  const int width = m_image_size.width;
+  const int n = m_image_size.area();
+
+  depth.create(m_image_size);
+  if (confidence)
+    amplitude_out.create(m_image_size);
+  if (gray && confidence)
+    gray->create(m_image_size);
+
+  int min_confidence = 0, max_confidence = 0;
+  if (confidence && gray)
+  {
+    min_confidence = SHRT_MAX; max_confidence = SHRT_MIN;
+    for (int i = 0; i < n; ++i)
+    {
+      min_confidence = std::min(min_confidence, int(confidence[i]));
+      max_confidence = std::max(max_confidence, int(confidence[i]));
+    }
+  }
+  float scale = max_confidence > min_confidence ? 255.f / (max_confidence - min_confidence) : 0.f;
+
+  // Integer rows are converted to float in a small buffer that stays in cache.
+  m_row_buffer.resize(2*width);
+  float* depth_row = &m_row_buffer[0];
+  float* confidence_row = &m_row_buffer[width];
+
+  for (int r = 0; r < m_image_size.height; ++r)
+  {
+    const short* raw_row = raw_depth + r*width;
+    for (int c = 0; c < width; ++c)
+      depth_row[c] = raw_row[c] > m_max_raw_depth ? 0.f : raw_row[c] * m_raw_depth_scale;
+
+    if (confidence)
+    {
+      const short* confidence_raw_row = confidence + r*width;
+      for (int c = 0; c < width; ++c)
+        confidence_row[c] = confidence_raw_row[c];
+    }
+
+    processRow(r,
+               depth_row,
+               confidence ? confidence_row : 0,
+               0,
+               min_confidence, scale,
+               depth, amplitude_out, confidence ? gray : 0);
+  }
+}
+
+} // ntk
@@ -0,0 +1,119 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_CAMERA_TOF_FRAME_PROCESSOR_H
+#define NTK_CAMERA_TOF_FRAME_PROCESSOR_H
+
+#include <ntk/core.h>
+
+#include <vector>
+
+namespace ntk
+{
+
+/*!
+ * Hardware independent post-processing of raw Time-of-Flight buffers.
+ *
+ * Converts the driver distance and amplitude buffers into depth,
+ * amplitude and 8-bit gray color images in a single pass over the frame:
+ * vertical flip, invalid flags and confidence masking, optional
+ * radial distance to Z conversion and amplitude normalization.
+ * The radial to Z factors are precomputed from the intrinsics and
+ * distortion, since they only depend on the raw pixel position.
+ */
+class ToFFrameProcessor
+{
+public:
+  ToFFrameProcessor();
+
+public:
+  /*! Raw image size. Must be set before processing. */
+  void setImageSize(const cv::Size& size);
+  const cv::Size& imageSize() const { return m_image_size; }
+
+  /*!
+   * Enable the radial distance to Z conversion. Distortion coefficients
+   * are optional, they are used to compute the ray of each raw pixel.
+   */
+  void setRadialToZ(const cv::Mat1d& intrinsics, const cv::Mat1d& distortion = cv::Mat1d());
+  void disableRadialToZ() { m_radial_to_z = false; }
+
+  /*! Whether output images are flipped upside down. */
+  void setFlipVertically(bool flip) { m_flip_vertically = flip; }
+
+  /*! Pixels with an amplitude below this value get a zero depth. */
+  void setMinAmplitude(float amplitude) { m_min_amplitude = amplitude; }
+
+  /*! Pixels with any of these bits set in the flags buffer get a zero depth. */
+  void setInvalidFlags(unsigned flags) { m_invalid_flags = flags; }
+
+  /*! Scale applied to raw integer depth values, e.g. 0.001 for millimeters. */
+  void setRawDepthScale(float scale) { m_raw_depth_scale = scale; }
+
+  /*! Raw integer depth values above this one are considered invalid. */
+  void setMaxRawDepth(int value) { m_max_raw_depth = value; }
+
+public:
+  /*!
+   * Process float buffers (e.g. PMD). amplitude is required, flags can be null.
+   * Output images are reallocated only if their size does not match.
+   * gray can be null if no color image is needed.
+   */
+  void process(const float* distance,
+               const float* amplitude,
+               const unsigned* flags,
+               cv::Mat1f& depth,
+               cv::Mat1f& amplitude_out,
+               cv::Mat3b* gray);
+
+  /*! Process 16 bits integer buffers (e.g. SoftKinetic). confidence can be null. */
+  void process(const short* raw_depth,
+               const short* confidence,
+               cv::Mat1f& depth,
+               cv::Mat1f& amplitude_out,
+               cv::Mat3b* gray);
+
+private:
+  void computeAmplitudeRange(const float* amplitude, float& min_value, float& max_value) const;
+
+  void processRow(int row,
+                  const float* distance,
+                  const float* amplitude,
+                  const unsigned* flags,
+                  float amplitude_offset,
+                  float amplitude_scale,
+                  cv::Mat1f& depth,
+                  cv::Mat1f& amplitude_out,
+                  cv::Mat3b* gray);
+
+private:
+  cv::Size m_image_size;
+  bool m_radial_to_z;
+  bool m_flip_vertically;
+  float m_min_amplitude;
+  unsigned m_invalid_flags;
+  float m_raw_depth_scale;
+  int m_max_raw_depth;
+  cv::Mat1f m_z_factors;
+  std::vector<float> m_row_buffer;
+};
+
+} // ntk
+
+#endif // NTK_CAMERA_TOF_FRAME_PROCESSOR_H
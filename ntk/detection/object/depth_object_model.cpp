@@ -0,0 +1,174 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#include "depth_object_model.h"
+
+namespace ntk
+{
+
+void DepthObjectModel :: initialize(const ntk::Rect3f& bounds, float voxel_size, float truncation)
+{
+    ntk_assert(!bounds.isEmpty() && voxel_size > 0, "Invalid volume.");
+    m_voxel_size = voxel_size;
+    m_truncation = truncation > 0 ? truncation : 3*voxel_size;
+    m_origin = cv::Point3f(bounds.x, bounds.y, bounds.z);
+    m_size[0] = std::max(int(ceil(bounds.width / voxel_size)), 1);
+    m_size[1] = std::max(int(ceil(bounds.height / voxel_size)), 1);
+    m_size[2] = std::max(int(ceil(bounds.depth / voxel_size)), 1);
+
+    const int num_voxels = m_size[0]*m_size[1]*m_size[2];
+    m_tsdf.assign(num_voxels, 1.f);
+    m_weights.assign(num_voxels, 0.f);
+    m_points.clear();
+    m_normals.clear();
+}
+
+cv::Point3f DepthObjectModel :: voxelCenter(int x, int y, int z) const
+{
+    return cv::Point3f(m_origin.x + (x+0.5f)*m_voxel_size,
+                       m_origin.y + (y+0.5f)*m_voxel_size,
+                       m_origin.z + (z+0.5f)*m_voxel_size);
+}
+
+void DepthObjectModel :: integrateView(const cv::Mat1f& depth, const ntk::Pose3D& pose, const cv::Mat1b& mask)
+{
+    ntk_assert(!m_tsdf.empty(), "Volume not initialized, or already finalized.");
+
+    // Project one slice at a time.
+    const int slice_size = m_size[0]*m_size[1];
+    std::vector<cv::Point3f> centers (slice_size);
+    std::vector<cv::Point3f> projected;
+    for (int z = 0; z < m_size[2]; ++z)
+    {
+        for (int y = 0; y < m_size[1]; ++y)
+            for (int x = 0; x < m_size[0]; ++x)
+                centers[y*m_size[0] + x] = voxelCenter(x, y, z);
+        pose.projectToImage(centers, projected);
+
+        for (int i = 0; i < slice_size; ++i)
+        {
+            const cv::Point3f& p = projected[i];
+            const int r = ntk::math::rnd(p.y);
+            const int c = ntk::math::rnd(p.x);
+            if (p.z <= 0 || !is_yx_in_range(depth, r, c))
+                continue;
+            if (mask.data && !mask(r,c))
+                continue;
+
+            const float d = depth(r,c);
+            if (d < 1e-5)
+                continue;
+
+            // Distance along the optical axis, positive in front of the surface.
+            const float sdf = d - p.z;
+            if (sdf < -m_truncation)
+                continue;
+
+            const int index = z*slice_size + i;
+            float& weight = m_weights[index];
+            m_tsdf[index] = (m_tsdf[index]*weight + std::min(1.f, sdf / m_truncation)) / (weight + 1);
+            weight += 1;
+        }
+    }
+}
+
+bool DepthObjectModel :: computeGradient(int x, int y, int z, cv::Point3f& gradient) const
+{
+    if (x < 1 || y < 1 || z < 1 || x >= m_size[0]-1 || y >= m_size[1]-1 || z >= m_size[2]-1)
+        return false;
+
+    const int neighbors[6] = {
+        voxelIndex(x-1,y,z), voxelIndex(x+1,y,z),
+        voxelIndex(x,y-1,z), voxelIndex(x,y+1,z),
+        voxelIndex(x,y,z-1), voxelIndex(x,y,z+1)
+    };
+    for (int k = 0; k < 6; ++k)
+        if (m_weights[neighbors[k]] <= 0)
+            return false;
+
+    gradient = cv::Point3f(m_tsdf[neighbors[1]] - m_tsdf[neighbors[0]],
+                           m_tsdf[neighbors[3]] - m_tsdf[neighbors[2]],
+                           m_tsdf[neighbors[5]] - m_tsdf[neighbors[4]]);
+    float norm = cv::norm(gradient);
+    if (norm < 1e-6)
+        return false;
+    gradient *= 1.0f / norm;
+    return true;
+}
+
+void DepthObjectModel :: finalize(int max_samples)
+{
+    ntk_assert(max_samples > 0, "At least one sample must be kept.");
+
+    std::vector<cv::Point3f> points;
+    std::vector<cv::Point3f> normals;
+
+    // Zero crossings between each voxel and its next neighbor along each axis.
+    // Crossings from or to a truncated value are silhouette artifacts.
+    for (int z = 0; z < m_size[2]; ++z)
+    for (int y = 0; y < m_size[1]; ++y)
+    for (int x = 0; x < m_size[0]; ++x)
+    {
+        const int index = voxelIndex(x, y, z);
+        const float value = m_tsdf[index];
+        if (m_weights[index] <= 0 || std::abs(value) >= 1)
+            continue;
+
+        cv::Point3f normal;
+        bool has_normal = false;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            int next[3] = { x, y, z };
+            ++next[axis];
+            if (next[axis] >= m_size[axis])
+                continue;
+
+            const int next_index = voxelIndex(next[0], next[1], next[2]);
+            const float next_value = m_tsdf[next_index];
+            if (m_weights[next_index] <= 0 || std::abs(next_value) >= 1 || (value > 0) == (next_value > 0))
+                continue;
+
+            if (!has_normal && !computeGradient(x, y, z, normal))
+                break;
+            has_normal = true;
+
+            cv::Point3f p = voxelCenter(x, y, z);
+            const float offset = value / (value - next_value) * m_voxel_size;
+            if (axis == 0) p.x += offset;
+            else if (axis == 1) p.y += offset;
+            else p.z += offset;
+            points.push_back(p);
+            normals.push_back(normal);
+        }
+    }
+
+    const int step = std::max(1, int((points.size() + max_samples - 1) / max_samples));
+    m_points.clear();
+    m_normals.clear();
+    for (size_t i = 0; i < points.size(); i += step)
+    {
+        m_points.push_back(points[i]);
+        m_normals.push_back(normals[i]);
+    }
+
+    std::vector<float>().swap(m_tsdf);
+    std::vector<float>().swap(m_weights);
+}
+
+} // ntk
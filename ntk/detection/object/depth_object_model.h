@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_DETECTION_OBJECT_DEPTH_OBJECT_MODEL_H
+#define NTK_DETECTION_OBJECT_DEPTH_OBJECT_MODEL_H
+
+#include <ntk/ntk.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/utils/opencv_utils.h>
+
+namespace ntk
+{
+
+/*!
+ * Depth and normal model of an object, without any appearance information.
+ * Depth views are first fused into a truncated signed distance volume in
+ * object coordinates. finalize() then keeps only oriented surface samples
+ * and releases the volume.
+ */
+class DepthObjectModel
+{
+public:
+    DepthObjectModel() : m_voxel_size(0.004f), m_truncation(0.012f)
+    { m_size[0] = m_size[1] = m_size[2] = 0; }
+
+public:
+    /*! Allocate an empty volume covering bounds. Truncation defaults to 3 voxels. */
+    void initialize(const ntk::Rect3f& bounds, float voxel_size, float truncation = -1);
+
+    /*!
+     * Fuse a depth image. pose maps object coordinates to the image.
+     * If mask is given, only its non-zero pixels are used.
+     */
+    void integrateView(const cv::Mat1f& depth, const ntk::Pose3D& pose, const cv::Mat1b& mask = cv::Mat1b());
+
+    /*! Extract at most max_samples surface samples and release the volume. */
+    void finalize(int max_samples = 1000);
+
+public:
+    bool isEmpty() const { return m_points.empty(); }
+    float voxelSize() const { return m_voxel_size; }
+
+    /*! Surface samples and their outward normals, in object coordinates. */
+    const std::vector<cv::Point3f>& points() const { return m_points; }
+    const std::vector<cv::Point3f>& normals() const { return m_normals; }
+
+private:
+    int voxelIndex(int x, int y, int z) const { return (z*m_size[1] + y)*m_size[0] + x; }
+    cv::Point3f voxelCenter(int x, int y, int z) const;
+    bool computeGradient(int x, int y, int z, cv::Point3f& gradient) const;
+
+private:
+    float m_voxel_size;
+    float m_truncation;
+    cv::Point3f m_origin;
+    int m_size[3];
+    std::vector<float> m_tsdf;
+    std::vector<float> m_weights;
+    std::vector<cv::Point3f> m_points;
+    std::vector<cv::Point3f> m_normals;
+};
+ntk_ptr_typedefs(DepthObjectModel)
+
+} // ntk
+
+#endif // NTK_DETECTION_OBJECT_DEPTH_OBJECT_MODEL_H
@@ -0,0 +1,327 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#include "depth_pose_verifier.h"
+#include "object_detector.h"
+#include "visual_object.h"
+
+#include <ntk/utils/sse.h>
+
+#include <vectorial/simd4f.h>
+
+#include <map>
+
+namespace
+{
+
+// Samples closer than this to the camera plane are ignored.
+const float min_sample_depth = 1e-3f;
+
+// Row-major pose transform in the opencv camera frame, z forward and y downward.
+cv::Mat1f camera_transform(const ntk::Pose3D& pose)
+{
+    cv::Mat1d R, t;
+    pose.cvOpencvCameraTransform(R, t);
+    cv::Mat1f H = cv::Mat1f::eye(4,4);
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 3; ++c)
+            H(r,c) = R(r,c);
+        H(r,3) = t(r);
+    }
+    return H;
+}
+
+struct ScoringParameters
+{
+    float fx, fy, cx, cy;
+    float width, height;
+    float depth_tolerance;
+    float min_normal_cosine;
+};
+
+// Compare a transformed sample with the image. facing is the dot product
+// of the sample normal and position, (u,v) its projection shifted by half
+// a pixel so that truncation rounds to the nearest pixel.
+inline void check_sample(const ScoringParameters& params,
+                         const cv::Mat1f& depth,
+                         const cv::Mat3f& image_normals,
+                         float pz, float nx, float ny, float nz,
+                         float facing, float u, float v,
+                         float& num_visible,
+                         float& num_inliers)
+{
+    // Only samples in front of the camera and facing it are visible.
+    if (!(pz >= min_sample_depth) || !(facing < 0))
+        return;
+
+    if (!(u >= 0 && v >= 0 && u < params.width && v < params.height))
+        return;
+
+    const int r = int(v);
+    const int c = int(u);
+    const float d = depth(r,c);
+    if (!(d > 0))
+        return;
+
+    num_visible += 1;
+    const cv::Vec3f& image_normal = image_normals(r,c);
+    const float normal_dot = image_normal[0]*nx + image_normal[1]*ny + image_normal[2]*nz;
+    if (std::abs(d - pz) < params.depth_tolerance && normal_dot > params.min_normal_cosine)
+        num_inliers += 1;
+}
+
+void count_agreeing_samples(const cv::Mat1f& H,
+                            const std::vector<cv::Point3f>& points,
+                            const std::vector<cv::Point3f>& normals,
+                            const cv::Mat1f& depth,
+                            const cv::Mat3f& image_normals,
+                            const ScoringParameters& params,
+                            float& num_visible,
+                            float& num_inliers)
+{
+    const vectorial::mat4f transform = ntk::toSSE(H);
+    num_visible = 0;
+    num_inliers = 0;
+    foreach_idx(i, points)
+    {
+        const cv::Point3f& n = normals[i];
+        const vectorial::vec4f p = transform * ntk::toSSE(points[i]);
+        const vectorial::vec4f normal = transform * vectorial::vec4f(n.x, n.y, n.z, 0);
+        const float px = p.x(), py = p.y(), pz = p.z();
+        const float nx = normal.x(), ny = normal.y(), nz = normal.z();
+
+        const float iz = 1.f / pz;
+        const float u = params.fx*px*iz + params.cx + 0.5f;
+        const float v = params.fy*py*iz + params.cy + 0.5f;
+        check_sample(params, depth, image_normals, pz, nx, ny, nz,
+                     nx*px + ny*py + nz*pz, u, v, num_visible, num_inliers);
+    }
+}
+
+// Same as count_agreeing_samples for four poses at once, one pose per lane.
+// The transforms are stored as structures of arrays, m[4*r+c] holding the
+// (r,c) coefficient of the four poses, so that each sample is transformed
+// and projected with a handful of simd4f operations.
+void count_agreeing_samples_x4(const cv::Mat1f H[4],
+                               const std::vector<cv::Point3f>& points,
+                               const std::vector<cv::Point3f>& normals,
+                               const cv::Mat1f& depth,
+                               const cv::Mat3f& image_normals,
+                               const ScoringParameters& params,
+                               float num_visible[4],
+                               float num_inliers[4])
+{
+    simd4f m[12];
+    for (int r = 0; r < 3; ++r)
+    for (int c = 0; c < 4; ++c)
+        m[4*r+c] = simd4f_create(H[0](r,c), H[1](r,c), H[2](r,c), H[3](r,c));
+
+    const simd4f one = simd4f_splat(1.f);
+    const simd4f half = simd4f_splat(0.5f);
+    const simd4f fx = simd4f_splat(params.fx);
+    const simd4f fy = simd4f_splat(params.fy);
+    const simd4f cx = simd4f_splat(params.cx);
+    const simd4f cy = simd4f_splat(params.cy);
+
+    for (int k = 0; k < 4; ++k)
+        num_visible[k] = num_inliers[k] = 0;
+
+    float pzs[4], nxs[4], nys[4], nzs[4], facings[4], us[4], vs[4];
+    foreach_idx(i, points)
+    {
+        const simd4f x = simd4f_splat(points[i].x);
+        const simd4f y = simd4f_splat(points[i].y);
+        const simd4f z = simd4f_splat(points[i].z);
+        const simd4f px = simd4f_madd(m[0], x, simd4f_madd(m[1], y, simd4f_madd(m[2], z, m[3])));
+        const simd4f py = simd4f_madd(m[4], x, simd4f_madd(m[5], y, simd4f_madd(m[6], z, m[7])));
+        const simd4f pz = simd4f_madd(m[8], x, simd4f_madd(m[9], y, simd4f_madd(m[10], z, m[11])));
+
+        const simd4f n_x = simd4f_splat(normals[i].x);
+        const simd4f n_y = simd4f_splat(normals[i].y);
+        const simd4f n_z = simd4f_splat(normals[i].z);
+        const simd4f nx = simd4f_madd(m[0], n_x, simd4f_madd(m[1], n_y, simd4f_mul(m[2], n_z)));
+        const simd4f ny = simd4f_madd(m[4], n_x, simd4f_madd(m[5], n_y, simd4f_mul(m[6], n_z)));
+        const simd4f nz = simd4f_madd(m[8], n_x, simd4f_madd(m[9], n_y, simd4f_mul(m[10], n_z)));
+
+        const simd4f facing = simd4f_add(simd4f_add(simd4f_mul(nx, px), simd4f_mul(ny, py)), simd4f_mul(nz, pz));
+        const simd4f iz = simd4f_div(one, pz);
+        const simd4f u = simd4f_add(simd4f_add(simd4f_mul(simd4f_mul(fx, px), iz), cx), half);
+        const simd4f v = simd4f_add(simd4f_add(simd4f_mul(simd4f_mul(fy, py), iz), cy), half);
+
+        // The image lookups are gathers, done lane by lane.
+        simd4f_ustore4(pz, pzs);
+        simd4f_ustore4(nx, nxs);
+        simd4f_ustore4(ny, nys);
+        simd4f_ustore4(nz, nzs);
+        simd4f_ustore4(facing, facings);
+        simd4f_ustore4(u, us);
+        simd4f_ustore4(v, vs);
+        for (int k = 0; k < 4; ++k)
+            check_sample(params, depth, image_normals, pzs[k], nxs[k], nys[k], nzs[k],
+                         facings[k], us[k], vs[k], num_visible[k], num_inliers[k]);
+    }
+}
+
+}
+
+namespace ntk
+{
+
+void DepthPoseVerifier :: setDepthImage(const cv::Mat1f& depth, const cv::Mat1d& intrinsics)
+{
+    m_fx = intrinsics(0,0);
+    m_fy = intrinsics(1,1);
+    m_cx = intrinsics(0,2);
+    m_cy = intrinsics(1,2);
+
+    // Normals from neighbors two pixels away to smooth out depth noise,
+    // oriented towards the camera. Pixels across depth discontinuities
+    // have no reliable normal and are left out of the scoring depth.
+    const int step = 2;
+    const float max_relative_gap = 0.05f;
+    m_depth.create(depth.size());
+    m_depth.setTo(cv::Scalar::all(0));
+    m_normals.create(depth.size());
+    m_normals.setTo(cv::Scalar::all(0));
+    for (int r = step; r < depth.rows-step; ++r)
+    for (int c = step; c < depth.cols-step; ++c)
+    {
+        const float d = depth(r,c);
+        const float d_left = depth(r,c-step);
+        const float d_right = depth(r,c+step);
+        const float d_up = depth(r-step,c);
+        const float d_down = depth(r+step,c);
+        if (d <= 0 || d_left <= 0 || d_right <= 0 || d_up <= 0 || d_down <= 0)
+            continue;
+
+        const float max_gap = max_relative_gap * d;
+        if (std::abs(d_right - d_left) > max_gap || std::abs(d_down - d_up) > max_gap)
+            continue;
+
+        cv::Vec3f left ((c-step-m_cx)*d_left/m_fx, (r-m_cy)*d_left/m_fy, d_left);
+        cv::Vec3f right ((c+step-m_cx)*d_right/m_fx, (r-m_cy)*d_right/m_fy, d_right);
+        cv::Vec3f up ((c-m_cx)*d_up/m_fx, (r-step-m_cy)*d_up/m_fy, d_up);
+        cv::Vec3f down ((c-m_cx)*d_down/m_fx, (r+step-m_cy)*d_down/m_fy, d_down);
+        cv::Vec3f normal = (right - left).cross(down - up);
+        const float norm = cv::norm(normal);
+        if (norm < 1e-10)
+            continue;
+
+        normal *= 1.f / norm;
+        cv::Vec3f center ((c-m_cx)*d/m_fx, (r-m_cy)*d/m_fy, d);
+        if (normal.dot(center) > 0)
+            normal = -normal;
+        m_normals(r,c) = normal;
+        m_depth(r,c) = d;
+    }
+}
+
+void DepthPoseVerifier :: scorePoses(const DepthObjectModel& model,
+                                     const std::vector<ntk::Pose3D>& poses,
+                                     std::vector<float>& scores) const
+{
+    ntk_assert(m_depth.data, "No depth image set.");
+    scores.assign(poses.size(), 0.f);
+    if (model.isEmpty() || poses.empty())
+        return;
+
+    ScoringParameters params;
+    params.fx = m_fx;
+    params.fy = m_fy;
+    params.cx = m_cx;
+    params.cy = m_cy;
+    params.width = m_depth.cols;
+    params.height = m_depth.rows;
+    params.depth_tolerance = m_depth_tolerance;
+    params.min_normal_cosine = m_min_normal_cosine;
+
+    std::vector<float> num_visible (poses.size());
+    std::vector<float> num_inliers (poses.size());
+
+    if (m_multi_pose_scoring)
+    {
+        for (size_t first = 0; first < poses.size(); first += 4)
+        {
+            // The last block is padded with the last pose.
+            cv::Mat1f transforms[4];
+            for (size_t k = 0; k < 4; ++k)
+                transforms[k] = camera_transform(poses[std::min(first + k, poses.size() - 1)]);
+
+            float visible[4], inliers[4];
+            count_agreeing_samples_x4(transforms, model.points(), model.normals(),
+                                      m_depth, m_normals, params, visible, inliers);
+            for (size_t k = 0; k < 4 && first + k < poses.size(); ++k)
+            {
+                num_visible[first + k] = visible[k];
+                num_inliers[first + k] = inliers[k];
+            }
+        }
+    }
+    else
+    {
+        foreach_idx(i, poses)
+        {
+            count_agreeing_samples(camera_transform(poses[i]), model.points(), model.normals(),
+                                   m_depth, m_normals, params, num_visible[i], num_inliers[i]);
+        }
+    }
+
+    foreach_idx(i, poses)
+    {
+        if (num_visible[i] >= m_min_visible_samples)
+            scores[i] = num_inliers[i] / num_visible[i];
+    }
+}
+
+void DepthPoseVerifier :: scoreMatches(const ObjectDetector& detector, std::vector<float>& scores)
+{
+    scores.assign(detector.nbObjectMatches(), 0.f);
+    const RGBDImage& image = detector.analyzedImage();
+    if (!image.calibration() || !image.mappedDepth().data)
+        return;
+
+    setDepthImage(image.mappedDepth(), image.calibration()->rgb_intrinsics);
+
+    // Batch the hypotheses of each object.
+    std::map<const VisualObject*, std::vector<int> > matches_by_object;
+    for (unsigned i = 0; i < detector.nbObjectMatches(); ++i)
+    {
+        const ObjectMatch& match = detector.objectMatch(i);
+        if (!match.pose()->hasPose3D() || match.model().depthModel().isEmpty())
+            continue;
+        matches_by_object[&match.model()].push_back(i);
+    }
+
+    std::map<const VisualObject*, std::vector<int> >::const_iterator it;
+    for (it = matches_by_object.begin(); it != matches_by_object.end(); ++it)
+    {
+        const std::vector<int>& indices = it->second;
+        std::vector<Pose3D> poses;
+        foreach_idx(i, indices)
+            poses.push_back(detector.objectMatch(indices[i]).pose()->pose3d());
+
+        std::vector<float> object_scores;
+        scorePoses(it->first->depthModel(), poses, object_scores);
+        foreach_idx(i, indices)
+            scores[indices[i]] = object_scores[i];
+    }
+}
+
+} // ntk
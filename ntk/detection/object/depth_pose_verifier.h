@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_DETECTION_OBJECT_DEPTH_POSE_VERIFIER_H
+#define NTK_DETECTION_OBJECT_DEPTH_POSE_VERIFIER_H
+
+#include <ntk/ntk.h>
+#include <ntk/geometry/pose_3d.h>
+
+#include "depth_object_model.h"
+
+namespace ntk
+{
+
+class ObjectDetector;
+
+/*!
+ * Verify object pose hypotheses against a depth image, using the DepthObjectModel of the object.
+ * The score of a pose is the fraction of visible model samples whose depth and normal
+ * agree with the image. Hypotheses are scored four at a time, one pose per SIMD lane,
+ * so that many poses coming from any detector can be checked cheaply.
+ */
+class DepthPoseVerifier
+{
+public:
+    DepthPoseVerifier()
+        : m_depth_tolerance(0.01f),
+          m_min_normal_cosine(0.8f),
+          m_min_visible_samples(20),
+          m_multi_pose_scoring(true),
+          m_fx(1), m_fy(1), m_cx(0), m_cy(0)
+    {}
+
+public:
+    /*! Maximal depth difference of agreeing samples, in meters. */
+    void setDepthTolerance(float tolerance) { m_depth_tolerance = tolerance; }
+
+    /*! Minimal cosine between the model and image normals of agreeing samples. */
+    void setMinNormalCosine(float cosine) { m_min_normal_cosine = cosine; }
+
+    /*! Poses with fewer visible samples get a zero score. */
+    void setMinVisibleSamples(int n) { m_min_visible_samples = n; }
+
+    /*! Score four poses per pass over the samples (default), or one by one. */
+    void setMultiPoseScoring(bool enabled) { m_multi_pose_scoring = enabled; }
+
+public:
+    /*!
+     * Set the observed depth image and its camera intrinsics, and compute its normals.
+     * Pixels without a reliable normal, e.g. on silhouettes, are ignored when scoring.
+     */
+    void setDepthImage(const cv::Mat1f& depth, const cv::Mat1d& intrinsics);
+
+    const cv::Mat1f& scoringDepth() const { return m_depth; }
+    const cv::Mat3f& imageNormals() const { return m_normals; }
+
+    /*! Score poses mapping object coordinates to the depth image camera. */
+    void scorePoses(const DepthObjectModel& model,
+                    const std::vector<ntk::Pose3D>& poses,
+                    std::vector<float>& scores) const;
+
+    /*!
+     * Score the 3D pose of each match of detector against its analyzed image.
+     * Matches without 3D pose or object depth model get a zero score.
+     */
+    void scoreMatches(const ObjectDetector& detector, std::vector<float>& scores);
+
+private:
+    float m_depth_tolerance;
+    float m_min_normal_cosine;
+    int m_min_visible_samples;
+    bool m_multi_pose_scoring;
+    cv::Mat1f m_depth;
+    cv::Mat3f m_normals;
+    float m_fx, m_fy, m_cx, m_cy;
+};
+
+} // ntk
+
+#endif // NTK_DETECTION_OBJECT_DEPTH_POSE_VERIFIER_H
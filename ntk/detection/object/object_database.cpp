@@ -188,6 +188,15 @@ namespace ntk
     return sum;
   }
 
+  void ObjectDatabase :: buildDepthModels(float voxel_size)
+  {
+    ntk::TimeCount tc ("Build depth models", 1);
+    foreach_idx(i, m_objects)
+    {
+      m_objects[i]->buildDepthModel(voxel_size);
+    }
+  }
+
   void ObjectDatabase :: loadOrBuild()
   {
     QDir db_dir (m_dir.c_str());
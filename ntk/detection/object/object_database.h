@@ -76,6 +76,9 @@ namespace ntk
 
       int uniqueId() const { return m_id; }
 
+      // Build the depth model of every object, see VisualObject::buildDepthModel.
+      void buildDepthModels(float voxel_size = 0.004f);
+
     protected:
       void loadOrBuild();
 
@@ -133,7 +133,8 @@ void VFHObjectDetector::findObjects()
     modeler.addNewView(analyzedImage(), *analyzedImage().calibration()->depth_pose);
     modeler.computeSurfaceMesh();
 
-    const std::vector<cv::Point3f>& object_points = modeler.currentMesh().vertices;
+    MeshConstPtr object_mesh = modeler.currentMesh();
+    const std::vector<cv::Point3f>& object_points = object_mesh->vertices;
     pcl::PointCloud<pcl::PointXYZ>::Ptr object_cloud (new pcl::PointCloud<pcl::PointXYZ>);
     vectorToPointCloud<pcl::PointXYZ>(*object_cloud, object_points);
 
@@ -228,4 +228,55 @@ void VisualObject :: loadOrBuild()
     tc_load_obj.elapsedMsecs(" -- after save: ");
 }
 
+void VisualObject :: buildDepthModel(float voxel_size, int max_samples)
+{
+    m_depth_model = DepthObjectModel();
+
+    // Without 3D model, bound the object by its masked depth pixels.
+    Rect3f bounds = m_bounding_box;
+    if (bounds.isEmpty())
+    {
+        foreach_idx(i, m_views)
+        {
+            const VisualObjectView& view = m_views[i];
+            if (!view.hasDepth() || !view.hasMask() || !view.objectPose().isValid())
+                continue;
+
+            cv::Mat1f depth = view.mappedDepthImage();
+            for (int r = 0; r < depth.rows; r += 4)
+            for (int c = 0; c < depth.cols; c += 4)
+            {
+                if (depth(r,c) < 1e-5)
+                    continue;
+                bounds.extendToInclude(view.objectPose().unprojectFromImage(cv::Point2f(c,r), depth(r,c)));
+            }
+        }
+    }
+
+    if (bounds.isEmpty())
+    {
+        ntk_dbg(1) << "No bounds for the depth model of " << m_name;
+        return;
+    }
+
+    const float margin = 2*voxel_size;
+    bounds.x -= margin;
+    bounds.y -= margin;
+    bounds.z -= margin;
+    bounds.width += 2*margin;
+    bounds.height += 2*margin;
+    bounds.depth += 2*margin;
+    m_depth_model.initialize(bounds, voxel_size);
+
+    foreach_idx(i, m_views)
+    {
+        const VisualObjectView& view = m_views[i];
+        if (!view.hasDepth() || !view.objectPose().isValid())
+            continue;
+        m_depth_model.integrateView(view.mappedDepthImage(), view.objectPose());
+    }
+    m_depth_model.finalize(max_samples);
+    ntk_dbg_print(m_depth_model.points().size(), 1);
+}
+
 } // end of avs
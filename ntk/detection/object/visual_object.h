@@ -24,6 +24,7 @@
 # include <ntk/mesh/mesh.h>
 
 # include "visual_object_view.h"
+# include "depth_object_model.h"
 
 namespace ntk
 {
@@ -78,6 +79,11 @@ namespace ntk
 
     bool hasZCorrection() const { return !ntk::flt_eq(m_z_correction_a, 0, 1e-5); }
 
+    // Fuse the depth of all views into a compact model for pose verification.
+    // Not persisted, has to be rebuilt after loading.
+    void buildDepthModel(float voxel_size = 0.004f, int max_samples = 1000);
+    const ntk::DepthObjectModel& depthModel() const { return m_depth_model; }
+
   private:
     const ObjectDatabase* m_database;
     ntk::Rect3f m_bounding_box;
@@ -90,6 +96,7 @@ namespace ntk
     double m_z_correction_a;
     double m_z_correction_b;
     mutable ntk::Mesh m_cached_mesh;
+    ntk::DepthObjectModel m_depth_model;
   };
   ntk_ptr_typedefs(VisualObject);
 
@@ -77,6 +77,20 @@ public:
     void setObjectHeightLimits(float min_h = 0.01, float max_h = 0.5) { object_min_height_ = min_h;  object_max_height_ = max_h; }
     void setMaxDistToPlane(float d) { m_max_dist_to_plane = d; }
 
+    /*!
+     * In temporal mode, the table plane and hull of the previous frame are
+     * kept as long as the new frame still has at least min_inlier_ratio of
+     * the plane inliers it had when it was fitted. Only clusters touching
+     * regions whose occupancy changed are extracted again, the other ones
+     * keep their cells and only gather the new points falling into them.
+     */
+    void setTemporalMode(bool enabled, float min_inlier_ratio = 0.8f)
+    { m_temporal_mode = enabled; m_min_table_inlier_ratio = min_inlier_ratio; resetTemporalState(); }
+    bool temporalMode() const { return m_temporal_mode; }
+
+    /*! Forget the cached table model and clusters. */
+    void resetTemporalState();
+
 public:
     /*! Returns true if at least one object and plane are detected. */
     bool detect(PointCloudConstPtr cloud);
@@ -89,6 +103,22 @@ public:
     const std::vector <std::vector<cv::Point3f> >& objectClusters() const { return m_object_clusters; }
     PointCloudConstPtr tableInliers() const { return table_projected_; }
 
+    /*! Whether the last detection reused the cached table model. */
+    bool tableModelWasReused() const { return m_table_model_reused; }
+
+    /*! Number of clusters extracted again by the last detection. */
+    int numReclusteredObjects() const { return m_num_reclustered_objects; }
+
+private:
+    bool fitTableModel();
+    int countTablePlaneInliers() const;
+    void computeObjectCells(std::vector<uint64>& cells) const;
+    uint64 cellKey(const Point& p) const;
+    void extractClusters(const std::vector<int>& indices,
+                         std::vector< std::vector<cv::Point3f> >& clusters,
+                         std::vector< std::vector<uint64> >& cluster_cells);
+    void extractChangedClusters(const std::vector<uint64>& object_cells);
+
 private:
     // PCL objects
     KdTreePtr normals_tree_, clusters_tree_;
@@ -135,6 +165,19 @@ private:
 
     ntk::Plane m_plane;
     std::vector< std::vector<cv::Point3f> > m_object_clusters;
+
+    // Temporal mode state.
+    bool m_temporal_mode;
+    float m_min_table_inlier_ratio;
+    bool m_has_table_model;
+    bool m_table_model_reused;
+    int m_num_table_inliers;
+    int m_num_reclustered_objects;
+    // All clusters of the previous frame, before the plane distance filter,
+    // and the sorted cells of size object_cluster_tolerance_ they occupy.
+    std::vector< std::vector<cv::Point3f> > m_all_clusters;
+    std::vector< std::vector<uint64> > m_all_cluster_cells;
+    std::vector<uint64> m_object_cells;
 };
 
 
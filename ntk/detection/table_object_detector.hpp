@@ -22,6 +22,9 @@
 
 # include <boost/make_shared.hpp>
 
+# include <algorithm>
+# include <iterator>
+
 using namespace pcl;
 using cv::Point3f;
 
@@ -30,7 +33,13 @@ namespace ntk
 
 template <class PointType>
 TableObjectDetector<PointType> :: TableObjectDetector()
-    : m_max_dist_to_plane(0.03)
+    : m_max_dist_to_plane(0.03),
+      m_temporal_mode(false),
+      m_min_table_inlier_ratio(0.8f),
+      m_has_table_model(false),
+      m_table_model_reused(false),
+      m_num_table_inliers(0),
+      m_num_reclustered_objects(0)
 {
     // ---[ Create all PCL objects and set their parameters
     setObjectVoxelSize();
@@ -98,11 +107,24 @@ void TableObjectDetector<PointType> :: initialize()
     cluster_.setSearchMethod (clusters_tree_);
 }
 
+template <class PointType>
+void TableObjectDetector<PointType> :: resetTemporalState()
+{
+    m_has_table_model = false;
+    m_table_model_reused = false;
+    m_num_table_inliers = 0;
+    m_all_clusters.clear();
+    m_all_cluster_cells.clear();
+    m_object_cells.clear();
+}
+
 template <class PointType>
 bool TableObjectDetector<PointType> :: detect(PointCloudConstPtr cloud)
 {
     ntk::TimeCount tc("TableObjectDetector::detect", 1);
     m_object_clusters.clear();
+    m_table_model_reused = false;
+    m_num_reclustered_objects = 0;
     initialize();
 
     ntk_dbg(1) << cv::format("PointCloud with %d data points.\n", cloud->width * cloud->height);
@@ -125,9 +147,104 @@ bool TableObjectDetector<PointType> :: detect(PointCloudConstPtr cloud)
     if ((int)cloud_filtered_->points.size () < k_)
     {
         ntk_dbg(0) << cv::format("WARNING Filtering returned %d points! Continuing.\n", (int)cloud_filtered_->points.size ());
+        resetTemporalState();
+        return false;
+    }
+
+    // ---[ Validate the previous table model, it is much cheaper than fitting a new one.
+    if (m_temporal_mode && m_has_table_model)
+    {
+        int num_inliers = countTablePlaneInliers();
+        m_table_model_reused = num_inliers >= m_min_table_inlier_ratio * m_num_table_inliers;
+        ntk_dbg(1) << cv::format("Cached table model: %d inliers out of %d, %s.\n", num_inliers, m_num_table_inliers,
+                                 m_table_model_reused ? "reused" : "fitting again");
+    }
+
+    if (!m_table_model_reused)
+    {
+        // The clusters of the previous model are not comparable anymore.
+        resetTemporalState();
+        if (!fitTableModel())
+            return false;
+    }
+    tc.elapsedMsecs("table model");
+
+    // ---[ Get the objects on top of the table
+    pcl::PointIndices cloud_object_indices;
+    prism_.setInputCloud (cloud_filtered_);
+    prism_.setInputPlanarHull (table_hull_);
+    prism_.segment (cloud_object_indices);
+    ntk_dbg(1) << cv::format("Number of object point indices: %d.\n", (int)cloud_object_indices.indices.size ());
+
+    pcl::PointCloud<Point> cloud_objects;
+    pcl::ExtractIndices<Point> extract_object_indices;
+    //extract_object_indices.setInputCloud (cloud_all_minus_table_ptr);
+    extract_object_indices.setInputCloud (cloud_filtered_);
+    //      extract_object_indices.setInputCloud (cloud_downsampled_);
+    extract_object_indices.setIndices (boost::make_shared<const pcl::PointIndices> (cloud_object_indices));
+    extract_object_indices.filter (cloud_objects);
+    cloud_objects_.reset (new pcl::PointCloud<Point> (cloud_objects));
+    ntk_dbg(1) << cv::format("Number of object point candidates: %d.\n", (int)cloud_objects.points.size ());
+
+    if (cloud_objects.points.size () == 0)
+    {
+        m_all_clusters.clear();
+        m_all_cluster_cells.clear();
+        m_object_cells.clear();
         return false;
     }
 
+    // ---[ Downsample the points
+    pcl::PointCloud<Point> cloud_objects_downsampled;
+    grid_objects_.setInputCloud (cloud_objects_);
+    grid_objects_.filter (cloud_objects_downsampled);
+    cloud_objects_downsampled_.reset (new pcl::PointCloud<Point> (cloud_objects_downsampled));
+    ntk_dbg(1) << cv::format("Number of object point candidates left after downsampling: %d.\n", (int)cloud_objects_downsampled.points.size ());
+
+    // ---[ Split the objects into Euclidean clusters
+    std::vector<uint64> object_cells;
+    computeObjectCells(object_cells);
+    if (m_table_model_reused)
+    {
+        extractChangedClusters(object_cells);
+    }
+    else
+    {
+        std::vector<int> all_indices (cloud_objects_downsampled_->points.size());
+        foreach_idx(i, all_indices)
+            all_indices[i] = i;
+        extractClusters(all_indices, m_all_clusters, m_all_cluster_cells);
+        m_num_reclustered_objects = m_all_clusters.size();
+    }
+    m_object_cells.swap(object_cells);
+    ntk_dbg(1) << cv::format("Number of clusters found matching the given constraints: %d, %d extracted again.\n",
+                             (int)m_all_clusters.size (), m_num_reclustered_objects);
+
+    foreach_idx(i, m_all_clusters)
+    {
+        const std::vector<Point3f>& object_points = m_all_clusters[i];
+
+        float min_dist_to_plane = FLT_MAX;
+        for (int j = 0; j < object_points.size(); ++j)
+        {
+            Point3f pobj = object_points[j];
+            min_dist_to_plane = std::min(plane().distanceToPlane(pobj), min_dist_to_plane);
+        }
+
+        ntk_dbg_print(min_dist_to_plane, 1);
+        if (min_dist_to_plane > m_max_dist_to_plane)
+            continue;
+
+        m_object_clusters.push_back(object_points);
+    }
+
+    tc.stop();
+    return true;
+}
+
+template <class PointType>
+bool TableObjectDetector<PointType> :: fitTableModel()
+{
     // ---[ Estimate the point normals
     pcl::PointCloud<pcl::Normal> cloud_normals;
     n3d_.setInputCloud (cloud_downsampled_);
@@ -171,65 +288,143 @@ bool TableObjectDetector<PointType> :: detect(PointCloudConstPtr cloud)
     hull_.reconstruct (table_hull);
     table_hull_.reset (new pcl::PointCloud<Point> (table_hull));
 
-    // ---[ Get the objects on top of the table
-    pcl::PointIndices cloud_object_indices;
-    prism_.setInputCloud (cloud_filtered_);
-    prism_.setInputPlanarHull (table_hull_);
-    prism_.segment (cloud_object_indices);
-    ntk_dbg(1) << cv::format("Number of object point indices: %d.\n", (int)cloud_object_indices.indices.size ());
+    // Reference for the validation of the next frames.
+    m_num_table_inliers = countTablePlaneInliers();
+    m_has_table_model = true;
+    return true;
+}
 
-    pcl::PointCloud<Point> cloud_objects;
-    pcl::ExtractIndices<Point> extract_object_indices;
-    //extract_object_indices.setInputCloud (cloud_all_minus_table_ptr);
-    extract_object_indices.setInputCloud (cloud_filtered_);
-    //      extract_object_indices.setInputCloud (cloud_downsampled_);
-    extract_object_indices.setIndices (boost::make_shared<const pcl::PointIndices> (cloud_object_indices));
-    extract_object_indices.filter (cloud_objects);
-    cloud_objects_.reset (new pcl::PointCloud<Point> (cloud_objects));
-    ntk_dbg(1) << cv::format("Number of object point candidates: %d.\n", (int)cloud_objects.points.size ());
+template <class PointType>
+int TableObjectDetector<PointType> :: countTablePlaneInliers() const
+{
+    const std::vector<float>& coeffs = table_coefficients_->values;
+    int num_inliers = 0;
+    foreach_idx(i, cloud_downsampled_->points)
+    {
+        const Point& p = cloud_downsampled_->points[i];
+        float dist = coeffs[0]*p.x + coeffs[1]*p.y + coeffs[2]*p.z + coeffs[3];
+        if (std::abs(dist) < sac_distance_threshold_)
+            ++num_inliers;
+    }
+    return num_inliers;
+}
 
-    if (cloud_objects.points.size () == 0)
-        return false;
+template <class PointType>
+uint64 TableObjectDetector<PointType> :: cellKey(const Point& p) const
+{
+    // 21 bits per axis, centered on the camera. Coordinates are kept in
+    // [1, 2^21-2] so that the neighbors of a cell never carry into the
+    // next field. Points further away share the border cells.
+    const double inv_size = 1.0 / object_cluster_tolerance_;
+    const double min_coord = 1, max_coord = (1 << 21) - 2;
+    uint64 x = (uint64)std::min(max_coord, std::max(min_coord, floor(p.x * inv_size) + (1 << 20)));
+    uint64 y = (uint64)std::min(max_coord, std::max(min_coord, floor(p.y * inv_size) + (1 << 20)));
+    uint64 z = (uint64)std::min(max_coord, std::max(min_coord, floor(p.z * inv_size) + (1 << 20)));
+    return (x << 42) | (y << 21) | z;
+}
 
-    // ---[ Downsample the points
-    pcl::PointCloud<Point> cloud_objects_downsampled;
-    grid_objects_.setInputCloud (cloud_objects_);
-    grid_objects_.filter (cloud_objects_downsampled);
-    cloud_objects_downsampled_.reset (new pcl::PointCloud<Point> (cloud_objects_downsampled));
-    ntk_dbg(1) << cv::format("Number of object point candidates left after downsampling: %d.\n", (int)cloud_objects_downsampled.points.size ());
+template <class PointType>
+void TableObjectDetector<PointType> :: computeObjectCells(std::vector<uint64>& cells) const
+{
+    cells.resize(cloud_objects_downsampled_->points.size());
+    foreach_idx(i, cells)
+        cells[i] = cellKey(cloud_objects_downsampled_->points[i]);
+    std::sort(cells.begin(), cells.end());
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+}
 
-    // ---[ Split the objects into Euclidean clusters
+template <class PointType>
+void TableObjectDetector<PointType> :: extractClusters(const std::vector<int>& indices,
+                                                       std::vector< std::vector<Point3f> >& clusters,
+                                                       std::vector< std::vector<uint64> >& cluster_cells)
+{
     std::vector< PointIndices > object_clusters;
-    cluster_.setInputCloud (cloud_objects_downsampled_);
-    cluster_.extract (object_clusters);
-    ntk_dbg(1) << cv::format("Number of clusters found matching the given constraints: %d.\n", (int)object_clusters.size ());
+    if (!indices.empty())
+    {
+        cluster_.setInputCloud (cloud_objects_downsampled_);
+        cluster_.setIndices (boost::make_shared< std::vector<int> > (indices));
+        cluster_.extract (object_clusters);
+    }
 
     for (size_t i = 0; i < object_clusters.size (); ++i)
     {
         std::vector<Point3f> object_points;
+        std::vector<uint64> cells;
         foreach_idx(k, object_clusters[i].indices)
         {
             int index = object_clusters[i].indices[k];
             Point p = cloud_objects_downsampled_->points[index];
             object_points.push_back(Point3f(p.x,p.y,p.z));
+            cells.push_back(cellKey(p));
         }
+        std::sort(cells.begin(), cells.end());
+        cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
 
-        float min_dist_to_plane = FLT_MAX;
-        for (int j = 0; j < object_points.size(); ++j)
+        clusters.push_back(object_points);
+        cluster_cells.push_back(cells);
+    }
+}
+
+template <class PointType>
+void TableObjectDetector<PointType> :: extractChangedClusters(const std::vector<uint64>& object_cells)
+{
+    // Cells that became occupied or free since the previous frame.
+    std::vector<uint64> changed_cells;
+    std::set_symmetric_difference(m_object_cells.begin(), m_object_cells.end(),
+                                  object_cells.begin(), object_cells.end(),
+                                  std::back_inserter(changed_cells));
+
+    // Keep the clusters which are not adjacent to any changed cell.
+    // Their neighborhood did not change, so they would be extracted with
+    // the same cells, but their points are taken again from the new cloud
+    // since objects may have moved by less than a cell.
+    std::vector< std::vector<Point3f> > clusters;
+    std::vector< std::vector<uint64> > cluster_cells;
+    std::vector< std::pair<uint64, int> > kept_cells;
+    foreach_idx(i, m_all_clusters)
+    {
+        bool touches_changes = false;
+        const std::vector<uint64>& cells = m_all_cluster_cells[i];
+        for (int k = 0; k < cells.size() && !touches_changes; ++k)
+        for (int dx = -1; dx <= 1 && !touches_changes; ++dx)
+        for (int dy = -1; dy <= 1 && !touches_changes; ++dy)
+        for (int dz = -1; dz <= 1 && !touches_changes; ++dz)
         {
-            Point3f pobj = object_points[j];
-            min_dist_to_plane = std::min(plane().distanceToPlane(pobj), min_dist_to_plane);
+            // Cannot wrap, cellKey keeps coordinates away from the field bounds.
+            uint64 neighbor = cells[k] + ((int64)dx << 42) + ((int64)dy << 21) + dz;
+            touches_changes = std::binary_search(changed_cells.begin(), changed_cells.end(), neighbor);
         }
 
-        ntk_dbg_print(min_dist_to_plane, 1);
-        if (min_dist_to_plane > m_max_dist_to_plane)
+        if (touches_changes)
             continue;
 
-        m_object_clusters.push_back(object_points);
+        foreach_idx(k, cells)
+            kept_cells.push_back(std::make_pair(cells[k], (int)clusters.size()));
+        clusters.push_back(std::vector<Point3f>());
+        cluster_cells.push_back(cells);
     }
+    std::sort(kept_cells.begin(), kept_cells.end());
 
-    tc.stop();
-    return true;
+    // Refresh the points of the kept clusters and cluster the remaining points only.
+    std::vector<int> indices;
+    foreach_idx(i, cloud_objects_downsampled_->points)
+    {
+        const Point& p = cloud_objects_downsampled_->points[i];
+        uint64 cell = cellKey(p);
+        std::vector< std::pair<uint64, int> >::const_iterator it
+                = std::lower_bound(kept_cells.begin(), kept_cells.end(), std::make_pair(cell, -1));
+        if (it != kept_cells.end() && it->first == cell)
+            clusters[it->second].push_back(Point3f(p.x,p.y,p.z));
+        else
+            indices.push_back(i);
+    }
+
+    const int num_kept = clusters.size();
+    extractClusters(indices, clusters, cluster_cells);
+    m_num_reclustered_objects = clusters.size() - num_kept;
+
+    m_all_clusters.swap(clusters);
+    m_all_cluster_cells.swap(cluster_cells);
 }
 
 template <class PointType>
@@ -35,6 +35,21 @@ estimateCurrentPose()
         if (ok)
             m_current_pose = m_absolute_pose_estimator.estimatedPose();
         m_last_markers = m_absolute_pose_estimator.detectedMarkers();
+
+        // Keep refining an automatically estimated setup, only touching
+        // the markers visible in this frame.
+        if (ok && m_refine_marker_setup)
+        {
+            addMarkerObservations(m_current_pose, m_last_markers, false /* already in setup frame */);
+            foreach_idx(i, m_last_markers)
+            {
+                int id = m_last_markers[i].id;
+                cv::Point3f center;
+                if (m_setup_estimator.numObservations(id) >= m_min_marker_observations
+                    && m_setup_estimator.estimateCenter(id, center))
+                    m_absolute_pose_estimator.setMarkerCenter(id, center);
+            }
+        }
         return ok;
     }
 
@@ -43,15 +58,12 @@ estimateCurrentPose()
     // there are detected markers.
     if (!m_started)
     {
-        m_new_image.copyTo(m_last_image);
         m_current_pose = *m_new_image.calibration()->depth_pose;
         m_first_pose = m_current_pose;
         m_new_image.copyTo(m_first_image);
     }
 
     m_relative_pose_estimator.setSourceImage(m_new_image);
-    // m_relative_pose_estimator.setTargetImage(m_last_image);
-    // m_relative_pose_estimator.setTargetPose(m_current_pose);
     m_relative_pose_estimator.setTargetImage(m_first_image);
     m_relative_pose_estimator.setTargetPose(m_first_pose);
     bool ok = m_relative_pose_estimator.estimateNewPose();
@@ -60,22 +72,26 @@ estimateCurrentPose()
     m_last_markers = m_relative_pose_estimator.detectedMarkersInSourceImage();
     m_started = true;
 
-    m_new_image.copyTo(m_last_image);
+    const Pose3D& source_pose = m_relative_pose_estimator.estimatedSourcePose();
+
+    // The setup is expressed in the frame of the first detected marker,
+    // so that markers lying on the same board share the z = 0 plane.
+    if (!m_has_reference_marker && m_last_markers.size() > 0)
+        setReferenceMarker(m_last_markers[0].computePose(), source_pose);
 
-    SetupFrame frame;
-    m_new_image.copyTo(frame.image);
-    frame.pose = m_relative_pose_estimator.estimatedSourcePose();
-    frame.markers = m_relative_pose_estimator.detectedMarkersInSourceImage();
     // At least two markers are necessary to improve the setup estimation.
-    if (frame.markers.size() < 2)
+    if (m_last_markers.size() < 2)
         return false;
 
-    m_setup_frames.push_back(frame);
+    addMarkerObservations(source_pose, m_last_markers, true /* in world frame */);
     if (estimateMarkerSetup())
     {
         m_marker_setup_estimated = true;
+        m_refine_marker_setup = true;
+        // The first image is not needed anymore.
+        m_first_image = RGBDImage();
     }
-    m_current_pose = m_relative_pose_estimator.estimatedSourcePose();
+    m_current_pose = source_pose;
     return true; // FIXME: temp.
 }
 
@@ -84,15 +100,68 @@ reset()
 {
     IncrementalPoseEstimatorFromImage::reset();
     m_started = false;
+    m_has_reference_marker = false;
+    m_setup_estimator.reset();
+    m_relative_pose_estimator.resetTracking();
+    if (m_refine_marker_setup)
+    {
+        // Setup was estimated by us and not given by the user, forget it.
+        m_marker_setup_estimated = false;
+        m_refine_marker_setup = false;
+    }
+}
+
+void ntk::IncrementalPoseEstimatorFromMarkers::
+setReferenceMarker(const Pose3D& marker_pose, const Pose3D& camera_pose)
+{
+    m_reference_marker_pose = marker_pose;
+    m_reference_camera_pose = camera_pose;
+    m_has_reference_marker = true;
+}
+
+void ntk::IncrementalPoseEstimatorFromMarkers::
+addMarkerObservations(const Pose3D& camera_pose,
+                      const std::vector<aruco::Marker>& markers,
+                      bool in_world_frame)
+{
+    IncrementalMarkerSetupEstimator::FrameObservations observations;
+    observations.reserve(markers.size());
+
+    foreach_idx(i, markers)
+    {
+        Pose3D marker_pose = markers[i].computePose();
+        cv::Point3f camera_center = marker_pose.cameraTransform(cv::Point3f(0,0,0));
+        if (camera_center.z < 1e-5 && camera_center.z > -1e-5)
+            continue;
+
+        cv::Point3f center = camera_pose.invCameraTransform(camera_center);
+        if (in_world_frame)
+        {
+            center = m_reference_camera_pose.cameraTransform(center);
+            center = m_reference_marker_pose.invCameraTransform(center);
+        }
+
+        // Marker pose precision decreases quadratically with distance.
+        float weight = 1.0f / (camera_center.z * camera_center.z);
+        observations.push_back(IncrementalMarkerSetupEstimator::Observation(markers[i].id, center, weight));
+    }
+
+    m_setup_estimator.addFrame(observations);
 }
 
 bool ntk::IncrementalPoseEstimatorFromMarkers::
 estimateMarkerSetup()
 {
-    if (m_setup_frames.size() < 10)
+    if (m_setup_estimator.numFrames() < m_min_setup_frames)
         return false;
 
-    return false;
+    MarkerSetup setup (markerSetup().marker_size);
+    int num_markers = m_setup_estimator.fillMarkerSetup(setup, m_min_marker_observations);
+    if (num_markers < 2)
+        return false;
+
+    m_absolute_pose_estimator.setMarkerSetup(setup);
+    return true;
 }
 
 void ntk::IncrementalPoseEstimatorFromMarkers::
@@ -108,21 +177,132 @@ drawDetectedMarkers(cv::Mat3b &image)
 void ntk::IncrementalPoseEstimatorFromMarkers::
 setMarkerSize(float size)
 {
-    m_marker_setup.marker_size = size;
+    MarkerSetup setup = markerSetup();
+    setup.marker_size = size;
     m_relative_pose_estimator.setMarkerSize(size);
-    m_absolute_pose_estimator.setMarkerSetup(m_marker_setup);
+    m_absolute_pose_estimator.setMarkerSetup(setup);
 }
 
 void ntk::IncrementalPoseEstimatorFromMarkers::
 setMarkerSetup(const ntk::MarkerSetup &setup)
 {
-    m_marker_setup = setup;
-    m_absolute_pose_estimator.setMarkerSetup(m_marker_setup);
-    m_relative_pose_estimator.setMarkerSize(m_marker_setup.marker_size);
+    m_absolute_pose_estimator.setMarkerSetup(setup);
+    m_relative_pose_estimator.setMarkerSize(setup.marker_size);
     m_marker_setup_estimated = true;
+    m_refine_marker_setup = false;
+}
+
+// ============================================================================
+void ntk::IncrementalMarkerSetupEstimator::
+setWindowSize(int size)
+{
+    m_window_size = std::max(size, 1);
+    while (m_frames.size() > m_window_size)
+    {
+        accumulate(m_frames.front(), -1.0);
+        m_frames.pop_front();
+    }
+}
+
+void ntk::IncrementalMarkerSetupEstimator::
+reset()
+{
+    m_frames.clear();
+    m_markers.clear();
+}
+
+void ntk::IncrementalMarkerSetupEstimator::
+accumulate(const FrameObservations& observations, double sign)
+{
+    foreach_idx(i, observations)
+    {
+        const Observation& obs = observations[i];
+        MarkerInformation& info = m_markers[obs.id];
+        info.weight += sign * obs.weight;
+        info.weighted_center += sign * obs.weight * cv::Vec3d(obs.center.x, obs.center.y, obs.center.z);
+        info.count += (sign > 0) ? 1 : -1;
+    }
+}
+
+void ntk::IncrementalMarkerSetupEstimator::
+addFrame(const FrameObservations& observations)
+{
+    if (m_frames.size() >= m_window_size)
+    {
+        accumulate(m_frames.front(), -1.0);
+        m_frames.pop_front();
+    }
+
+    m_frames.push_back(observations);
+    accumulate(observations, 1.0);
+}
+
+int ntk::IncrementalMarkerSetupEstimator::
+numObservations(int id) const
+{
+    std::map<int, MarkerInformation>::const_iterator it = m_markers.find(id);
+    if (it == m_markers.end())
+        return 0;
+    return it->second.count;
+}
+
+bool ntk::IncrementalMarkerSetupEstimator::
+estimateCenter(int id, cv::Point3f& center) const
+{
+    std::map<int, MarkerInformation>::const_iterator it = m_markers.find(id);
+    if (it == m_markers.end() || it->second.count < 1 || it->second.weight < 1e-10)
+        return false;
+
+    cv::Vec3d c = it->second.weighted_center * (1.0 / it->second.weight);
+    center = cv::Point3f(c[0], c[1], c[2]);
+    return true;
+}
+
+int ntk::IncrementalMarkerSetupEstimator::
+fillMarkerSetup(MarkerSetup& setup, int min_observations) const
+{
+    int num_added = 0;
+    std::map<int, MarkerInformation>::const_iterator it;
+    for (it = m_markers.begin(); it != m_markers.end(); ++it)
+    {
+        if (it->second.count < min_observations)
+            continue;
+
+        cv::Point3f center;
+        if (!estimateCenter(it->first, center))
+            continue;
+
+        setup.addMarker(it->first, center);
+        ++num_added;
+    }
+    return num_added;
 }
 
 // ============================================================================
+void ntk::AbsolutePoseEstimatorMarkers::
+setMarkerSetup(const MarkerSetup& setup)
+{
+    m_marker_setup = setup;
+    m_marker_index_from_id.clear();
+    foreach_idx(i, m_marker_setup.markers)
+        m_marker_index_from_id[m_marker_setup.markers[i].id()] = i;
+}
+
+void ntk::AbsolutePoseEstimatorMarkers::
+setMarkerCenter(int id, const cv::Point3f& center)
+{
+    std::map<int, int>::const_iterator it = m_marker_index_from_id.find(id);
+    if (it == m_marker_index_from_id.end())
+    {
+        m_marker_index_from_id[id] = m_marker_setup.markers.size();
+        m_marker_setup.addMarker(id, center);
+        return;
+    }
+
+    MarkerPose& marker = m_marker_setup.markers[it->second];
+    marker.setFromSizeAndCenter(marker.markerSize(), center);
+}
+
 bool ntk::AbsolutePoseEstimatorMarkers::
 estimateNewPose()
 {
@@ -151,14 +331,9 @@ estimateNewPose()
     std::vector< std::pair<aruco::Marker, MarkerPose> > marker_pairs;
     foreach_idx(i, markers)
     {
-        foreach_idx(j, m_marker_setup.markers)
-        {
-            if (markers[i].id == m_marker_setup.markers[j].id())
-            {
-                marker_pairs.push_back(std::make_pair(markers[i], m_marker_setup.markers[j]));
-                break;
-            }
-        }
+        std::map<int, int>::const_iterator it = m_marker_index_from_id.find(markers[i].id);
+        if (it != m_marker_index_from_id.end())
+            marker_pairs.push_back(std::make_pair(markers[i], m_marker_setup.markers[it->second]));
     }
 
     // At least two to ensure a good tracking.
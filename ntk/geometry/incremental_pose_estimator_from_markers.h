@@ -24,6 +24,9 @@
 #include <ntk/geometry/relative_pose_estimator_markers.h>
 #include <ntk/geometry/plane.h>
 
+#include <deque>
+#include <map>
+
 namespace ntk
 {
 
@@ -62,14 +65,80 @@ struct MarkerSetup
     void shiftToCenter();
 };
 
+/*!
+ * Estimate the marker positions of a setup from per-frame observations.
+ * Only the last windowSize() frames are kept, and their contributions are
+ * accumulated in information form (weight and weighted center per marker),
+ * so adding a frame only costs O(visible markers), whatever the number
+ * of frames seen so far.
+ */
+class IncrementalMarkerSetupEstimator
+{
+public:
+    struct Observation
+    {
+        Observation(int id = -1, const cv::Point3f& center = cv::Point3f(0,0,0), float weight = 1.f)
+            : id(id), center(center), weight(weight)
+        {}
+
+        int id;
+        cv::Point3f center;
+        float weight;
+    };
+    typedef std::vector<Observation> FrameObservations;
+
+public:
+    IncrementalMarkerSetupEstimator(int window_size = 100)
+        : m_window_size(window_size)
+    {}
+
+    void setWindowSize(int size);
+    int windowSize() const { return m_window_size; }
+
+    void reset();
+
+    /*! Add the observations of one frame, dropping the oldest frame if the window is full. */
+    void addFrame(const FrameObservations& observations);
+
+    int numFrames() const { return m_frames.size(); }
+    int numObservations(int id) const;
+
+    /*! Weighted mean center of the given marker over the window. */
+    bool estimateCenter(int id, cv::Point3f& center) const;
+
+    /*! Add to setup all the markers observed at least min_observations times. */
+    int fillMarkerSetup(MarkerSetup& setup, int min_observations) const;
+
+private:
+    struct MarkerInformation
+    {
+        MarkerInformation() : weight(0), weighted_center(0,0,0), count(0)
+        {}
+
+        double weight;
+        cv::Vec3d weighted_center;
+        int count;
+    };
+
+    void accumulate(const FrameObservations& observations, double sign);
+
+private:
+    int m_window_size;
+    std::deque<FrameObservations> m_frames;
+    std::map<int, MarkerInformation> m_markers;
+};
+
 class AbsolutePoseEstimatorMarkers : public PoseEstimator
 {
 public:
     AbsolutePoseEstimatorMarkers()
     {}
 
-    void setMarkerSetup(const MarkerSetup& setup)
-    { m_marker_setup = setup; }
+    void setMarkerSetup(const MarkerSetup& setup);
+    const MarkerSetup& markerSetup() const { return m_marker_setup; }
+
+    /*! Update the center of a single marker, adding it if unknown. */
+    void setMarkerCenter(int id, const cv::Point3f& center);
 
 public:
     void setInputImage(const RGBDImage* image) { m_image = image; }
@@ -79,24 +148,21 @@ public:
 private:
     const RGBDImage* m_image;
     MarkerSetup m_marker_setup;
+    std::map<int, int> m_marker_index_from_id;
     std::vector<aruco::Marker> m_detected_markers;
 };
 ntk_ptr_typedefs(AbsolutePoseEstimatorMarkers)
 
 class IncrementalPoseEstimatorFromMarkers : public IncrementalPoseEstimatorFromImage
 {
-public:
-    struct SetupFrame
-    {
-        RGBDImage image;
-        Pose3D pose;
-        std::vector<aruco::Marker> markers;
-    };
-
 public:
     IncrementalPoseEstimatorFromMarkers()
         : m_started(false),
-          m_marker_setup_estimated(false)
+          m_marker_setup_estimated(false),
+          m_refine_marker_setup(false),
+          m_has_reference_marker(false),
+          m_min_setup_frames(10),
+          m_min_marker_observations(5)
     {}
 
     virtual IncrementalPoseEstimatorFromMarkers* clone() const { return new IncrementalPoseEstimatorFromMarkers(*this); }
@@ -105,6 +171,17 @@ public:
     void setMarkerSize(float size);
     void setMarkerSetup(const MarkerSetup& setup);
 
+    /*! The setup is owned by the absolute estimator, which refines it in place. */
+    const MarkerSetup& markerSetup() const { return m_absolute_pose_estimator.markerSetup(); }
+
+    /*! Number of frames used to estimate and refine the marker setup. */
+    void setSetupWindowSize(int size) { m_setup_estimator.setWindowSize(size); }
+    const IncrementalMarkerSetupEstimator& setupEstimator() const { return m_setup_estimator; }
+
+    /*! Track marker corners between frames while the setup is being estimated. */
+    void setUseCornerTracking(bool enable, int detection_interval = 10)
+    { m_relative_pose_estimator.setUseCornerTracking(enable, detection_interval); }
+
 public:
     virtual bool estimateCurrentPose();
     virtual void reset();
@@ -114,17 +191,36 @@ protected:
     bool estimateMarkerSetup();
     bool isMarkerSetupEstimated() const { return m_marker_setup_estimated; }
 
+    /*!
+     * The setup frame is the one of the given marker, seen from camera_pose.
+     * Both poses are relative to the first image.
+     */
+    void setReferenceMarker(const Pose3D& marker_pose, const Pose3D& camera_pose);
+
+    /*!
+     * Add the markers seen from camera_pose to the setup estimator.
+     * If in_world_frame is true, camera_pose is relative to the first image
+     * and centers are moved into the reference marker frame.
+     */
+    void addMarkerObservations(const Pose3D& camera_pose,
+                               const std::vector<aruco::Marker>& markers,
+                               bool in_world_frame);
+
 private:
     RelativePoseEstimatorMarkers m_relative_pose_estimator;
     AbsolutePoseEstimatorMarkers m_absolute_pose_estimator;
-    RGBDImage m_last_image;
     RGBDImage m_first_image;
     Pose3D m_first_pose;
     bool m_started;
     bool m_marker_setup_estimated;
-    std::vector<SetupFrame> m_setup_frames;
+    bool m_refine_marker_setup;
+    IncrementalMarkerSetupEstimator m_setup_estimator;
+    bool m_has_reference_marker;
+    Pose3D m_reference_marker_pose;
+    Pose3D m_reference_camera_pose;
+    int m_min_setup_frames;
+    int m_min_marker_observations;
     std::vector<aruco::Marker> m_last_markers;
-    MarkerSetup m_marker_setup;
 };
 ntk_ptr_typedefs(IncrementalPoseEstimatorFromMarkers)
 
@@ -101,6 +101,50 @@ estimateDeltaPose(Pose3D& new_depth_pose,
     return ok;
 }
 
+bool IncrementalPoseEstimatorFromRgbFeatures::
+trackWithMotionModel(Pose3D& new_depth_pose,
+                     const RGBDImage& image,
+                     ntk::Ptr<FeatureSet> image_features,
+                     const Pose3D& predicted_depth_pose,
+                     int closest_view_index)
+{
+    const ImageData& ref_image_data = m_image_data[closest_view_index];
+
+    RelativePoseEstimatorFromRgbFeatures estimator (m_feature_parameters);
+    estimator.setTargetPose(ref_image_data.depth_pose);
+    estimator.setTargetImage(ref_image_data.image, m_features[closest_view_index]);
+    estimator.setSourceImage(image, image_features);
+    estimator.setInitialSourcePoseEstimate(predicted_depth_pose);
+    estimator.setGuidedMatching(m_guided_search_radius, m_min_tracking_inliers);
+    estimator.setMinMatches(m_min_tracking_inliers);
+    if (!estimator.estimateNewPose())
+        return false;
+
+    // A wrong pose can still get a small consensus set, check the inlier statistics.
+    const int num_inliers = estimator.numInliers();
+    const float inlier_ratio = num_inliers / float(std::max(estimator.numMatches(), 1));
+    ntk_dbg_print(num_inliers, 1);
+    ntk_dbg_print(inlier_ratio, 1);
+    if (num_inliers < m_min_tracking_inliers || inlier_ratio < m_min_tracking_inlier_ratio)
+        return false;
+
+    new_depth_pose = estimator.estimatedSourcePose();
+    return true;
+}
+
+ntk::Ptr<FeatureSet> IncrementalPoseEstimatorFromRgbFeatures::extractFeatures(const RGBDImage& image)
+{
+    ntk::Ptr<FeatureSet> features (new FeatureSet);
+    features->extractFromImage(image, m_feature_parameters);
+    return features;
+}
+
+double IncrementalPoseEstimatorFromRgbFeatures::imageTime(const RGBDImage& image) const
+{
+    // Frame index when images have no timestamp.
+    return image.timestamp() > 0 ? double(image.timestamp()) : double(m_frame_index);
+}
+
 #if 0
 bool IncrementalPoseEstimatorFromRgbFeatures::
 estimateDeltaPose(Pose3D& new_rgb_pose,
@@ -192,8 +236,7 @@ bool IncrementalPoseEstimatorFromRgbFeatures::estimateCurrentPose()
 
     ntk_ensure(image.mappedDepth().data, "Image must have depth mapping.");
 
-    ntk::Ptr<FeatureSet> image_features (new FeatureSet);
-    image_features->extractFromImage(image, m_feature_parameters);
+    ntk::Ptr<FeatureSet> image_features = extractFeatures(image);
     tc.elapsedMsecs(" -- extract features from Image -- ");
 
 #if 0
@@ -208,25 +251,46 @@ bool IncrementalPoseEstimatorFromRgbFeatures::estimateCurrentPose()
 
     int closest_view_index = -1;
 
+    const double image_time = imageTime(image);
+    ++m_frame_index;
+
+    bool tracked = false;
+    if (m_image_data.size() > 0 && m_use_motion_model && m_motion_model.canPredict())
+    {
+        closest_view_index = m_image_data.size() - 1;
+        new_pose = m_image_data[closest_view_index].depth_pose;
+        Pose3D predicted_pose = m_motion_model.predict(image_time);
+        tracked = trackWithMotionModel(new_pose, image, image_features, predicted_pose, closest_view_index);
+        tc.elapsedMsecs(" -- track with motion model -- ");
+        if (!tracked)
+        {
+            ntk_dbg(1) << "Tracking lost, relocalizing.";
+            new_pose = m_image_data[closest_view_index].depth_pose;
+            ++m_num_relocalizations;
+        }
+    }
+
     if (m_image_data.size() > 0)
     {
         std::vector<cv::DMatch> best_matches;
-        closest_view_index = computeNumMatchesWithPrevious(image, *image_features, best_matches);
-        tc.elapsedMsecs(" -- computeNumMatchesWithPrevious -- ");
-        ntk_dbg_print(closest_view_index, 1);
-        ntk_dbg_print(best_matches.size(), 1);       
+        if (!tracked)
+        {
+            closest_view_index = computeNumMatchesWithPrevious(image, *image_features, best_matches);
+            tc.elapsedMsecs(" -- computeNumMatchesWithPrevious -- ");
+            ntk_dbg_print(closest_view_index, 1);
+            ntk_dbg_print(best_matches.size(), 1);
+            new_pose = m_image_data[closest_view_index].depth_pose;
+        }
 
 #ifdef HEAVY_DEBUG
         imwrite("/tmp/debug_matches.png", debug_img);
 #endif
 
-        new_pose = m_image_data[closest_view_index].depth_pose;
-
-        if (best_matches.size() > 0)
+        if (tracked || best_matches.size() > 0)
         {
-            Pose3D delta_pose = new_pose;
+            Pose3D delta_pose = m_image_data[closest_view_index].depth_pose;
 
-            if (!estimateDeltaPose(new_pose, image, image_features, best_matches, closest_view_index))
+            if (!tracked && !estimateDeltaPose(new_pose, image, image_features, best_matches, closest_view_index))
                 pose_ok = false;
 
             // Compute the difference between the reference image pose and the new image one.
@@ -280,6 +344,7 @@ bool IncrementalPoseEstimatorFromRgbFeatures::estimateCurrentPose()
 
 
         m_current_pose = new_pose;
+        m_motion_model.update(new_pose, image_time);
         if (m_incremental_model || first_pass)
         {
             ImageData image_data;
@@ -320,6 +385,9 @@ void IncrementalPoseEstimatorFromRgbFeatures::reset()
     m_features.clear();
     m_image_data.clear();
     m_current_pose = Pose3D();
+    m_motion_model.reset();
+    m_num_relocalizations = 0;
+    m_frame_index = 0;
 }
 
 #if defined(NESTK_USE_PCL) || defined(USE_PCL)
@@ -22,6 +22,7 @@
 
 #include "incremental_pose_estimator.h"
 #include "relative_pose_estimator.h"
+#include "pose_motion_model.h"
 #include <ntk/image/feature.h>
 
 namespace ntk
@@ -37,7 +38,13 @@ class IncrementalPoseEstimatorFromRgbFeatures : public IncrementalPoseEstimatorF
 {
 public:
     IncrementalPoseEstimatorFromRgbFeatures(const FeatureSetParams& params, bool use_icp = false)
-        : m_feature_parameters(params), m_use_icp(use_icp), m_incremental_model(true)
+        : m_feature_parameters(params), m_use_icp(use_icp), m_incremental_model(true),
+          m_use_motion_model(false),
+          m_guided_search_radius(20),
+          m_min_tracking_inliers(30),
+          m_min_tracking_inlier_ratio(0.3f),
+          m_num_relocalizations(0),
+          m_frame_index(0)
     {
         // Force feature extraction to return only features with depth.
         m_feature_parameters.only_features_with_depth = true;
@@ -48,7 +55,14 @@ public:
         : IncrementalPoseEstimatorFromImage(rhs),
           m_feature_parameters(rhs.m_feature_parameters),
           m_use_icp(rhs.m_use_icp),
-          m_incremental_model(rhs.m_incremental_model)
+          m_incremental_model(rhs.m_incremental_model),
+          m_motion_model(rhs.m_motion_model),
+          m_use_motion_model(rhs.m_use_motion_model),
+          m_guided_search_radius(rhs.m_guided_search_radius),
+          m_min_tracking_inliers(rhs.m_min_tracking_inliers),
+          m_min_tracking_inlier_ratio(rhs.m_min_tracking_inlier_ratio),
+          m_num_relocalizations(0),
+          m_frame_index(0)
     {
         reset();
     }
@@ -61,6 +75,32 @@ public:
     virtual void reset();
     void setIncrementalModel(bool enable) { m_incremental_model = enable; }
 
+    /*!
+     * Predict each new pose with a motion model and track it against the
+     * last view only, matching features within search_radius pixels of
+     * their predicted location. Matching with all the previous views,
+     * the relocalization, is only done when tracking fails.
+     */
+    void setUseMotionModel(bool enable, float search_radius = 20, bool use_acceleration = false)
+    {
+        m_use_motion_model = enable;
+        m_guided_search_radius = search_radius;
+        m_motion_model.setUseAcceleration(use_acceleration);
+    }
+
+    /*! Tracking fails if the RANSAC consensus set is smaller than these. */
+    void setTrackingThresholds(int min_inliers, float min_inlier_ratio)
+    { m_min_tracking_inliers = min_inliers; m_min_tracking_inlier_ratio = min_inlier_ratio; }
+
+    const PoseMotionModel& motionModel() const { return m_motion_model; }
+
+    /*! Number of tracking failures which required a relocalization since the last reset. */
+    int numRelocalizations() const { return m_num_relocalizations; }
+
+protected:
+    /*! Features of a new image, only the ones with depth. */
+    virtual ntk::Ptr<FeatureSet> extractFeatures(const RGBDImage& image);
+
 private:
     struct ImageData
     {
@@ -92,6 +132,14 @@ private:
                            int closest_view_index);
 #endif
 
+    bool trackWithMotionModel(Pose3D& new_depth_pose,
+                              const RGBDImage& image,
+                              ntk::Ptr<FeatureSet> features,
+                              const Pose3D& predicted_depth_pose,
+                              int closest_view_index);
+
+    double imageTime(const RGBDImage& image) const;
+
 #ifdef NESTK_USE_PCL
     bool optimizeWithICP(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud_source,
                          Pose3D& depth_pose,
@@ -104,6 +152,13 @@ private:
     FeatureSetParams m_feature_parameters;
     bool m_use_icp;
     bool m_incremental_model;
+    PoseMotionModel m_motion_model;
+    bool m_use_motion_model;
+    float m_guided_search_radius;
+    int m_min_tracking_inliers;
+    float m_min_tracking_inlier_ratio;
+    int m_num_relocalizations;
+    int m_frame_index;
     cv::Mat3b m_feedback_image;
 };
 
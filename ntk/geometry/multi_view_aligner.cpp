@@ -0,0 +1,463 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#include "multi_view_aligner.h"
+#include "relative_pose_estimator_icp.h"
+
+#include <ntk/mesh/pcl_utils.h>
+#include <ntk/thread/parallel.h>
+#include <ntk/utils/time.h>
+
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/registration/transforms.h>
+
+#include <cfloat>
+#include <map>
+
+namespace
+{
+
+inline cv::Vec3d transform_point(const cv::Mat1d& H, const cv::Vec3d& p)
+{
+    return cv::Vec3d(H(0,0)*p[0] + H(0,1)*p[1] + H(0,2)*p[2] + H(0,3),
+                     H(1,0)*p[0] + H(1,1)*p[1] + H(1,2)*p[2] + H(1,3),
+                     H(2,0)*p[0] + H(2,1)*p[1] + H(2,2)*p[2] + H(2,3));
+}
+
+inline cv::Vec3d to_vec3d(const pcl::PointNormal& p)
+{
+    return cv::Vec3d(p.x, p.y, p.z);
+}
+
+Eigen::Affine3f to_eigen_transform(const cv::Mat1d& H)
+{
+    Eigen::Affine3f T;
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
+            T(r,c) = H(r,c);
+    return T;
+}
+
+// Fraction of the smallest box covered by the intersection of both boxes.
+double overlap_ratio(const cv::Vec3d& min1, const cv::Vec3d& max1,
+                     const cv::Vec3d& min2, const cv::Vec3d& max2)
+{
+    double intersection = 1, volume1 = 1, volume2 = 1;
+    for (int k = 0; k < 3; ++k)
+    {
+        intersection *= std::max(0.0, std::min(max1[k], max2[k]) - std::max(min1[k], min2[k]));
+        volume1 *= max1[k] - min1[k];
+        volume2 *= max2[k] - min2[k];
+    }
+    return intersection / std::max(std::min(volume1, volume2), 1e-12);
+}
+
+// Number of points of each view used for closest point constraints.
+const int max_closest_points = 300;
+
+// Step to visit about max_points points evenly spread in the cloud.
+inline int sampling_step(int size, int max_points)
+{
+    return std::max(1, size / std::max(1, max_points));
+}
+
+}
+
+namespace ntk
+{
+
+struct MultiViewAligner::PairRegistrationBody
+{
+    PairRegistrationBody(const MultiViewAligner& aligner, std::vector<ViewPair>& pairs)
+        : aligner(aligner), pairs(pairs)
+    {}
+
+    void operator()(const IndexRange& range) const
+    {
+        for (int i = range.begin; i < range.end; ++i)
+            aligner.registerPair(pairs[i]);
+    }
+
+    const MultiViewAligner& aligner;
+    std::vector<ViewPair>& pairs;
+};
+
+struct MultiViewAligner::ClosestPointsBody
+{
+    ClosestPointsBody(const MultiViewAligner& aligner,
+                      double max_distance,
+                      std::vector< std::vector<PointConstraint> >& constraints)
+        : aligner(aligner), max_distance(max_distance), constraints(constraints)
+    {}
+
+    void operator()(const IndexRange& range) const
+    {
+        for (int i = range.begin; i < range.end; ++i)
+        {
+            const ViewPair& pair = aligner.m_pairs[i];
+            if (!pair.registered)
+                continue;
+            // Current relative transform given by the view poses.
+            cv::Mat1d second_to_first = aligner.m_views[pair.first].pose.inv() * aligner.m_views[pair.second].pose;
+            aligner.findClosestPoints(pair, second_to_first, max_distance, constraints[i]);
+        }
+    }
+
+    const MultiViewAligner& aligner;
+    double max_distance;
+    std::vector< std::vector<PointConstraint> >& constraints;
+};
+
+MultiViewAligner :: MultiViewAligner()
+    : m_voxel_leaf_size(0.005),
+      m_distance_threshold(0.05),
+      m_min_overlap(0.3),
+      m_min_inlier_ratio(0.3),
+      m_max_neighbours(4),
+      m_max_iterations(30),
+      m_refinement_iterations(3)
+{
+}
+
+int MultiViewAligner :: addView(PointCloudConstPtr cloud, const Pose3D& initial_pose)
+{
+    View view;
+    view.cloud = cloud;
+    view.pose = initial_pose.cvCameraTransformd();
+
+    view.filtered_cloud.reset(new PointCloudType);
+    pcl::VoxelGrid<pcl::PointNormal> grid;
+    grid.setLeafSize (m_voxel_leaf_size, m_voxel_leaf_size, m_voxel_leaf_size);
+    grid.setInputCloud(cloud);
+    grid.filter(*view.filtered_cloud);
+
+    view.bbox_min = cv::Point3f(FLT_MAX, FLT_MAX, FLT_MAX);
+    view.bbox_max = cv::Point3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    foreach_idx(i, view.filtered_cloud->points)
+    {
+        const pcl::PointNormal& p = view.filtered_cloud->points[i];
+        view.bbox_min = cv::Point3f(std::min(view.bbox_min.x, p.x), std::min(view.bbox_min.y, p.y), std::min(view.bbox_min.z, p.z));
+        view.bbox_max = cv::Point3f(std::max(view.bbox_max.x, p.x), std::max(view.bbox_max.y, p.y), std::max(view.bbox_max.z, p.z));
+    }
+
+    if (view.filtered_cloud->points.size() > 0)
+    {
+        view.tree.reset(new pcl::search::KdTree<pcl::PointNormal>);
+        view.tree->setInputCloud(view.filtered_cloud);
+    }
+
+    m_views.push_back(view);
+    return m_views.size() - 1;
+}
+
+void MultiViewAligner :: clear()
+{
+    m_views.clear();
+    m_pairs.clear();
+}
+
+Pose3D MultiViewAligner :: viewPose(int view) const
+{
+    Pose3D pose;
+    pose.setCameraTransform(m_views[view].pose);
+    return pose;
+}
+
+bool MultiViewAligner :: align()
+{
+    TimeCount tc ("MultiViewAligner::align", 1);
+
+    computeOverlappingPairs();
+    ntk_dbg_print(m_pairs.size(), 1);
+    tc.elapsedMsecs(" -- overlapping pairs -- ");
+
+    registerPairs();
+    int num_registered = 0;
+    foreach_idx(i, m_pairs)
+        num_registered += m_pairs[i].registered;
+    ntk_dbg_print(num_registered, 1);
+    tc.elapsedMsecs(" -- pairwise registrations -- ");
+    if (num_registered < 1)
+        return false;
+
+    solveGlobalPoses();
+    tc.elapsedMsecs(" -- global poses -- ");
+
+    refineJointly();
+    tc.elapsedMsecs(" -- joint refinement -- ");
+    return true;
+}
+
+void MultiViewAligner :: computeOverlappingPairs()
+{
+    m_pairs.clear();
+
+    // World bounding boxes, padded so that planar views have a volume.
+    std::vector<cv::Vec3d> world_min (m_views.size()), world_max (m_views.size());
+    foreach_idx(v, m_views)
+    {
+        const View& view = m_views[v];
+        world_min[v] = cv::Vec3d(DBL_MAX, DBL_MAX, DBL_MAX);
+        world_max[v] = cv::Vec3d(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            cv::Vec3d p ((corner & 1) ? view.bbox_max.x : view.bbox_min.x,
+                         (corner & 2) ? view.bbox_max.y : view.bbox_min.y,
+                         (corner & 4) ? view.bbox_max.z : view.bbox_min.z);
+            p = transform_point(view.pose, p);
+            for (int k = 0; k < 3; ++k)
+            {
+                world_min[v][k] = std::min(world_min[v][k], p[k] - m_voxel_leaf_size);
+                world_max[v][k] = std::max(world_max[v][k], p[k] + m_voxel_leaf_size);
+            }
+        }
+    }
+
+    std::map<std::pair<int,int>, double> selected;
+    foreach_idx(i, m_views)
+    {
+        std::vector< std::pair<double,int> > candidates;
+        foreach_idx(j, m_views)
+        {
+            if (i == j)
+                continue;
+            double overlap = overlap_ratio(world_min[i], world_max[i], world_min[j], world_max[j]);
+            if (overlap >= m_min_overlap)
+                candidates.push_back(std::make_pair(overlap, j));
+        }
+
+        std::sort(candidates.begin(), candidates.end(), std::greater< std::pair<double,int> >());
+        for (int k = 0; k < candidates.size() && k < m_max_neighbours; ++k)
+        {
+            const int j = candidates[k].second;
+            selected[std::make_pair(std::min(i,j), std::max(i,j))] = candidates[k].first;
+        }
+    }
+
+    for (std::map<std::pair<int,int>, double>::const_iterator it = selected.begin();
+         it != selected.end(); ++it)
+    {
+        ViewPair pair (it->first.first, it->first.second);
+        pair.overlap = it->second;
+        m_pairs.push_back(pair);
+    }
+}
+
+void MultiViewAligner :: registerPairs()
+{
+    parallel_for(0, m_pairs.size(), PairRegistrationBody(*this, m_pairs), 1);
+}
+
+void MultiViewAligner :: registerPair(ViewPair& pair) const
+{
+    const View& first = m_views[pair.first];
+    const View& second = m_views[pair.second];
+
+    pair.registered = false;
+    if (first.filtered_cloud->points.size() < 3 || second.filtered_cloud->points.size() < 3)
+        return;
+
+    PointCloudPtr target (new PointCloudType);
+    Eigen::Affine3f first_pose = to_eigen_transform(first.pose);
+    pcl::transformPointCloud(*first.filtered_cloud, *target, first_pose);
+
+    PointCloudPtr source (new PointCloudType);
+    Eigen::Affine3f second_pose = to_eigen_transform(second.pose);
+    pcl::transformPointCloud(*second.filtered_cloud, *source, second_pose);
+
+    RelativePoseEstimatorICP<pcl::PointNormal> icp;
+    icp.setVoxelSize(m_voxel_leaf_size);
+    icp.setDistanceThreshold(m_distance_threshold);
+    icp.setMaxIterations(m_max_iterations);
+    icp.setTargetCloud(target);
+    icp.setSourceCloud(source);
+    if (!icp.estimateNewPose())
+        return;
+
+    // World correction of the second view, then relative transform between view coordinates.
+    cv::Mat1d correction = icp.estimatedSourcePose().inverted().cvCameraTransformd();
+    pair.second_to_first = cv::Mat1d(first.pose.inv() * correction * second.pose);
+
+    // Views with no actual overlap can still converge somewhere, reject them.
+    std::vector<PointConstraint> inliers;
+    findClosestPoints(pair, pair.second_to_first, 2.0 * m_voxel_leaf_size, inliers);
+    const int num_points = second.filtered_cloud->points.size();
+    const int step = sampling_step(num_points, max_closest_points);
+    const int num_samples = (num_points + step - 1) / step;
+    pair.registered = inliers.size() >= m_min_inlier_ratio * num_samples;
+}
+
+void MultiViewAligner :: solveGlobalPoses()
+{
+    const int max_points_per_pair = 50;
+
+    std::vector<PointConstraint> constraints;
+    foreach_idx(i, m_pairs)
+    {
+        const ViewPair& pair = m_pairs[i];
+        if (!pair.registered)
+            continue;
+
+        // Virtual correspondences carrying the pairwise transform.
+        const PointCloudType& cloud = *m_views[pair.second].filtered_cloud;
+        const int step = sampling_step(cloud.points.size(), max_points_per_pair);
+        for (int k = 0; k < cloud.points.size(); k += step)
+        {
+            cv::Vec3d p2 = to_vec3d(cloud.points[k]);
+            cv::Vec3d p1 = transform_point(pair.second_to_first, p2);
+            constraints.push_back(PointConstraint(pair.first, p1, pair.second, p2));
+        }
+    }
+
+    solvePoses(constraints, 20);
+}
+
+void MultiViewAligner :: findClosestPoints(const ViewPair& pair,
+                                           const cv::Mat1d& second_to_first,
+                                           double max_distance,
+                                           std::vector<PointConstraint>& constraints) const
+{
+    constraints.clear();
+
+    const View& first = m_views[pair.first];
+    const View& second = m_views[pair.second];
+    if (!first.tree)
+        return;
+
+    const double sqr_max_distance = max_distance * max_distance;
+
+    std::vector<int> indices (1);
+    std::vector<float> sqr_distances (1);
+    const PointCloudType& cloud = *second.filtered_cloud;
+    const int step = sampling_step(cloud.points.size(), max_closest_points);
+    for (int k = 0; k < cloud.points.size(); k += step)
+    {
+        cv::Vec3d p2 = to_vec3d(cloud.points[k]);
+        cv::Vec3d p = transform_point(second_to_first, p2);
+        pcl::PointNormal query;
+        query.x = p[0]; query.y = p[1]; query.z = p[2];
+        if (first.tree->nearestKSearch(query, 1, indices, sqr_distances) < 1)
+            continue;
+        if (sqr_distances[0] > sqr_max_distance)
+            continue;
+        cv::Vec3d p1 = to_vec3d(first.filtered_cloud->points[indices[0]]);
+        constraints.push_back(PointConstraint(pair.first, p1, pair.second, p2));
+    }
+}
+
+void MultiViewAligner :: refineJointly()
+{
+    double max_distance = m_distance_threshold;
+    for (int iteration = 0; iteration < m_refinement_iterations; ++iteration)
+    {
+        std::vector< std::vector<PointConstraint> > pair_constraints (m_pairs.size());
+        parallel_for(0, m_pairs.size(), ClosestPointsBody(*this, max_distance, pair_constraints), 1);
+
+        std::vector<PointConstraint> constraints;
+        foreach_idx(i, pair_constraints)
+            constraints.insert(constraints.end(), pair_constraints[i].begin(), pair_constraints[i].end());
+        ntk_dbg_print(constraints.size(), 1);
+
+        solvePoses(constraints, 3);
+        max_distance = std::max(max_distance * 0.5, 2.0 * m_voxel_leaf_size);
+    }
+}
+
+void MultiViewAligner :: solvePoses(const std::vector<PointConstraint>& constraints, int max_iterations)
+{
+    // Gauss-Newton over small rotation and translation updates of each view
+    // but the first one, applied in world coordinates.
+    const int num_views = m_views.size();
+    if (num_views < 2 || constraints.empty())
+        return;
+
+    const int dim = 6 * (num_views - 1);
+    for (int iteration = 0; iteration < max_iterations; ++iteration)
+    {
+        cv::Mat1d H (dim, dim, 0.0);
+        cv::Mat1d g (dim, 1, 0.0);
+        double error = 0;
+
+        foreach_idx(i, constraints)
+        {
+            const PointConstraint& c = constraints[i];
+            const cv::Vec3d A = transform_point(m_views[c.view1].pose, c.p1);
+            const cv::Vec3d B = transform_point(m_views[c.view2].pose, c.p2);
+            const cv::Vec3d residual = A - B;
+            error += residual.dot(residual);
+
+            // d(A)/d(rotation) = -[A]x, d(A)/d(translation) = I, and opposite for B.
+            double J[2][3][6] = {
+                { { 0, A[2], -A[1], 1, 0, 0 },
+                  { -A[2], 0, A[0], 0, 1, 0 },
+                  { A[1], -A[0], 0, 0, 0, 1 } },
+                { { 0, -B[2], B[1], -1, 0, 0 },
+                  { B[2], 0, -B[0], 0, -1, 0 },
+                  { -B[1], B[0], 0, 0, 0, -1 } }
+            };
+            const int offsets[2] = { 6*(c.view1 - 1), 6*(c.view2 - 1) };
+
+            for (int a = 0; a < 2; ++a)
+            {
+                if (offsets[a] < 0)
+                    continue;
+                for (int u = 0; u < 6; ++u)
+                {
+                    g(offsets[a]+u) += J[a][0][u]*residual[0] + J[a][1][u]*residual[1] + J[a][2][u]*residual[2];
+                    for (int b = 0; b < 2; ++b)
+                    {
+                        if (offsets[b] < 0)
+                            continue;
+                        double* H_row = H.ptr<double>(offsets[a]+u) + offsets[b];
+                        for (int v = 0; v < 6; ++v)
+                            H_row[v] += J[a][0][u]*J[b][0][v] + J[a][1][u]*J[b][1][v] + J[a][2][u]*J[b][2][v];
+                    }
+                }
+            }
+        }
+
+        // Light damping, views without any constraint stay where they are.
+        for (int d = 0; d < dim; ++d)
+            H(d,d) += 1e-6;
+
+        cv::Mat1d delta;
+        cv::solve(H, -g, delta, cv::DECOMP_CHOLESKY);
+
+        for (int v = 1; v < num_views; ++v)
+        {
+            const int o = 6*(v - 1);
+            cv::Mat1d rotation_vector = (cv::Mat1d(3,1) << delta(o), delta(o+1), delta(o+2));
+            cv::Mat1d R;
+            cv::Rodrigues(rotation_vector, R);
+            cv::Mat1d update = cv::Mat1d::eye(4,4);
+            cv::Mat1d update_rotation = update(cv::Rect(0,0,3,3));
+            R.copyTo(update_rotation);
+            update(0,3) = delta(o+3);
+            update(1,3) = delta(o+4);
+            update(2,3) = delta(o+5);
+            m_views[v].pose = cv::Mat1d(update * m_views[v].pose);
+        }
+
+        ntk_dbg_print(sqrt(error / constraints.size()), 2);
+        if (cv::norm(delta, cv::NORM_INF) < 1e-8)
+            break;
+    }
+}
+
+} // ntk
@@ -0,0 +1,164 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_GEOMETRY_MULTI_VIEW_ALIGNER_H
+#define NTK_GEOMETRY_MULTI_VIEW_ALIGNER_H
+
+#include <ntk/core.h>
+#include <ntk/geometry/pose_3d.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/search/kdtree.h>
+
+namespace ntk
+{
+
+/*!
+ * Simultaneous alignment of many point cloud views, e.g. a turntable capture.
+ *
+ * Views whose bounding boxes overlap are registered pairwise with ICP, in
+ * parallel. The pairwise transforms are then made globally consistent by
+ * solving for all the view poses at once, and a final joint refinement
+ * minimizes closest point distances between all the overlapping views.
+ *
+ * View poses follow the Mesh::applyTransform convention, i.e. the camera
+ * transform of a pose brings the view points into world coordinates.
+ * The first view is kept fixed.
+ */
+class MultiViewAligner
+{
+public:
+    typedef pcl::PointCloud<pcl::PointNormal> PointCloudType;
+    typedef PointCloudType::Ptr PointCloudPtr;
+    typedef PointCloudType::ConstPtr PointCloudConstPtr;
+
+    /*! Pair of overlapping views and the transform from second to first view coordinates. */
+    struct ViewPair
+    {
+        ViewPair(int first = -1, int second = -1)
+            : first(first), second(second), overlap(0), registered(false)
+        {}
+
+        int first;
+        int second;
+        double overlap;
+        bool registered;
+        cv::Mat1d second_to_first;
+    };
+
+public:
+    MultiViewAligner();
+
+    /*! Add a view with its initial pose. Returns the view index. */
+    int addView(PointCloudConstPtr cloud, const Pose3D& initial_pose);
+
+    void clear();
+
+    int numViews() const { return m_views.size(); }
+
+public:
+    /*! Size of the leafs of the voxel grid used for registration. */
+    void setVoxelSize(double s) { m_voxel_leaf_size = s; }
+
+    /*! Distance threshold to associate points. */
+    void setDistanceThreshold(double th) { m_distance_threshold = th; }
+
+    /*! Minimal ratio of bounding box intersection to the smallest box volume. */
+    void setMinOverlap(double ratio) { m_min_overlap = ratio; }
+
+    /*! Maximal number of pairs, with the most overlapping views, per view. */
+    void setMaxNeighbours(int n) { m_max_neighbours = n; }
+
+    /*! Minimal fraction of points of a registered pair which must have a close neighbour. */
+    void setMinInlierRatio(double ratio) { m_min_inlier_ratio = ratio; }
+
+    /*! Set the maximal number of ICP iterations of pairwise registrations. */
+    void setMaxIterations(int n) { m_max_iterations = n; }
+
+    /*! Number of joint refinement passes. 0 disables the refinement. */
+    void setRefinementIterations(int n) { m_refinement_iterations = n; }
+
+public:
+    /*! Run the full alignment. Returns false if no pair could be registered. */
+    bool align();
+
+    /*! Select the overlapping pairs with the current poses. */
+    void computeOverlappingPairs();
+
+    /*! Register all the selected pairs in parallel. */
+    void registerPairs();
+
+    /*! Compute globally consistent poses from the registered pairs. */
+    void solveGlobalPoses();
+
+    /*! Minimize closest point distances between registered pairs. */
+    void refineJointly();
+
+    const std::vector<ViewPair>& pairs() const { return m_pairs; }
+    Pose3D viewPose(int view) const;
+
+private:
+    struct View
+    {
+        PointCloudConstPtr cloud;
+        PointCloudPtr filtered_cloud;
+        pcl::search::KdTree<pcl::PointNormal>::Ptr tree;
+        cv::Mat1d pose;
+        cv::Point3f bbox_min;
+        cv::Point3f bbox_max;
+    };
+
+    // Points of two views which should coincide in world coordinates.
+    struct PointConstraint
+    {
+        PointConstraint(int view1 = 0, const cv::Vec3d& p1 = cv::Vec3d(),
+                        int view2 = 0, const cv::Vec3d& p2 = cv::Vec3d())
+            : view1(view1), view2(view2), p1(p1), p2(p2)
+        {}
+
+        int view1, view2;
+        cv::Vec3d p1, p2;
+    };
+
+    struct PairRegistrationBody;
+    struct ClosestPointsBody;
+
+    void registerPair(ViewPair& pair) const;
+    void findClosestPoints(const ViewPair& pair,
+                           const cv::Mat1d& second_to_first,
+                           double max_distance,
+                           std::vector<PointConstraint>& constraints) const;
+    void solvePoses(const std::vector<PointConstraint>& constraints, int max_iterations);
+
+private:
+    std::vector<View> m_views;
+    std::vector<ViewPair> m_pairs;
+    double m_voxel_leaf_size;
+    double m_distance_threshold;
+    double m_min_overlap;
+    double m_min_inlier_ratio;
+    int m_max_neighbours;
+    int m_max_iterations;
+    int m_refinement_iterations;
+};
+
+} // ntk
+
+#endif // NTK_GEOMETRY_MULTI_VIEW_ALIGNER_H
@@ -22,6 +22,7 @@
 #include "pose_3d.hpp"
 
 #include <ntk/utils/opencv_utils.h>
+#include <ntk/utils/sse.h>
 #include <ntk/geometry/eigen_utils.h>
 
 #include <Eigen/Core>
@@ -750,6 +751,19 @@ void Pose3D :: setCameraTransform(const Pose3D& pose)
     impl->computeProjectiveTransform();
 }
 
+void Pose3D :: setCameraTransformFromOpencv(const cv::Mat1d& rotation, const cv::Mat1d& translation)
+{
+    // Flipping y and z is its own inverse.
+    for (int r = 0; r < 3; ++r)
+    {
+        const double sign = (r == 0) ? 1 : -1;
+        for (int c = 0; c < 3; ++c)
+            impl->camera_transform(r,c) = sign*rotation(r,c);
+        impl->camera_transform(r,3) = sign*translation(r);
+    }
+    impl->computeProjectiveTransform();
+}
+
 cv::Point3f Pose3D :: cameraTransform(const cv::Point3f& p) const
 {
     Eigen::Vector3d ep; toEigen(p, ep);
@@ -841,6 +855,20 @@ void Pose3D::cvRotationMatrixTranslation(cv::Mat1d& translation, cv::Mat1d& rota
     translation(2,0) = H(2,3);
 }
 
+void Pose3D :: cvOpencvCameraTransform(cv::Mat1d& rotation, cv::Mat1d& translation) const
+{
+    rotation.create(3,3);
+    translation.create(3,1);
+    const cv::Mat1d H = cvCameraTransformd();
+    for (int r = 0; r < 3; ++r)
+    {
+        const double sign = (r == 0) ? 1 : -1;
+        for (int c = 0; c < 3; ++c)
+            rotation(r,c) = sign*H(r,c);
+        translation(r) = sign*H(r,3);
+    }
+}
+
 cv::Mat1f Pose3D :: cvProjectionMatrix() const
 {
     cv::Mat1f m(4,4);
@@ -1005,6 +1033,66 @@ cv::Point3f Pose3D :: unprojectFromImage(const cv::Point2f& p, double depth) con
     return toVec3f(output);
 }
 
+void Pose3D :: projectToImage(const std::vector<cv::Point3f>& points, std::vector<cv::Point3f>& pixels) const
+{
+    ntk_assert(m_has_camera_params, "You need to set camera params first!");
+    pixels.resize(points.size());
+    if (points.empty())
+        return;
+
+    if (isOrthographic())
+    {
+        foreach_idx(i, points)
+            pixels[i] = projectToImage(points[i]);
+        return;
+    }
+
+    VectorialProjector projector (*this);
+    foreach_idx(i, points)
+        pixels[i] = toPoint3f(projector.projectToImage(points[i]));
+}
+
+void Pose3D :: unprojectFromImage(const std::vector<cv::Point2f>& pixels,
+                                  const std::vector<float>& depths,
+                                  std::vector<cv::Point3f>& points) const
+{
+    ntk_assert(m_has_camera_params, "You need to set camera params first!");
+    ntk_assert(pixels.size() == depths.size(), "Each pixel must have a depth.");
+    points.resize(pixels.size());
+    if (pixels.empty())
+        return;
+
+    if (isOrthographic())
+    {
+        foreach_idx(i, pixels)
+            points[i] = unprojectFromImage(pixels[i], depths[i]);
+        return;
+    }
+
+    VectorialProjector projector (*this);
+    foreach_idx(i, pixels)
+        points[i] = toPoint3f(projector.unprojectFromImage(cv::Point3f(pixels[i].x, pixels[i].y, depths[i])));
+}
+
+void Pose3D :: unprojectFromImage(const std::vector<cv::Point3f>& pixels, std::vector<cv::Point3f>& points) const
+{
+    ntk_assert(m_has_camera_params, "You need to set camera params first!");
+    points.resize(pixels.size());
+    if (pixels.empty())
+        return;
+
+    if (isOrthographic())
+    {
+        foreach_idx(i, pixels)
+            points[i] = unprojectFromImage(pixels[i]);
+        return;
+    }
+
+    VectorialProjector projector (*this);
+    foreach_idx(i, pixels)
+        points[i] = toPoint3f(projector.unprojectFromImage(pixels[i]));
+}
+
 void Pose3D :: applyTransformBefore(const Pose3D& rhs_pose)
 {
     // impl->camera_transform = impl->camera_transform * rhs_pose.impl->camera_transform;
@@ -184,6 +184,12 @@ public:
    */
   void cvRotationMatrixTranslation(cv::Mat1d& translation, cv::Mat1d& rotation) const;
 
+  /*!
+   * Returns the camera rotation and translation in the OpenCV camera frame,
+   * looking towards +z with y downward instead of -z with y upward.
+   */
+  void cvOpencvCameraTransform(cv::Mat1d& rotation, cv::Mat1d& translation) const;
+
   /*! Returns the inverse camera transform as an OpenCV 4x4 matrix. */
   cv::Mat1f cvInvCameraTransform() const;
 
@@ -227,6 +233,9 @@ public:
   /*! Set the 3D camera transform from another pose. */
   void setCameraTransform(const Pose3D& pose);
 
+  /*! Set the 3D camera transform from a rotation and translation in the OpenCV camera frame. */
+  void setCameraTransformFromOpencv(const cv::Mat1d& rotation, const cv::Mat1d& translation);
+
   /*! Set the 3D camera transform from 3x3 fundamental matrix. */
   void setCameraTransformFromCvFundamentalMatrix(const cv::Mat1f& F);
 
@@ -266,6 +275,20 @@ public:
   /*! Project a set of image points to 3D. */
   void unprojectFromImage(const cv::Mat1f& pixels, const cv::Mat1b& mask, cv::Mat4f& voxels) const;
 
+  /*!
+   * Project a list of 3D points, same as projectToImage on each point.
+   * Computed in single precision with the vectorial types of ntk/utils/sse.h.
+   */
+  void projectToImage(const std::vector<cv::Point3f>& points, std::vector<cv::Point3f>& pixels) const;
+
+  /*! Unproject a list of image points given their depth, see projectToImage. */
+  void unprojectFromImage(const std::vector<cv::Point2f>& pixels,
+                          const std::vector<float>& depths,
+                          std::vector<cv::Point3f>& points) const;
+
+  /*! Unproject a list of image points, z being the depth. */
+  void unprojectFromImage(const std::vector<cv::Point3f>& pixels, std::vector<cv::Point3f>& points) const;
+
 public:
   /*!
    * Compute the euclidian distance between two poses.
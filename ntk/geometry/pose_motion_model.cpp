@@ -0,0 +1,150 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#include "pose_motion_model.h"
+
+namespace
+{
+
+// Skew symmetric matrix of a vector.
+cv::Mat1d skew(const cv::Vec3d& v)
+{
+    return (cv::Mat1d(3,3) << 0, -v[2], v[1],
+                              v[2], 0, -v[0],
+                              -v[1], v[0], 0);
+}
+
+// Maps the translational part of a twist to the translation of its
+// rigid transform, so that constant twists give screw motions.
+cv::Mat1d se3_translation_jacobian(const cv::Vec3d& rotation)
+{
+    const double theta = cv::norm(rotation);
+    cv::Mat1d W = skew(rotation);
+    if (theta < 1e-8)
+        return cv::Mat1d(cv::Mat1d::eye(3,3) + 0.5*W);
+    const double theta2 = theta*theta;
+    return cv::Mat1d(cv::Mat1d::eye(3,3)
+                     + ((1 - cos(theta)) / theta2) * W
+                     + ((theta - sin(theta)) / (theta2*theta)) * (W*W));
+}
+
+// Twist of a 4x4 rigid transform.
+void se3_log(const cv::Mat1d& H, cv::Vec3d& rotation, cv::Vec3d& translation)
+{
+    cv::Mat1d rotation_vector;
+    cv::Rodrigues(H(cv::Rect(0,0,3,3)), rotation_vector);
+    rotation = cv::Vec3d(rotation_vector(0), rotation_vector(1), rotation_vector(2));
+    cv::Mat1d t = (cv::Mat1d(3,1) << H(0,3), H(1,3), H(2,3));
+    cv::Mat1d u = se3_translation_jacobian(rotation).inv() * t;
+    translation = cv::Vec3d(u(0), u(1), u(2));
+}
+
+// Rigid transform of a twist.
+cv::Mat1d se3_exp(const cv::Vec3d& rotation, const cv::Vec3d& translation)
+{
+    cv::Mat1d R;
+    cv::Rodrigues(cv::Mat1d(rotation), R);
+    cv::Mat1d t = se3_translation_jacobian(rotation) * cv::Mat1d(translation);
+    cv::Mat1d H = cv::Mat1d::eye(4,4);
+    cv::Mat1d H_rotation = H(cv::Rect(0,0,3,3));
+    R.copyTo(H_rotation);
+    cv::Mat1d H_translation = H(cv::Rect(3,0,1,3));
+    t.copyTo(H_translation);
+    return H;
+}
+
+}
+
+namespace ntk
+{
+
+PoseMotionModel :: PoseMotionModel()
+    : m_use_acceleration(false)
+{
+    reset();
+}
+
+void PoseMotionModel :: reset()
+{
+    m_last_pose = Pose3D();
+    m_last_time = 0;
+    m_last_dt = 0;
+    m_num_updates = 0;
+    m_angular_velocity = m_linear_velocity = cv::Vec3d(0,0,0);
+    m_angular_acceleration = m_linear_acceleration = cv::Vec3d(0,0,0);
+}
+
+void PoseMotionModel :: update(const Pose3D& pose, double time)
+{
+    if (m_num_updates > 0)
+    {
+        const double dt = time - m_last_time;
+        if (dt <= 0)
+        {
+            // Same time, just replace the last pose.
+            m_last_pose = pose;
+            return;
+        }
+
+        // Camera motion since the last pose, as a twist per time unit.
+        cv::Mat1d delta = pose.cvCameraTransformd() * m_last_pose.cvCameraTransformd().inv();
+        cv::Vec3d rotation, translation;
+        se3_log(delta, rotation, translation);
+        cv::Vec3d angular_velocity = rotation * (1.0 / dt);
+        cv::Vec3d linear_velocity = translation * (1.0 / dt);
+
+        // Velocities are means over each interval, i.e. at their middle.
+        if (m_num_updates > 1)
+        {
+            const double velocity_dt = 0.5 * (dt + m_last_dt);
+            m_angular_acceleration = (angular_velocity - m_angular_velocity) * (1.0 / velocity_dt);
+            m_linear_acceleration = (linear_velocity - m_linear_velocity) * (1.0 / velocity_dt);
+        }
+        m_angular_velocity = angular_velocity;
+        m_linear_velocity = linear_velocity;
+        m_last_dt = dt;
+    }
+
+    m_last_pose = pose;
+    m_last_time = time;
+    ++m_num_updates;
+}
+
+Pose3D PoseMotionModel :: predict(double time) const
+{
+    if (!canPredict())
+        return m_last_pose;
+
+    const double dt = time - m_last_time;
+    cv::Vec3d rotation = m_angular_velocity * dt;
+    cv::Vec3d translation = m_linear_velocity * dt;
+    if (m_use_acceleration && m_num_updates > 2)
+    {
+        // Velocity is known at the middle of the last interval.
+        const double factor = 0.5 * dt * (m_last_dt + dt);
+        rotation += m_angular_acceleration * factor;
+        translation += m_linear_acceleration * factor;
+    }
+
+    Pose3D predicted_pose = m_last_pose;
+    predicted_pose.setCameraTransform(cv::Mat1d(se3_exp(rotation, translation) * m_last_pose.cvCameraTransformd()));
+    return predicted_pose;
+}
+
+} // ntk
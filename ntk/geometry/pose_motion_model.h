@@ -0,0 +1,71 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_GEOMETRY_POSE_MOTION_MODEL_H
+#define NTK_GEOMETRY_POSE_MOTION_MODEL_H
+
+#include <ntk/core.h>
+#include <ntk/geometry/pose_3d.h>
+
+namespace ntk
+{
+
+/*!
+ * Constant velocity, or constant acceleration, motion model of a camera.
+ * The velocity is the twist of the relative camera transform between the
+ * last two poses per time unit, so constant velocities give screw motions.
+ * Time is given by the caller, e.g. image timestamps or frame indices.
+ */
+class PoseMotionModel
+{
+public:
+    PoseMotionModel();
+
+    void reset();
+
+    /*! Also estimate the acceleration from the last three poses. */
+    void setUseAcceleration(bool enable) { m_use_acceleration = enable; }
+
+    /*! Add the estimated pose at the given time. */
+    void update(const Pose3D& pose, double time);
+
+    /*! Whether a velocity is known, i.e. at least two poses were given. */
+    bool canPredict() const { return m_num_updates >= 2; }
+
+    /*! Predict the pose at the given time. Returns the last pose if no velocity is known. */
+    Pose3D predict(double time) const;
+
+    const Pose3D& lastPose() const { return m_last_pose; }
+    double lastTime() const { return m_last_time; }
+
+private:
+    Pose3D m_last_pose;
+    double m_last_time;
+    double m_last_dt;
+    int m_num_updates;
+    bool m_use_acceleration;
+    cv::Vec3d m_angular_velocity;
+    cv::Vec3d m_linear_velocity;
+    cv::Vec3d m_angular_acceleration;
+    cv::Vec3d m_linear_acceleration;
+};
+
+} // ntk
+
+#endif // NTK_GEOMETRY_POSE_MOTION_MODEL_H
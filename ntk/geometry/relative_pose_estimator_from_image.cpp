@@ -23,7 +23,7 @@
 
 #include <ntk/camera/rgbd_processor.h>
 #include <ntk/mesh/pcl_utils.h>
-#include <ntk/mesh/mesh_generator.h>
+#include <ntk/image/bilateral_filter.h>
 #include <ntk/utils/time.h>
 
 using cv::Vec3f;
@@ -34,6 +34,24 @@ using cv::Point3f;
 namespace ntk
 {
 
+void prepareRGBDICPCloud(const RGBDImage& image,
+                         RGBDImage& filtered_image,
+                         pcl::PointCloud<pcl::PointNormal>& cloud,
+                         int subsampling_factor)
+{
+    ntk_ensure(image.calibration(), "Image must be calibrated.");
+    filtered_image.setCalibration(image.calibration());
+    image.depthMask().copyTo(filtered_image.depthMaskRef());
+
+    // Same filter as RGBDProcessor::bilateralFilter, without the intermediate copies.
+    depth_bilateralFilter(image.depth(), filtered_image.depthRef(), 7, 20, 20, 0.01f);
+
+    OpenniRGBDProcessor processor;
+    processor.computeNormals(filtered_image);
+
+    rgbdImageToPointCloud(cloud, filtered_image, *image.calibration()->depth_pose, subsampling_factor);
+}
+
 bool RelativePoseEstimatorFromRgbFeatures::
 estimateNewPose(Pose3D& new_pose,
                 const RGBDImage& image,
@@ -72,6 +90,7 @@ estimateNewPose(Pose3D& new_pose,
     std::vector<bool> valid_points;
     double error = rms_optimize_ransac(new_pose, ref_points, img_points, valid_points, false /* use_depth */);
     error /= ref_points.size();
+    m_num_inliers = std::count(valid_points.begin(), valid_points.end(), true);
 
     ntk_dbg_print(error, 1);
     ntk_dbg_print(new_pose, 2);
@@ -134,49 +153,29 @@ optimizeWithRGBDICP(Pose3D& new_pose, const RGBDImage& image,
         best_img_points[i] = clean_img_points[best_indices[i]];
     }
 
-    RGBDImage filtered_source_image;
-    m_source_image->copyTo(filtered_source_image);
+    ntk::TimeCount tc("RGBD-ICP", 1);
 
-    RGBDImage filtered_target_image;
-    m_target_image->copyTo(filtered_target_image);
-
-    OpenniRGBDProcessor processor;
-    processor.bilateralFilter(filtered_source_image);
-    processor.bilateralFilter(filtered_target_image);
-    // processor.computeNormals(filtered_source_image);
-    // processor.computeNormals(filtered_target_image);
-
-    MeshGenerator generator;
-    generator.setMeshType(MeshGenerator::TriangleMesh);
-    generator.setUseColor(true);
-
-    generator.generate(filtered_source_image);
-    Mesh source_mesh = generator.mesh();
-    source_mesh.computeNormalsFromFaces();
-
-    generator.generate(filtered_target_image);
-    Mesh target_mesh = generator.mesh();
-    target_mesh.computeNormalsFromFaces();
-
-    pcl::PointCloud<pcl::PointNormal>::Ptr sampled_source_cloud;
-    sampled_source_cloud.reset(new pcl::PointCloud<pcl::PointNormal>());
+    if (!m_icp_target_cloud)
+    {
+        m_icp_target_cloud.reset(new pcl::PointCloud<pcl::PointNormal>());
+        prepareRGBDICPCloud(*m_target_image, m_icp_target_image, *m_icp_target_cloud);
+        tc.elapsedMsecs(" -- prepare target");
+    }
 
+    // Only a sample of the source is used, no need to convert every pixel.
     pcl::PointCloud<pcl::PointNormal>::Ptr source_cloud;
     source_cloud.reset(new pcl::PointCloud<pcl::PointNormal>());
+    prepareRGBDICPCloud(*m_source_image, m_icp_source_image, *source_cloud, 2);
 
-    pcl::PointCloud<pcl::PointNormal>::Ptr target_cloud;
-    target_cloud.reset(new pcl::PointCloud<pcl::PointNormal>());
-
-    // rgbdImageToPointCloud(*source_cloud, filtered_source_image);
-    // rgbdImageToPointCloud(*target_cloud, filtered_target_image);
-    meshToPointCloud(*source_cloud, source_mesh);
-    meshToPointCloud(*target_cloud, target_mesh);
+    pcl::PointCloud<pcl::PointNormal>::Ptr sampled_source_cloud;
+    sampled_source_cloud.reset(new pcl::PointCloud<pcl::PointNormal>());
 
     const int num_samples = 1000;
     NormalCloudSampler<pcl::PointNormal> sampler;
     sampler.subsample(*source_cloud, *sampled_source_cloud, num_samples);
+    tc.elapsedMsecs(" -- prepare source");
 
-    RelativePoseEstimatorRGBDICP<pcl::PointNormal> icp_estimator;
+    RelativePoseEstimatorRGBDICP<pcl::PointNormal>& icp_estimator = *m_icp_estimator;
     // RelativePoseEstimatorICPWithNormals<pcl::PointNormal> icp_estimator;
     icp_estimator.setVoxelSize(0.001);
     icp_estimator.setDistanceThreshold(0.05);
@@ -184,7 +183,7 @@ optimizeWithRGBDICP(Pose3D& new_pose, const RGBDImage& image,
     icp_estimator.setMaxIterations(100);
 
     icp_estimator.setSourceCloud(sampled_source_cloud);
-    icp_estimator.setTargetCloud(target_cloud);
+    icp_estimator.setTargetCloud(m_icp_target_cloud);
 
     // icp_estimator.setColorFeatures(new_pose, clean_ref_points, clean_img_points);
     icp_estimator.setColorFeatures(new_pose, best_ref_points, best_img_points);
@@ -192,6 +191,7 @@ optimizeWithRGBDICP(Pose3D& new_pose, const RGBDImage& image,
     icp_estimator.setInitialSourcePoseEstimate(new_pose);
 
     bool ok = icp_estimator.estimateNewPose();
+    tc.stop();
     if (!ok)
     {
         ntk_dbg(1) << "RGBD-ICP failed";
@@ -257,11 +257,12 @@ bool RelativePoseEstimatorFromRgbFeatures::estimateNewPose()
     }
 
     m_num_matches = 0;
+    m_num_inliers = 0;
 
     FeatureSet& image_features = *m_source_features;
 
     std::vector<cv::DMatch> matches;
-    m_target_features->matchWith(image_features, matches, 0.8f*0.8f);
+    matchFeatures(image, image_features, matches);
     ntk_dbg_print(matches.size(), 1);
     trimMatches(matches, 0.15f, 100);
     tc.elapsedMsecs(" -- match features -- ");
@@ -275,10 +276,14 @@ bool RelativePoseEstimatorFromRgbFeatures::estimateNewPose()
 
     m_num_matches = matches.size();
 
-    if (matches.size() < m_min_matches)
+    if ((int)matches.size() < m_min_matches)
         return false;
 
+    // With guided matching, start from the predicted pose, closer than the target one.
+    // Other callers keep starting from the target pose.
     m_estimated_pose = m_target_pose;
+    if (m_guided_search_radius > 0 && m_initial_pose.isValid())
+        m_estimated_pose = m_initial_pose;
     m_estimated_pose.toRightCamera(image.calibration()->rgb_intrinsics,
                                    image.calibration()->R, image.calibration()->T);
 
@@ -292,10 +297,37 @@ bool RelativePoseEstimatorFromRgbFeatures::estimateNewPose()
     return true;
 }
 
+void RelativePoseEstimatorFromRgbFeatures::matchFeatures(const RGBDImage& image,
+                                                         const FeatureSet& image_features,
+                                                         std::vector<cv::DMatch>& matches)
+{
+    m_used_guided_matching = false;
+
+    if (m_guided_search_radius > 0 && m_initial_pose.isValid())
+    {
+        Pose3D predicted_rgb_pose = m_initial_pose;
+        predicted_rgb_pose.toRightCamera(image.calibration()->rgb_intrinsics,
+                                         image.calibration()->R, image.calibration()->T);
+        m_target_features->matchWithGuided(image_features, predicted_rgb_pose,
+                                           m_guided_search_radius, matches, 0.8f*0.8f);
+        ntk_dbg_print(matches.size(), 1);
+        if ((int)matches.size() >= m_min_guided_matches)
+        {
+            m_used_guided_matching = true;
+            return;
+        }
+        // Prediction was probably wrong.
+        matches.clear();
+    }
+
+    m_target_features->matchWith(image_features, matches, 0.8f*0.8f);
+}
+
 void RelativePoseEstimatorFromRgbFeatures::resetTarget()
 {
     m_target_features = toPtr(new FeatureSet);
     m_target_image = 0;
+    m_icp_target_cloud.reset();
     m_estimated_pose = Pose3D();
 }
 
@@ -309,6 +341,7 @@ void RelativePoseEstimatorFromRgbFeatures::setTargetImage(const RGBDImage &image
 {
     ntk_ensure(image.calibration(), "Image must be calibrated.");
     m_target_image = &image;
+    m_icp_target_cloud.reset();
     if (!m_target_pose.isValid())
     {
         m_target_pose = *m_target_image->calibration()->depth_pose;
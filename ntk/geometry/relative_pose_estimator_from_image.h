@@ -21,13 +21,25 @@
 #define NTK_GEOMETRY_RELATIVE_POSE_ESTIMATOR_FROM_IMAGE_H
 
 #include "relative_pose_estimator.h"
+#include "relative_pose_estimator_rgbd_icp.h"
 
 //#include <ntk/image/sift_gpu.h>
 #include <ntk/image/feature.h>
+#include <ntk/camera/rgbd_image.h>
 
 namespace ntk
 {
 
+/*!
+ * Bilateral filter the depth of image into filtered_image, compute its normals
+ * and convert one pixel every subsampling_factor into a cloud with normals,
+ * without building a mesh. filtered_image only gets depth, mask and normals.
+ */
+void prepareRGBDICPCloud(const RGBDImage& image,
+                         RGBDImage& filtered_image,
+                         pcl::PointCloud<pcl::PointNormal>& cloud,
+                         int subsampling_factor = 1);
+
 /*!
  * Estimate relative 3D pose using feature point detection.
  * Feature matches are computed between the new image and past images,
@@ -43,7 +55,12 @@ public:
           m_feature_parameters(params),
           m_min_matches(10),
           m_num_matches(0),
-          m_postprocess_with_rgbd_icp(false)
+          m_num_inliers(0),
+          m_postprocess_with_rgbd_icp(false),
+          m_guided_search_radius(0),
+          m_min_guided_matches(30),
+          m_used_guided_matching(false),
+          m_icp_estimator(new RelativePoseEstimatorRGBDICP<pcl::PointNormal>)
     {
         // Force feature extraction to return only features with depth.
         m_feature_parameters.only_features_with_depth = true;
@@ -64,6 +81,23 @@ public:
     void setMinMatches(int n) { m_min_matches = n; }
     int numMatches() const { return m_num_matches; }
 
+    //! Number of matches in the RANSAC consensus set of the last estimation.
+    int numInliers() const { return m_num_inliers; }
+
+    /*!
+     * When an initial source pose estimate is given, only match features
+     * whose predicted projection is within search_radius pixels.
+     * The estimate also seeds the pose optimization, which otherwise
+     * starts from the target pose.
+     * Falls back to global matching if less than min_matches are found.
+     * A non positive radius disables guided matching.
+     */
+    void setGuidedMatching(float search_radius, int min_matches = 30)
+    { m_guided_search_radius = search_radius; m_min_guided_matches = min_matches; }
+
+    //! Whether the last call to estimateNewPose kept the guided matches.
+    bool usedGuidedMatching() const { return m_used_guided_matching; }
+
 private:
     bool estimateNewPose(Pose3D& new_pose,
                          const RGBDImage& image,
@@ -74,6 +108,10 @@ private:
 
     void computeTargetFeatures();
 
+    void matchFeatures(const RGBDImage& image,
+                       const FeatureSet& image_features,
+                       std::vector<cv::DMatch>& matches);
+
     void optimizeWithRGBDICP(Pose3D& new_pose,
                              const RGBDImage& image,
                              std::vector<cv::Point3f>& ref_points,
@@ -87,7 +125,18 @@ private:
     FeatureSetParams m_feature_parameters;
     int m_min_matches;
     int m_num_matches;
+    int m_num_inliers;
     bool m_postprocess_with_rgbd_icp;
+    float m_guided_search_radius;
+    int m_min_guided_matches;
+    bool m_used_guided_matching;
+
+    // RGBD-ICP target data, kept until setTargetImage changes the target.
+    // The estimator keeps the filtered target cloud and its search tree.
+    RGBDImage m_icp_target_image;
+    pcl::PointCloud<pcl::PointNormal>::Ptr m_icp_target_cloud;
+    RGBDImage m_icp_source_image;
+    ntk::Ptr< RelativePoseEstimatorRGBDICP<pcl::PointNormal> > m_icp_estimator;
 };
 
 }
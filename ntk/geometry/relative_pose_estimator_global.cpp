@@ -0,0 +1,537 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#include "relative_pose_estimator_global.h"
+
+#include <ntk/mesh/pcl_utils.h>
+#include <ntk/thread/parallel.h>
+#include <ntk/utils/time.h>
+
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/registration/transforms.h>
+#include <pcl/registration/transformation_estimation_svd.h>
+
+#include <cfloat>
+
+namespace
+{
+
+const int fpfh_bins_per_feature = 11;
+const int fpfh_size = 3*fpfh_bins_per_feature;
+
+inline int fpfh_bin(float value, float min_value, float max_value)
+{
+    int bin = int(fpfh_bins_per_feature * (value - min_value) / (max_value - min_value));
+    return std::max(0, std::min(bin, fpfh_bins_per_feature - 1));
+}
+
+// Angular features of a point pair in its Darboux frame, as in
+// Rusu et al., "Fast Point Feature Histograms (FPFH) for 3D registration".
+bool compute_pair_features(const Eigen::Vector3f& p1, const Eigen::Vector3f& n1,
+                           const Eigen::Vector3f& p2, const Eigen::Vector3f& n2,
+                           float& f1, float& f2, float& f3)
+{
+    Eigen::Vector3f dp = p2 - p1;
+    const float dist = dp.norm();
+    if (dist < FLT_EPSILON)
+        return false;
+    dp /= dist;
+
+    // The source of the frame is the point whose normal is the most aligned with dp.
+    Eigen::Vector3f u = n1;
+    Eigen::Vector3f n = n2;
+    const float angle1 = n1.dot(dp);
+    const float angle2 = n2.dot(dp);
+    f3 = angle1;
+    if (std::abs(angle1) < std::abs(angle2))
+    {
+        u = n2;
+        n = n1;
+        dp = -dp;
+        f3 = -angle2;
+    }
+
+    Eigen::Vector3f v = dp.cross(u);
+    const float v_norm = v.norm();
+    if (v_norm < FLT_EPSILON)
+        return false;
+    v /= v_norm;
+    const Eigen::Vector3f w = u.cross(v);
+
+    f2 = v.dot(n);
+    f1 = atan2(w.dot(n), u.dot(n));
+    return true;
+}
+
+struct NeighbourhoodSPFHBody
+{
+    NeighbourhoodSPFHBody(const pcl::PointCloud<pcl::PointNormal>& cloud,
+                          const pcl::search::KdTree<pcl::PointNormal>& tree,
+                          double radius,
+                          std::vector< std::vector<int> >& neighbours,
+                          std::vector< std::vector<float> >& sqr_distances,
+                          cv::Mat1f& spfh)
+        : cloud(cloud), tree(tree), radius(radius),
+          neighbours(neighbours), sqr_distances(sqr_distances), spfh(spfh)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        for (int i = range.begin; i < range.end; ++i)
+        {
+            tree.radiusSearch(cloud.points[i], radius, neighbours[i], sqr_distances[i]);
+
+            float* hist = spfh.ptr<float>(i);
+            std::fill(hist, hist + fpfh_size, 0.f);
+            const Eigen::Vector3f p1 = cloud.points[i].getVector3fMap();
+            const Eigen::Vector3f n1 = cloud.points[i].getNormalVector3fMap();
+
+            int num_pairs = 0;
+            foreach_idx(k, neighbours[i])
+            {
+                const int j = neighbours[i][k];
+                if (j == i)
+                    continue;
+                float f1, f2, f3;
+                if (!compute_pair_features(p1, n1,
+                                           cloud.points[j].getVector3fMap(),
+                                           cloud.points[j].getNormalVector3fMap(),
+                                           f1, f2, f3))
+                    continue;
+                ++hist[fpfh_bin(f1, -M_PI, M_PI)];
+                ++hist[fpfh_bins_per_feature + fpfh_bin(f2, -1, 1)];
+                ++hist[2*fpfh_bins_per_feature + fpfh_bin(f3, -1, 1)];
+                ++num_pairs;
+            }
+
+            if (num_pairs > 0)
+                for (int b = 0; b < fpfh_size; ++b)
+                    hist[b] *= 100.f / num_pairs;
+        }
+    }
+
+    const pcl::PointCloud<pcl::PointNormal>& cloud;
+    const pcl::search::KdTree<pcl::PointNormal>& tree;
+    double radius;
+    std::vector< std::vector<int> >& neighbours;
+    std::vector< std::vector<float> >& sqr_distances;
+    cv::Mat1f& spfh;
+};
+
+// Weighted sum of the neighbours SPFH, each feature block normalized to 100.
+struct FPFHBody
+{
+    FPFHBody(const std::vector< std::vector<int> >& neighbours,
+             const std::vector< std::vector<float> >& sqr_distances,
+             const cv::Mat1f& spfh,
+             cv::Mat1f& descriptors)
+        : neighbours(neighbours), sqr_distances(sqr_distances),
+          spfh(spfh), descriptors(descriptors)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        for (int i = range.begin; i < range.end; ++i)
+        {
+            float* hist = descriptors.ptr<float>(i);
+            std::fill(hist, hist + fpfh_size, 0.f);
+            foreach_idx(k, neighbours[i])
+            {
+                if (sqr_distances[i][k] < FLT_EPSILON)
+                    continue;
+                const float weight = 1.f / sqr_distances[i][k];
+                const float* neighbour_hist = spfh.ptr<float>(neighbours[i][k]);
+                for (int b = 0; b < fpfh_size; ++b)
+                    hist[b] += weight * neighbour_hist[b];
+            }
+
+            for (int f = 0; f < 3; ++f)
+            {
+                float* block = hist + f*fpfh_bins_per_feature;
+                float sum = 0;
+                for (int b = 0; b < fpfh_bins_per_feature; ++b)
+                    sum += block[b];
+                if (sum > 0)
+                    for (int b = 0; b < fpfh_bins_per_feature; ++b)
+                        block[b] *= 100.f / sum;
+            }
+        }
+    }
+
+    const std::vector< std::vector<int> >& neighbours;
+    const std::vector< std::vector<float> >& sqr_distances;
+    const cv::Mat1f& spfh;
+    cv::Mat1f& descriptors;
+};
+
+struct NearestDescriptorBody
+{
+    NearestDescriptorBody(const cv::Mat1f& queries,
+                          const cv::Mat1f& descriptors,
+                          std::vector<int>& nearest,
+                          std::vector<float>& sqr_distances)
+        : queries(queries), descriptors(descriptors),
+          nearest(nearest), sqr_distances(sqr_distances)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        for (int i = range.begin; i < range.end; ++i)
+        {
+            const float* query = queries.ptr<float>(i);
+            int best_index = -1;
+            float best_dist = FLT_MAX;
+            for (int j = 0; j < descriptors.rows; ++j)
+            {
+                const float* descriptor = descriptors.ptr<float>(j);
+                float dist = 0;
+                for (int k = 0; k < descriptors.cols && dist < best_dist; ++k)
+                {
+                    const float diff = query[k] - descriptor[k];
+                    dist += diff*diff;
+                }
+                if (dist < best_dist)
+                {
+                    best_dist = dist;
+                    best_index = j;
+                }
+            }
+            nearest[i] = best_index;
+            sqr_distances[i] = best_dist;
+        }
+    }
+
+    const cv::Mat1f& queries;
+    const cv::Mat1f& descriptors;
+    std::vector<int>& nearest;
+    std::vector<float>& sqr_distances;
+};
+
+inline float sqr_point_distance(const pcl::PointNormal& p1, const pcl::PointNormal& p2)
+{
+    return (p1.getVector3fMap() - p2.getVector3fMap()).squaredNorm();
+}
+
+}
+
+namespace ntk
+{
+
+void computeFPFHDescriptors(const pcl::PointCloud<pcl::PointNormal>& cloud,
+                            double radius,
+                            cv::Mat1f& descriptors)
+{
+    const int n = cloud.points.size();
+    descriptors.create(n, fpfh_size);
+    if (n < 1)
+        return;
+
+    pcl::PointCloud<pcl::PointNormal>::Ptr cloud_ptr (new pcl::PointCloud<pcl::PointNormal>(cloud));
+    pcl::search::KdTree<pcl::PointNormal> tree;
+    tree.setInputCloud(cloud_ptr);
+
+    std::vector< std::vector<int> > neighbours (n);
+    std::vector< std::vector<float> > sqr_distances (n);
+    cv::Mat1f spfh (n, fpfh_size);
+
+    parallel_for(0, n, NeighbourhoodSPFHBody(cloud, tree, radius, neighbours, sqr_distances, spfh), 64);
+    parallel_for(0, n, FPFHBody(neighbours, sqr_distances, spfh, descriptors), 256);
+}
+
+void findMutualNearestNeighbours(const cv::Mat1f& source_descriptors,
+                                 const cv::Mat1f& target_descriptors,
+                                 std::vector<cv::DMatch>& matches)
+{
+    matches.clear();
+    if (source_descriptors.rows < 1 || target_descriptors.rows < 1)
+        return;
+
+    std::vector<int> nearest_target (source_descriptors.rows);
+    std::vector<float> source_sqr_distances (source_descriptors.rows);
+    parallel_for(0, source_descriptors.rows,
+                 NearestDescriptorBody(source_descriptors, target_descriptors,
+                                       nearest_target, source_sqr_distances), 64);
+
+    std::vector<int> nearest_source (target_descriptors.rows);
+    std::vector<float> target_sqr_distances (target_descriptors.rows);
+    parallel_for(0, target_descriptors.rows,
+                 NearestDescriptorBody(target_descriptors, source_descriptors,
+                                       nearest_source, target_sqr_distances), 64);
+
+    foreach_idx(i, nearest_target)
+    {
+        const int j = nearest_target[i];
+        if (j >= 0 && nearest_source[j] == i)
+            matches.push_back(cv::DMatch(i, j, sqrt(source_sqr_distances[i])));
+    }
+}
+
+RelativePoseEstimatorGlobal :: RelativePoseEstimatorGlobal()
+    : m_voxel_leaf_size(0.01),
+      m_feature_radius(0.05),
+      m_inlier_threshold(0.015),
+      m_max_ransac_iterations(100000),
+      m_refine_with_icp(true),
+      m_num_correspondences(0),
+      m_num_inliers(0),
+      m_cached_voxel_leaf_size(-1),
+      m_cached_feature_radius(-1)
+{
+    m_icp_estimator.setVoxelSize(0.005);
+    m_icp_estimator.setDistanceThreshold(0.03);
+    m_icp_estimator.setMaxIterations(30);
+}
+
+void RelativePoseEstimatorGlobal :: downsample(const PointCloudType& input, PointCloudType& output) const
+{
+    PointCloudPtr input_ptr (new PointCloudType(input));
+    PointCloudType filtered;
+    pcl::VoxelGrid<pcl::PointNormal> grid;
+    grid.setLeafSize (m_voxel_leaf_size, m_voxel_leaf_size, m_voxel_leaf_size);
+    grid.setInputCloud(input_ptr);
+    grid.filter(filtered);
+
+    // Averaged normals are not unit anymore, and may cancel out.
+    output.points.clear();
+    output.points.reserve(filtered.points.size());
+    foreach_idx(i, filtered.points)
+    {
+        pcl::PointNormal p = filtered.points[i];
+        const float norm = p.getNormalVector3fMap().norm();
+        if (!(norm > 0.5f))
+            continue;
+        p.getNormalVector3fMap() /= norm;
+        output.points.push_back(p);
+    }
+    output.width = output.points.size();
+    output.height = 1;
+}
+
+bool RelativePoseEstimatorGlobal :: preprocessTargetCloud()
+{
+    cv::Mat1f target_transform = m_target_pose.isValid() ? m_target_pose.cvCameraTransform() : cv::Mat1f();
+    const bool same_pose = target_transform.size() == m_cached_target_transform.size()
+            && (target_transform.empty() || cv::countNonZero(target_transform != m_cached_target_transform) == 0);
+
+    if (m_filtered_target
+        && m_cached_target_input == m_target_cloud
+        && m_cached_voxel_leaf_size == m_voxel_leaf_size
+        && m_cached_feature_radius == m_feature_radius
+        && same_pose)
+        return true;
+
+    m_filtered_target.reset();
+
+    m_world_target.reset(new PointCloudType(*m_target_cloud));
+    if (m_target_pose.isValid())
+    {
+        Eigen::Affine3f H = toPclInvCameraTransform(m_target_pose);
+        pcl::transformPointCloudWithNormals(*m_world_target, *m_world_target, H);
+    }
+
+    PointCloudPtr filtered_target (new PointCloudType);
+    downsample(*m_world_target, *filtered_target);
+    ntk_dbg_print(filtered_target->points.size(), 1);
+    if (filtered_target->points.size() < 3)
+        return false;
+
+    computeFPFHDescriptors(*filtered_target, m_feature_radius, m_target_descriptors);
+
+    m_filtered_target = filtered_target;
+    m_cached_target_input = m_target_cloud;
+    m_cached_voxel_leaf_size = m_voxel_leaf_size;
+    m_cached_feature_radius = m_feature_radius;
+    target_transform.copyTo(m_cached_target_transform);
+    return true;
+}
+
+bool RelativePoseEstimatorGlobal ::
+estimateTransformRANSAC(const PointCloudType& source,
+                        const PointCloudType& target,
+                        const std::vector<cv::DMatch>& matches,
+                        Eigen::Matrix4f& transform)
+{
+    const float sqr_inlier_threshold = m_inlier_threshold * m_inlier_threshold;
+    // Samples with an edge length changed by more than 10% are rejected.
+    const float min_edge_ratio = 0.9f;
+    const double confidence = 0.999;
+    const int num_matches = matches.size();
+
+    pcl::registration::TransformationEstimationSVD<pcl::PointNormal, pcl::PointNormal> svd;
+    cv::RNG rng (42);
+
+    std::vector<int> sample_source (3), sample_target (3);
+    std::vector<int> best_inliers;
+    int num_iterations = m_max_ransac_iterations;
+    int num_evaluated = 0;
+    for (int iteration = 0; iteration < num_iterations; ++iteration)
+    {
+        int s[3] = { rng.uniform(0, num_matches), rng.uniform(0, num_matches), rng.uniform(0, num_matches) };
+        if (s[0] == s[1] || s[0] == s[2] || s[1] == s[2])
+            continue;
+
+        // Early pruning: a rigid transform preserves the sample edge lengths.
+        bool consistent = true;
+        for (int k = 0; k < 3 && consistent; ++k)
+        {
+            const cv::DMatch& m1 = matches[s[k]];
+            const cv::DMatch& m2 = matches[s[(k+1)%3]];
+            const float source_length = sqrt(sqr_point_distance(source.points[m1.queryIdx], source.points[m2.queryIdx]));
+            const float target_length = sqrt(sqr_point_distance(target.points[m1.trainIdx], target.points[m2.trainIdx]));
+            consistent = source_length > m_voxel_leaf_size
+                    && std::min(source_length, target_length) > min_edge_ratio * std::max(source_length, target_length);
+        }
+        if (!consistent)
+            continue;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            sample_source[k] = matches[s[k]].queryIdx;
+            sample_target[k] = matches[s[k]].trainIdx;
+        }
+        Eigen::Matrix4f H;
+        svd.estimateRigidTransformation(source, sample_source, target, sample_target, H);
+        ++num_evaluated;
+
+        std::vector<int> inliers;
+        const Eigen::Affine3f affine_H (H);
+        foreach_idx(i, matches)
+        {
+            pcl::PointNormal p = source.points[matches[i].queryIdx];
+            p.getVector3fMap() = affine_H * p.getVector3fMap();
+            if (sqr_point_distance(p, target.points[matches[i].trainIdx]) < sqr_inlier_threshold)
+                inliers.push_back(i);
+        }
+
+        if (inliers.size() <= best_inliers.size())
+            continue;
+
+        best_inliers.swap(inliers);
+        transform = H;
+
+        // Adaptive number of samples for the given confidence.
+        const double inlier_ratio = double(best_inliers.size()) / num_matches;
+        const double p_outlier_sample = 1.0 - inlier_ratio * inlier_ratio * inlier_ratio;
+        if (p_outlier_sample < DBL_EPSILON)
+            break;
+        const double needed_iterations = log(1.0 - confidence) / log(p_outlier_sample);
+        num_iterations = std::min(double(m_max_ransac_iterations), iteration + 1 + needed_iterations);
+    }
+
+    ntk_dbg_print(num_evaluated, 1);
+    ntk_dbg_print(best_inliers.size(), 1);
+
+    m_num_inliers = best_inliers.size();
+    if (best_inliers.size() < 3)
+        return false;
+
+    // Final fit on all the inliers.
+    std::vector<int> inlier_source (best_inliers.size()), inlier_target (best_inliers.size());
+    foreach_idx(i, best_inliers)
+    {
+        inlier_source[i] = matches[best_inliers[i]].queryIdx;
+        inlier_target[i] = matches[best_inliers[i]].trainIdx;
+    }
+    svd.estimateRigidTransformation(source, inlier_source, target, inlier_target, transform);
+    return true;
+}
+
+bool RelativePoseEstimatorGlobal :: estimateNewPose()
+{
+    m_num_correspondences = 0;
+    m_num_inliers = 0;
+
+    if (!m_source_cloud || !m_target_cloud
+        || m_source_cloud->points.size() < 3
+        || m_target_cloud->points.size() < 3)
+    {
+        ntk_dbg(1) << "Not enough points to register.";
+        return false;
+    }
+
+    ntk::TimeCount tc("RelativePoseEstimatorGlobal", 1);
+
+    if (!preprocessTargetCloud())
+        return false;
+    tc.elapsedMsecs(" -- target descriptors -- ");
+
+    PointCloudPtr world_source (new PointCloudType(*m_source_cloud));
+    if (m_initial_pose.isValid())
+    {
+        Eigen::Affine3f H = toPclInvCameraTransform(m_initial_pose);
+        pcl::transformPointCloudWithNormals(*world_source, *world_source, H);
+    }
+
+    PointCloudType filtered_source;
+    downsample(*world_source, filtered_source);
+    ntk_dbg_print(filtered_source.points.size(), 1);
+    if (filtered_source.points.size() < 3)
+        return false;
+
+    cv::Mat1f source_descriptors;
+    computeFPFHDescriptors(filtered_source, m_feature_radius, source_descriptors);
+    tc.elapsedMsecs(" -- source descriptors -- ");
+
+    std::vector<cv::DMatch> matches;
+    findMutualNearestNeighbours(source_descriptors, m_target_descriptors, matches);
+    m_num_correspondences = matches.size();
+    ntk_dbg_print(m_num_correspondences, 1);
+    tc.elapsedMsecs(" -- mutual matches -- ");
+    if (matches.size() < 3)
+        return false;
+
+    Eigen::Matrix4f T;
+    if (!estimateTransformRANSAC(filtered_source, *m_filtered_target, matches, T))
+        return false;
+    tc.elapsedMsecs(" -- RANSAC -- ");
+
+    if (m_refine_with_icp)
+    {
+        PointCloudPtr moved_source (new PointCloudType);
+        Eigen::Affine3f H (T);
+        pcl::transformPointCloudWithNormals(*world_source, *moved_source, H);
+
+        // Both clouds are already in world coordinates.
+        m_icp_estimator.setTargetPose(Pose3D());
+        m_icp_estimator.setInitialSourcePoseEstimate(Pose3D());
+        m_icp_estimator.setTargetCloud(m_world_target);
+        m_icp_estimator.setSourceCloud(moved_source);
+        if (m_icp_estimator.estimateNewPose())
+            T = toPclCameraTransform(m_icp_estimator.estimatedSourcePose().inverted()).matrix() * T;
+        else
+            ntk_dbg(1) << "ICP refinement failed, keeping the RANSAC estimate.";
+        tc.elapsedMsecs(" -- ICP refinement -- ");
+    }
+
+    cv::Mat1f cv_T (4,4);
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
+            cv_T(r,c) = T(r,c);
+    Pose3D relative_pose;
+    relative_pose.setCameraTransform(cv_T);
+
+    // Same convention as RelativePoseEstimatorICP.
+    m_estimated_pose = m_initial_pose;
+    m_estimated_pose.applyTransformBefore(relative_pose.inverted());
+    return true;
+}
+
+} // ntk
@@ -0,0 +1,119 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_GEOMETRY_RELATIVE_POSE_ESTIMATOR_GLOBAL_H
+#define NTK_GEOMETRY_RELATIVE_POSE_ESTIMATOR_GLOBAL_H
+
+#include "relative_pose_estimator_icp.h"
+
+namespace ntk
+{
+
+/*!
+ * Compute the 33 bins FPFH descriptor of each point, using the neighbours
+ * within radius. Points are processed in parallel and must have normals.
+ */
+void computeFPFHDescriptors(const pcl::PointCloud<pcl::PointNormal>& cloud,
+                            double radius,
+                            cv::Mat1f& descriptors);
+
+/*!
+ * Find the descriptor pairs which are each other's nearest neighbour.
+ * queryIdx is the source row, trainIdx the target row and distance
+ * the L2 distance between descriptors.
+ */
+void findMutualNearestNeighbours(const cv::Mat1f& source_descriptors,
+                                 const cv::Mat1f& target_descriptors,
+                                 std::vector<cv::DMatch>& matches);
+
+/*!
+ * Estimate the relative 3D pose between two point clouds with normals,
+ * without any initial guess.
+ *
+ * Both clouds are downsampled with a voxel grid, FPFH descriptors are
+ * matched with mutual nearest neighbours and a RANSAC loop gives a first
+ * estimate. Samples whose edge lengths are not preserved are pruned before
+ * fitting any transform. The estimate is then refined with ICP.
+ *
+ * The target descriptors are kept while the target cloud, its pose and
+ * the parameters do not change.
+ */
+class RelativePoseEstimatorGlobal : public RelativePoseEstimatorFromPointClouds<pcl::PointNormal>
+{
+public:
+    RelativePoseEstimatorGlobal();
+
+public:
+    /*! Size of the leafs of the voxel grid. */
+    void setVoxelSize(double s) { m_voxel_leaf_size = s; }
+
+    /*! Neighbourhood radius of the descriptors, a few voxels. */
+    void setFeatureRadius(double r) { m_feature_radius = r; }
+
+    /*! Maximal distance between aligned correspondences to count as inliers. */
+    void setInlierThreshold(double th) { m_inlier_threshold = th; }
+
+    /*! Set the maximal number of RANSAC samples. */
+    void setMaxRANSACIterations(int n) { m_max_ransac_iterations = n; }
+
+    /*! Whether the RANSAC estimate should be refined with ICP. */
+    void setRefineWithICP(bool doit) { m_refine_with_icp = doit; }
+
+    /*! ICP estimator used for the refinement, to tune its parameters. */
+    RelativePoseEstimatorICP<pcl::PointNormal>& icpEstimator() { return m_icp_estimator; }
+
+    int numCorrespondences() const { return m_num_correspondences; }
+    int numInliers() const { return m_num_inliers; }
+
+public:
+    virtual bool estimateNewPose();
+
+protected:
+    bool preprocessTargetCloud();
+
+    void downsample(const PointCloudType& input, PointCloudType& output) const;
+
+    bool estimateTransformRANSAC(const PointCloudType& source,
+                                 const PointCloudType& target,
+                                 const std::vector<cv::DMatch>& matches,
+                                 Eigen::Matrix4f& transform);
+
+protected:
+    double m_voxel_leaf_size;
+    double m_feature_radius;
+    double m_inlier_threshold;
+    int m_max_ransac_iterations;
+    bool m_refine_with_icp;
+    int m_num_correspondences;
+    int m_num_inliers;
+    RelativePoseEstimatorICP<pcl::PointNormal> m_icp_estimator;
+
+    // Target in world coordinates with its descriptors.
+    PointCloudPtr m_world_target;
+    PointCloudPtr m_filtered_target;
+    cv::Mat1f m_target_descriptors;
+    PointCloudConstPtr m_cached_target_input;
+    cv::Mat1f m_cached_target_transform;
+    double m_cached_voxel_leaf_size;
+    double m_cached_feature_radius;
+};
+
+} // ntk
+
+#endif // NTK_GEOMETRY_RELATIVE_POSE_ESTIMATOR_GLOBAL_H
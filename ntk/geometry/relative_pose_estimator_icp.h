@@ -25,6 +25,10 @@
 #endif
 #include "relative_pose_estimator.h"
 
+#ifdef HAVE_PCL_GREATER_THAN_1_6_0
+#include <pcl/search/kdtree.h>
+#endif
+
 namespace ntk
 {
 
@@ -36,6 +40,11 @@ namespace ntk
  *
  * This is based on the PCL library implementation of ICP.
  * The algorithm first downsample the image using a voxel grid filter.
+ *
+ * With several pyramid levels, a few iterations are first run on coarser
+ * voxel grids, doubling the voxel size at each level. Filtered target
+ * levels and their search trees are kept across calls while the target
+ * does not change, so aligning many sources against one target is cheap.
  */
 template <class PointT>
 class RelativePoseEstimatorICP : public RelativePoseEstimatorFromPointClouds<PointT>
@@ -51,13 +60,22 @@ protected:
     typedef pcl::PointCloud<PointT> PointCloudType;
     typedef typename PointCloudType::ConstPtr PointCloudConstPtr;
     typedef typename PointCloudType::Ptr PointCloudPtr;
+#ifdef HAVE_PCL_GREATER_THAN_1_6_0
+    typedef typename pcl::search::KdTree<PointT>::Ptr KdTreePtr;
+#endif
 
 public:
     RelativePoseEstimatorICP()
         : m_distance_threshold(0.05),
           m_voxel_leaf_size(0.005),
           m_ransac_outlier_threshold(0.01),
-          m_max_iterations(100)
+          m_max_iterations(100),
+          m_num_pyramid_levels(1),
+          m_coarse_level_iterations(10),
+          m_level_max_iterations(100),
+          m_level_distance_threshold(0.05),
+          m_level_transformation_epsilon(1e-10),
+          m_cached_voxel_leaf_size(-1)
     {}
 
 public:
@@ -73,6 +91,15 @@ public:
     /*! Set the outlier rehjection threshold for RANSAC. */
     void setRANSACOutlierRejectionThreshold(double th) { m_ransac_outlier_threshold = th; }
 
+    /*!
+     * Number of resolution levels. Level k uses a voxel size and a distance
+     * threshold 2^k times larger and at most coarse_iterations iterations,
+     * stopping earlier once converged. The finest level uses the max
+     * iterations. A single level is the plain ICP.
+     */
+    void setPyramidLevels(int num_levels, int coarse_iterations = 10)
+    { m_num_pyramid_levels = std::max(num_levels, 1); m_coarse_level_iterations = coarse_iterations; }
+
 public:
     virtual bool estimateNewPose();
     virtual void transformPointCloud(PointCloudType& input,
@@ -81,19 +108,52 @@ public:
 
 protected:
     virtual bool preprocessClouds();
+    bool preprocessTargetCloud();
 
     virtual bool computeRegistration(Pose3D& relative_pose,
                                      PointCloudConstPtr source_cloud,
                                      PointCloudConstPtr target_cloud,
                                      PointCloudType& aligned_cloud);
 
+    bool computePyramidRegistration(Pose3D& relative_pose);
+
+    /*! Filtered target at the given pyramid level, built on demand.
+     *  Its search tree becomes the one of the current level. */
+    PointCloudConstPtr useTargetLevel(int level);
+
+    /*! Let reg use the cached search tree of the current level target, if any. */
+    template <class RegistrationT>
+    void setTargetSearchMethod(RegistrationT& reg, PointCloudConstPtr target_cloud);
+
 protected:
     double m_distance_threshold;
     double m_voxel_leaf_size;
     double m_ransac_outlier_threshold;
     int m_max_iterations;
+    int m_num_pyramid_levels;
+    int m_coarse_level_iterations;
     PointCloudPtr m_filtered_target;
     PointCloudPtr m_filtered_source;
+
+    // Parameters of the level being registered by computeRegistration.
+    int m_level_max_iterations;
+    double m_level_distance_threshold;
+    double m_level_transformation_epsilon;
+#ifdef HAVE_PCL_GREATER_THAN_1_6_0
+    KdTreePtr m_level_target_tree;
+    PointCloudConstPtr m_level_target_tree_cloud;
+#endif
+
+    // Filtered target, reused while the target cloud, its pose and the voxel size are unchanged.
+    // Coarser levels and search trees are built when first needed.
+    PointCloudPtr m_cached_filtered_target;
+    PointCloudConstPtr m_cached_target_input;
+    cv::Mat1f m_cached_target_transform;
+    double m_cached_voxel_leaf_size;
+    std::vector<PointCloudPtr> m_cached_target_levels;
+#ifdef HAVE_PCL_GREATER_THAN_1_6_0
+    std::vector<KdTreePtr> m_cached_target_trees;
+#endif
 };
 
 template <class PointT>
@@ -105,8 +165,9 @@ protected:
     typedef typename PointCloudType::ConstPtr PointCloudConstPtr;
     typedef typename PointCloudType::Ptr PointCloudPtr;
 
-    using super::m_max_iterations;
-    using super::m_distance_threshold;
+    using super::m_level_max_iterations;
+    using super::m_level_distance_threshold;
+    using super::m_level_transformation_epsilon;
     using super::m_ransac_outlier_threshold;
 
 protected:
@@ -48,6 +48,106 @@
 namespace ntk
 {
 
+template <class PointT>
+bool RelativePoseEstimatorICP<PointT> :: preprocessTargetCloud()
+{
+    cv::Mat1f target_transform = m_target_pose.isValid() ? m_target_pose.cvCameraTransform() : cv::Mat1f();
+    const bool same_pose = target_transform.size() == m_cached_target_transform.size()
+            && (target_transform.empty() || cv::countNonZero(target_transform != m_cached_target_transform) == 0);
+
+    if (m_cached_filtered_target
+        && m_cached_target_input == m_target_cloud
+        && m_cached_voxel_leaf_size == m_voxel_leaf_size
+        && same_pose)
+    {
+        m_filtered_target = m_cached_filtered_target;
+        return true;
+    }
+
+    m_cached_filtered_target.reset();
+    m_cached_target_levels.clear();
+#ifdef HAVE_PCL_GREATER_THAN_1_6_0
+    m_cached_target_trees.clear();
+    m_level_target_tree.reset();
+    m_level_target_tree_cloud.reset();
+#endif
+
+    PointCloudPtr temp_target (new pcl::PointCloud<PointT>());
+    pcl::PassThrough<PointT> filter;
+    filter.setInputCloud (m_target_cloud);
+    filter.filter (*temp_target);
+
+    PointCloudPtr filtered_target (new pcl::PointCloud<PointT>());
+    pcl::VoxelGrid<PointT> grid;
+    grid.setLeafSize (m_voxel_leaf_size, m_voxel_leaf_size, m_voxel_leaf_size);
+    grid.setInputCloud(temp_target);
+    grid.filter(*filtered_target);
+    ntk_dbg_print(filtered_target->points.size(), 1);
+
+    if (filtered_target->points.size() < 1)
+        return false;
+
+    if (m_target_pose.isValid())
+    {
+        Eigen::Affine3f H = toPclInvCameraTransform(m_target_pose);
+        this->transformPointCloud(*filtered_target, *filtered_target, H);
+    }
+
+    m_cached_filtered_target = filtered_target;
+    m_cached_target_input = m_target_cloud;
+    m_cached_voxel_leaf_size = m_voxel_leaf_size;
+    target_transform.copyTo(m_cached_target_transform);
+    m_cached_target_levels.push_back(m_cached_filtered_target);
+    m_filtered_target = m_cached_filtered_target;
+    return true;
+}
+
+template <class PointT>
+typename RelativePoseEstimatorICP<PointT>::PointCloudConstPtr
+RelativePoseEstimatorICP<PointT> :: useTargetLevel(int level)
+{
+    ntk_assert(!m_cached_target_levels.empty(), "preprocessTargetCloud must be called before.");
+
+    // Each level is filtered from the previous one, already in world coordinates.
+    while (int(m_cached_target_levels.size()) <= level)
+    {
+        const double leaf_size = m_voxel_leaf_size * (1 << m_cached_target_levels.size());
+        PointCloudPtr coarser_target (new pcl::PointCloud<PointT>());
+        pcl::VoxelGrid<PointT> grid;
+        grid.setLeafSize (leaf_size, leaf_size, leaf_size);
+        grid.setInputCloud(m_cached_target_levels.back());
+        grid.filter(*coarser_target);
+        m_cached_target_levels.push_back(coarser_target);
+    }
+
+    PointCloudPtr target = m_cached_target_levels[level];
+
+#ifdef HAVE_PCL_GREATER_THAN_1_6_0
+    m_cached_target_trees.resize(m_cached_target_levels.size());
+    if (!m_cached_target_trees[level] && target->points.size() > 0)
+    {
+        m_cached_target_trees[level].reset(new pcl::search::KdTree<PointT>);
+        m_cached_target_trees[level]->setInputCloud(target);
+    }
+    m_level_target_tree = m_cached_target_trees[level];
+    m_level_target_tree_cloud = target;
+#endif
+
+    return target;
+}
+
+template <class PointT>
+template <class RegistrationT>
+void RelativePoseEstimatorICP<PointT> :: setTargetSearchMethod(RegistrationT& reg,
+                                                                PointCloudConstPtr target_cloud)
+{
+#ifdef HAVE_PCL_GREATER_THAN_1_6_0
+    // Only valid if target_cloud is the cached level, and not a swapped source.
+    if (m_level_target_tree && m_level_target_tree_cloud == target_cloud)
+        reg.setSearchMethodTarget (m_level_target_tree, true /* force_no_recompute */);
+#endif
+}
+
 template <class PointT>
 bool RelativePoseEstimatorICP<PointT> :: preprocessClouds()
 {
@@ -57,39 +157,29 @@ bool RelativePoseEstimatorICP<PointT> :: preprocessClouds()
         return false;
     }
 
-    PointCloudConstPtr target = m_target_cloud;
     PointCloudConstPtr source = m_source_cloud;
 
-    ntk_dbg_print(target->points.size(), 1);
+    ntk_dbg_print(m_target_cloud->points.size(), 1);
     ntk_dbg_print(source->points.size(), 1);
 
     m_filtered_source.reset(new pcl::PointCloud<PointT>());
-    m_filtered_target.reset(new pcl::PointCloud<PointT>());
 
     PointCloudPtr temp_source (new pcl::PointCloud<PointT>());
-    PointCloudPtr temp_target (new pcl::PointCloud<PointT>());
 
     pcl::PassThrough<PointT> filter;
     filter.setInputCloud (source);
     filter.filter (*temp_source);
 
-    filter.setInputCloud (target);
-    filter.filter (*temp_target);
-
     pcl::VoxelGrid<PointT> grid;
     grid.setLeafSize (m_voxel_leaf_size, m_voxel_leaf_size, m_voxel_leaf_size);
 
     grid.setInputCloud(temp_source);
     grid.filter(*m_filtered_source);
 
-    grid.setInputCloud(temp_target);
-    grid.filter(*m_filtered_target);
-
     ntk_dbg_print(temp_source->points.size(), 1);
     ntk_dbg_print(m_filtered_source->points.size(), 1);
-    ntk_dbg_print(m_filtered_target->points.size(), 1);
 
-    if (m_filtered_source->points.size() < 1 || m_filtered_target->points.size() < 1)
+    if (m_filtered_source->points.size() < 1 || !preprocessTargetCloud())
     {
         ntk_dbg(1) << "Warning: no remaining points after filtering.";
         return false;
@@ -101,12 +191,6 @@ bool RelativePoseEstimatorICP<PointT> :: preprocessClouds()
         this->transformPointCloud(*m_filtered_source, *m_filtered_source, H);
     }
 
-    if (m_target_pose.isValid())
-    {
-        Eigen::Affine3f H = toPclInvCameraTransform(m_target_pose);
-        this->transformPointCloud(*m_filtered_target, *m_filtered_target, H);
-    }
-
     return true;
 }
 
@@ -126,17 +210,31 @@ bool RelativePoseEstimatorICP<PointT> :: estimateNewPose()
         mesh2.saveToPlyFile("debug_mesh_target.ply");
     }
 
-    // The source cloud should be smaller than the target one.
+    Pose3D relative_pose;
     bool swap_source_and_target = false;
-    if (m_filtered_source->points.size() > 2.0 * m_filtered_target->points.size())
+
+    if (m_num_pyramid_levels > 1)
     {
-        swap_source_and_target = true;
-        std::swap(m_filtered_source, m_filtered_target);
+        // No swapping here, target levels and their trees are reused across calls.
+        ok = computePyramidRegistration(relative_pose);
+    }
+    else
+    {
+        // The source cloud should be smaller than the target one.
+        if (m_filtered_source->points.size() > 2.0 * m_filtered_target->points.size())
+        {
+            swap_source_and_target = true;
+            std::swap(m_filtered_source, m_filtered_target);
+        }
+
+        m_level_max_iterations = m_max_iterations;
+        m_level_distance_threshold = m_distance_threshold;
+        m_level_transformation_epsilon = 1e-10;
+        useTargetLevel(0);
+
+        PointCloudType cloud_reg;
+        ok = computeRegistration(relative_pose, m_filtered_source, m_filtered_target, cloud_reg);
     }
-
-    Pose3D relative_pose;
-    PointCloudType cloud_reg;
-    ok = computeRegistration(relative_pose, m_filtered_source, m_filtered_target, cloud_reg);
 
     if (!ok)
         return false;
@@ -159,6 +257,66 @@ bool RelativePoseEstimatorICP<PointT> :: estimateNewPose()
     return true;
 }
 
+template <class PointT>
+bool RelativePoseEstimatorICP<PointT> :: computePyramidRegistration(Pose3D& relative_pose)
+{
+    // Accumulated transform of the source, from the coarsest level to the finest.
+    Eigen::Affine3f H = Eigen::Affine3f::Identity();
+
+    for (int level = m_num_pyramid_levels - 1; level >= 0; --level)
+    {
+        const double scale = 1 << level;
+        const double leaf_size = m_voxel_leaf_size * scale;
+
+        PointCloudConstPtr target = useTargetLevel(level);
+
+        PointCloudPtr source = m_filtered_source;
+        if (level > 0)
+        {
+            source.reset(new pcl::PointCloud<PointT>());
+            pcl::VoxelGrid<PointT> grid;
+            grid.setLeafSize (leaf_size, leaf_size, leaf_size);
+            grid.setInputCloud(m_filtered_source);
+            grid.filter(*source);
+        }
+
+        PointCloudPtr moved_source (new pcl::PointCloud<PointT>());
+        this->transformPointCloud(*source, *moved_source, H);
+
+        ntk_dbg_print(level, 1);
+        ntk_dbg_print(moved_source->points.size(), 1);
+        ntk_dbg_print(target->points.size(), 1);
+
+        m_level_max_iterations = level > 0 ? m_coarse_level_iterations : m_max_iterations;
+        m_level_distance_threshold = m_distance_threshold * scale;
+        // Stop a level once the updates get much smaller than its voxels.
+        m_level_transformation_epsilon = std::max(1e-10, 1e-4 * leaf_size * leaf_size);
+
+        Pose3D level_pose;
+        PointCloudType cloud_reg;
+        bool ok = moved_source->points.size() >= 3
+                && target->points.size() >= 3
+                && computeRegistration(level_pose, moved_source, target, cloud_reg);
+
+        if (!ok)
+        {
+            // Coarse levels can fail with too few points, finer ones may still converge.
+            if (level == 0)
+                return false;
+            continue;
+        }
+
+        H = toPclCameraTransform(level_pose) * H;
+    }
+
+    cv::Mat1f T(4,4);
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
+            T(r,c) = H(r,c);
+    relative_pose.setCameraTransform(T);
+    return true;
+}
+
 template <class PointT>
 void RelativePoseEstimatorICP<PointT> ::
 transformPointCloud(PointCloudType& input,
@@ -176,12 +334,13 @@ computeRegistration(Pose3D& relative_pose,
                     PointCloudType& aligned_cloud)
 {
     pcl::IterativeClosestPoint<PointT, PointT> reg;
-    reg.setMaximumIterations (m_max_iterations);
-    reg.setTransformationEpsilon (1e-10);
+    reg.setMaximumIterations (m_level_max_iterations);
+    reg.setTransformationEpsilon (m_level_transformation_epsilon);
     reg.setRANSACOutlierRejectionThreshold(m_ransac_outlier_threshold);
-    reg.setMaxCorrespondenceDistance (m_distance_threshold);
+    reg.setMaxCorrespondenceDistance (m_level_distance_threshold);
     reg.setInputCloud (source_cloud);
     reg.setInputTarget (target_cloud);
+    setTargetSearchMethod(reg, target_cloud);
     reg.align (aligned_cloud);
 
     if (0)
@@ -241,7 +400,7 @@ computeRegistration(Pose3D& relative_pose,
     boost::shared_ptr<pcl::registration::CorrespondenceRejectorDistance> rejector_distance (new pcl::registration::CorrespondenceRejectorDistance);
     rejector_distance->setInputSource<PointT>(source_cloud);
     rejector_distance->setInputTarget<PointT>(target_cloud);
-    rejector_distance->setMaximumDistance(m_distance_threshold);
+    rejector_distance->setMaximumDistance(m_level_distance_threshold);
     reg.addCorrespondenceRejector(rejector_distance);
 
     boost::shared_ptr<pcl::registration::CorrespondenceRejectorSurfaceNormal> rejector_normal (new pcl::registration::CorrespondenceRejectorSurfaceNormal);
@@ -287,9 +446,9 @@ computeRegistration(Pose3D& relative_pose,
     source_mesh.saveToPlyFile("debug_source.ply");
 #endif
 
-    reg.setMaximumIterations (m_max_iterations);
-    reg.setTransformationEpsilon (1e-10);
-    reg.setMaxCorrespondenceDistance (m_distance_threshold);
+    reg.setMaximumIterations (m_level_max_iterations);
+    reg.setTransformationEpsilon (m_level_transformation_epsilon);
+    reg.setMaxCorrespondenceDistance (m_level_distance_threshold);
     reg.setRANSACOutlierRejectionThreshold(m_ransac_outlier_threshold);
 #ifdef HAVE_PCL_GREATER_THAN_1_6_0
     reg.setInputSource (source_cloud);
@@ -297,6 +456,7 @@ computeRegistration(Pose3D& relative_pose,
     reg.setInputCloud (source_cloud);
 #endif
     reg.setInputTarget (target_cloud);
+    this->setTargetSearchMethod(reg, target_cloud);
     reg.align (aligned_cloud);
 
     if (!reg.hasConverged())
@@ -22,21 +22,330 @@
 
 #include <ntk/aruco/aruco.h>
 
+#include <opencv2/video/tracking.hpp>
+
+namespace
+{
+
+// Sum of squared reprojection errors of model_points with the pinhole camera (R, t),
+// expressed in the opencv camera frame. If JtJ and Jtr are given, also accumulate
+// the Gauss-Newton normal equations of a left perturbation (rotation, translation).
+double reprojection_error(const cv::Mat1d& R, const cv::Mat1d& t,
+                          double fx, double fy, double cx, double cy,
+                          const std::vector<cv::Point3f>& model_points,
+                          const std::vector<cv::Point2f>& image_points,
+                          cv::Mat1d* JtJ, cv::Mat1d* Jtr)
+{
+    double error = 0;
+    foreach_idx(i, model_points)
+    {
+        const cv::Point3f& m = model_points[i];
+        const double px = R(0,0)*m.x + R(0,1)*m.y + R(0,2)*m.z + t(0);
+        const double py = R(1,0)*m.x + R(1,1)*m.y + R(1,2)*m.z + t(1);
+        const double pz = R(2,0)*m.x + R(2,1)*m.y + R(2,2)*m.z + t(2);
+        if (pz < 1e-6)
+            continue;
+
+        const double iz = 1.0/pz;
+        const double x = px*iz;
+        const double y = py*iz;
+        const double ru = fx*x + cx - image_points[i].x;
+        const double rv = fy*y + cy - image_points[i].y;
+        error += ru*ru + rv*rv;
+        if (!JtJ)
+            continue;
+
+        const double ju[6] = { -fx*x*y, fx*(1+x*x), -fx*y, fx*iz, 0, -fx*x*iz };
+        const double jv[6] = { -fy*(1+y*y), fy*x*y, fy*x, 0, fy*iz, -fy*y*iz };
+        for (int a = 0; a < 6; ++a)
+        {
+            for (int b = 0; b <= a; ++b)
+                (*JtJ)(a,b) += ju[a]*ju[b] + jv[a]*jv[b];
+            (*Jtr)(a) += ju[a]*ru + jv[a]*rv;
+        }
+    }
+    return error;
+}
+
+// Gauss-Newton refinement of a camera pose from 3D-2D point matches, with analytic derivatives.
+// Return the final RMS reprojection error in pixels.
+double refine_pose_from_points(ntk::Pose3D& pose,
+                               const std::vector<cv::Point3f>& model_points,
+                               const std::vector<cv::Point2f>& image_points,
+                               int max_iterations = 10)
+{
+    const double fx = pose.focalX(), fy = pose.focalY();
+    const double cx = pose.imageCenterX(), cy = pose.imageCenterY();
+
+    cv::Mat1d R, t;
+    pose.cvOpencvCameraTransform(R, t);
+
+    double error = reprojection_error(R, t, fx, fy, cx, cy, model_points, image_points, 0, 0);
+    for (int iteration = 0; iteration < max_iterations; ++iteration)
+    {
+        cv::Mat1d JtJ (6,6, 0.), Jtr (6,1, 0.);
+        reprojection_error(R, t, fx, fy, cx, cy, model_points, image_points, &JtJ, &Jtr);
+        for (int a = 0; a < 6; ++a)
+            for (int b = a+1; b < 6; ++b)
+                JtJ(a,b) = JtJ(b,a);
+
+        cv::Mat1d delta;
+        if (!cv::solve(JtJ, -Jtr, delta, cv::DECOMP_CHOLESKY))
+            break;
+
+        cv::Mat1d delta_R;
+        cv::Rodrigues(delta.rowRange(0,3), delta_R);
+        cv::Mat1d new_R = delta_R * R;
+        cv::Mat1d new_t = delta_R * t + delta.rowRange(3,6);
+        double new_error = reprojection_error(new_R, new_t, fx, fy, cx, cy, model_points, image_points, 0, 0);
+        if (new_error > error)
+            break;
+
+        R = new_R;
+        t = new_t;
+        error = new_error;
+        if (cv::norm(delta) < 1e-8)
+            break;
+    }
+
+    pose.setCameraTransformFromOpencv(R, t);
+    return sqrt(error / std::max(int(model_points.size()), 1));
+}
+
+// Same validity checks as aruco::MarkerDetector candidates.
+bool is_valid_marker_shape(const std::vector<cv::Point2f>& corners)
+{
+    if (!cv::isContourConvex(cv::Mat(corners)))
+        return false;
+    for (int k = 0; k < 4; ++k)
+        if (cv::norm(corners[k] - corners[(k+1)%4]) < 10)
+            return false;
+    return true;
+}
+
+}
+
+void ntk::RelativePoseEstimatorMarkers::
+setUseCornerTracking(bool enable, int detection_interval)
+{
+    m_use_corner_tracking = enable;
+    m_detection_interval = std::max(detection_interval, 1);
+    resetTracking();
+}
+
+void ntk::RelativePoseEstimatorMarkers::
+resetTracking()
+{
+    m_previous_gray = cv::Mat1b();
+    m_frames_since_detection = 0;
+}
+
+void ntk::RelativePoseEstimatorMarkers::
+detectMarkers(const RGBDImage& image, std::vector<aruco::Marker>& markers) const
+{
+    aruco::MarkerDetector detector;
+    cv::Mat3b tmp;
+    image.rgb().copyTo(tmp);
+    detector.detect(tmp, markers, *image.calibration(), m_marker_size);
+}
+
+void ntk::RelativePoseEstimatorMarkers::
+updateTargetMarkers()
+{
+    // Target images usually stay the same for many source images.
+    if (m_target_markers_image == m_target_image
+        && m_target_markers_data == m_target_image->rgb().data
+        && m_target_markers_timestamp == m_target_image->timestamp())
+        return;
+
+    std::vector<aruco::Marker> markers;
+    detectMarkers(*m_target_image, markers);
+    m_target_marker_poses.clear();
+    foreach_idx(i, markers)
+        m_target_marker_poses[markers[i].id] = markers[i].computePose();
+
+    m_target_markers_image = m_target_image;
+    m_target_markers_data = m_target_image->rgb().data;
+    m_target_markers_timestamp = m_target_image->timestamp();
+}
+
+void ntk::RelativePoseEstimatorMarkers::
+collectCornerMatches(const std::vector<aruco::Marker>& markers,
+                     const Pose3D& target_rgb_pose,
+                     std::vector<cv::Point3f>& model_points,
+                     std::vector<cv::Point2f>& image_points) const
+{
+    // Corners in the marker frame, in the order used by aruco::Marker::calculateExtrinsics.
+    const float h = m_marker_size/2.0f;
+    const cv::Point3f marker_corners[4] = {
+        cv::Point3f(-h, -h, 0), cv::Point3f(-h, h, 0), cv::Point3f(h, h, 0), cv::Point3f(h, -h, 0)
+    };
+
+    model_points.clear();
+    image_points.clear();
+    foreach_idx(i, markers)
+    {
+        std::map<int, Pose3D>::const_iterator it = m_target_marker_poses.find(markers[i].id);
+        if (it == m_target_marker_poses.end())
+            continue;
+
+        for (int k = 0; k < 4; ++k)
+        {
+            cv::Point3f p = it->second.cameraTransform(marker_corners[k]);
+            model_points.push_back(target_rgb_pose.invCameraTransform(p));
+            image_points.push_back(markers[i][k]);
+        }
+    }
+}
+
+bool ntk::RelativePoseEstimatorMarkers::
+trackSourceMarkers(const cv::Mat1b& gray, std::vector<aruco::Marker>& markers) const
+{
+    std::vector<cv::Point2f> previous_corners;
+    foreach_idx(i, m_source_markers)
+        previous_corners.insert(previous_corners.end(), m_source_markers[i].begin(), m_source_markers[i].end());
+    if (previous_corners.empty())
+        return false;
+
+    // Forward-backward optical flow, corners coming back too far away are lost.
+    const cv::Size window_size (15, 15);
+    const int max_level = 3;
+    std::vector<cv::Point2f> corners, back_corners;
+    std::vector<uchar> status, back_status;
+    std::vector<float> flow_errors;
+    cv::calcOpticalFlowPyrLK(m_previous_gray, gray, previous_corners, corners,
+                             status, flow_errors, window_size, max_level);
+    cv::calcOpticalFlowPyrLK(gray, m_previous_gray, corners, back_corners,
+                             back_status, flow_errors, window_size, max_level);
+
+    markers.clear();
+    foreach_idx(i, m_source_markers)
+    {
+        std::vector<cv::Point2f> marker_corners (4);
+        bool tracked = true;
+        for (int k = 0; tracked && k < 4; ++k)
+        {
+            const int index = 4*i + k;
+            tracked = status[index] && back_status[index]
+                      && cv::norm(back_corners[index] - previous_corners[index]) < 1.0;
+            marker_corners[k] = corners[index];
+        }
+        if (!tracked)
+            continue;
+
+        // Lock corners back onto the image to avoid drifting.
+        cv::cornerSubPix(gray, marker_corners, cv::Size(3,3), cv::Size(-1,-1),
+                         cv::TermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 15, 0.05));
+        if (!is_valid_marker_shape(marker_corners))
+            continue;
+
+        aruco::Marker marker;
+        marker.id = m_source_markers[i].id;
+        marker.assign(marker_corners.begin(), marker_corners.end());
+        markers.push_back(marker);
+    }
+    return !markers.empty();
+}
+
+bool ntk::RelativePoseEstimatorMarkers::
+estimateNewPoseWithTracking()
+{
+    const RGBDCalibration& calibration = *m_source_image->calibration();
+    updateTargetMarkers();
+
+    Pose3D target_rgb_pose = m_target_pose;
+    target_rgb_pose.toRightCamera(m_target_image->calibration()->rgb_intrinsics,
+                                  m_target_image->calibration()->R,
+                                  m_target_image->calibration()->T);
+
+    cv::Mat1b gray;
+    cv::cvtColor(m_source_image->rgb(), gray, CV_BGR2GRAY);
+
+    std::vector<aruco::Marker> markers;
+    std::vector<cv::Point3f> model_points;
+    std::vector<cv::Point2f> image_points;
+    Pose3D rgb_pose;
+    double error = 0;
+
+    bool tracked = false;
+    if (!m_previous_gray.empty()
+        && m_previous_gray.size() == gray.size()
+        && m_frames_since_detection + 1 < m_detection_interval
+        && trackSourceMarkers(gray, markers))
+    {
+        collectCornerMatches(markers, target_rgb_pose, model_points, image_points);
+        if (model_points.size() >= 4)
+        {
+            rgb_pose = m_previous_rgb_pose;
+            error = refine_pose_from_points(rgb_pose, model_points, image_points);
+            tracked = error < m_max_tracking_error;
+        }
+    }
+
+    if (tracked)
+    {
+        ++m_frames_since_detection;
+        // Tracked markers get their own extrinsics, as detected ones.
+        foreach_idx(i, markers)
+            markers[i].calculateExtrinsics(m_marker_size, cv::Mat(calibration.rgb_intrinsics));
+    }
+    else
+    {
+        detectMarkers(*m_source_image, markers);
+        ++m_num_detections;
+        m_frames_since_detection = 0;
+
+        collectCornerMatches(markers, target_rgb_pose, model_points, image_points);
+        if (model_points.size() < 4)
+        {
+            m_source_markers = markers;
+            resetTracking();
+            return false;
+        }
+
+        // Init from the first marker also seen in the target image.
+        foreach_idx(i, markers)
+        {
+            std::map<int, Pose3D>::const_iterator it = m_target_marker_poses.find(markers[i].id);
+            if (it == m_target_marker_poses.end())
+                continue;
+
+            rgb_pose = target_rgb_pose;
+            rgb_pose.setCameraParametersFromOpencv(calibration.rgb_intrinsics);
+            rgb_pose.applyTransformAfter(it->second.inverted());
+            rgb_pose.applyTransformAfter(markers[i].computePose());
+            break;
+        }
+        error = refine_pose_from_points(rgb_pose, model_points, image_points);
+    }
+    ntk_dbg_print(error, 2);
+
+    m_source_markers = markers;
+    m_previous_gray = gray;
+    m_previous_rgb_pose = rgb_pose;
+
+    m_estimated_pose = rgb_pose;
+    m_estimated_pose.toLeftCamera(calibration.depth_intrinsics, calibration.R, calibration.T);
+    return true;
+}
+
 
 bool ntk::RelativePoseEstimatorMarkers::
 estimateNewPose()
 {
     ntk_assert(m_marker_size > 0, "You must set a marker size before!");
 
-    aruco::MarkerDetector detector;
+    if (m_use_corner_tracking)
+        return estimateNewPoseWithTracking();
 
     std::vector<aruco::Marker> source_markers;
     std::vector<aruco::Marker> target_markers;
 
+    detectMarkers(*m_source_image, source_markers);
+    detectMarkers(*m_target_image, target_markers);
+
+    if (ntk::ntk_debug_level >= 2)
     {
-        cv::Mat3b tmp;
-        m_source_image->rgb().copyTo(tmp);
-        detector.detect(tmp, source_markers, *m_source_image->calibration(), m_marker_size);
         cv::Mat3b debug_im; m_source_image->rgb().copyTo(debug_im);
         for(size_t i=0; i < source_markers.size(); ++i)
         {
@@ -44,13 +353,8 @@ estimateNewPose()
             source_markers[i].draw(debug_im, Scalar(0,0,255), 2);
         }
         imwrite("/tmp/debug_markers_source.png", debug_im);
-    }
 
-    {
-        cv::Mat3b tmp;
-        m_target_image->rgb().copyTo(tmp);
-        detector.detect(tmp, target_markers, *m_target_image->calibration(), m_marker_size);
-        cv::Mat3b debug_im; m_target_image->rgb().copyTo(debug_im);
+        m_target_image->rgb().copyTo(debug_im);
         for(size_t i=0; i < target_markers.size(); ++i)
         {
             std::cout << target_markers[i] << endl;
@@ -133,6 +437,7 @@ estimateNewPose()
         m_estimated_pose.applyTransformBefore(delta_target_pose);
     }
 
+    if (ntk::ntk_debug_level >= 2)
     {
         cv::Mat3b debug_img;
         m_target_image->rgb().copyTo(debug_img);
@@ -23,25 +23,81 @@
 #include <ntk/geometry/relative_pose_estimator.h>
 #include <ntk/aruco/marker.h>
 
+#include <map>
+
 namespace ntk
 {
 
+/*!
+ * Estimate the pose of the source image from the aruco markers also visible in the target image.
+ * With corner tracking enabled, source images are expected to come from a sequence.
+ * The marker corners of the previous source image are then tracked with optical flow,
+ * and the full marker detection only runs periodically or when the tracking is lost.
+ */
 class RelativePoseEstimatorMarkers : public RelativePoseEstimatorFromImages
 {
 public:
-    RelativePoseEstimatorMarkers() : m_marker_size(-1)
+    RelativePoseEstimatorMarkers()
+        : m_marker_size(-1),
+          m_use_corner_tracking(false),
+          m_detection_interval(10),
+          m_max_tracking_error(2.f),
+          m_frames_since_detection(0),
+          m_num_detections(0),
+          m_target_markers_image(0),
+          m_target_markers_data(0),
+          m_target_markers_timestamp(-1)
     {}
 
 public:
     void setMarkerSize(float size) { m_marker_size = size; }
     const std::vector<aruco::Marker>& detectedMarkersInSourceImage() const  { return m_source_markers; }
 
+    /*!
+     * Track the source marker corners from one source image to the next.
+     * A full detection is run every detection_interval images, or when tracking fails.
+     */
+    void setUseCornerTracking(bool enable, int detection_interval = 10);
+
+    /*! Tracking is considered lost above this RMS reprojection error, in pixels. */
+    void setMaxTrackingError(float error) { m_max_tracking_error = error; }
+
+    /*! Forget the tracked corners, the next source image will go through full detection. */
+    void resetTracking();
+
+    /*! Number of full marker detections run on source images. */
+    int numDetections() const { return m_num_detections; }
+
 public:
     virtual bool estimateNewPose();
 
+private:
+    bool estimateNewPoseWithTracking();
+    void detectMarkers(const RGBDImage& image, std::vector<aruco::Marker>& markers) const;
+    void updateTargetMarkers();
+    bool trackSourceMarkers(const cv::Mat1b& gray, std::vector<aruco::Marker>& markers) const;
+    void collectCornerMatches(const std::vector<aruco::Marker>& markers,
+                              const Pose3D& target_rgb_pose,
+                              std::vector<cv::Point3f>& model_points,
+                              std::vector<cv::Point2f>& image_points) const;
+
 private:
     std::vector<aruco::Marker> m_source_markers;
     float m_marker_size;
+
+    bool m_use_corner_tracking;
+    int m_detection_interval;
+    float m_max_tracking_error;
+    int m_frames_since_detection;
+    int m_num_detections;
+    cv::Mat1b m_previous_gray;
+    Pose3D m_previous_rgb_pose;
+
+    // Markers detected in the target image, indexed by id.
+    const RGBDImage* m_target_markers_image;
+    const uchar* m_target_markers_data;
+    int m_target_markers_timestamp;
+    std::map<int, Pose3D> m_target_marker_poses;
 };
 
 }
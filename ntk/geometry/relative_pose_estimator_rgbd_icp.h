@@ -34,8 +34,9 @@ protected:
     typedef typename PointCloudType::ConstPtr PointCloudConstPtr;
     typedef typename PointCloudType::Ptr PointCloudPtr;
 
-    using super::m_max_iterations;
-    using super::m_distance_threshold;
+    using super::m_level_max_iterations;
+    using super::m_level_distance_threshold;
+    using super::m_level_transformation_epsilon;
     using super::m_ransac_outlier_threshold;
 
 public:
@@ -71,7 +71,7 @@ computeRegistration(Pose3D& relative_pose,
     boost::shared_ptr<pcl::registration::CorrespondenceRejectorDistance> rejector_distance (new pcl::registration::CorrespondenceRejectorDistance);
     rejector_distance->setInputSource<PointT>(source_cloud);
     rejector_distance->setInputTarget<PointT>(target_cloud);
-    rejector_distance->setMaximumDistance(m_distance_threshold);
+    rejector_distance->setMaximumDistance(m_level_distance_threshold);
     reg.addCorrespondenceRejector(rejector_distance);
 
     boost::shared_ptr<pcl::registration::CorrespondenceRejectorSurfaceNormal> rejector_normal (new pcl::registration::CorrespondenceRejectorSurfaceNormal);
@@ -106,12 +106,14 @@ computeRegistration(Pose3D& relative_pose,
     rejector_trimmed->setOverlapRatio(0.5f);
     reg.addCorrespondenceRejector(rejector_trimmed);
 
-    reg.setMaximumIterations (m_max_iterations);
-    reg.setTransformationEpsilon (1e-10);
-    reg.setMaxCorrespondenceDistance (m_distance_threshold);
+    reg.setMaximumIterations (m_level_max_iterations);
+    reg.setTransformationEpsilon (m_level_transformation_epsilon);
+    reg.setMaxCorrespondenceDistance (m_level_distance_threshold);
     reg.setRANSACOutlierRejectionThreshold(m_ransac_outlier_threshold);
     reg.setInputSource (source_cloud);
     reg.setInputTarget (target_cloud);
+    this->setTargetSearchMethod(reg, target_cloud);
+
     reg.align (aligned_cloud);
 
     if (!reg.hasConverged())
@@ -20,24 +20,264 @@
 
 #include "screen_grabber.h"
 
+#include <ntk/utils/debug.h>
+
+#include <QThread>
+#include <QBuffer>
+#include <QDataStream>
+
+#include <algorithm>
+
 namespace ntk
 {
 
-ScreenGrabber :: ScreenGrabber(const std::string& dir_name)
-  : m_frame_count(0), m_dir(dir_name.c_str())
+class ScreenGrabber :: Worker : public QThread
+{
+public:
+  Worker(ScreenGrabber* grabber) : m_grabber(grabber)
+  {}
+
+protected:
+  virtual void run() { m_grabber->workerLoop(); }
+
+private:
+  ScreenGrabber* m_grabber;
+};
+
+ScreenGrabber :: ScreenGrabber(const std::string& dir_name,
+                               OutputFormat format,
+                               int num_workers,
+                               int max_pending_frames)
+  : m_dir(dir_name.c_str()),
+    m_format(format),
+    m_max_pending_frames(std::max(max_pending_frames, 1)),
+    m_jpeg_quality(90),
+    m_frame_count(0),
+    m_in_progress(0),
+    m_saved_frames(0),
+    m_dropped_frames(0),
+    m_failed_frames(0),
+    m_should_exit(false),
+    m_next_stream_index(0)
 {
   m_dir.mkpath(".");
+
+  for (int i = 0; i < std::max(num_workers, 1); ++i)
+  {
+    Worker* worker = new Worker(this);
+    m_workers.push_back(worker);
+    worker->start(QThread::LowPriority);
+  }
+}
+
+ScreenGrabber :: ~ScreenGrabber()
+{
+  flush();
+
+  {
+    QMutexLocker locker(&m_lock);
+    m_should_exit = true;
+    m_queue_not_empty.wakeAll();
+  }
+
+  foreach_idx(i, m_workers)
+  {
+    m_workers[i]->wait();
+    delete m_workers[i];
+  }
+
+  if (m_stream.isOpen())
+    m_stream.close();
 }
 
 void ScreenGrabber :: reset()
 {
+  flush();
+
+  QMutexLocker locker(&m_lock);
   m_frame_count = 0;
+  m_saved_frames = 0;
+  m_dropped_frames = 0;
+  m_failed_frames = 0;
+
+  QMutexLocker stream_locker(&m_stream_lock);
+  if (m_stream.isOpen())
+    m_stream.close();
+  m_next_stream_index = 0;
+  m_stream_reorder_buffer.clear();
 }
 
-void ScreenGrabber :: saveFrame(const QPixmap& pixmap)
+bool ScreenGrabber :: saveFrame(const QPixmap& pixmap)
 {
-  pixmap.save(m_dir.absoluteFilePath(QString("frame%1.png").arg(m_frame_count, 4, 10, QChar('0'))));
+  // QPixmap cannot be used outside of the GUI thread, the conversion
+  // is the only per-frame work left on the caller side.
+  return saveFrame(pixmap.toImage());
+}
+
+bool ScreenGrabber :: saveFrame(const QImage& image)
+{
+  QMutexLocker locker(&m_lock);
+  if (int(m_queue.size()) + m_in_progress >= m_max_pending_frames)
+  {
+    ++m_dropped_frames;
+    ntk_dbg(2) << "[ScreenGrabber] Encoders too slow, dropping frame.";
+    return false;
+  }
+
+  // QImage is implicitly shared, this does not copy the pixels.
+  m_queue.push_back(Frame(m_frame_count, image));
   ++m_frame_count;
+  m_queue_not_empty.wakeOne();
+  return true;
+}
+
+void ScreenGrabber :: flush()
+{
+  QMutexLocker locker(&m_lock);
+  while (!m_queue.empty() || m_in_progress > 0)
+    m_queue_drained.wait(&m_lock);
+}
+
+int ScreenGrabber :: numSavedFrames() const
+{
+  QMutexLocker locker(&m_lock);
+  return m_saved_frames;
+}
+
+int ScreenGrabber :: numDroppedFrames() const
+{
+  QMutexLocker locker(&m_lock);
+  return m_dropped_frames;
+}
+
+int ScreenGrabber :: numFailedFrames() const
+{
+  QMutexLocker locker(&m_lock);
+  return m_failed_frames;
+}
+
+int ScreenGrabber :: numPendingFrames() const
+{
+  QMutexLocker locker(&m_lock);
+  return m_queue.size() + m_in_progress;
+}
+
+void ScreenGrabber :: workerLoop()
+{
+  QMutexLocker locker(&m_lock);
+  while (true)
+  {
+    while (m_queue.empty() && !m_should_exit)
+      m_queue_not_empty.wait(&m_lock);
+
+    if (m_queue.empty())
+      break;
+
+    Frame frame = m_queue.front();
+    m_queue.pop_front();
+    ++m_in_progress;
+
+    locker.unlock();
+    const bool saved = encodeFrame(frame);
+    // Release the pixels before signaling that memory is available again.
+    frame.image = QImage();
+    locker.relock();
+
+    --m_in_progress;
+    if (saved)
+      ++m_saved_frames;
+    else
+      ++m_failed_frames;
+    if (m_queue.empty() && m_in_progress == 0)
+      m_queue_drained.wakeAll();
+  }
+}
+
+bool ScreenGrabber :: encodeFrame(const Frame& frame)
+{
+  switch (m_format)
+  {
+  case PngFiles:
+  case JpegFiles:
+  {
+    const bool png = m_format == PngFiles;
+    QString filename = QString(png ? "frame%1.png" : "frame%1.jpg").arg(frame.index, 4, 10, QChar('0'));
+    if (!frame.image.save(m_dir.absoluteFilePath(filename), png ? "PNG" : "JPG", png ? -1 : m_jpeg_quality))
+    {
+      ntk_dbg(0) << "[ScreenGrabber] Could not save " << m_dir.absoluteFilePath(filename);
+      return false;
+    }
+    return true;
+  }
+
+  case MjpegStream:
+  {
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    if (!frame.image.save(&buffer, "JPG", m_jpeg_quality))
+    {
+      ntk_dbg(0) << "[ScreenGrabber] Could not encode frame " << frame.index;
+      // Keep the stream order, the next frames are waiting for this index.
+      writeStreamChunk(frame.index, QByteArray());
+      return false;
+    }
+    return writeStreamChunk(frame.index, data);
+  }
+
+  case RawStream:
+  {
+    // Header: width, height, QImage::Format, bytes per line, then the pixels.
+    QByteArray data;
+    QDataStream header(&data, QIODevice::WriteOnly);
+    header.setByteOrder(QDataStream::LittleEndian);
+    header << qint32(frame.image.width())
+           << qint32(frame.image.height())
+           << qint32(frame.image.format())
+           << qint32(frame.image.bytesPerLine());
+    data.append((const char*)frame.image.bits(), frame.image.byteCount());
+    return writeStreamChunk(frame.index, data);
+  }
+  }
+  return false;
+}
+
+bool ScreenGrabber :: openStream()
+{
+  QString filename = m_format == MjpegStream ? "frames.mjpeg" : "frames.raw";
+  m_stream.setFileName(m_dir.absoluteFilePath(filename));
+  if (!m_stream.open(QIODevice::WriteOnly | QIODevice::Truncate))
+  {
+    ntk_dbg(0) << "[ScreenGrabber] Could not open " << m_stream.fileName();
+    return false;
+  }
+  return true;
+}
+
+bool ScreenGrabber :: writeStreamChunk(int index, const QByteArray& data)
+{
+  // Frames are encoded in parallel, but have to be appended in order.
+  // Chunks waiting for an earlier frame are written by the thread of
+  // that frame, so only the stream state can be checked here.
+  QMutexLocker locker(&m_stream_lock);
+  if (!m_stream.isOpen() && !openStream())
+    return false;
+
+  bool ok = true;
+  m_stream_reorder_buffer[index] = data;
+  std::map<int, QByteArray>::iterator it = m_stream_reorder_buffer.begin();
+  while (it != m_stream_reorder_buffer.end() && it->first == m_next_stream_index)
+  {
+    if (m_stream.write(it->second) != it->second.size())
+    {
+      ntk_dbg(0) << "[ScreenGrabber] Could not write frame " << it->first
+                 << " to " << m_stream.fileName();
+      ok = false;
+    }
+    m_stream_reorder_buffer.erase(it++);
+    ++m_next_stream_index;
+  }
+  return ok;
 }
 
 } // ntk
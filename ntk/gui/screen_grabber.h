@@ -23,23 +23,108 @@
 #include <ntk/core.h>
 
 #include <QPixmap>
+#include <QImage>
 #include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <deque>
+#include <map>
+#include <vector>
 
 namespace ntk
 {
 
+/*!
+ * Record a sequence of screen frames.
+ *
+ * saveFrame only queues the frame, encoding and writing happen in a pool
+ * of background threads. At most maxPendingFrames frames are kept in
+ * memory, extra frames are dropped and counted in numDroppedFrames.
+ * Frames that could not be encoded or written are reported and counted
+ * in numFailedFrames, not in numSavedFrames.
+ */
 class ScreenGrabber
 {
 public:
-  ScreenGrabber(const std::string& dir_name);
+  enum OutputFormat
+  {
+    PngFiles = 0,   //!< One frameXXXX.png file per frame.
+    JpegFiles = 1,  //!< One frameXXXX.jpg file per frame.
+    MjpegStream = 2, //!< Concatenated JPEG frames in a single frames.mjpeg file.
+    RawStream = 3   //!< Uncompressed frames in a single frames.raw file.
+  };
 
 public:
+  ScreenGrabber(const std::string& dir_name,
+                OutputFormat format = PngFiles,
+                int num_workers = 2,
+                int max_pending_frames = 16);
+  ~ScreenGrabber();
+
+public:
+  /*! Wait for pending frames and restart numbering from zero. */
   void reset();
-  void saveFrame(const QPixmap& pixmap);
+
+  /*! Queue a frame for encoding. Returns false if the frame was dropped. */
+  bool saveFrame(const QPixmap& pixmap);
+  bool saveFrame(const QImage& image);
+
+  /*! Block until all the queued frames have been written. */
+  void flush();
+
+public:
+  void setJpegQuality(int quality) { m_jpeg_quality = quality; }
+
+  int numSavedFrames() const;
+  int numDroppedFrames() const;
+  int numFailedFrames() const;
+  int numPendingFrames() const;
+
+private:
+  struct Frame
+  {
+    Frame(int index = -1, const QImage& image = QImage())
+      : index(index), image(image)
+    {}
+
+    int index;
+    QImage image;
+  };
+
+  class Worker;
+  friend class Worker;
+
+private:
+  void workerLoop();
+  bool encodeFrame(const Frame& frame);
+  bool writeStreamChunk(int index, const QByteArray& data);
+  bool openStream();
 
 private:
-  int m_frame_count;
   QDir m_dir;
+  OutputFormat m_format;
+  int m_max_pending_frames;
+  int m_jpeg_quality;
+
+  mutable QMutex m_lock;
+  QWaitCondition m_queue_not_empty;
+  QWaitCondition m_queue_drained;
+  std::deque<Frame> m_queue;
+  int m_frame_count;
+  int m_in_progress;
+  int m_saved_frames;
+  int m_dropped_frames;
+  int m_failed_frames;
+  bool m_should_exit;
+
+  QMutex m_stream_lock;
+  QFile m_stream;
+  int m_next_stream_index;
+  std::map<int, QByteArray> m_stream_reorder_buffer;
+
+  std::vector<Worker*> m_workers;
 };
 
 } // ntk
@@ -25,6 +25,7 @@
 #include <ntk/utils/opencv_utils.h>
 #include <ntk/numeric/utils.h>
 #include <ntk/utils/time.h>
+#include <ntk/thread/parallel.h>
 
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/flann/flann.hpp>
@@ -34,6 +35,7 @@
 #endif
 
 #include <cassert>
+#include <cfloat>
 
 #ifdef HAVE_OPENCV_GREATER_THAN_2_4_0
 #include <opencv2/nonfree/nonfree.hpp>
@@ -394,6 +396,18 @@ void FeatureSet :: compute3dLocation(const Pose3D& pose)
     }
 }
 
+void FeatureSet :: setFeatures(FeatureType type,
+                                const std::vector<FeaturePoint>& locations,
+                                const cv::Mat1f& descriptors)
+{
+    ntk_ensure(int(locations.size()) == descriptors.rows, "Each location must have a descriptor.");
+    m_feature_type = type;
+    m_descriptor_size = descriptors.cols;
+    m_locations = locations;
+    descriptors.copyTo(m_descriptors);
+    impl->descriptor_index.release();
+}
+
 void FeatureSet :: draw(const cv::Mat3b& image, cv::Mat3b& display_image) const
 {
     std::vector<KeyPoint> keypoints(m_locations.size());
@@ -481,5 +495,369 @@ void FeatureSet :: matchWith(const FeatureSet& rhs,
     }
 }
 
+namespace
+{
+
+// Keypoints bucketed into square cells. Indices of each cell are stored
+// contiguously, cell k owning indices[cell_begin[k]..cell_begin[k+1]).
+struct KeypointGrid
+{
+    KeypointGrid(const std::vector<FeaturePoint>& locations, float cell_size)
+        : cell_size(cell_size), min_x(0), min_y(0), cols(0), rows(0)
+    {
+        if (locations.empty())
+            return;
+
+        float max_x = locations[0].pt.x, max_y = locations[0].pt.y;
+        min_x = max_x; min_y = max_y;
+        foreach_idx(i, locations)
+        {
+            min_x = std::min(min_x, locations[i].pt.x);
+            min_y = std::min(min_y, locations[i].pt.y);
+            max_x = std::max(max_x, locations[i].pt.x);
+            max_y = std::max(max_y, locations[i].pt.y);
+        }
+        cols = cellCol(max_x) + 1;
+        rows = cellRow(max_y) + 1;
+
+        cell_begin.assign(rows*cols + 1, 0);
+        foreach_idx(i, locations)
+            ++cell_begin[cellIndex(locations[i].pt) + 1];
+        for (int k = 1; k < cell_begin.size(); ++k)
+            cell_begin[k] += cell_begin[k-1];
+
+        std::vector<int> next (cell_begin.begin(), cell_begin.end() - 1);
+        indices.resize(locations.size());
+        foreach_idx(i, locations)
+            indices[next[cellIndex(locations[i].pt)]++] = i;
+    }
+
+    int cellCol(float x) const { return cvFloor((x - min_x) / cell_size); }
+    int cellRow(float y) const { return cvFloor((y - min_y) / cell_size); }
+    int cellIndex(const cv::Point2f& p) const { return cellRow(p.y)*cols + cellCol(p.x); }
+
+    float cell_size;
+    float min_x, min_y;
+    int cols, rows;
+    std::vector<int> cell_begin;
+    std::vector<int> indices;
+};
+
+float descriptorSquaredDistance(const float* d1, const float* d2, int size)
+{
+    float dist = 0;
+    for (int k = 0; k < size; ++k)
+    {
+        const float diff = d1[k] - d2[k];
+        dist += diff*diff;
+    }
+    return dist;
+}
+
+}
+
+void FeatureSet :: matchWithGuided(const FeatureSet& rhs,
+                                   const Pose3D& predicted_rhs_rgb_pose,
+                                   float search_radius,
+                                   std::vector<cv::DMatch>& matches,
+                                   float ratio_threshold) const
+{
+    ntk_ensure(featureType() == rhs.featureType(), "Cannot match with different feature type.");
+    ntk_ensure(search_radius > 0, "Search radius must be positive.");
+
+    const std::vector<FeaturePoint>& rhs_locations = rhs.locations();
+    if (m_locations.empty() || rhs_locations.empty())
+        return;
+
+    const KeypointGrid grid (rhs_locations, search_radius);
+    const float sqr_radius = search_radius*search_radius;
+    const int size = descriptorSize();
+
+    // Two closest features of this set for each rhs feature, as
+    // the global knn search would report them.
+    std::vector<float> best_dist (rhs_locations.size(), FLT_MAX);
+    std::vector<float> second_dist (rhs_locations.size(), FLT_MAX);
+    std::vector<int> best_index (rhs_locations.size(), -1);
+
+    foreach_idx(j, m_locations)
+    {
+        const FeaturePoint& loc = m_locations[j];
+        if (!loc.has_depth)
+            continue;
+
+        const cv::Point3f p = predicted_rhs_rgb_pose.projectToImage(loc.p3d);
+        if (p.z <= 0)
+            continue;
+
+        const int min_col = std::max(grid.cellCol(p.x - search_radius), 0);
+        const int max_col = std::min(grid.cellCol(p.x + search_radius), grid.cols - 1);
+        const int min_row = std::max(grid.cellRow(p.y - search_radius), 0);
+        const int max_row = std::min(grid.cellRow(p.y + search_radius), grid.rows - 1);
+
+        const float* descriptor = m_descriptors.ptr<float>(j);
+        for (int r = min_row; r <= max_row; ++r)
+        for (int c = min_col; c <= max_col; ++c)
+        {
+            const int cell = r*grid.cols + c;
+            for (int k = grid.cell_begin[cell]; k < grid.cell_begin[cell+1]; ++k)
+            {
+                const int i = grid.indices[k];
+                const float dx = rhs_locations[i].pt.x - p.x;
+                const float dy = rhs_locations[i].pt.y - p.y;
+                if (dx*dx + dy*dy > sqr_radius)
+                    continue;
+
+                const float dist = descriptorSquaredDistance(descriptor, rhs.m_descriptors.ptr<float>(i), size);
+                if (dist < best_dist[i])
+                {
+                    second_dist[i] = best_dist[i];
+                    best_dist[i] = dist;
+                    best_index[i] = j;
+                }
+                else if (dist < second_dist[i])
+                {
+                    second_dist[i] = dist;
+                }
+            }
+        }
+    }
+
+    // A keypoint with a single candidate in its window cannot be ambiguous.
+    // Its distance is compared to the median second distance of the others,
+    // which is a typical distance between unrelated features.
+    std::vector<float> second_dists;
+    foreach_idx(i, second_dist)
+        if (second_dist[i] != FLT_MAX)
+            second_dists.push_back(second_dist[i]);
+    float single_reference_dist = FLT_MAX;
+    if (!second_dists.empty())
+    {
+        std::nth_element(second_dists.begin(), second_dists.begin() + second_dists.size()/2, second_dists.end());
+        single_reference_dist = second_dists[second_dists.size()/2];
+    }
+
+    foreach_idx(i, rhs_locations)
+    {
+        if (best_index[i] < 0)
+            continue;
+        float reference_dist = second_dist[i];
+        if (reference_dist == FLT_MAX)
+        {
+            if (single_reference_dist == FLT_MAX)
+                continue;
+            reference_dist = single_reference_dist;
+        }
+        const double dist_ratio = reference_dist > 0 ? best_dist[i]/reference_dist : 1.0;
+        if (dist_ratio > ratio_threshold) // probably wrong match
+            continue;
+
+        DMatch m(i, best_index[i], -1, dist_ratio);
+        matches.push_back(m);
+    }
+}
+
+// Queries [0, rhs size) look for rhs descriptors in the lhs index,
+// the following ones for lhs descriptors in the rhs index.
+struct FeatureSet::RatioTestBody
+{
+    RatioTestBody(const FeatureSet& lhs, const FeatureSet& rhs, float ratio_threshold,
+                  std::vector<int>& rhs_to_lhs, std::vector<float>& rhs_ratios,
+                  std::vector<int>& lhs_to_rhs)
+        : lhs(lhs), rhs(rhs), ratio_threshold(ratio_threshold),
+          rhs_to_lhs(rhs_to_lhs), rhs_ratios(rhs_ratios), lhs_to_rhs(lhs_to_rhs)
+    {}
+
+    void operator()(const IndexRange& range) const
+    {
+        const int num_rhs = rhs.m_descriptors.rows;
+        std::vector<float> query (lhs.descriptorSize());
+        float ratio = 0;
+        for (int i = range.begin; i < range.end; ++i)
+        {
+            if (i < num_rhs)
+                rhs_to_lhs[i] = search(lhs.impl->descriptor_index, rhs.m_descriptors.ptr<float>(i), query, rhs_ratios[i]);
+            else
+                lhs_to_rhs[i-num_rhs] = search(rhs.impl->descriptor_index, lhs.m_descriptors.ptr<float>(i-num_rhs), query, ratio);
+        }
+    }
+
+    // Index of the closest descriptor if it passes the ratio test, -1 otherwise.
+    int search(Impl::IndexType* index, const float* descriptor, std::vector<float>& query, float& ratio) const
+    {
+        std::vector<int> indices(2, -1);
+        std::vector<float> dists(2, 0);
+        std::copy(descriptor, descriptor + query.size(), query.begin());
+#ifdef HAVE_OPENCV_GREATER_THAN_2_3_0
+        cvflann::SearchParams params(64);
+#else
+        cv::flann::SearchParams params(64);
+#endif
+        index->knnSearch(query, indices, dists, 2, params);
+        if (indices[0] < 0 || indices[1] < 0)
+            return -1;
+        ratio = dists[0]/dists[1];
+        if (ratio > ratio_threshold) // probably wrong match
+            return -1;
+        return indices[0];
+    }
+
+    const FeatureSet& lhs;
+    const FeatureSet& rhs;
+    float ratio_threshold;
+    std::vector<int>& rhs_to_lhs;
+    std::vector<float>& rhs_ratios;
+    std::vector<int>& lhs_to_rhs;
+};
+
+void FeatureSet :: matchWithMutual(FeatureSet& rhs,
+                                   std::vector<cv::DMatch>& matches,
+                                   float ratio_threshold,
+                                   bool use_motion_filter)
+{
+    ntk_ensure(featureType() == rhs.featureType(), "Cannot match with different feature type.");
+
+    if (!impl->descriptor_index)
+        buildDescriptorIndex();
+    if (!rhs.impl->descriptor_index)
+        rhs.buildDescriptorIndex();
+
+    // Still no index? There was no features in one of the images.
+    if (!impl->descriptor_index || !rhs.impl->descriptor_index)
+        return;
+
+    const int num_rhs = rhs.m_descriptors.rows;
+    const int num_lhs = m_descriptors.rows;
+    std::vector<int> rhs_to_lhs (num_rhs, -1);
+    std::vector<float> rhs_ratios (num_rhs, 0);
+    std::vector<int> lhs_to_rhs (num_lhs, -1);
+    parallel_for(0, num_rhs + num_lhs,
+                 RatioTestBody(*this, rhs, ratio_threshold, rhs_to_lhs, rhs_ratios, lhs_to_rhs),
+                 64);
+
+    const int first_match = matches.size();
+    for (int i = 0; i < num_rhs; ++i)
+    {
+        const int j = rhs_to_lhs[i];
+        if (j < 0 || lhs_to_rhs[j] != i)
+            continue;
+        DMatch m(i, j, -1, rhs_ratios[i]);
+        matches.push_back(m);
+    }
+
+    if (use_motion_filter)
+    {
+        std::vector<cv::DMatch> new_matches (matches.begin() + first_match, matches.end());
+        filter_matches_with_motion_statistics(rhs.m_locations, m_locations, new_matches);
+        matches.resize(first_match);
+        matches.insert(matches.end(), new_matches.begin(), new_matches.end());
+    }
+}
+
+namespace
+{
+
+// Regular grid over the bounding box of the given points.
+struct MotionGrid
+{
+    MotionGrid(const std::vector<cv::Point2f>& points, int grid_size)
+        : grid_size(grid_size)
+    {
+        min_x = max_x = points[0].x;
+        min_y = max_y = points[0].y;
+        foreach_idx(i, points)
+        {
+            min_x = std::min(min_x, points[i].x);
+            max_x = std::max(max_x, points[i].x);
+            min_y = std::min(min_y, points[i].y);
+            max_y = std::max(max_y, points[i].y);
+        }
+        // Small margin, so that the max coordinates fall in the last cell.
+        scale_x = grid_size / (max_x - min_x + 1e-3f);
+        scale_y = grid_size / (max_y - min_y + 1e-3f);
+    }
+
+    int col(const cv::Point2f& p) const { return std::min(int((p.x - min_x)*scale_x), grid_size-1); }
+    int row(const cv::Point2f& p) const { return std::min(int((p.y - min_y)*scale_y), grid_size-1); }
+
+    int grid_size;
+    float min_x, max_x, min_y, max_y;
+    float scale_x, scale_y;
+};
+
+}
+
+void filter_matches_with_motion_statistics(const std::vector<FeaturePoint>& query_locations,
+                                           const std::vector<FeaturePoint>& train_locations,
+                                           std::vector<cv::DMatch>& matches,
+                                           int grid_size,
+                                           float threshold_factor)
+{
+    if (matches.size() < 2)
+        return;
+
+    if (grid_size <= 0)
+        grid_size = std::max(2, std::min(20, int(sqrt(matches.size() / 8.0))));
+    const int num_cells = grid_size*grid_size;
+
+    std::vector<cv::Point2f> query_points (matches.size());
+    std::vector<cv::Point2f> train_points (matches.size());
+    foreach_idx(i, matches)
+    {
+        query_points[i] = query_locations[matches[i].queryIdx].pt;
+        train_points[i] = train_locations[matches[i].trainIdx].pt;
+    }
+
+    const MotionGrid query_grid (query_points, grid_size);
+    const MotionGrid train_grid (train_points, grid_size);
+
+    // Number of matches per query cell, and per pair of query and train cells.
+    std::vector<int> query_cell_count (num_cells, 0);
+    std::vector<int> cell_pair_count (num_cells*num_cells, 0);
+    foreach_idx(i, matches)
+    {
+        const int query_cell = query_grid.row(query_points[i])*grid_size + query_grid.col(query_points[i]);
+        const int train_cell = train_grid.row(train_points[i])*grid_size + train_grid.col(train_points[i]);
+        ++query_cell_count[query_cell];
+        ++cell_pair_count[query_cell*num_cells + train_cell];
+    }
+
+    std::vector<cv::DMatch> kept_matches;
+    kept_matches.reserve(matches.size());
+    foreach_idx(i, matches)
+    {
+        const int query_row = query_grid.row(query_points[i]), query_col = query_grid.col(query_points[i]);
+        const int train_row = train_grid.row(train_points[i]), train_col = train_grid.col(train_points[i]);
+
+        // Matches moving the same way from neighbour cells. A one cell tolerance
+        // on the train side accounts for motions which are not a multiple of
+        // the cell size, instead of running again with shifted grids.
+        int support = 0, neighbourhood_count = 0, num_neighbours = 0;
+        for (int dr = -1; dr <= 1; ++dr)
+        for (int dc = -1; dc <= 1; ++dc)
+        {
+            const int qr = query_row + dr, qc = query_col + dc;
+            if (qr < 0 || qc < 0 || qr >= grid_size || qc >= grid_size)
+                continue;
+            const int query_cell = qr*grid_size + qc;
+            neighbourhood_count += query_cell_count[query_cell];
+            ++num_neighbours;
+
+            for (int tr = train_row + dr - 1; tr <= train_row + dr + 1; ++tr)
+            for (int tc = train_col + dc - 1; tc <= train_col + dc + 1; ++tc)
+            {
+                if (tr < 0 || tc < 0 || tr >= grid_size || tc >= grid_size)
+                    continue;
+                support += cell_pair_count[query_cell*num_cells + tr*grid_size + tc];
+            }
+        }
+
+        const double threshold = threshold_factor * sqrt(neighbourhood_count / double(num_neighbours));
+        if (support > threshold)
+            kept_matches.push_back(matches[i]);
+    }
+
+    ntk_dbg_print(kept_matches.size(), 2);
+    matches.swap(kept_matches);
+}
 
 } // ntk
@@ -125,6 +125,11 @@ public:
     /*! Compute each feature p3d location using the given pose. */
     void compute3dLocation(const Pose3D& pose);
 
+    /*! Use features computed elsewhere, e.g. by an external detector. */
+    void setFeatures(FeatureType type,
+                     const std::vector<FeaturePoint>& locations,
+                     const cv::Mat1f& descriptors);
+
 public:
     /*!
    * Extract descriptors from an image.
@@ -143,6 +148,36 @@ public:
                    std::vector<cv::DMatch>& matches,
                    float ratio_threshold = 0.8*0.8);
 
+    /*!
+   * Same as matchWith, but only compare descriptors of features that
+   * are close in the rhs image once this set p3d locations are
+   * projected with the predicted rhs rgb pose.
+   * Only features with depth are considered, compute3dLocation must
+   * have been called before. A rhs keypoint with a single candidate in
+   * its window is matched if the candidate passes the ratio test against
+   * the median second closest distance of the other keypoints.
+   * \param search_radius Maximal distance in pixels between a projected
+   * feature and a rhs keypoint.
+   */
+    void matchWithGuided(const FeatureSet& rhs,
+                         const Pose3D& predicted_rhs_rgb_pose,
+                         float search_radius,
+                         std::vector<cv::DMatch>& matches,
+                         float ratio_threshold = 0.8*0.8) const;
+
+    /*!
+   * Symmetric version of matchWith. rhs features are matched with this set
+   * and this set with rhs features, both directions in parallel with the
+   * cached descriptor index of each set. Only mutual best matches passing
+   * the ratio test in both directions are kept.
+   * \param use_motion_filter Also reject matches not supported by their
+   * neighbours, see filter_matches_with_motion_statistics.
+   */
+    void matchWithMutual(FeatureSet& rhs,
+                         std::vector<cv::DMatch>& matches,
+                         float ratio_threshold = 0.8*0.8,
+                         bool use_motion_filter = false);
+
 public:
     void draw(const cv::Mat3b& image, cv::Mat3b& display_image) const;
     void drawMatches(const cv::Mat3b& image,
@@ -159,6 +194,7 @@ private:
 
 private:
     struct Impl; // use pimpl to avoid exposing flann, that gives conflicts with PCL.
+    struct RatioTestBody;
 
 private:
     Impl* impl;
@@ -185,6 +221,22 @@ struct Feature
     int index;
 };
 
+/*!
+ * Grid-based motion statistics filter. Keypoints of both images are
+ * bucketed into grid cells, and a match is kept only if enough matches go
+ * from the neighbourhood of its query cell to the same neighbourhood of its
+ * train cell. Works best with a few hundred matches or more.
+ * \param grid_size Number of cells per image dimension, 0 to choose it
+ * from the number of matches.
+ * \param threshold_factor Required support, relative to the square root
+ * of the mean number of matches in the neighbour cells.
+ */
+void filter_matches_with_motion_statistics(const std::vector<FeaturePoint>& query_locations,
+                                           const std::vector<FeaturePoint>& train_locations,
+                                           std::vector<cv::DMatch>& matches,
+                                           int grid_size = 0,
+                                           float threshold_factor = 6);
+
 } // ntk
 
 #endif // NTK_IMAGE_FEATURE_H
@@ -0,0 +1,276 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+
+#include "fixed_point_remap.h"
+
+#include <ntk/utils/debug.h>
+#include <ntk/thread/parallel.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace ntk
+{
+
+namespace
+{
+
+const int frac_mask = cv::INTER_TAB_SIZE - 1;
+const float frac_scale = 1.f / cv::INTER_TAB_SIZE;
+
+void check_maps(const cv::Mat& map1, const cv::Mat& map2)
+{
+    ntk_assert(map1.type() == CV_16SC2, "Fixed-point maps expected.");
+    ntk_assert(map2.type() == CV_16UC1 && map2.size() == map1.size(), "Fixed-point maps expected.");
+}
+
+struct RemapDepthBody
+{
+    const cv::Mat& map1;
+    const cv::Mat& map2;
+    const cv::Mat1f& depth;
+    cv::Mat1f& remapped_depth;
+    const cv::Mat1f& amplitude;
+    cv::Mat1f& remapped_amplitude;
+    const cv::Mat1f& intensity;
+    cv::Mat1f& remapped_intensity;
+    float max_relative_delta;
+
+    RemapDepthBody(const cv::Mat& map1, const cv::Mat& map2,
+                   const cv::Mat1f& depth, cv::Mat1f& remapped_depth,
+                   const cv::Mat1f& amplitude, cv::Mat1f& remapped_amplitude,
+                   const cv::Mat1f& intensity, cv::Mat1f& remapped_intensity,
+                   float max_relative_delta)
+        : map1(map1), map2(map2),
+          depth(depth), remapped_depth(remapped_depth),
+          amplitude(amplitude), remapped_amplitude(remapped_amplitude),
+          intensity(intensity), remapped_intensity(remapped_intensity),
+          max_relative_delta(max_relative_delta)
+    {}
+
+    // Source value, or 0 outside of the image, as cv::remap with BORDER_CONSTANT.
+    static float value(const cv::Mat1f& im, int x, int y)
+    {
+        if (x < 0 || y < 0 || x >= im.cols || y >= im.rows)
+            return 0.f;
+        return im(y,x);
+    }
+
+    static void neighbours(const cv::Mat1f& im, int x0, int y0, bool inside, float* v)
+    {
+        if (inside)
+        {
+            const float* row0 = im.ptr<float>(y0);
+            const float* row1 = im.ptr<float>(y0 + 1);
+            v[0] = row0[x0]; v[1] = row0[x0 + 1];
+            v[2] = row1[x0]; v[3] = row1[x0 + 1];
+        }
+        else
+        {
+            v[0] = value(im, x0, y0); v[1] = value(im, x0 + 1, y0);
+            v[2] = value(im, x0, y0 + 1); v[3] = value(im, x0 + 1, y0 + 1);
+        }
+    }
+
+    static float bilinear(const cv::Mat1f& im, int x0, int y0, bool inside,
+                          float w00, float w01, float w10, float w11)
+    {
+        float v[4];
+        neighbours(im, x0, y0, inside, v);
+        return w00 * v[0] + w01 * v[1] + w10 * v[2] + w11 * v[3];
+    }
+
+    void operator()(const IndexRange& range) const
+    {
+        const bool has_amplitude = amplitude.data != 0;
+        const bool has_intensity = intensity.data != 0;
+        const int width = depth.cols;
+        const int height = depth.rows;
+
+        for (int r = range.begin; r < range.end; ++r)
+        {
+            const short* coords = map1.ptr<short>(r);
+            const ushort* fractions = map2.ptr<ushort>(r);
+            float* depth_row = remapped_depth.ptr<float>(r);
+            float* amplitude_row = has_amplitude ? remapped_amplitude.ptr<float>(r) : 0;
+            float* intensity_row = has_intensity ? remapped_intensity.ptr<float>(r) : 0;
+
+            for (int c = 0; c < map1.cols; ++c)
+            {
+                const int x0 = coords[2*c];
+                const int y0 = coords[2*c+1];
+                // All four neighbours outside.
+                if (x0 < -1 || y0 < -1 || x0 >= width || y0 >= height)
+                {
+                    depth_row[c] = 0.f;
+                    if (has_amplitude) amplitude_row[c] = 0.f;
+                    if (has_intensity) intensity_row[c] = 0.f;
+                    continue;
+                }
+
+                const bool inside = x0 >= 0 && y0 >= 0 && x0 + 1 < width && y0 + 1 < height;
+                const int fx = fractions[c] & frac_mask;
+                const int fy = fractions[c] >> cv::INTER_BITS;
+                const float wx = fx * frac_scale;
+                const float wy = fy * frac_scale;
+                const float w00 = (1.f - wx) * (1.f - wy);
+                const float w01 = wx * (1.f - wy);
+                const float w10 = (1.f - wx) * wy;
+                const float w11 = wx * wy;
+
+                // Depth outside the image reads as 0, i.e. as a hole, so border
+                // pixels fall back to the nearest neighbour instead of being
+                // blended with 0, and get 0 when that neighbour is outside.
+                float d[4];
+                neighbours(depth, x0, y0, inside, d);
+                const float min_d = std::min(std::min(d[0], d[1]), std::min(d[2], d[3]));
+                const float max_d = std::max(std::max(d[0], d[1]), std::max(d[2], d[3]));
+
+                // NaN neighbours fail the test too.
+                if (min_d > 1e-5f && (max_d - min_d) <= max_relative_delta * min_d)
+                    depth_row[c] = w00 * d[0] + w01 * d[1] + w10 * d[2] + w11 * d[3];
+                else
+                    depth_row[c] = d[(fy*2 < cv::INTER_TAB_SIZE ? 0 : 2) + (fx*2 < cv::INTER_TAB_SIZE ? 0 : 1)];
+
+                if (has_amplitude)
+                    amplitude_row[c] = bilinear(amplitude, x0, y0, inside, w00, w01, w10, w11);
+                if (has_intensity)
+                    intensity_row[c] = bilinear(intensity, x0, y0, inside, w00, w01, w10, w11);
+            }
+        }
+    }
+};
+
+struct RemapColorBody
+{
+    const cv::Mat& map1;
+    const cv::Mat& map2;
+    const cv::Mat3b& src;
+    cv::Mat3b& dst;
+    cv::Rect roi;
+
+    RemapColorBody(const cv::Mat& map1, const cv::Mat& map2,
+                   const cv::Mat3b& src, cv::Mat3b& dst, cv::Rect roi)
+        : map1(map1), map2(map2), src(src), dst(dst), roi(roi)
+    {}
+
+    // Source pixel, or black outside of the roi, as cv::remap with BORDER_CONSTANT.
+    const uchar* pixel(int x, int y) const
+    {
+        static const uchar black[3] = { 0, 0, 0 };
+        if (x < 0 || y < 0 || x >= roi.width || y >= roi.height)
+            return black;
+        return src.ptr<uchar>(y + roi.y) + 3*(x + roi.x);
+    }
+
+    void operator()(const IndexRange& range) const
+    {
+        const int weight_bits = 2 * cv::INTER_BITS;
+        const int round = 1 << (weight_bits - 1);
+
+        for (int r = range.begin; r < range.end; ++r)
+        {
+            const short* coords = map1.ptr<short>(r);
+            const ushort* fractions = map2.ptr<ushort>(r);
+            uchar* out = dst.ptr<uchar>(r);
+
+            for (int c = 0; c < map1.cols; ++c, out += 3)
+            {
+                const int x = coords[2*c];
+                const int y = coords[2*c+1];
+                const int fx = fractions[c] & frac_mask;
+                const int fy = fractions[c] >> cv::INTER_BITS;
+                const int w00 = (cv::INTER_TAB_SIZE - fx) * (cv::INTER_TAB_SIZE - fy);
+                const int w01 = fx * (cv::INTER_TAB_SIZE - fy);
+                const int w10 = (cv::INTER_TAB_SIZE - fx) * fy;
+                const int w11 = fx * fy;
+
+                const uchar* p00;
+                const uchar* p01;
+                const uchar* p10;
+                const uchar* p11;
+                if (x >= 0 && y >= 0 && x + 1 < roi.width && y + 1 < roi.height)
+                {
+                    p00 = src.ptr<uchar>(y + roi.y) + 3*(x + roi.x);
+                    p01 = p00 + 3;
+                    p10 = src.ptr<uchar>(y + roi.y + 1) + 3*(x + roi.x);
+                    p11 = p10 + 3;
+                }
+                else
+                {
+                    p00 = pixel(x, y);
+                    p01 = pixel(x + 1, y);
+                    p10 = pixel(x, y + 1);
+                    p11 = pixel(x + 1, y + 1);
+                }
+
+                for (int k = 0; k < 3; ++k)
+                    out[k] = (w00*p00[k] + w01*p01[k] + w10*p10[k] + w11*p11[k] + round) >> weight_bits;
+            }
+        }
+    }
+};
+
+}
+
+void remapDepthPlanes(const cv::Mat& map1, const cv::Mat& map2,
+                      const cv::Mat1f& depth, cv::Mat1f& remapped_depth,
+                      const cv::Mat1f& amplitude, cv::Mat1f& remapped_amplitude,
+                      const cv::Mat1f& intensity, cv::Mat1f& remapped_intensity,
+                      float max_relative_delta)
+{
+    check_maps(map1, map2);
+    ntk_assert(!amplitude.data || amplitude.size() == depth.size(), "Amplitude size mismatch.");
+    ntk_assert(!intensity.data || intensity.size() == depth.size(), "Intensity size mismatch.");
+    // Remapping cannot be done in place.
+    if (remapped_depth.data == depth.data) remapped_depth.release();
+    if (remapped_amplitude.data == amplitude.data) remapped_amplitude.release();
+    if (remapped_intensity.data == intensity.data) remapped_intensity.release();
+
+    remapped_depth.create(map1.size());
+    if (amplitude.data)
+        remapped_amplitude.create(map1.size());
+    if (intensity.data)
+        remapped_intensity.create(map1.size());
+
+    RemapDepthBody body (map1, map2,
+                         depth, remapped_depth,
+                         amplitude, remapped_amplitude,
+                         intensity, remapped_intensity,
+                         max_relative_delta);
+    parallel_for(0, map1.rows, body, 16);
+}
+
+void remapColor(const cv::Mat& map1, const cv::Mat& map2,
+                const cv::Mat3b& src, cv::Mat3b& dst,
+                cv::Rect src_roi)
+{
+    check_maps(map1, map2);
+    if (dst.data == src.data)
+        dst.release();
+
+    cv::Rect roi = src_roi.area() > 0 ? src_roi : cv::Rect(0, 0, src.cols, src.rows);
+    ntk_assert((roi & cv::Rect(0, 0, src.cols, src.rows)) == roi, "Invalid source roi.");
+
+    dst.create(map1.size());
+    RemapColorBody body (map1, map2, src, dst, roi);
+    parallel_for(0, map1.rows, body, 16);
+}
+
+} // ntk
@@ -0,0 +1,63 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_IMAGE_FIXED_POINT_REMAP_H
+#define NTK_IMAGE_FIXED_POINT_REMAP_H
+
+# include <ntk/core.h>
+
+namespace ntk
+{
+
+/*
+ * Single-pass remapping with the fixed-point maps produced by
+ * cv::initUndistortRectifyMap or cv::convertMaps with CV_16SC2:
+ * map1 holds the integer source coordinates, map2 the interpolation index
+ * (cv::INTER_BITS fractional bits per axis).
+ * Destination images are only reallocated when their size changes.
+ * Rows are processed in parallel.
+ */
+
+/*!
+ * Remap depth, amplitude and intensity planes together.
+ * Depth is interpolated bilinearly only when the four source neighbours
+ * are valid and within max_relative_delta of each other, otherwise the
+ * nearest neighbour is used, so no depth is invented across discontinuities.
+ * Amplitude and intensity are skipped when their source is empty.
+ * Neighbours outside the source image read as 0, like cv::remap with
+ * BORDER_CONSTANT; for depth they count as holes.
+ */
+void remapDepthPlanes(const cv::Mat& map1, const cv::Mat& map2,
+                      const cv::Mat1f& depth, cv::Mat1f& remapped_depth,
+                      const cv::Mat1f& amplitude, cv::Mat1f& remapped_amplitude,
+                      const cv::Mat1f& intensity, cv::Mat1f& remapped_intensity,
+                      float max_relative_delta = 0.02f);
+
+/*!
+ * Bilinear remap of a color image with integer arithmetic.
+ * The maps address the src_roi area of src, which crops the source
+ * image without copying it. An empty roi means the whole image.
+ */
+void remapColor(const cv::Mat& map1, const cv::Mat& map2,
+                const cv::Mat3b& src, cv::Mat3b& dst,
+                cv::Rect src_roi = cv::Rect());
+
+} // ntk
+
+#endif // NTK_IMAGE_FIXED_POINT_REMAP_H
@@ -51,22 +51,23 @@ bool GridRGBDModeler :: addNewView(const RGBDImage& image, Pose3D& depth_pose)
     filter.filter(subsampled_cloud);
     *m_current_cloud = subsampled_cloud;
 
-    pointCloudToMesh(m_mesh, *m_current_cloud);
-    m_mesh.colors.resize(m_mesh.vertices.size(), cv::Vec3b(255,255,255));
+    Mesh& mesh = newMesh();
+    pointCloudToMesh(mesh, *m_current_cloud);
+    mesh.colors.resize(mesh.vertices.size(), cv::Vec3b(255,255,255));
 
     if (m_colorize)
     {
         Pose3D rgb_pose = depth_pose;
         rgb_pose.toRightCamera(image.calibration()->rgb_intrinsics, image.calibration()->R, image.calibration()->T);
 
-        foreach_idx(i, m_mesh.vertices)
+        foreach_idx(i, mesh.vertices)
         {
-            Point3f p_rgb = rgb_pose.projectToImage(m_mesh.vertices[i]);
+            Point3f p_rgb = rgb_pose.projectToImage(mesh.vertices[i]);
             if (!is_yx_in_range(image.rgb(), p_rgb.y, p_rgb.x))
                 continue;
 
             cv::Vec3b color = bgr_to_rgb(image.rgb()(p_rgb.y, p_rgb.x));
-            m_mesh.colors[i] = color;
+            mesh.colors[i] = color;
         }
     }
 
@@ -43,7 +43,7 @@ public:
 public:
     virtual float resolution() const { return m_resolution; }
     virtual void setResolution(float resolution) { m_resolution = resolution; reset(); }
-    virtual int numPoints() const { return m_mesh.vertices.size(); }
+    virtual int numPoints() const { return m_mesh->vertices.size(); }
     void setColorize(bool doit) { m_colorize = doit; }
 
 public:
@@ -30,6 +30,7 @@
 // #include <opencv2/core/core.hpp>
 
 #include <ntk/utils/time.h>
+#include <ntk/thread/parallel.h>
 
 #include <fstream>
 #include <cstring>
@@ -87,6 +88,180 @@ ply::PlyProperty available_face_properties[] = { /* list of property information
 
 
 
+}
+
+// Compaction helpers.
+namespace
+{
+
+const int compaction_chunk_size = 16384;
+
+struct CountKeptBody
+{
+    CountKeptBody(const std::vector<unsigned char>& keep, std::vector<int>& counts)
+        : keep(keep), counts(counts)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        int n = 0;
+        for (int i = range.begin; i < range.end; ++i)
+            n += (keep[i] != 0);
+        counts[range.chunk] = n;
+    }
+
+    const std::vector<unsigned char>& keep;
+    std::vector<int>& counts;
+};
+
+struct AssignIndicesBody
+{
+    AssignIndicesBody(const std::vector<unsigned char>& keep,
+                      const std::vector<int>& offsets,
+                      std::vector<int>& new_indices)
+        : keep(keep), offsets(offsets), new_indices(new_indices)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        int next = offsets[range.chunk];
+        for (int i = range.begin; i < range.end; ++i)
+            new_indices[i] = keep[i] ? next++ : -1;
+    }
+
+    const std::vector<unsigned char>& keep;
+    const std::vector<int>& offsets;
+    std::vector<int>& new_indices;
+};
+
+// Parallel exclusive prefix sum of the mask. Removed elements get -1.
+int compute_compaction_indices(const std::vector<unsigned char>& keep, std::vector<int>& new_indices)
+{
+    new_indices.resize(keep.size());
+
+    std::vector<ntk::IndexRange> chunks;
+    ntk::split_range(0, keep.size(), ntk::parallel_num_chunks(keep.size(), compaction_chunk_size), chunks);
+    if (chunks.empty())
+        return 0;
+
+    std::vector<int> counts (chunks.size(), 0);
+    ntk::parallel_for_chunks(chunks, CountKeptBody(keep, counts));
+
+    std::vector<int> offsets (chunks.size(), 0);
+    int total = 0;
+    foreach_idx(i, counts)
+    {
+        offsets[i] = total;
+        total += counts[i];
+    }
+
+    ntk::parallel_for_chunks(chunks, AssignIndicesBody(keep, offsets, new_indices));
+    return total;
+}
+
+template <class T>
+struct ScatterBody
+{
+    ScatterBody(const std::vector<T>& input, const std::vector<int>& new_indices, std::vector<T>& output)
+        : input(input), new_indices(new_indices), output(output)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        for (int i = range.begin; i < range.end; ++i)
+            if (new_indices[i] >= 0)
+                output[new_indices[i]] = input[i];
+    }
+
+    const std::vector<T>& input;
+    const std::vector<int>& new_indices;
+    std::vector<T>& output;
+};
+
+// Streams that are not aligned with the mask are inconsistent and get cleared.
+template <class T>
+void compact_stream(std::vector<T>& stream, const std::vector<int>& new_indices, int new_size)
+{
+    if (stream.size() != new_indices.size())
+    {
+        stream.clear();
+        return;
+    }
+
+    std::vector<T> output (new_size);
+    ntk::parallel_for(0, stream.size(), ScatterBody<T>(stream, new_indices, output), compaction_chunk_size);
+    stream.swap(output);
+}
+
+struct RemapFacesBody
+{
+    RemapFacesBody(std::vector<ntk::Face>& faces, const std::vector<int>& new_indices)
+        : faces(faces), new_indices(new_indices)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        for (int face_i = range.begin; face_i < range.end; ++face_i)
+        {
+            ntk::Face& face = faces[face_i];
+            if (!face.isValid())
+                continue;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                int new_index = new_indices[face.indices[k]];
+                if (new_index < 0)
+                {
+                    face.kill();
+                    break;
+                }
+                face.indices[k] = new_index;
+            }
+        }
+    }
+
+    std::vector<ntk::Face>& faces;
+    const std::vector<int>& new_indices;
+};
+
+struct NotNanVertexMaskBody
+{
+    NotNanVertexMaskBody(const std::vector<cv::Point3f>& vertices, std::vector<unsigned char>& keep)
+        : vertices(vertices), keep(keep)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        for (int i = range.begin; i < range.end; ++i)
+            keep[i] = !ntk::isnan(vertices[i]);
+    }
+
+    const std::vector<cv::Point3f>& vertices;
+    std::vector<unsigned char>& keep;
+};
+
+struct AliveFaceMaskBody
+{
+    AliveFaceMaskBody(const std::vector<ntk::Face>& faces, std::vector<unsigned char>& keep)
+        : faces(faces), keep(keep)
+    {}
+
+    void operator()(const ntk::IndexRange& range) const
+    {
+        for (int i = range.begin; i < range.end; ++i)
+        {
+            const ntk::Face& face = faces[i];
+            keep[i] = face.isValid()
+                    && face.indices[0] != face.indices[1]
+                    && face.indices[0] != face.indices[2]
+                    && face.indices[1] != face.indices[2];
+        }
+    }
+
+    const std::vector<ntk::Face>& faces;
+    std::vector<unsigned char>& keep;
+};
+
 }
 
 namespace ntk
@@ -1214,57 +1389,9 @@ void Mesh::removeDuplicatedVertices(float max_dist)
 
 void Mesh::removeIsolatedVertices()
 {
-    std::vector<int> new_indices (vertices.size());
-    int cur_index = 0;
-    foreach_idx(i, vertices)
-    {
-        if (isnan(vertices[i]))
-        {
-            new_indices[i] = -1;
-        }
-        else
-        {
-            new_indices[i] = cur_index;
-            ++cur_index;
-        }
-    }
-
-    ntk::Mesh new_mesh;
-    new_mesh.vertices.resize(cur_index);
-
-    if (hasColors())
-        new_mesh.colors.resize(cur_index);
-    if (hasNormals())
-        new_mesh.normals.resize(cur_index);
-    if (hasTexcoords())
-        new_mesh.texcoords.resize(cur_index);
-
-    foreach_idx(i, vertices)
-    {
-        if (new_indices[i] < 0) continue;
-        new_mesh.vertices[new_indices[i]] = vertices[i];
-        if (hasColors())
-            new_mesh.colors[new_indices[i]] = colors[i];
-        if (hasNormals())
-            new_mesh.normals[new_indices[i]] = normals[i];
-        if (hasTexcoords())
-            new_mesh.texcoords[new_indices[i]] = texcoords[i];
-    }
-
-    foreach_idx(face_i, faces)
-    {
-        foreach_idx(v_i, faces[face_i])
-        {
-            int old_index = faces[face_i].indices[v_i];
-            ntk_assert(new_indices[old_index] >= 0, "Inconsistent face.");
-            faces[face_i].indices[v_i] = new_indices[old_index];
-        }
-    }
-
-    vertices = new_mesh.vertices;
-    colors = new_mesh.colors;
-    normals = new_mesh.normals;
-    texcoords = new_mesh.texcoords;
+    std::vector<unsigned char> keep (vertices.size());
+    parallel_for(0, vertices.size(), NotNanVertexMaskBody(vertices, keep), compaction_chunk_size);
+    compactVertices(keep);
 
     if (hasFaces() && hasNormals())
         computeNormalsFromFaces();
@@ -1297,12 +1424,8 @@ void Mesh::removeDuplicatedFaces()
     FaceComparatorByIndices comparator (faces);
     std::sort(stl_bounds(ordered_indices), comparator);
 
-    std::vector<Face> new_faces;
-    new_faces.reserve(faces.size());
-
-    std::vector<FaceTexcoord> new_face_texcoords;
-    new_face_texcoords.reserve(face_texcoords.size());
-
+    // Keep the first face of each group of identical faces.
+    std::vector<unsigned char> keep (faces.size(), 0);
     Face prev_face (-1, -1, -1);
     for (int i = 0; i < ordered_indices.size(); ++i)
     {
@@ -1315,73 +1438,17 @@ void Mesh::removeDuplicatedFaces()
         }
 
         prev_face = face;
-        new_faces.push_back(face);
-        if (hasFaceTexcoords())
-            new_face_texcoords.push_back(face_texcoords[face_i]);
+        keep[face_i] = 1;
     }
 
-    faces = new_faces;
-    face_texcoords = new_face_texcoords;
+    compactFaces(keep);
 }
 
 void Mesh::removeNanVertices()
 {
-    std::vector<int> new_indices (vertices.size());
-    int cur_index = 0;
-    foreach_idx(i, vertices)
-    {
-        if (isnan(vertices[i]))
-        {
-            new_indices[i] = -1;
-        }
-        else
-        {
-            new_indices[i] = cur_index;
-            ++cur_index;
-        }
-    }
-
-    ntk::Mesh new_mesh;
-    new_mesh.vertices.resize(cur_index);
-
-    if (hasColors())
-        new_mesh.colors.resize(cur_index);
-    if (hasNormals())
-        new_mesh.normals.resize(cur_index);
-    if (hasTexcoords())
-        new_mesh.texcoords.resize(cur_index);
-
-    foreach_idx(i, vertices)
-    {
-        if (new_indices[i] < 0) continue;
-        new_mesh.vertices[new_indices[i]] = vertices[i];
-        if (hasColors())
-            new_mesh.colors[new_indices[i]] = colors[i];
-        if (hasNormals())
-            new_mesh.normals[new_indices[i]] = normals[i];
-        if (hasTexcoords())
-            new_mesh.texcoords[new_indices[i]] = texcoords[i];
-    }
-
-    foreach_idx(face_i, faces)
-    {
-        foreach_idx(v_i, faces[face_i])
-        {
-            int old_index = faces[face_i].indices[v_i];
-            int new_index = new_indices[old_index];
-            if (new_index < 0)
-            {
-                faces[face_i].kill();
-                break;
-            }
-
-            faces[face_i].indices[v_i] = new_index;
-        }
-    }
-
-    vertices = new_mesh.vertices;
-    colors = new_mesh.colors;
-    normals = new_mesh.normals;
+    std::vector<unsigned char> keep (vertices.size());
+    parallel_for(0, vertices.size(), NotNanVertexMaskBody(vertices, keep), compaction_chunk_size);
+    compactVertices(keep);
 
     removeDeadFaces();
 }
@@ -1485,35 +1552,38 @@ float Mesh::faceArea(int face_id) const
 
 void Mesh::removeDeadFaces()
 {
-    std::vector<Face> new_faces;
-    new_faces.reserve(faces.size());
+    std::vector<unsigned char> keep (faces.size());
+    parallel_for(0, faces.size(), AliveFaceMaskBody(faces, keep), compaction_chunk_size);
+    compactFaces(keep);
+}
+
+int Mesh::compactVertices(const std::vector<unsigned char>& keep_vertex)
+{
+    ntk_assert(keep_vertex.size() == vertices.size(), "Mask does not match the vertices.");
 
-    std::vector<FaceTexcoord> new_face_texcoords;
-    new_face_texcoords.reserve(face_texcoords.size());
+    std::vector<int> new_indices;
+    const int new_size = compute_compaction_indices(keep_vertex, new_indices);
 
-    std::vector<int> new_face_labels;
-    new_face_labels.reserve(face_labels.size());
+    compact_stream(vertices, new_indices, new_size);
+    compact_stream(colors, new_indices, new_size);
+    compact_stream(normals, new_indices, new_size);
+    compact_stream(texcoords, new_indices, new_size);
 
-    foreach_idx(face_i, faces)
-    {
-        const Face& face = faces[face_i];
-        if (!face.isValid()
-                || face.indices[0] == face.indices[1]
-                || face.indices[0] == face.indices[2]
-                || face.indices[1] == face.indices[2])
-            continue;
-        new_faces.push_back(face);
+    parallel_for(0, faces.size(), RemapFacesBody(faces, new_indices), compaction_chunk_size);
+    return new_size;
+}
 
-        if (hasFaceTexcoords())
-            new_face_texcoords.push_back(face_texcoords[face_i]);
+int Mesh::compactFaces(const std::vector<unsigned char>& keep_face)
+{
+    ntk_assert(keep_face.size() == faces.size(), "Mask does not match the faces.");
 
-        if (hasFaceLabels())
-            new_face_labels.push_back(face_labels[face_i]);
-    }
+    std::vector<int> new_indices;
+    const int new_size = compute_compaction_indices(keep_face, new_indices);
 
-    faces = new_faces;
-    face_texcoords = new_face_texcoords;
-    face_labels = new_face_labels;
+    compact_stream(faces, new_indices, new_size);
+    compact_stream(face_texcoords, new_indices, new_size);
+    compact_stream(face_labels, new_indices, new_size);
+    return new_size;
 }
 
 cv::Point3f barycentricCoordinates(const cv::Point3f ref_points[3], const cv::Point3f& p)
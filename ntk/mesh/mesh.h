@@ -66,7 +66,7 @@ namespace ntk
   {
   public:
     Face(unsigned i1, unsigned i2, unsigned i3)
-    { indices[0] = i1; indices[1] = i2; indices[2] = i2; }
+    { indices[0] = i1; indices[1] = i2; indices[2] = i3; }
 
     Face() {}
 
@@ -242,6 +242,24 @@ namespace ntk
 
     void removeFacesWithoutVisibility();
 
+    // Compaction
+  public:
+    /*!
+     * Keep only the vertices with a non-zero keep_vertex entry.
+     * Every per-vertex stream is compacted and face indices are remapped
+     * in parallel, using a prefix sum of the mask. Per-vertex streams whose
+     * size does not match the vertices are cleared. Faces referencing a
+     * removed vertex are killed, use removeDeadFaces to drop them.
+     * Returns the new number of vertices.
+     */
+    int compactVertices(const std::vector<unsigned char>& keep_vertex);
+
+    /*!
+     * Keep only the faces with a non-zero keep_face entry, along with
+     * their texcoords and labels. Returns the new number of faces.
+     */
+    int compactFaces(const std::vector<unsigned char>& keep_face);
+
   public:
     bool hasColors() const { return colors.size() == vertices.size(); }
     bool hasNormals() const { return normals.size() == vertices.size(); }
@@ -23,12 +23,45 @@
 #include <ntk/geometry/pose_3d.h>
 #include <ntk/numeric/levenberg_marquart_minimizer.h>
 #include <ntk/utils/time.h>
+#include <ntk/utils/sse.h>
 
 using namespace cv;
 
 namespace ntk
 {
 
+namespace
+{
+
+// 21 bits per coordinate, enough for 2km at 1mm resolution.
+inline quint64 voxel_key(const vectorial::vec4f& p, float inv_voxel_size)
+{
+    const quint64 mask = (1 << 21) - 1;
+    quint64 x = quint64(qint64(floorf(p.x() * inv_voxel_size))) & mask;
+    quint64 y = quint64(qint64(floorf(p.y() * inv_voxel_size))) & mask;
+    quint64 z = quint64(qint64(floorf(p.z() * inv_voxel_size))) & mask;
+    return (x << 42) | (y << 21) | z;
+}
+
+}
+
+Mesh& RGBDModeler :: editableMesh()
+{
+    if (m_mesh_shared)
+    {
+        m_mesh = new Mesh(*m_mesh);
+        m_mesh_shared = false;
+    }
+    return *m_mesh;
+}
+
+Mesh& RGBDModeler :: newMesh()
+{
+    m_mesh = new Mesh;
+    m_mesh_shared = false;
+    return *m_mesh;
+}
+
 bool RGBDModeler :: addNewView(const RGBDImage& image, Pose3D& depth_pose)
 {
     Pose3D rgb_pose = depth_pose;
@@ -38,28 +71,66 @@ bool RGBDModeler :: addNewView(const RGBDImage& image, Pose3D& depth_pose)
     world_to_camera_normal_pose.applyTransformBefore(Vec3f(0,0,0), depth_pose.cvEulerRotation());
     Pose3D camera_to_world_normal_pose = world_to_camera_normal_pose; camera_to_world_normal_pose.invert();
 
-    const Mat1f& depth_im = image.depth();    
-    for_all_rc(depth_im)
+    VectorialProjector rgb_projector (rgb_pose);
+    const vectorial::mat4f normal_transform = toSSE(camera_to_world_normal_pose.cvCameraTransform());
+
+    // The unprojection of (c, r, d) is d * (c*col_axis + r*row_axis + z_axis) + origin,
+    // which avoids a full matrix product per pixel.
+    const vectorial::mat4f unproject = toSSE(depth_pose.cvInvProjectionMatrix());
+    const vectorial::vec4f col_axis = unproject * vectorial::vec4f(1, 0, 0, 0);
+    const vectorial::vec4f row_axis = unproject * vectorial::vec4f(0, 1, 0, 0);
+    const vectorial::vec4f z_axis = unproject * vectorial::vec4f(0, 0, 1, 0);
+    const vectorial::vec4f origin = unproject * vectorial::vec4f(0, 0, 0, 1);
+
+    const bool use_voxels = m_voxel_size > 0;
+    const float inv_voxel_size = use_voxels ? 1.f / m_voxel_size : 0.f;
+    const bool has_normals = image.normal().data;
+
+    const Mat1f& depth_im = image.depth();
+    const Mat1b& depth_mask = image.depthMask();
+    const Mat3b& rgb_im = image.rgb();
+    Mesh& mesh = editableMesh();
+    for (int r = 0; r < depth_im.rows; ++r)
     {
-        if (!image.depthMask()(r,c))
-            continue;
-        float depth = depth_im(r,c) + m_global_depth_offset;
-        Point3f p3d = depth_pose.unprojectFromImage(Point2f(c,r), depth);
-        Point3f p_rgb = rgb_pose.projectToImage(p3d);
-        if (!is_yx_in_range(image.rgb(), p_rgb.y, p_rgb.x))
-            continue;
+        const float* depth_row = depth_im.ptr<float>(r);
+        const uchar* mask_row = depth_mask.ptr<uchar>(r);
+        const Vec3f* normal_row = has_normals ? image.normal().ptr<Vec3f>(r) : 0;
 
-        if (!m_bounding_box.isEmpty() && !m_bounding_box.isPointInside(p3d))
-            continue;
+        const vectorial::vec4f row_ray = z_axis + row_axis * float(r);
+        for (int c = 0; c < depth_im.cols; ++c)
+        {
+            if (!mask_row[c])
+                continue;
+
+            const float depth = depth_row[c] + m_global_depth_offset;
+            const vectorial::vec4f p3d = (row_ray + col_axis * float(c)) * depth + origin;
 
-        Vec3f camera_normal = image.normal().data ? image.normal()(r, c) : Vec3f(0,0,1);
-        Vec3f world_normal = camera_to_world_normal_pose.cameraTransform(camera_normal);
-        normalize(world_normal);
+            const vectorial::vec4f p_rgb = rgb_projector.projectToImage(p3d);
+            if (!is_yx_in_range(rgb_im, p_rgb.y(), p_rgb.x()))
+                continue;
 
-        cv::Vec3b color = bgr_to_rgb(image.rgb()(p_rgb.y, p_rgb.x));
-        m_mesh.vertices.push_back(p3d);
-        m_mesh.colors.push_back(color);
-        m_mesh.normals.push_back(world_normal);
+            if (!m_bounding_box.isEmpty() && !m_bounding_box.isPointInside(toPoint3f(p3d)))
+                continue;
+
+            if (use_voxels)
+            {
+                quint64 key = voxel_key(p3d, inv_voxel_size);
+                if (m_occupied_voxels.contains(key))
+                    continue;
+                m_occupied_voxels.insert(key);
+            }
+
+            // Pixels without a valid normal face the camera, as when there is no normal image.
+            Vec3f camera_normal (0,0,1);
+            if (normal_row && normal_row[c].dot(normal_row[c]) > 1e-12f)
+                camera_normal = normal_row[c];
+            const vectorial::vec4f world_normal = vectorial::normalize(
+                        normal_transform * vectorial::vec4f(camera_normal[0], camera_normal[1], camera_normal[2], 0));
+
+            mesh.vertices.push_back(toPoint3f(p3d));
+            mesh.colors.push_back(bgr_to_rgb(rgb_im(p_rgb.y(), p_rgb.x())));
+            mesh.normals.push_back(toPoint3f(world_normal));
+        }
     }
 
     return true;
@@ -75,29 +146,45 @@ RGBDModelerInOwnThread::~RGBDModelerInOwnThread()
 bool RGBDModelerInOwnThread::addNewView(const RGBDImage &image, Pose3D &depth_pose)
 {
     ntk::TimeCount tc("INOWNTHREAD", 2);
+    RGBDImagePtr image_copy (new RGBDImage);
+    image.copyTo(*image_copy);
+    tc.stop();
+    return addNewView(image_copy, depth_pose);
+}
+
+bool RGBDModelerInOwnThread::addNewView(RGBDImageConstPtr image, const Pose3D& depth_pose)
+{
     FrameEventDataPtr data (new FrameEventData);
     data->type = FrameEventData::NewImage;
-    image.copyTo(data->image);
+    data->image = image;
     data->pose = depth_pose;
     newEvent(this, data);
-    tc.stop();
     return true;
 }
 
-const Mesh& RGBDModelerInOwnThread::currentMesh() const
+MeshConstPtr RGBDModelerInOwnThread::meshSnapshot(int* generation) const
+{
+    QMutexLocker locker(&m_snapshot_lock);
+    if (generation)
+        *generation = m_mesh_generation;
+    return m_mesh_snapshot;
+}
+
+int RGBDModelerInOwnThread::meshGeneration() const
 {
-    // The lock has been acquired from outside.
-    acquireLock();
+    QMutexLocker locker(&m_snapshot_lock);
+    return m_mesh_generation;
+}
 
-    // FIXME: this check is a bit hacky. The mesh could have changed
-    // without changing the number of vertices. But for now it works
-    // well enough to avoid copying the mesh on every access.
-    if (m_mesh.vertices.size() != new_mesh.vertices.size())
-        *(const_cast<Mesh*>(&m_mesh)) = new_mesh;
+void RGBDModelerInOwnThread::publishMeshSnapshot()
+{
+    // The child copies its mesh before modifying it again,
+    // readers only wait for the pointer swap.
+    MeshConstPtr snapshot = child->currentMesh();
 
-    // Lock released.
-    releaseLock();
-    return m_mesh;
+    QMutexLocker locker(&m_snapshot_lock);
+    m_mesh_snapshot = snapshot;
+    ++m_mesh_generation;
 }
 
 void RGBDModelerInOwnThread::computeMesh()
@@ -128,6 +215,15 @@ void RGBDModelerInOwnThread::reset()
     newEvent(&mesh_event_sender, data);
 }
 
+void RGBDModelerInOwnThread::setVoxelSize(float voxel_size)
+{
+    m_voxel_size = voxel_size;
+    FrameEventDataPtr data (new FrameEventData);
+    data->type = FrameEventData::SetVoxelSize;
+    data->voxel_size = voxel_size;
+    newEvent(&config_event_sender, data);
+}
+
 void RGBDModelerInOwnThread::run()
 {
     setThreadShouldExit(false);
@@ -145,43 +241,42 @@ void RGBDModelerInOwnThread::run()
         {
         case FrameEventData::NewImage:
         {
-            child->addNewView(data->image, data->pose);
+            child->addNewView(*data->image, data->pose);
             break;
         }
 
         case FrameEventData::ComputeMesh:
         {
             child->computeMesh();
-            acquireLock();
-            new_mesh = child->currentMesh();
-            releaseLock();
+            publishMeshSnapshot();
             break;
         }
 
         case FrameEventData::ComputeSurfaceMesh:
         {
             child->computeSurfaceMesh();
-            acquireLock();
-            new_mesh = child->currentMesh();
-            releaseLock();
+            publishMeshSnapshot();
             break;
         }
 
         case FrameEventData::ComputeAccurateSurfaceColor:
         {
             child->computeAccurateVerticeColors();
-            acquireLock();
-            new_mesh = child->currentMesh();
-            releaseLock();
+            publishMeshSnapshot();
             break;
         }
 
         case FrameEventData::Reset:
         {
             child->reset();
-            acquireLock();
-            new_mesh = child->currentMesh();
-            releaseLock();
+            publishMeshSnapshot();
+            break;
+        }
+
+        case FrameEventData::SetVoxelSize:
+        {
+            child->setVoxelSize(data->voxel_size);
+            publishMeshSnapshot();
             break;
         }
         };
@@ -28,6 +28,8 @@
 #include <ntk/thread/utils.h>
 #include <ntk/thread/event.h>
 
+#include <QSet>
+
 namespace ntk
 {
 
@@ -37,14 +39,21 @@ class RGBDModeler
 {
 public:
     RGBDModeler() :
+        m_mesh(new Mesh),
+        m_mesh_shared(false),
         m_global_depth_offset(0),
-        m_use_surfels(false)
+        m_use_surfels(false),
+        m_voxel_size(0)
     {}
 
 public:
     virtual void acquireLock() const {}
     virtual void releaseLock() const {}
-    virtual const Mesh& currentMesh() const { return m_mesh; }
+    /*!
+     * Current model, shared without copy. The returned mesh is never modified
+     * afterwards, the modeler copies it before its next in-place update.
+     */
+    virtual MeshConstPtr currentMesh() const { m_mesh_shared = true; return m_mesh; }
     const RGBDImage& lastImage() const { return m_last_image; }
     void setGlobalDepthOffset(float offset) { m_global_depth_offset = offset; }
     virtual float resolution() const { return 0; }
@@ -55,20 +64,38 @@ public:
     void setSurfelRendering(bool use_surfels) { m_use_surfels = use_surfels; }
     void setBoundingBox(const Rect3f& bbox) { m_bounding_box = bbox; }
 
+    /*!
+     * Only add a point if its voxel does not already have one, so that the
+     * model size depends on the scanned volume and not on the number of views.
+     * 0 disables it. Changing it resets the model.
+     */
+    void setVoxelSize(float voxel_size) { m_voxel_size = voxel_size; reset(); }
+    float voxelSize() const { return m_voxel_size; }
+
 public:
     virtual bool addNewView(const RGBDImage& image, Pose3D& depth_pose);
     virtual void computeMesh() {}
     virtual void computeSurfaceMesh() { computeMesh(); }
     virtual void computeAccurateVerticeColors() {}
-    virtual void reset() { m_mesh.clear(); }
+    virtual void reset() { newMesh(); m_occupied_voxels.clear(); }
+
+protected:
+    /*! Mesh to update in place, copied first if it was shared by currentMesh(). */
+    Mesh& editableMesh();
+
+    /*! Start a new empty mesh, leaving a shared one untouched. */
+    Mesh& newMesh();
 
 protected:
-    ntk::Mesh m_mesh;
+    MeshPtr m_mesh;
+    mutable bool m_mesh_shared;
     float m_global_depth_offset;
     ntk::Plane m_support_plane;
     ntk::RGBDImage m_last_image;
     bool m_use_surfels;
     Rect3f m_bounding_box;
+    float m_voxel_size;
+    QSet<quint64> m_occupied_voxels;
 };
 ntk_ptr_typedefs(RGBDModeler)
 
@@ -106,11 +133,13 @@ public:
                          ComputeMesh = 1,
                          ComputeSurfaceMesh = 2,
                          ComputeAccurateSurfaceColor = 3,
-                         Reset = 4};
+                         Reset = 4,
+                         SetVoxelSize = 5};
 
         EventType type;
-        RGBDImage image;
+        RGBDImageConstPtr image; // shared, never modified after being queued.
         ntk::Pose3D pose;
+        float voxel_size;
     };
     ntk_ptr_typedefs(FrameEventData)
 
@@ -121,6 +150,8 @@ public:
     RGBDModelerInOwnThread(Name name, RGBDModelerPtr child)
     : EventProcessingBlockInOwnThread(name)
     , child (child)
+    , m_mesh_snapshot (new Mesh)
+    , m_mesh_generation (0)
     {}
 
     virtual ~RGBDModelerInOwnThread();
@@ -128,19 +159,46 @@ public:
 public:
     virtual void acquireLock() const { lock.lock(); }
     virtual void releaseLock() const { lock.unlock(); }
-    virtual const Mesh& currentMesh() const; //  { return child->currentMesh(); }
+
+    /*! Last published mesh, same as meshSnapshot(). */
+    virtual MeshConstPtr currentMesh() const { return meshSnapshot(); }
+
+    /*!
+     * Last mesh published by the modeler thread, in O(1).
+     * Snapshots are immutable and shared with the child modeler without copy,
+     * a new one is published after each mesh computation. If generation is not null, it is set to the snapshot
+     * generation number, which increases with each publication.
+     */
+    MeshConstPtr meshSnapshot(int* generation = 0) const;
+
+    /*! Generation number of the last published mesh. */
+    int meshGeneration() const;
     const RGBDImage& lastImage() const { return child->lastImage(); }
     void setGlobalDepthOffset(float offset) { child->setGlobalDepthOffset(offset); }
     virtual float resolution() const { return child->resolution(); }
     virtual void setResolution(float resolution) { return child->setResolution(resolution); }
-    virtual void setDepthMargin(float depth_margin) { return setDepthMargin(depth_margin); }
+    virtual void setDepthMargin(float depth_margin) { return child->setDepthMargin(depth_margin); }
     const ntk::Plane& supportPlane() const { return child->supportPlane(); }
     virtual int numPoints() const { return child->numPoints(); }
     void setSurfelRendering(bool use_surfels) { return child->setSurfelRendering(use_surfels); }
     void setBoundingBox(const Rect3f& bbox) { return child->setBoundingBox(bbox); }
 
+    /*!
+     * Applied by the modeler thread, together with the model reset.
+     * Only the latest requested size is kept if several are pending.
+     */
+    void setVoxelSize(float voxel_size);
+
 public:
+    /*!
+     * Queue a copy of image, the caller keeps ownership of its buffers.
+     * Prefer the RGBDImageConstPtr overload to avoid the copy.
+     */
     virtual bool addNewView(const RGBDImage& image, Pose3D& depth_pose);
+
+    /*! Queue image without copying it. It must not be modified afterwards. */
+    bool addNewView(RGBDImageConstPtr image, const Pose3D& depth_pose);
+
     virtual void computeMesh();
     virtual void computeSurfaceMesh();
     virtual void computeAccurateVerticeColors();
@@ -149,11 +207,19 @@ public:
 public:
     virtual void run();
 
+protected:
+    void publishMeshSnapshot();
+
 protected:
     RGBDModelerPtr child;
-    Mesh new_mesh;
     MeshEventSender mesh_event_sender;
+    MeshEventSender config_event_sender;
     mutable RecursiveQMutex lock;
+
+private:
+    mutable QMutex m_snapshot_lock;
+    MeshConstPtr m_mesh_snapshot;
+    int m_mesh_generation;
 };
 ntk_ptr_typedefs(RGBDModelerInOwnThread)
 
@@ -267,10 +267,10 @@ bool SurfelsRGBDModeler :: addNewView(const RGBDImage& image_, Pose3D& depth_pos
 
 void SurfelsRGBDModeler :: computeMesh()
 {
-    m_mesh.clear();
-    m_mesh.vertices.reserve(m_surfels.size());
-    m_mesh.normals.reserve(m_surfels.size());
-    m_mesh.colors.reserve(m_surfels.size());
+    Mesh& mesh = newMesh();
+    mesh.vertices.reserve(m_surfels.size());
+    mesh.normals.reserve(m_surfels.size());
+    mesh.colors.reserve(m_surfels.size());
 
     foreach_const_it(it, m_surfels, SurfelMap)
     {
@@ -282,9 +282,9 @@ void SurfelsRGBDModeler :: computeMesh()
             continue;
 
         if (m_use_surfels)
-            m_mesh.addSurfel(surfel);
+            mesh.addSurfel(surfel);
         else
-            m_mesh.addPointFromSurfel(surfel);
+            mesh.addPointFromSurfel(surfel);
     }
 }
 
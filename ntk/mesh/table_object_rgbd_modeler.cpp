@@ -180,7 +180,7 @@ void TableObjectRGBDModeler :: reset()
 
 void TableObjectRGBDModeler :: computeMesh()
 {
-    m_mesh.clear();
+    Mesh& mesh = newMesh();
 
     // First pass fill up
     for_all_drc(m_voxels)
@@ -199,13 +199,13 @@ void TableObjectRGBDModeler :: computeMesh()
             p.x += m_resolution/2.0;
         }
 #endif
-        m_mesh.addCube(p, Point3f(size_x,m_resolution,m_resolution), color);
+        mesh.addCube(p, Point3f(size_x,m_resolution,m_resolution), color);
     }
 }
 
 void TableObjectRGBDModeler :: computeSurfaceMesh()
 {
-    m_mesh.clear();
+    Mesh& mesh = newMesh();
     for_all_drc(m_voxels)
     {
         if (m_voxels(d,r,c) != ObjectVoxel)
@@ -225,21 +225,22 @@ void TableObjectRGBDModeler :: computeSurfaceMesh()
         Point3f p = toRealWorld(Point3f(c,r,d));
         float size_x = m_resolution;
         const Vec3b& color = m_voxels_color(d,r,c);
-        m_mesh.addCube(p, Point3f(size_x,m_resolution,m_resolution), color);
+        mesh.addCube(p, Point3f(size_x,m_resolution,m_resolution), color);
     }    
 }
 
 void TableObjectRGBDModeler :: computeAccurateVerticeColors()
 {
-    std::fill(stl_bounds(m_mesh.colors), Vec3b(255,255,255));
+    Mesh& mesh = editableMesh();
+    std::fill(stl_bounds(mesh.colors), Vec3b(255,255,255));
     cv::Mat4b projected_image = toMat4b(m_last_image.rgb());
     MeshRenderer renderer(m_last_image.rgb().cols, m_last_image.rgb().rows);
-    renderer.setMesh(m_mesh);
+    renderer.setMesh(mesh);
     renderer.setPose(*m_last_image.calibration()->rgb_pose);
     renderer.renderToImage(projected_image, MeshRenderer::NORMAL);
-    foreach_idx(i, m_mesh.vertices)
+    foreach_idx(i, mesh.vertices)
     {
-        Point3f p = m_last_image.calibration()->rgb_pose->projectToImage(m_mesh.vertices[i]);
+        Point3f p = m_last_image.calibration()->rgb_pose->projectToImage(mesh.vertices[i]);
         int r = ntk::math::rnd(p.y);
         int c = ntk::math::rnd(p.x);
         Vec3b color (255,255,255);
@@ -251,7 +252,7 @@ void TableObjectRGBDModeler :: computeAccurateVerticeColors()
                 color = bgr_to_rgb(m_last_image.rgb()(r,c));
             }
         }
-        m_mesh.colors[i] = color;
+        mesh.colors[i] = color;
     }
 }
 
@@ -26,68 +26,223 @@
 #include <algorithm>
 #include <ntk/numeric/cost_function.h>
 #include <ntk/numeric/levenberg_marquart_minimizer.h>
+#include <ntk/thread/parallel.h>
 
 namespace ntk
 {
 
-void mean_empirical_distribution(EmpiricalDistribution& mean_distrib,
-                                 const std::vector<double>& distrib,
-                                 int n_values,
-                                 double precision)
+namespace
 {
-  mean_distrib.reset();
-  cv::Mat_< std::complex<double> > cv_array (1, cv::getOptimalDFTSize(distrib.size()*n_values+1));
-  cv_array = std::complex<double>(0);
-  foreach_idx(i, distrib) cv_array(0,i) = distrib[i];
-  cv::dft(cv_array, cv_array);
-  for (int c = 0; c < cv_array.cols; ++c)
-    cv_array(0,c) = std::pow(cv_array(0,c), n_values);
-  cv::idft(cv_array, cv_array);
-  std::map<double,double> raw_pdf;
-  for (int i = distrib.size()*n_values; i >=0; --i)
+
+typedef cv::Mat_< std::complex<double> > ComplexArray;
+
+// Smallest power of two >= size.
+int dft_power_of_two_size(int size)
+{
+  int dft_size = 1;
+  while (dft_size < size)
+    dft_size *= 2;
+  return dft_size;
+}
+
+// Fill mean_distrib from the n-th power of the spectrum of a raw pdf
+// whose bin i has value i*precision. powered_spectrum is modified.
+void mean_distribution_from_spectrum(EmpiricalDistribution& mean_distrib,
+                                     ComplexArray& powered_spectrum,
+                                     int raw_size,
+                                     double precision,
+                                     int n_values)
+{
+  cv::idft(powered_spectrum, powered_spectrum);
+
+  const int support_size = raw_size*n_values+1;
+  ntk_assert(support_size <= powered_spectrum.cols, "Spectrum too small, results would be aliased.");
+  std::vector< std::pair<double,double> > raw_pdf;
+  raw_pdf.reserve(support_size);
+  for (int i = 0; i < support_size; ++i)
   {
-    double p = cv_array(0, i).real()/cv_array.cols;
+    double p = powered_spectrum(0, i).real()/powered_spectrum.cols;
     if (p > 1e-16)
-      raw_pdf[double(i*precision)/n_values] = p;
+      raw_pdf.push_back(std::make_pair(double(i*precision)/n_values, p));
   }
+
+  mean_distrib.reset(precision);
   mean_distrib.setRawPdf(raw_pdf);
 }
 
-void mean_empirical_distribution(EmpiricalDistribution& mean_distrib,
-                                 const EmpiricalDistribution& raw_distrib,
-                                 int n_values)
+// Sample the raw distribution on its bins. Returns false if it cannot be used.
+bool sample_raw_distribution(const EmpiricalDistribution& raw_distrib, std::vector<double>& distrib_vector)
 {
-  mean_distrib.reset(raw_distrib.precision());
   const std::map<int, double>& distrib_map = raw_distrib.rawDistribution();
-  if (distrib_map.size() < 2) return;
+  if (distrib_map.size() < 2) return false;
   int min_value = distrib_map.begin()->first;
   int max_value = distrib_map.rbegin()->first;
   if (min_value < 0)
   {
     ntk_dbg(0) << "Cannot estimate mean for negative values.";
-    return;
+    return false;
   }
-  std::vector<double> distrib_vector(max_value+1, 0);
+  distrib_vector.resize(max_value+1, 0);
   foreach_idx(i, distrib_vector)
   {
     distrib_vector[i] = 10000.0 * (raw_distrib.cdf(double(i) * raw_distrib.precision())
                                    - raw_distrib.cdf(double(i-1.0) * raw_distrib.precision()));
   }
+  return true;
+}
+
+void compute_spectrum(const std::vector<double>& distrib, int dft_size, ComplexArray& spectrum)
+{
+  spectrum.create(1, dft_size);
+  spectrum = std::complex<double>(0);
+  foreach_idx(i, distrib) spectrum(0,i) = distrib[i];
+  cv::dft(spectrum, spectrum);
+}
+
+}
+
+void mean_empirical_distribution(EmpiricalDistribution& mean_distrib,
+                                 const std::vector<double>& distrib,
+                                 int n_values,
+                                 double precision)
+{
+  ComplexArray cv_array;
+  compute_spectrum(distrib, cv::getOptimalDFTSize(distrib.size()*n_values+1), cv_array);
+  for (int c = 0; c < cv_array.cols; ++c)
+    cv_array(0,c) = std::pow(cv_array(0,c), n_values);
+  mean_distribution_from_spectrum(mean_distrib, cv_array, distrib.size(), precision, n_values);
+}
+
+void mean_empirical_distribution(EmpiricalDistribution& mean_distrib,
+                                 const EmpiricalDistribution& raw_distrib,
+                                 int n_values)
+{
+  mean_distrib.reset(raw_distrib.precision());
+  std::vector<double> distrib_vector;
+  if (!sample_raw_distribution(raw_distrib, distrib_vector))
+    return;
 
   mean_empirical_distribution(mean_distrib, distrib_vector, n_values, mean_distrib.precision());
 }
 
 void EmpiricalMeanDistribution :: reset(const EmpiricalDistribution& raw_distribution)
 {
+  QWriteLocker locker(&m_lock);
   m_raw_distribution = &raw_distribution;
+  m_precision = raw_distribution.precision();
   m_mean_distributions.clear();
   m_mean_distributions.resize(m_max_exact_size);
-  foreach_idx(i, m_mean_distributions)
+  m_spectrum.release();
+
+  std::vector<double> distrib_vector;
+  if (!sample_raw_distribution(raw_distribution, distrib_vector))
+  {
+    m_raw_size = 0;
+    return;
+  }
+
+  // A power of two, so that the spectrum for smaller n can be obtained
+  // by subsampling it.
+  m_raw_size = distrib_vector.size();
+  compute_spectrum(distrib_vector, dft_power_of_two_size(m_raw_size*m_max_exact_size+1), m_spectrum);
+}
+
+void EmpiricalMeanDistribution ::
+computeExactDistributions(int first_n, int last_n, std::vector<EmpiricalDistributionPtr>& output) const
+{
+  output.clear();
+  ComplexArray full_power;
+  for (int n = first_n; n <= last_n; ++n)
+  {
+    EmpiricalDistributionPtr distrib (new EmpiricalDistribution(m_precision));
+    output.push_back(distrib);
+    if (m_spectrum.empty())
+      continue;
+
+    // Successive spectral powers.
+    if (full_power.empty())
+    {
+      full_power.create(m_spectrum.size());
+      for (int c = 0; c < m_spectrum.cols; ++c)
+        full_power(0,c) = std::pow(m_spectrum(0,c), n);
+    }
+    else
+    {
+      for (int c = 0; c < m_spectrum.cols; ++c)
+        full_power(0,c) *= m_spectrum(0,c);
+    }
+
+    // The pdf of the mean of n values spans raw_size*n+1 bins. Subsampling
+    // the spectrum by a factor s gives the DFT of the pdf aliased with a
+    // period cols/s, which is exact as long as that period covers the support.
+    int dft_size = full_power.cols;
+    while (dft_size % 2 == 0 && dft_size/2 >= m_raw_size*n+1)
+      dft_size /= 2;
+    const int stride = full_power.cols / dft_size;
+
+    ComplexArray powered_spectrum (1, dft_size);
+    for (int c = 0; c < dft_size; ++c)
+      powered_spectrum(0,c) = full_power(0, c*stride);
+
+    mean_distribution_from_spectrum(*distrib, powered_spectrum, m_raw_size, m_precision, n);
+  }
+}
+
+struct EmpiricalMeanDistribution::PrecomputeBody
+{
+  PrecomputeBody(const EmpiricalMeanDistribution& that,
+                 std::vector< std::vector<EmpiricalDistributionPtr> >& outputs)
+    : that(that), outputs(outputs)
+  {}
+
+  void operator()(const ntk::IndexRange& range) const
+  {
+    that.computeExactDistributions(range.begin+1, range.end, outputs[range.chunk]);
+  }
+
+  const EmpiricalMeanDistribution& that;
+  std::vector< std::vector<EmpiricalDistributionPtr> >& outputs;
+};
+
+void EmpiricalMeanDistribution :: precomputeAll()
+{
+  // The spectrum is only modified by reset, no need to lock while computing.
+  std::vector<ntk::IndexRange> chunks;
+  ntk::split_range(0, m_max_exact_size, ntk::parallel_num_chunks(m_max_exact_size, 1), chunks);
+  std::vector< std::vector<EmpiricalDistributionPtr> > outputs (chunks.size());
+  ntk::parallel_for_chunks(chunks, PrecomputeBody(*this, outputs));
+
+  // Keep the distributions already computed, references to them may be held.
+  QWriteLocker locker(&m_lock);
+  foreach_idx(chunk_i, chunks)
+    foreach_idx(i, outputs[chunk_i])
+    {
+      EmpiricalDistributionPtr& distrib = m_mean_distributions[chunks[chunk_i].begin + i];
+      if (!distrib)
+        distrib = outputs[chunk_i][i];
+    }
+}
+
+const EmpiricalDistribution& EmpiricalMeanDistribution :: exactDistribution(unsigned n) const
+{
+  // Distributions are never replaced once computed, so the common case
+  // only needs the shared lock.
+  {
+    QReadLocker locker(&m_lock);
+    const EmpiricalDistributionPtr& distrib = m_mean_distributions[n-1];
+    if (distrib)
+      return *distrib;
+  }
+
+  QWriteLocker locker(&m_lock);
+  EmpiricalDistributionPtr& distrib = m_mean_distributions[n-1];
+  if (!distrib)
   {
-    EmpiricalDistribution* distrib = new EmpiricalDistribution(m_raw_distribution->precision());
-    mean_empirical_distribution(*distrib, *m_raw_distribution, i+1);
-    m_mean_distributions[i] = toPtr(distrib);
+    std::vector<EmpiricalDistributionPtr> output;
+    computeExactDistributions(n, n, output);
+    distrib = output[0];
   }
+  return *distrib;
 }
 
 double EmpiricalMeanDistribution :: logCdf(unsigned n, double mean) const
@@ -98,7 +253,7 @@ double EmpiricalMeanDistribution :: logCdf(unsigned n, double mean) const
   }
 
   if (n == 0) return 0;
-  return m_mean_distributions[n-1]->logCdf(mean);
+  return exactDistribution(n).logCdf(mean);
 }
 
 // Taken from the Gnu Gama library  http://www.gnu.org/software/gama/
@@ -173,6 +328,70 @@ unsigned draw_from_distrib(const std::vector<double>& distrib, cv::RNG& rgen)
   return distrib.size() - 1;
 }
 
+void DiscreteSampler :: reset(const std::vector<double>& weights)
+{
+  const int n = weights.size();
+  m_probabilities.resize(n);
+  m_aliases.resize(n);
+  if (n == 0)
+    return;
+
+  const double sum = std::accumulate(stl_bounds(weights), 0.0);
+  ntk_assert(sum > 0, "Weights must have a positive sum.");
+
+  // Vose's alias method.
+  std::vector<double> scaled (n);
+  std::vector<int> small, large;
+  small.reserve(n);
+  large.reserve(n);
+  for (int i = 0; i < n; ++i)
+  {
+    scaled[i] = weights[i] * n / sum;
+    if (scaled[i] < 1.0)
+      small.push_back(i);
+    else
+      large.push_back(i);
+  }
+
+  while (!small.empty() && !large.empty())
+  {
+    int s = small.back(); small.pop_back();
+    int l = large.back();
+    m_probabilities[s] = scaled[s];
+    m_aliases[s] = l;
+    scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+    if (scaled[l] < 1.0)
+    {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+
+  // Remaining columns are full, up to rounding errors.
+  foreach_idx(i, large)
+  {
+    m_probabilities[large[i]] = 1.f;
+    m_aliases[large[i]] = large[i];
+  }
+  foreach_idx(i, small)
+  {
+    m_probabilities[small[i]] = 1.f;
+    m_aliases[small[i]] = small[i];
+  }
+}
+
+void DiscreteSampler :: draw(cv::RNG& rgen, int num_samples, std::vector<unsigned>& samples) const
+{
+  samples.resize(num_samples);
+  const unsigned n = size();
+  for (int i = 0; i < num_samples; ++i)
+  {
+    // Column from the high bits of a 32 bits draw, avoids a modulo.
+    unsigned column = unsigned((uint64(unsigned(rgen)) * n) >> 32);
+    samples[i] = float(rgen) < m_probabilities[column] ? column : m_aliases[column];
+  }
+}
+
 OneMinusExpDistribution::OneMinusExpDistribution(
   const std::map< double, double > & distrib,
   double* loglikelihood)
@@ -304,6 +523,7 @@ void EmpiricalDistribution :: addValueFast(double value)
 void EmpiricalDistribution :: finalize()
 {
   computeCdfValues();
+  computeCdfCells();
   computeTailDecreasingRate();
 }
 
@@ -337,13 +557,19 @@ void EmpiricalDistribution :: addValue(double value)
 }
 
 void EmpiricalDistribution :: setRawPdf(const std::map<double,double>& pdf)
+{
+  std::vector< std::pair<double,double> > sorted_pdf (pdf.begin(), pdf.end());
+  setRawPdf(sorted_pdf);
+}
+
+void EmpiricalDistribution :: setRawPdf(const std::vector< std::pair<double,double> >& sorted_pdf)
 {
   QWriteLocker locker(&m_lock);
   reset(precision());
   bool first = true;
-  foreach_const_it(it, pdf, cat2(std::map<double,double>))
+  foreach_idx(i, sorted_pdf)
   {
-    int actual_value = ntk::math::rnd(it->first / m_precision);
+    int actual_value = ntk::math::rnd(sorted_pdf[i].first / m_precision);
     if (first)
     {
       m_min_value = actual_value;
@@ -356,12 +582,11 @@ void EmpiricalDistribution :: setRawPdf(const std::map<double,double>& pdf)
       m_max_value = std::max(m_max_value, actual_value);
     }
 
-    double n_values = it->second*100.0; // make sure values are big enough.
+    double n_values = sorted_pdf[i].second*100.0; // make sure values are big enough.
 
-    if (m_raw_distribution.find(actual_value) == m_raw_distribution.end())
-      m_raw_distribution[actual_value] = n_values;
-    else
-      m_raw_distribution[actual_value] += n_values;
+    // Values are sorted, so the end is the right insertion hint.
+    std::map<int,double>::iterator it = m_raw_distribution.insert(m_raw_distribution.end(), std::make_pair(actual_value, 0.0));
+    it->second += n_values;
     m_mean += (actual_value*m_precision)*n_values;
     m_nb_raw_values += n_values;
   }
@@ -376,6 +601,7 @@ void EmpiricalDistribution :: setRawPdf(const std::map<double,double>& pdf)
   m_variance /= m_nb_raw_values;
 
   computeCdfValues();
+  computeCdfCells();
   computeTailDecreasingRate();
 }
 
@@ -391,6 +617,7 @@ void EmpiricalDistribution :: invertValues()
   m_mean *= -1;
   m_raw_distribution = new_raw_values;
   computeCdfValues();
+  computeCdfCells();
 }
 
 namespace
@@ -582,6 +809,99 @@ void EmpiricalDistribution :: computeCdfValues()
     it->second = sum;
   }
   ntk_assert(m_raw_distribution.size() == 0 || flt_eq(sum, 1.0, 1e-5), "Corrupted cdf.");
+
+  computeLookupTables();
+}
+
+void EmpiricalDistribution :: computeLookupTables()
+{
+  QWriteLocker locker(&m_lock);
+  // The cdf cells are only rebuilt by computeCdfCells.
+  m_cdf_cells.clear();
+  m_cdf_upper_guide.clear();
+  m_cdf_keys.clear();
+  m_cdf_sorted_values.clear();
+  m_icdf_guide.clear();
+
+  if (m_cdf_values.empty())
+    return;
+
+  m_cdf_keys.reserve(m_cdf_values.size());
+  m_cdf_sorted_values.reserve(m_cdf_values.size());
+  foreach_const_it(it, m_cdf_values, cat2(std::map<int, double>))
+  {
+    m_cdf_keys.push_back(it->first);
+    m_cdf_sorted_values.push_back(it->second);
+  }
+
+  // Guide table, the first key whose cdf is > i/n is at index >= m_icdf_guide[i].
+  const int n = m_cdf_sorted_values.size();
+  m_icdf_guide.resize(n);
+  int key_i = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    while (key_i < n && m_cdf_sorted_values[key_i] <= double(i)/n)
+      ++key_i;
+    m_icdf_guide[i] = key_i;
+  }
+}
+
+void EmpiricalDistribution :: computeCdfCells()
+{
+  QWriteLocker locker(&m_lock);
+  m_cdf_cells.clear();
+  m_cdf_upper_guide.clear();
+
+  if (m_cdf_keys.empty() || m_max_value <= m_min_value)
+    return;
+
+  // Wider domains get a guide with wider cells, so that the table always
+  // fits and lookups only scan the few keys of one cell.
+  const int max_num_cells = 1 << 16;
+  const int n = m_cdf_keys.size();
+  if ((m_max_value - m_min_value) > max_num_cells)
+  {
+    m_cdf_guide_width = (m_max_value - m_min_value + max_num_cells - 1) / max_num_cells;
+    m_cdf_upper_guide.resize((m_max_value - m_min_value) / m_cdf_guide_width + 1);
+    int upper_i = 0;
+    foreach_idx(j, m_cdf_upper_guide)
+    {
+      const int k = m_min_value + j * m_cdf_guide_width;
+      while (upper_i < n && m_cdf_keys[upper_i] <= k)
+        ++upper_i;
+      m_cdf_upper_guide[j] = upper_i;
+    }
+    return;
+  }
+
+  // Cells between m_min_value and m_max_value, with exactly the values
+  // the interpolation between the surrounding keys would give.
+  m_cdf_cells.resize(m_max_value - m_min_value);
+  int upper_i = std::upper_bound(stl_bounds(m_cdf_keys), m_min_value) - m_cdf_keys.begin();
+  for (int k = m_min_value; k < m_max_value; ++k)
+  {
+    while (upper_i < n && m_cdf_keys[upper_i] <= k)
+      ++upper_i;
+    ntk_assert(upper_i > 0 && upper_i < n, "Cells should be surrounded by keys.");
+
+    const std::pair<double, double> a (m_cdf_keys[upper_i-1], m_cdf_sorted_values[upper_i-1]);
+    const std::pair<double, double> b (m_cdf_keys[upper_i], m_cdf_sorted_values[upper_i]);
+
+    CdfCell& cell = m_cdf_cells[k - m_min_value];
+    cell.cdf = interpolate(k + 0.5, a, b);
+    cell.lower_key = a.first;
+    cell.log_lower_cdf = log(a.second);
+    cell.log_slope = (log(b.second) - log(a.second)) / (b.first - a.first);
+  }
+}
+
+int EmpiricalDistribution :: guidedUpperKeyIndex(double actual_x) const
+{
+  const int n = m_cdf_keys.size();
+  int i = m_cdf_upper_guide[(int(floor(actual_x)) - m_min_value) / m_cdf_guide_width];
+  while (i < n && m_cdf_keys[i] <= actual_x)
+    ++i;
+  return i;
 }
 
 double EmpiricalDistribution ::
@@ -599,24 +919,30 @@ logInterpolate(double x, const std::pair<double, double>& a, const std::pair<dou
 }
 
 void EmpiricalDistribution ::
-closestValueForCdf(double expected_cdf_value, double* closest_x, double* closest_cdf)
+closestValueForCdf(double expected_cdf_value, double* closest_x, double* closest_cdf) const
 {
-  QReadLocker locker(&m_lock);
   *closest_x = m_min_value;
   *closest_cdf = 1.0;
-  foreach_const_it(it, m_cdf_values, cat2(std::map<int, double>))
-  {
-    if (it->second > expected_cdf_value)
-      break;
-    *closest_x = it->first * m_precision;
-    *closest_cdf = it->second;
-  }
+
+  const int n = m_cdf_sorted_values.size();
+  if (n == 0)
+    return;
+
+  int guide_i = std::max(0, std::min(n-1, int(expected_cdf_value * n)));
+  int i = m_icdf_guide[guide_i];
+  while (i < n && m_cdf_sorted_values[i] <= expected_cdf_value)
+    ++i;
+
+  // i is the first key whose cdf is above the expected value.
+  if (i == 0)
+    return;
+  *closest_x = m_cdf_keys[i-1] * m_precision;
+  *closest_cdf = m_cdf_sorted_values[i-1];
 }
 
 double EmpiricalDistribution ::
 cdf(const double x) const
 {
-  QReadLocker locker(&m_lock);
   if (!isAccurate()) return 1.0;
   if (m_min_value == m_max_value) return 1.0;
 
@@ -635,6 +961,17 @@ cdf(const double x) const
     return 0;
   }
 
+  if (!m_cdf_cells.empty())
+    return m_cdf_cells[int(floor(actual_x)) - m_min_value].cdf;
+
+  if (!m_cdf_upper_guide.empty())
+  {
+    const int i = guidedUpperKeyIndex(actual_x);
+    return interpolate(actual_x,
+                       std::pair<double, double>(m_cdf_keys[i-1], m_cdf_sorted_values[i-1]),
+                       std::pair<double, double>(m_cdf_keys[i], m_cdf_sorted_values[i]));
+  }
+
   std::map<int, double>::const_iterator it, lower_it;
   it = m_cdf_values.upper_bound(actual_x);
   ntk_assert(it != m_cdf_values.end() && it != m_cdf_values.begin(), "Theses cases were tested.");
@@ -645,7 +982,6 @@ cdf(const double x) const
 double EmpiricalDistribution ::
 logCdf(const double x) const
 {
-  QReadLocker locker(&m_lock);
   if (!isAccurate()) return -1e-10;
   if (m_min_value == m_max_value) return -1e-10;
 
@@ -664,6 +1000,20 @@ logCdf(const double x) const
     return std::min(v, -1e-10);
   }
 
+  if (!m_cdf_cells.empty())
+  {
+    const CdfCell& cell = m_cdf_cells[int(floor(actual_x)) - m_min_value];
+    return std::min(1e-10, cell.log_lower_cdf + (actual_x - cell.lower_key) * cell.log_slope);
+  }
+
+  if (!m_cdf_upper_guide.empty())
+  {
+    const int i = guidedUpperKeyIndex(actual_x);
+    return std::min(1e-10, logInterpolate(actual_x,
+                                          std::pair<double, double>(m_cdf_keys[i-1], m_cdf_sorted_values[i-1]),
+                                          std::pair<double, double>(m_cdf_keys[i], m_cdf_sorted_values[i])));
+  }
+
   std::map<int, double>::const_iterator it, lower_it;
   it = m_cdf_values.upper_bound(actual_x);
   if (it == m_cdf_values.end()) return -1e-10;
@@ -743,6 +1093,7 @@ loadFromXmlElement(const XMLNode& element)
     m_max_value = 0;
   }
   computeCdfValues();
+  computeCdfCells();
   computeTailDecreasingRate();
 }
 
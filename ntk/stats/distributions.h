@@ -35,18 +35,54 @@
 # include <map>
 # include <numeric>
 # include <utility>
+# include <complex>
 
 # include <algorithm>
 
 # include <QReadWriteLock>
+# include <QMutex>
 
 namespace ntk
 {
 
 
+/*!
+ * Draw an index from a normalized discrete distribution.
+ * Linear in the distribution size, use DiscreteSampler to draw
+ * many times from the same distribution.
+ */
 unsigned draw_from_distrib(const std::vector<double>& distrib,
                            cv::RNG& rgen);
 
+/*!
+ * Draw indices from a fixed discrete distribution in constant time,
+ * using Vose's alias method. Weights do not need to be normalized.
+ * Drawing is const, several threads can share a sampler as long
+ * as each one uses its own cv::RNG.
+ */
+class DiscreteSampler
+{
+public:
+  DiscreteSampler() {}
+  DiscreteSampler(const std::vector<double>& weights) { reset(weights); }
+
+  void reset(const std::vector<double>& weights);
+  int size() const { return m_aliases.size(); }
+
+  unsigned draw(cv::RNG& rgen) const
+  {
+    unsigned column = rgen.uniform(0, size());
+    return rgen.uniform(0.f, 1.f) < m_probabilities[column] ? column : m_aliases[column];
+  }
+
+  /*! Draw num_samples indices at once. */
+  void draw(cv::RNG& rgen, int num_samples, std::vector<unsigned>& samples) const;
+
+private:
+  std::vector<float> m_probabilities;
+  std::vector<unsigned> m_aliases;
+};
+
 template <class T, class U>
 double distrib_size(const std::map<T, U>& distrib)
 {
@@ -604,6 +640,7 @@ public:
     m_mean = 0;
     m_variance = 0;
     m_tail_decreasing_rate = 0.99;
+    m_cdf_guide_width = 1;
   }
 
 public:
@@ -619,12 +656,18 @@ public:
   double tailDecreasingRate() const { return m_tail_decreasing_rate; }
 
 public:
+  /*!
+   * cdf, logCdf and closestValueForCdf are table lookups and do not lock.
+   * They must not be called concurrently with addValue, finalize or
+   * any other modifier. The constant-time cdf table is only built by
+   * finalize, so call it after a series of addValue.
+   */
   virtual double cdf(const double x) const;
   virtual double logCdf(const double x) const;
 
 public:
-  bool isAccurate() const { QReadLocker locker(&m_lock); return m_nb_raw_values > 10; }
-  void closestValueForCdf(double expected_cdf_value, double* closest_x, double* closest_cdf);
+  bool isAccurate() const { return m_nb_raw_values > 10; }
+  void closestValueForCdf(double expected_cdf_value, double* closest_x, double* closest_cdf) const;
   void addValue(double value);
   void addValueFast(double value);
   void finalize();
@@ -633,6 +676,8 @@ public:
 public:
   std::map<double,double> rawPdf() const;
   void setRawPdf(const std::map<double,double>& pdf);
+  /*! Same as above, from (value, probability) pairs sorted by value. */
+  void setRawPdf(const std::vector< std::pair<double,double> >& sorted_pdf);
   const std::map<int, double>& rawDistribution() const { return m_raw_distribution; }
 
 public:
@@ -647,12 +692,36 @@ private:
   double interpolate(double x, const std::pair<double, double>& a, const std::pair<double, double>& b) const;
   double logInterpolate(double x, const std::pair<double, double>& a, const std::pair<double, double>& b) const;
   void computeCdfValues();
+  void computeLookupTables();
+  void computeCdfCells();
   void computeTailDecreasingRate();
+  // Index in m_cdf_keys of the first key above actual_x, using m_cdf_upper_guide.
+  int guidedUpperKeyIndex(double actual_x) const;
+
+private:
+  // Interpolation data for the values x such that k <= x/precision + 0.5 < k+1.
+  struct CdfCell
+  {
+    double cdf; // cdf at k + 0.5
+    double lower_key;
+    double log_lower_cdf;
+    double log_slope;
+  };
 
 private:
   std::map<int, double> m_raw_distribution;
   std::map<int, double> m_cdf_values;
-  std::map<int, double> m_icdf_values;
+  // One cell per integer of [m_min_value, m_max_value), only built
+  // by finalize and the bulk modifiers, not by addValue.
+  std::vector<CdfCell> m_cdf_cells;
+  // Domains too wide for one cell per integer get a guide instead, giving
+  // for each group of m_cdf_guide_width integers the first key above it.
+  std::vector<int> m_cdf_upper_guide;
+  int m_cdf_guide_width;
+  // Contiguous copy of m_cdf_values with a guide table for inversion.
+  std::vector<int> m_cdf_keys;
+  std::vector<double> m_cdf_sorted_values;
+  std::vector<int> m_icdf_guide;
   double m_precision;
   int m_min_value;
   int m_max_value;
@@ -677,11 +746,16 @@ void mean_empirical_distribution(EmpiricalDistribution& mean_distrib,
                                  const EmpiricalDistribution& raw_distrib,
                                  int n_values);
 
+/*!
+ * Exact laws of the mean of 1 to max_exact_size iid variables.
+ * They all derive from a single forward DFT of the raw distribution,
+ * and are computed on first use, or all at once with precomputeAll.
+ */
 class EmpiricalMeanDistribution // inherit from Distribution
 {
 public:
   EmpiricalMeanDistribution(int max_exact_size)
-    : m_max_exact_size(max_exact_size), m_raw_distribution(0)
+    : m_max_exact_size(max_exact_size), m_raw_distribution(0), m_precision(0), m_raw_size(0)
   {}
 
   void reset(const Distribution& raw_distribution)
@@ -692,18 +766,32 @@ public:
   }
   void reset(const EmpiricalDistribution& raw_distribution);
 
+  /*! Compute all the exact distributions now, in parallel. */
+  void precomputeAll();
+
   double logCdf(unsigned n, double mean) const;
 
   const EmpiricalDistribution& rawDistrib(unsigned n) const
   {
     ntk_assert(n > 0 && n <= m_mean_distributions.size(), "No empirical distrib for this size.");
-    return *(m_mean_distributions[n-1]);
+    return exactDistribution(n);
   }
 
+private:
+  struct PrecomputeBody;
+  const EmpiricalDistribution& exactDistribution(unsigned n) const;
+  void computeExactDistributions(int first_n, int last_n, std::vector<EmpiricalDistributionPtr>& output) const;
+
 private:
   int m_max_exact_size;
   const EmpiricalDistribution* m_raw_distribution;
-  std::vector<EmpiricalDistributionPtr> m_mean_distributions;
+  double m_precision;
+  int m_raw_size;
+  // Spectrum of the raw pdf, sized for the mean of m_max_exact_size values.
+  cv::Mat_< std::complex<double> > m_spectrum;
+  // Entries are computed once and never replaced until reset.
+  mutable std::vector<EmpiricalDistributionPtr> m_mean_distributions;
+  mutable QReadWriteLock m_lock;
 };
 
 } // end of ntk
@@ -0,0 +1,226 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#include "image_statistics.h"
+
+#include <ntk/utils/debug.h>
+
+#include <vectorial/simd4f.h>
+
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+namespace ntk
+{
+
+namespace
+{
+
+inline bool is_valid_pixel(float value, const uchar* mask_row, int c)
+{
+  return value == value && (!mask_row || mask_row[c]);
+}
+
+inline void welford_update(float value, float& count, float& mean, float& m2, float& min_value, float& max_value)
+{
+  count += 1.f;
+  const float delta = value - mean;
+  mean += delta / count;
+  m2 += delta * (value - mean);
+  min_value = std::min(min_value, value);
+  max_value = std::max(max_value, value);
+}
+
+}
+
+void ImageMomentsAccumulator :: reset(cv::Size size)
+{
+  m_count.create(size); m_count = 0.f;
+  m_mean.create(size); m_mean = 0.f;
+  m_m2.create(size); m_m2 = 0.f;
+  m_min.create(size); m_min = FLT_MAX;
+  m_max.create(size); m_max = -FLT_MAX;
+}
+
+void ImageMomentsAccumulator :: addImage(const cv::Mat1f& image, const cv::Mat1b& mask)
+{
+  ntk_assert(image.size() == size(), "Image size does not match the accumulator.");
+  ntk_assert(!mask.data || mask.size() == size(), "Mask size does not match the accumulator.");
+
+  const simd4f one = simd4f_splat(1.f);
+  for (int r = 0; r < image.rows; ++r)
+  {
+    const float* values = image.ptr<float>(r);
+    const uchar* mask_row = mask.data ? mask.ptr<uchar>(r) : 0;
+    float* count = m_count.ptr<float>(r);
+    float* mean = m_mean.ptr<float>(r);
+    float* m2 = m_m2.ptr<float>(r);
+    float* min_values = m_min.ptr<float>(r);
+    float* max_values = m_max.ptr<float>(r);
+
+    int c = 0;
+    for (; c + 4 <= image.cols; c += 4)
+    {
+      const bool all_valid = is_valid_pixel(values[c], mask_row, c)
+          && is_valid_pixel(values[c+1], mask_row, c+1)
+          && is_valid_pixel(values[c+2], mask_row, c+2)
+          && is_valid_pixel(values[c+3], mask_row, c+3);
+
+      if (!all_valid)
+      {
+        for (int k = c; k < c + 4; ++k)
+          if (is_valid_pixel(values[k], mask_row, k))
+            welford_update(values[k], count[k], mean[k], m2[k], min_values[k], max_values[k]);
+        continue;
+      }
+
+      const simd4f v = simd4f_uload4(values + c);
+      const simd4f n = simd4f_add(simd4f_uload4(count + c), one);
+      simd4f m = simd4f_uload4(mean + c);
+      const simd4f delta = simd4f_sub(v, m);
+      m = simd4f_add(m, simd4f_div(delta, n));
+      const simd4f new_m2 = simd4f_add(simd4f_uload4(m2 + c), simd4f_mul(delta, simd4f_sub(v, m)));
+
+      simd4f_ustore4(n, count + c);
+      simd4f_ustore4(m, mean + c);
+      simd4f_ustore4(new_m2, m2 + c);
+      simd4f_ustore4(simd4f_min(simd4f_uload4(min_values + c), v), min_values + c);
+      simd4f_ustore4(simd4f_max(simd4f_uload4(max_values + c), v), max_values + c);
+    }
+
+    for (; c < image.cols; ++c)
+      if (is_valid_pixel(values[c], mask_row, c))
+        welford_update(values[c], count[c], mean[c], m2[c], min_values[c], max_values[c]);
+  }
+}
+
+void ImageMomentsAccumulator :: merge(const ImageMomentsAccumulator& other)
+{
+  ntk_assert(other.size() == size(), "Cannot merge accumulators of different sizes.");
+
+  for_all_rc(m_count)
+  {
+    const float nb = other.m_count(r,c);
+    if (nb == 0)
+      continue;
+
+    const float na = m_count(r,c);
+    const float n = na + nb;
+    const float delta = other.m_mean(r,c) - m_mean(r,c);
+    m_mean(r,c) += delta * (nb / n);
+    m_m2(r,c) += other.m_m2(r,c) + delta * delta * (na * nb / n);
+    m_count(r,c) = n;
+    m_min(r,c) = std::min(m_min(r,c), other.m_min(r,c));
+    m_max(r,c) = std::max(m_max(r,c), other.m_max(r,c));
+  }
+}
+
+void ImageMomentsAccumulator :: computeVariance(cv::Mat1f& variance, bool unbiased) const
+{
+  variance.create(size());
+  const float offset = unbiased ? 1.f : 0.f;
+  for_all_rc(variance)
+  {
+    const float n = m_count(r,c) - offset;
+    variance(r,c) = n > 0 ? m_m2(r,c) / n : 0.f;
+  }
+}
+
+void ImageMomentsAccumulator :: computeDeviation(cv::Mat1f& deviation, bool unbiased) const
+{
+  computeVariance(deviation, unbiased);
+  cv::sqrt(deviation, deviation);
+}
+
+void ImageHistogramAccumulator :: reset(cv::Size size, int num_bins, float min_value, float max_value)
+{
+  ntk_assert(num_bins > 0 && max_value > min_value, "Invalid histogram range.");
+  m_size = size;
+  m_num_bins = num_bins;
+  m_min_value = min_value;
+  m_inv_bin_width = num_bins / (max_value - min_value);
+  m_bins.assign(size.area() * num_bins, 0);
+}
+
+void ImageHistogramAccumulator :: addImage(const cv::Mat1f& image, const cv::Mat1b& mask)
+{
+  ntk_assert(image.size() == m_size, "Image size does not match the accumulator.");
+  ntk_assert(!mask.data || mask.size() == m_size, "Mask size does not match the accumulator.");
+
+  for (int r = 0; r < image.rows; ++r)
+  {
+    const float* values = image.ptr<float>(r);
+    const uchar* mask_row = mask.data ? mask.ptr<uchar>(r) : 0;
+    unsigned* bins = &m_bins[r * m_size.width * m_num_bins];
+    for (int c = 0; c < image.cols; ++c, bins += m_num_bins)
+    {
+      if (!is_valid_pixel(values[c], mask_row, c))
+        continue;
+      int bin = int(floorf((values[c] - m_min_value) * m_inv_bin_width));
+      bin = std::max(0, std::min(m_num_bins - 1, bin));
+      ++bins[bin];
+    }
+  }
+}
+
+void ImageHistogramAccumulator :: merge(const ImageHistogramAccumulator& other)
+{
+  ntk_assert(other.m_size == m_size && other.m_num_bins == m_num_bins
+             && other.m_min_value == m_min_value && other.m_inv_bin_width == m_inv_bin_width,
+             "Cannot merge histograms with different bins.");
+  foreach_idx(i, m_bins)
+    m_bins[i] += other.m_bins[i];
+}
+
+void ImageHistogramAccumulator :: pixelHistogram(int r, int c, std::vector<double>& histogram) const
+{
+  const unsigned* bins = pixelHistogram(r, c);
+  histogram.assign(bins, bins + m_num_bins);
+}
+
+void ImageHistogramAccumulator :: computePercentile(double fraction, cv::Mat1f& output) const
+{
+  output.create(m_size);
+  const float bin_width = 1.f / m_inv_bin_width;
+  for_all_rc(output)
+  {
+    const unsigned* bins = pixelHistogram(r, c);
+    double total = 0;
+    for (int i = 0; i < m_num_bins; ++i)
+      total += bins[i];
+
+    if (total == 0)
+    {
+      output(r,c) = std::numeric_limits<float>::quiet_NaN();
+      continue;
+    }
+
+    // Linear interpolation inside the bin reaching the fraction.
+    const double target = fraction * total;
+    double cumulated = 0;
+    int i = 0;
+    for (; i < m_num_bins - 1 && cumulated + bins[i] < target; ++i)
+      cumulated += bins[i];
+    const double in_bin = bins[i] > 0 ? (target - cumulated) / bins[i] : 0;
+    output(r,c) = m_min_value + (i + float(in_bin)) * bin_width;
+  }
+}
+
+} // ntk
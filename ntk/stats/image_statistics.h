@@ -0,0 +1,116 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_STATS_IMAGE_STATISTICS_H
+#define NTK_STATS_IMAGE_STATISTICS_H
+
+#include <ntk/core.h>
+
+#include <vector>
+
+namespace ntk
+{
+
+/*!
+ * Streaming per-pixel mean, variance, min and max over a sequence of images.
+ *
+ * Uses Welford's update, so frames do not need to be stored and the
+ * variance stays accurate over long sequences. NaN pixels and pixels
+ * outside the optional mask are ignored. Accumulators over disjoint
+ * subsets of frames, e.g. filled by different threads, can be merged.
+ */
+class ImageMomentsAccumulator
+{
+public:
+  ImageMomentsAccumulator() {}
+  ImageMomentsAccumulator(cv::Size size) { reset(size); }
+
+public:
+  void reset(cv::Size size);
+  cv::Size size() const { return m_count.size(); }
+
+  void addImage(const cv::Mat1f& image, const cv::Mat1b& mask = cv::Mat1b());
+
+  /*! Add the frames accumulated by other, which must have the same size. */
+  void merge(const ImageMomentsAccumulator& other);
+
+public:
+  /*!
+   * Number of valid values seen by each pixel.
+   * Pixels without values have a min of FLT_MAX and a max of -FLT_MAX.
+   */
+  const cv::Mat1f& count() const { return m_count; }
+  const cv::Mat1f& mean() const { return m_mean; }
+  const cv::Mat1f& minImage() const { return m_min; }
+  const cv::Mat1f& maxImage() const { return m_max; }
+
+  /*! Pixels with less than two values (or one if biased) get 0. */
+  void computeVariance(cv::Mat1f& variance, bool unbiased = false) const;
+  void computeDeviation(cv::Mat1f& deviation, bool unbiased = false) const;
+
+private:
+  cv::Mat1f m_count;
+  cv::Mat1f m_mean;
+  cv::Mat1f m_m2; // sum of squared differences to the mean.
+  cv::Mat1f m_min;
+  cv::Mat1f m_max;
+};
+
+/*!
+ * Streaming per-pixel histograms with fixed bins over [min_value, max_value).
+ * Values outside of the range go to the first or last bin.
+ * NaN pixels and pixels outside the optional mask are ignored.
+ */
+class ImageHistogramAccumulator
+{
+public:
+  ImageHistogramAccumulator() : m_num_bins(0), m_min_value(0), m_inv_bin_width(0) {}
+  ImageHistogramAccumulator(cv::Size size, int num_bins, float min_value, float max_value)
+  { reset(size, num_bins, min_value, max_value); }
+
+public:
+  void reset(cv::Size size, int num_bins, float min_value, float max_value);
+  cv::Size size() const { return m_size; }
+  int numBins() const { return m_num_bins; }
+  float binCenter(int bin) const { return m_min_value + (bin + 0.5f) / m_inv_bin_width; }
+
+  void addImage(const cv::Mat1f& image, const cv::Mat1b& mask = cv::Mat1b());
+  void merge(const ImageHistogramAccumulator& other);
+
+public:
+  /*! Bins of pixel (r,c), contiguous. */
+  const unsigned* pixelHistogram(int r, int c) const
+  { return &m_bins[(r*m_size.width + c) * m_num_bins]; }
+
+  void pixelHistogram(int r, int c, std::vector<double>& histogram) const;
+
+  /*! Per-pixel value below which the given fraction of values fall, from the bins. */
+  void computePercentile(double fraction, cv::Mat1f& output) const;
+
+private:
+  cv::Size m_size;
+  int m_num_bins;
+  float m_min_value;
+  float m_inv_bin_width;
+  std::vector<unsigned> m_bins;
+};
+
+} // ntk
+
+#endif // NTK_STATS_IMAGE_STATISTICS_H
@@ -68,33 +68,166 @@ void EventListener::reportNewEventProcessed()
 namespace ntk
 {
 
+SyncEventListener :: ~SyncEventListener()
+{
+    Notification* notification = m_notifications;
+    while (notification)
+    {
+        Notification* next = notification->next;
+        delete notification;
+        notification = next;
+    }
+
+    Slot* slot = m_slots;
+    while (slot)
+    {
+        Slot* next = slot->next;
+        delete slot->latest.fetchAndStoreOrdered(0);
+        delete slot;
+        slot = next;
+    }
+}
+
+SyncEventListener::Slot* SyncEventListener :: findSlot(EventBroadcaster* sender) const
+{
+    for (Slot* slot = m_slots; slot; slot = slot->next)
+    {
+        if (slot->active && slot->sender == sender)
+            return slot;
+    }
+    return 0;
+}
+
+SyncEventListener::Slot* SyncEventListener :: findOrCreateSlot(EventBroadcaster* sender)
+{
+    Slot* slot = findSlot(sender);
+    if (slot)
+        return slot;
+
+    // New sender, slots are only added or reused under the lock.
+    m_lock.lock();
+    slot = findSlot(sender);
+    if (!slot)
+    {
+        for (slot = m_slots; slot && slot->active; slot = slot->next)
+        {}
+
+        if (!slot)
+        {
+            slot = new Slot;
+            slot->next = m_slots;
+            slot->sender.fetchAndStoreOrdered(sender);
+            slot->active.fetchAndStoreOrdered(1);
+            m_slots.fetchAndStoreOrdered(slot);
+        }
+        else
+        {
+            slot->sender.fetchAndStoreOrdered(sender);
+            slot->active.fetchAndStoreOrdered(1);
+        }
+    }
+    m_lock.unlock();
+    return slot;
+}
+
+void SyncEventListener :: pushNotification(Notification* notification)
+{
+    Notification* head;
+    do
+    {
+        head = m_notifications;
+        notification->next = head;
+    }
+    while (!m_notifications.testAndSetOrdered(head, notification));
+
+    // Waiters register before checking the list a last time,
+    // so a sleeping waiter is always seen here.
+    if (m_num_waiters > 0)
+    {
+        m_lock.lock();
+        m_condition.wakeOne();
+        m_lock.unlock();
+    }
+}
+
 void SyncEventListener :: newEvent(EventBroadcaster* sender, EventDataPtr data)
 {
     if (!m_enabled) return;
-    m_lock.lock();
-    Event new_event (sender, data);
 
-    bool sender_in_queue = false;
-    for (int i = 0; i < m_unprocessed_ordered_events.size(); ++i)
+    Slot* slot = findOrCreateSlot(sender);
+    if (isBuffered())
+    {
+        // Every event is queued, capacity is enforced when waiters collect them.
+        pushNotification(new Notification(slot, data));
+        return;
+    }
+
+    // Since there is no point in processing stale data, a pending event
+    // is replaced. The sender keeps its place in the ready queue, so no
+    // waiter needs to be woken up.
+    EventDataPtr* previous = slot->latest.fetchAndStoreOrdered(new EventDataPtr(data));
+    if (previous)
     {
-        if (m_unprocessed_ordered_events[i].sender == sender)
+        m_num_dropped_events.ref();
+        delete previous;
+        return;
+    }
+
+    pushNotification(new Notification(slot));
+}
+
+void SyncEventListener :: collectNotifications()
+{
+    // Taking the whole list is immune to ABA, entries come newest first.
+    Notification* notification = m_notifications.fetchAndStoreOrdered(0);
+    Notification* oldest = 0;
+    while (notification)
+    {
+        Notification* next = notification->next;
+        notification->next = oldest;
+        oldest = notification;
+        notification = next;
+    }
+
+    while (oldest)
+    {
+        Notification* next = oldest->next;
+        Slot* slot = oldest->slot;
+        if (!isBuffered())
+        {
+            m_ready_slots.push_back(slot);
+        }
+        else if (int(slot->events.size()) >= m_mailbox_capacity)
         {
-            // A event was received some time ago and left unprocessed.
-            // Leave it at its place in the queue, but update the data
-            // since there is no buffer it does not make sense to discard
-            // the new data and process the old one.
-            m_unprocessed_ordered_events[i] = new_event;
-            sender_in_queue = true;
-            break;
+            // The mailbox is full, drop the oldest event.
+            slot->events.pop_front();
+            slot->events.push_back(oldest->data);
+            m_num_dropped_events.ref();
         }
+        else
+        {
+            slot->events.push_back(oldest->data);
+            m_ready_slots.push_back(slot);
+        }
+        delete oldest;
+        oldest = next;
     }
+}
 
-    if (!sender_in_queue)
+void SyncEventListener :: senderDisconnected(EventBroadcaster* sender)
+{
+    m_lock.lock();
+    // Nothing about the slot must be left in the lock-free list.
+    collectNotifications();
+    Slot* slot = findSlot(sender);
+    if (slot)
     {
-        m_unprocessed_ordered_events.push_back(new_event);
+        m_ready_slots.erase(std::remove(m_ready_slots.begin(), m_ready_slots.end(), slot),
+                            m_ready_slots.end());
+        delete slot->latest.fetchAndStoreOrdered(0);
+        slot->events.clear();
+        slot->active.fetchAndStoreOrdered(0);
     }
-
-    m_condition.wakeAll();
     m_lock.unlock();
 }
 
@@ -104,6 +237,13 @@ void SyncEventListener :: setEnabled(bool enabled)
     m_condition.wakeAll();
 }
 
+void SyncEventListener :: setMailboxCapacity(int capacity)
+{
+    ntk_assert(capacity > 0, "Mailboxes need to hold at least one event.");
+    ntk_assert(m_slots == 0, "Capacity must be set before receiving events.");
+    m_mailbox_capacity = capacity;
+}
+
 const int
 SyncEventListener::event_timeout_msecs = 100;
 
@@ -114,15 +254,34 @@ EventListener::Event SyncEventListener :: waitForNewEvent(int timeout_msecs)
     Event last_event;
 
     m_lock.lock();
-    if (m_unprocessed_ordered_events.size() == 0)
+    collectNotifications();
+    if (m_ready_slots.size() == 0)
     {
-        m_condition.wait(&m_lock, timeout_msecs);
+        m_num_waiters.ref();
+        // Checked again once registered, a sender could have missed us before.
+        if (m_notifications == 0)
+            m_condition.wait(&m_lock, timeout_msecs);
+        m_num_waiters.deref();
+        collectNotifications();
     }
 
-    if (m_unprocessed_ordered_events.size() > 0)
+    while (m_ready_slots.size() > 0 && last_event.isNull())
     {
-        last_event = m_unprocessed_ordered_events.front();
-        m_unprocessed_ordered_events.pop_front();
+        Slot* slot = m_ready_slots.front();
+        m_ready_slots.pop_front();
+
+        if (isBuffered())
+        {
+            last_event = Event(slot->sender, slot->events.front());
+            slot->events.pop_front();
+            continue;
+        }
+
+        EventDataPtr* data = slot->latest.fetchAndStoreOrdered(0);
+        if (!data)
+            continue;
+        last_event = Event(slot->sender, *data);
+        delete data;
     }
 
     m_lock.unlock();
@@ -132,11 +291,17 @@ EventListener::Event SyncEventListener :: waitForNewEvent(int timeout_msecs)
 int SyncEventListener::currentQueueSize() const
 {
     m_lock.lock();
-    int value = m_unprocessed_ordered_events.size();
+    const_cast<SyncEventListener*>(this)->collectNotifications();
+    int value = m_ready_slots.size();
     m_lock.unlock();
     return value;
 }
 
+int SyncEventListener::numDroppedEvents() const
+{
+    return m_num_dropped_events;
+}
+
 void AsyncEventListener :: newEvent(EventBroadcaster* sender, EventDataPtr data)
 {
     SyncEventListener::newEvent(sender, data);
@@ -191,11 +356,15 @@ void EventBroadcaster :: removeEventListener(EventListener* listener)
         return;
 
     m_listeners.erase(i);
+    listener->senderDisconnected(this);
 }
 
 void EventBroadcaster :: removeAllEventListeners()
 {
-    m_listeners.clear();
+    Listeners listeners;
+    listeners.swap(m_listeners);
+    foreach_idx(i, listeners)
+        listeners[i]->senderDisconnected(this);
 }
 
 void EventBroadcaster :: broadcastEvent(EventDataPtr data)
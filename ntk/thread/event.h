@@ -28,6 +28,8 @@
 #include <QWaitCondition>
 #include <QMutex>
 #include <QEvent>
+#include <QAtomicInt>
+#include <QAtomicPointer>
 
 #include <string>
 #include <list>
@@ -108,6 +110,9 @@ public:
 public:
     virtual void newEvent(EventBroadcaster* sender = 0, EventDataPtr data = EventDataPtr()) = 0;
 
+    /*! Called when sender removes this listener, it will not send events anymore. */
+    virtual void senderDisconnected(EventBroadcaster* sender) {}
+
 public:
     double frameRate() const { return m_framerate; }
 
@@ -124,32 +129,110 @@ private:
 
 /*!
  * Listen to events and allows subclasses to waitForEvents.
- * There is no buffer, only one event will be kept from each source.
- * Implement a new BufferedSyncEventListener class if you want buffering.
+ * Each sender has its own mailbox. By default a mailbox only keeps the
+ * latest event of its sender, see BufferedSyncEventListener to keep more.
+ * Events are delivered in the order senders became ready.
+ *
+ * Senders never take a lock: the latest event is swapped atomically into
+ * the sender slot, and ready senders are pushed on a lock-free list. The
+ * mutex is only taken to wake up a waiting thread, when there is one.
  */
 class SyncEventListener : public EventListener
 {
 public:
     SyncEventListener() :
-        m_enabled(true)
+        m_enabled(true),
+        m_mailbox_capacity(1),
+        m_num_waiters(0),
+        m_num_dropped_events(0),
+        m_slots(0),
+        m_notifications(0)
     {}
 
+    ~SyncEventListener();
+
     void setEnabled(bool enabled);
     bool enabled() const { return m_enabled; }
 
     virtual void newEvent(EventBroadcaster* sender = 0, EventDataPtr data = EventDataPtr());
 
+    /*!
+     * Forget the mailbox of sender and its pending events.
+     * The sender must not send events concurrently.
+     */
+    virtual void senderDisconnected(EventBroadcaster* sender);
+
     static const int event_timeout_msecs;
     Event waitForNewEvent(int timeout_msecs = event_timeout_msecs);
 
+    /*! Number of events that were replaced before being processed. */
+    int numDroppedEvents() const;
+
 protected:
     int currentQueueSize() const;
 
+    /*!
+     * Maximal number of pending events per sender, must be set before
+     * receiving events. When a mailbox is full, its oldest event is dropped.
+     */
+    void setMailboxCapacity(int capacity);
+
+private:
+    // Mailbox of a sender. Slots are reused but only freed with the listener,
+    // so that senders can look them up without locking.
+    struct Slot
+    {
+        Slot() : active(0), latest(0), next(0) {}
+
+        QAtomicInt active;
+        QAtomicPointer<EventBroadcaster> sender;
+        QAtomicPointer<EventDataPtr> latest; // latest-value mode.
+        std::deque<EventDataPtr> events; // buffered mode, only used by waiters.
+        Slot* next;
+    };
+
+    // Lock-free list entry telling waiters that a slot is ready.
+    struct Notification
+    {
+        Notification(Slot* slot, EventDataPtr data = EventDataPtr())
+            : slot(slot), data(data), next(0)
+        {}
+
+        Slot* slot;
+        EventDataPtr data; // buffered mode.
+        Notification* next;
+    };
+
+private:
+    bool isBuffered() const { return m_mailbox_capacity > 1; }
+    Slot* findSlot(EventBroadcaster* sender) const;
+    Slot* findOrCreateSlot(EventBroadcaster* sender);
+    void pushNotification(Notification* notification);
+    // Must be called with m_lock held.
+    void collectNotifications();
+
 private:
     bool m_enabled;
+    int m_mailbox_capacity;
     mutable QMutex m_lock;
     QWaitCondition m_condition;
-    std::deque<Event> m_unprocessed_ordered_events;
+    QAtomicInt m_num_waiters;
+    QAtomicInt m_num_dropped_events;
+    QAtomicPointer<Slot> m_slots;
+    QAtomicPointer<Notification> m_notifications;
+    // One entry per pending event, gives the delivery order. Only used by waiters.
+    std::deque<Slot*> m_ready_slots;
+};
+
+/*!
+ * SyncEventListener keeping up to capacity events per sender
+ * instead of only the latest one.
+ */
+class BufferedSyncEventListener : public SyncEventListener
+{
+public:
+    BufferedSyncEventListener(int capacity = 16)
+    { setMailboxCapacity(capacity); }
 };
 
 //------------------------------------------------------------------------------
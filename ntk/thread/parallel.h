@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2013 ManCTL SARL <contact@manctl.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Nicolas Burrus <nicolas.burrus@manctl.com>
+ */
+
+#ifndef NTK_THREAD_PARALLEL_H
+#define NTK_THREAD_PARALLEL_H
+
+#include <ntk/core.h>
+
+#include <QThreadPool>
+#include <QtConcurrentMap>
+
+#include <vector>
+#include <algorithm>
+
+namespace ntk
+{
+
+/*!
+ * Half-open range [begin, end) of indices processed by one parallel task.
+ * chunk is the position of the range in the list it was split into.
+ */
+struct IndexRange
+{
+  IndexRange(int begin = 0, int end = 0, int chunk = 0)
+    : begin(begin), end(end), chunk(chunk)
+  {}
+
+  int size() const { return end - begin; }
+
+  int begin;
+  int end;
+  int chunk;
+};
+
+/*!
+ * Split [begin, end) into num_chunks contiguous ranges of similar size.
+ * The chunks are returned in order.
+ */
+inline void split_range(int begin, int end, int num_chunks, std::vector<IndexRange>& chunks)
+{
+  chunks.clear();
+  const int size = end - begin;
+  if (size <= 0)
+    return;
+
+  num_chunks = std::max(1, std::min(num_chunks, size));
+  for (int i = 0; i < num_chunks; ++i)
+    chunks.push_back(IndexRange(begin + (long long)size*i/num_chunks,
+                                begin + (long long)size*(i+1)/num_chunks,
+                                i));
+}
+
+/*! Number of chunks to use so that each one has at least min_chunk_size elements. */
+inline int parallel_num_chunks(int size, int min_chunk_size)
+{
+  int num_threads = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+  int max_chunks = std::max(1, size / std::max(1, min_chunk_size));
+  return std::min(num_threads, max_chunks);
+}
+
+namespace internal
+{
+
+template <class Body>
+struct ParallelForRange
+{
+  typedef void result_type;
+
+  ParallelForRange(const Body& body) : body(body) {}
+
+  void operator()(IndexRange& range) const { body(range); }
+
+  const Body& body;
+};
+
+} // internal
+
+/*!
+ * Call body(const IndexRange&) on each chunk of the given list,
+ * using the global QThreadPool. Body must be safe to call concurrently
+ * on disjoint chunks. A single chunk is processed in the calling thread.
+ */
+template <class Body>
+void parallel_for_chunks(std::vector<IndexRange>& chunks, const Body& body)
+{
+  if (chunks.size() == 1)
+  {
+    body(chunks[0]);
+    return;
+  }
+
+  QtConcurrent::blockingMap(chunks, internal::ParallelForRange<Body>(body));
+}
+
+/*!
+ * Process [begin, end) in parallel, splitting it into contiguous chunks
+ * of at least min_chunk_size indices.
+ */
+template <class Body>
+void parallel_for(int begin, int end, const Body& body, int min_chunk_size = 1024)
+{
+  std::vector<IndexRange> chunks;
+  split_range(begin, end, parallel_num_chunks(end - begin, min_chunk_size), chunks);
+  if (chunks.empty())
+    return;
+  parallel_for_chunks(chunks, body);
+}
+
+} // ntk
+
+#endif // NTK_THREAD_PARALLEL_H
@@ -77,7 +77,7 @@ int main(int argc, char **argv)
         Pose3D pose = *image.calibration()->depth_pose;
         modeler.addNewView(image, pose);
         modeler.computeMesh();
-        modeler.currentMesh().saveToPlyFile(cv::format("object%d.ply", cluster_id).c_str());
+        modeler.currentMesh()->saveToPlyFile(cv::format("object%d.ply", cluster_id).c_str());
     }
 
     grabber.stop();
@@ -0,0 +1,105 @@
+
+#include <ntk/ntk.h>
+#include <ntk/aruco/aruco.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const float marker_size = 0.04f;
+
+void make_board(int rows, int cols, aruco::BoardConfiguration& conf)
+{
+  conf._markersId.create(rows, cols, CV_32SC1);
+  for (int r = 0; r < rows; ++r)
+    for (int c = 0; c < cols; ++c)
+      conf._markersId.at<int>(r,c) = r*cols+c;
+  conf._markerSizePix = 100;
+  conf._markerDistancePix = 20;
+}
+
+// Project the board markers with the given extrinsics, as if they were detected.
+void render_markers(const aruco::BoardConfiguration& conf,
+                    const cv::Mat1f& K,
+                    const cv::Mat1f& rvec, const cv::Mat1f& tvec,
+                    std::vector<aruco::Marker>& markers)
+{
+  const cv::Mat& ids = conf._markersId;
+  double distance = double(conf._markerDistancePix) * marker_size / double(conf._markerSizePix);
+  float TX = -(((ids.rows-1)*(distance+marker_size) + marker_size)/2);
+  float TY = -(((ids.cols-1)*(distance+marker_size) + marker_size)/2);
+
+  markers.clear();
+  for (int r = 0; r < ids.rows; ++r)
+    for (int c = 0; c < ids.cols; ++c)
+    {
+      float AY = c*(distance+marker_size) + TY;
+      float AX = r*(distance+marker_size) + TX;
+      std::vector<cv::Point3f> obj;
+      obj.push_back(cv::Point3f(AX, AY, 0));
+      obj.push_back(cv::Point3f(AX, AY+marker_size, 0));
+      obj.push_back(cv::Point3f(AX+marker_size, AY+marker_size, 0));
+      obj.push_back(cv::Point3f(AX+marker_size, AY, 0));
+
+      std::vector<cv::Point2f> img;
+      cv::projectPoints(obj, rvec, tvec, K, cv::Mat(), img);
+
+      aruco::Marker marker;
+      marker.id = ids.at<int>(r,c);
+      marker.insert(marker.end(), img.begin(), img.end());
+      markers.push_back(marker);
+    }
+
+  // Detection order is arbitrary.
+  std::random_shuffle(markers.begin(), markers.end());
+}
+
+}
+
+bool test_board_detector(bool use_previous_pose)
+{
+  aruco::BoardConfiguration conf;
+  make_board(24, 24, conf);
+
+  cv::Mat1f K = (cv::Mat1f(3,3) << 525, 0, 320, 0, 525, 240, 0, 0, 1);
+  cv::Mat1f rvec = (cv::Mat1f(3,1) << 0.1f, -0.2f, 0.05f);
+  cv::Mat1f tvec = (cv::Mat1f(3,1) << 0.05f, -0.02f, 1.5f);
+
+  aruco::BoardDetector detector;
+  detector.setUsePreviousPoseAsGuess(use_previous_pose);
+
+  std::vector<aruco::Marker> markers;
+  double total_ticks = 0;
+  for (int frame = 0; frame < 200; ++frame)
+  {
+    rvec(0,0) += 0.002f;
+    tvec(2,0) += 0.001f;
+    render_markers(conf, K, rvec, tvec, markers);
+
+    aruco::Board board;
+    double start = cv::getTickCount();
+    float likelihood = detector.detect(markers, conf, board, cv::Mat(K), cv::Mat(), marker_size);
+    total_ticks += cv::getTickCount() - start;
+
+    NTK_TEST_FLOAT_EQ(likelihood, 1.0f);
+    NTK_TEST_FLOAT_EQ(board.Tvec.at<float>(2,0), tvec(2,0));
+  }
+
+  ntk_dbg(1) << "[BENCH] board detection (" << (use_previous_pose ? "previous pose" : "no guess") << "): "
+             << 1e3 * total_ticks / cv::getTickFrequency() / 200 << " ms/frame";
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_board_detector(false);
+  ok &= test_board_detector(true);
+  return ok != true;
+}
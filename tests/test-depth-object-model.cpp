@@ -0,0 +1,329 @@
+
+#include <ntk/ntk.h>
+#include <ntk/detection/object/depth_object_model.h>
+#include <ntk/detection/object/depth_pose_verifier.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 320;
+const int height = 240;
+const double focal = 300;
+
+// Box with a sphere sticking out of one corner, so that no pose is ambiguous.
+const cv::Point3d box_half_size (0.05, 0.03, 0.04);
+const cv::Point3d sphere_center (0.04, 0.03, 0.0);
+const double sphere_radius = 0.035;
+
+double box_distance(const cv::Point3d& p)
+{
+  cv::Point3d q (std::abs(p.x) - box_half_size.x,
+                 std::abs(p.y) - box_half_size.y,
+                 std::abs(p.z) - box_half_size.z);
+  cv::Point3d outside (std::max(q.x, 0.), std::max(q.y, 0.), std::max(q.z, 0.));
+  return cv::norm(outside) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.);
+}
+
+double surface_distance(const cv::Point3d& p)
+{
+  return std::min(box_distance(p), cv::norm(p - sphere_center) - sphere_radius);
+}
+
+cv::Point3d surface_normal(const cv::Point3d& p)
+{
+  const double eps = 1e-4;
+  cv::Point3d gradient (surface_distance(p + cv::Point3d(eps,0,0)) - surface_distance(p - cv::Point3d(eps,0,0)),
+                        surface_distance(p + cv::Point3d(0,eps,0)) - surface_distance(p - cv::Point3d(0,eps,0)),
+                        surface_distance(p + cv::Point3d(0,0,eps)) - surface_distance(p - cv::Point3d(0,0,eps)));
+  return gradient * (1.0 / cv::norm(gradient));
+}
+
+// Camera at 50cm looking at the object origin, in the opencv camera frame.
+void look_at(double azimuth_deg, double elevation_deg, cv::Mat1d& R, cv::Mat1d& t)
+{
+  const double azimuth = deg_to_rad(azimuth_deg);
+  const double elevation = deg_to_rad(elevation_deg);
+  cv::Vec3d center (cos(elevation)*sin(azimuth), sin(elevation), cos(elevation)*cos(azimuth));
+  center *= 0.5;
+
+  cv::Vec3d z = -center * (1.0 / cv::norm(center));
+  cv::Vec3d x = cv::Vec3d(0,-1,0).cross(z);
+  x *= 1.0 / cv::norm(x);
+  cv::Vec3d y = z.cross(x);
+
+  R = (cv::Mat1d(3,3) << x[0], x[1], x[2], y[0], y[1], y[2], z[0], z[1], z[2]);
+  t = -R * cv::Mat1d(center);
+}
+
+// Rotate the object around its own origin.
+void rotate_object(cv::Mat1d& R, const cv::Vec3d& rotation_vector)
+{
+  cv::Mat1d delta;
+  cv::Rodrigues(cv::Mat1d(rotation_vector), delta);
+  R = R * delta;
+}
+
+Pose3D to_pose(const cv::Mat1d& R, const cv::Mat1d& t)
+{
+  // Pose3D cameras have y and z flipped.
+  cv::Mat1d H = cv::Mat1d::eye(4,4);
+  for (int r = 0; r < 3; ++r)
+  {
+    const double sign = (r == 0) ? 1 : -1;
+    for (int c = 0; c < 3; ++c)
+      H(r,c) = sign*R(r,c);
+    H(r,3) = sign*t(r);
+  }
+
+  Pose3D pose;
+  pose.setCameraParameters(focal, focal, width/2, height/2);
+  pose.setCameraTransform(H);
+  return pose;
+}
+
+cv::Mat1d intrinsics()
+{
+  return (cv::Mat1d(3,3) << focal, 0, width/2, 0, focal, height/2, 0, 0, 1);
+}
+
+// Ray cast the analytic object, pixel centers at integer coordinates.
+cv::Mat1f render_depth(const cv::Mat1d& R, const cv::Mat1d& t)
+{
+  cv::Mat1d origin_mat = -R.t() * t;
+  cv::Point3d origin (origin_mat(0), origin_mat(1), origin_mat(2));
+  cv::Point3d box_min = -box_half_size;
+
+  cv::Mat1f depth (height, width, 0.f);
+  for_all_rc(depth)
+  {
+    // Unit z in the camera frame, so the ray parameter is the depth.
+    cv::Mat1d ray_mat = R.t() * (cv::Mat1d(3,1) << (c - width/2) / focal, (r - height/2) / focal, 1.0);
+    cv::Point3d ray (ray_mat(0), ray_mat(1), ray_mat(2));
+    double hit = std::numeric_limits<double>::max();
+
+    double t_near = -std::numeric_limits<double>::max();
+    double t_far = std::numeric_limits<double>::max();
+    const double o[3] = { origin.x, origin.y, origin.z };
+    const double d[3] = { ray.x, ray.y, ray.z };
+    const double lo[3] = { box_min.x, box_min.y, box_min.z };
+    const double hi[3] = { box_half_size.x, box_half_size.y, box_half_size.z };
+    for (int k = 0; k < 3; ++k)
+    {
+      if (std::abs(d[k]) < 1e-12)
+      {
+        if (o[k] < lo[k] || o[k] > hi[k])
+          t_near = std::numeric_limits<double>::max();
+        continue;
+      }
+      double t1 = (lo[k] - o[k]) / d[k];
+      double t2 = (hi[k] - o[k]) / d[k];
+      t_near = std::max(t_near, std::min(t1, t2));
+      t_far = std::min(t_far, std::max(t1, t2));
+    }
+    if (t_near <= t_far && t_near > 0)
+      hit = t_near;
+
+    cv::Point3d oc = origin - sphere_center;
+    double a = ray.dot(ray);
+    double b = 2 * ray.dot(oc);
+    double discriminant = b*b - 4*a*(oc.dot(oc) - sphere_radius*sphere_radius);
+    if (discriminant >= 0)
+    {
+      double t_sphere = (-b - sqrt(discriminant)) / (2*a);
+      if (t_sphere > 0)
+        hit = std::min(hit, t_sphere);
+    }
+
+    if (hit < std::numeric_limits<double>::max())
+      depth(r,c) = hit;
+  }
+  return depth;
+}
+
+void build_model(DepthObjectModel& model)
+{
+  const float voxel_size = 0.004f;
+  const float margin = 2*voxel_size;
+  Rect3f bounds (-box_half_size.x - margin, -box_half_size.y - margin, -box_half_size.z - margin,
+                 sphere_center.x + sphere_radius + box_half_size.x + 2*margin,
+                 sphere_center.y + sphere_radius + box_half_size.y + 2*margin,
+                 2*box_half_size.z + 2*margin);
+  model.initialize(bounds, voxel_size);
+
+  // Two rings of views, above and below.
+  for (int i = 0; i < 8; ++i)
+  {
+    cv::Mat1d R, t;
+    if (i < 4)
+      look_at(90*i, 30, R, t);
+    else
+      look_at(90*i + 45, -30, R, t);
+    model.integrateView(render_depth(R, t), to_pose(R, t));
+  }
+  model.finalize(1000);
+}
+
+}
+
+bool test_model_fusion()
+{
+  DepthObjectModel model;
+  TimeCount tc ("build model from 8 views", 1);
+  build_model(model);
+  tc.stop();
+
+  ntk_dbg_print(model.points().size(), 1);
+  ntk_ensure(model.points().size() > 500, "Too few surface samples.");
+  ntk_ensure(model.points().size() <= 1000, "Too many surface samples.");
+  NTK_TEST_FLOAT_EQ(model.normals().size(), model.points().size());
+
+  double mean_distance = 0;
+  int num_bad_normals = 0;
+  foreach_idx(i, model.points())
+  {
+    cv::Point3d p (model.points()[i].x, model.points()[i].y, model.points()[i].z);
+    cv::Point3d n (model.normals()[i].x, model.normals()[i].y, model.normals()[i].z);
+    double distance = std::abs(surface_distance(p));
+    mean_distance += distance;
+    ntk_ensure(distance < 2*model.voxelSize(), "Sample far from the surface.");
+    if (n.dot(surface_normal(p)) < 0.8)
+      ++num_bad_normals;
+  }
+  mean_distance /= model.points().size();
+  ntk_dbg_print(mean_distance, 1);
+  ntk_dbg_print(num_bad_normals, 1);
+  ntk_ensure(mean_distance < 0.002, "Samples are not accurate.");
+  // Only samples on the box edges and the sphere junction have blurred normals.
+  ntk_ensure(num_bad_normals < model.points().size() / 8, "Too many wrong normals.");
+  return true;
+}
+
+bool test_pose_verification()
+{
+  DepthObjectModel model;
+  build_model(model);
+
+  // Observed from a view that is not in the model.
+  cv::Mat1d R, t;
+  look_at(20, 15, R, t);
+  DepthPoseVerifier verifier;
+  verifier.setDepthImage(render_depth(R, t), intrinsics());
+
+  std::vector<Pose3D> good_poses;
+  good_poses.push_back(to_pose(R, t));
+  {
+    cv::Mat1d R2 = R.clone();
+    rotate_object(R2, cv::Vec3d(deg_to_rad(2.), 0, 0));
+    good_poses.push_back(to_pose(R2, t + (cv::Mat1d(3,1) << 0.003, 0, 0)));
+  }
+  {
+    cv::Mat1d R2 = R.clone();
+    rotate_object(R2, cv::Vec3d(0, deg_to_rad(-2.), 0));
+    good_poses.push_back(to_pose(R2, t + (cv::Mat1d(3,1) << 0, 0.002, 0.003)));
+  }
+
+  std::vector<Pose3D> wrong_poses;
+  for (int k = 0; k < 3; ++k)
+  {
+    cv::Mat1d translation = cv::Mat1d::zeros(3,1);
+    translation(k) = 0.05;
+    wrong_poses.push_back(to_pose(R, t + translation));
+
+    for (int sign = -1; sign <= 1; sign += 2)
+    {
+      cv::Vec3d rotation (0, 0, 0);
+      rotation[k] = sign * deg_to_rad(30.);
+      cv::Mat1d R2 = R.clone();
+      rotate_object(R2, rotation);
+      wrong_poses.push_back(to_pose(R2, t));
+    }
+  }
+
+  std::vector<float> good_scores, wrong_scores;
+  verifier.scorePoses(model, good_poses, good_scores);
+  verifier.scorePoses(model, wrong_poses, wrong_scores);
+
+  ntk_dbg_print(good_scores[0], 1);
+  ntk_ensure(good_scores[0] > 0.85, "True pose should be accepted.");
+  foreach_idx(i, good_scores)
+    ntk_ensure(good_scores[i] > 0.75, "Slightly perturbed pose should be accepted.");
+  foreach_idx(i, wrong_scores)
+  {
+    ntk_dbg_print(wrong_scores[i], 2);
+    ntk_ensure(wrong_scores[i] < 0.55, "Wrong pose should be rejected.");
+  }
+
+  // Object outside of the image.
+  std::vector<Pose3D> hidden_pose (1, to_pose(R, t + (cv::Mat1d(3,1) << 1, 0, 0)));
+  std::vector<float> hidden_score;
+  verifier.scorePoses(model, hidden_pose, hidden_score);
+  NTK_TEST_FLOAT_EQ(hidden_score[0], 0);
+  return true;
+}
+
+bool test_many_hypotheses()
+{
+  const int num_hypotheses = 1000;
+
+  DepthObjectModel model;
+  build_model(model);
+
+  cv::Mat1d R, t;
+  look_at(200, 40, R, t);
+  DepthPoseVerifier verifier;
+  verifier.setDepthImage(render_depth(R, t), intrinsics());
+
+  // Random hypotheses around the true pose, as a detector would produce.
+  cv::RNG rng (42);
+  std::vector<Pose3D> poses;
+  for (int i = 0; i < num_hypotheses; ++i)
+  {
+    cv::Mat1d R2 = R.clone();
+    const double max_angle = deg_to_rad(20.);
+    rotate_object(R2, cv::Vec3d(rng.uniform(-max_angle, max_angle),
+                                rng.uniform(-max_angle, max_angle),
+                                rng.uniform(-max_angle, max_angle)));
+    cv::Mat1d t2 = t + (cv::Mat1d(3,1) << rng.uniform(-0.03, 0.03), rng.uniform(-0.03, 0.03), rng.uniform(-0.03, 0.03));
+    poses.push_back(to_pose(R2, t2));
+  }
+
+  std::vector<float> scores;
+  TimeCount tc ("scorePoses x1000, four poses per pass", 1);
+  verifier.scorePoses(model, poses, scores);
+  tc.stop();
+
+  std::vector<float> single_scores;
+  verifier.setMultiPoseScoring(false);
+  TimeCount tc_single ("scorePoses x1000, one pose per pass", 1);
+  verifier.scorePoses(model, poses, single_scores);
+  tc_single.stop();
+
+  NTK_TEST_FLOAT_EQ(scores.size(), poses.size());
+  NTK_TEST_FLOAT_EQ(single_scores.size(), poses.size());
+  int num_accepted = 0;
+  foreach_idx(i, poses)
+  {
+    // Same operations in both paths, but the compiler may contract them differently.
+    ntk_ensure(std::abs(scores[i] - single_scores[i]) < 0.01, "Scores differ between the two paths.");
+    num_accepted += scores[i] > 0.75;
+  }
+  ntk_dbg_print(num_accepted, 1);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_model_fusion();
+  ok &= test_pose_verification();
+  ok &= test_many_hypotheses();
+  return ok != true;
+}
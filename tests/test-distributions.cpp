@@ -3,6 +3,7 @@
 #include <ntk/stats/estimation.h>
 #include <ntk/stats/distributions.h>
 #include <ntk/stats/histogram.h>
+#include <ntk/utils/time.h>
 
 #include "test_common.h"
 
@@ -60,6 +61,248 @@ bool test_mean()
   return true;
 }
 
+namespace
+{
+
+// Map-based lookups, as EmpiricalDistribution used to do them.
+struct ReferenceCdf
+{
+  ReferenceCdf(const EmpiricalDistribution& distrib)
+    : precision(distrib.precision())
+  {
+    const std::map<int, double>& raw = distrib.rawDistribution();
+    double n = distrib_size(raw);
+    double sum = 0, nb_values = 0;
+    min_value = raw.begin()->first;
+    max_value = raw.rbegin()->first;
+    foreach_const_it(it, raw, cat2(std::map<int, double>))
+    {
+      nb_values += it->second;
+      if (nb_values < 0.01*n)
+        min_value = it->first;
+      sum += it->second / n;
+      cdf_values[it->first] = sum;
+    }
+  }
+
+  double cdf(double x) const
+  {
+    double actual_x = ntk::math::rnd(x / precision) + 0.5;
+    std::map<int, double>::const_iterator it = cdf_values.upper_bound(actual_x);
+    std::map<int, double>::const_iterator lower_it = it; --lower_it;
+    return lower_it->second + (actual_x - lower_it->first) * ((it->second - lower_it->second) / (it->first - lower_it->first));
+  }
+
+  double logCdf(double x) const
+  {
+    double actual_x = (x / precision) + 0.5;
+    std::map<int, double>::const_iterator it = cdf_values.upper_bound(actual_x);
+    std::map<int, double>::const_iterator lower_it = it; --lower_it;
+    double v = log(lower_it->second) + (actual_x - lower_it->first)
+        * ((log(it->second) - log(lower_it->second)) / (it->first - lower_it->first));
+    return std::min(1e-10, v);
+  }
+
+  double closestValueForCdf(double expected_cdf_value) const
+  {
+    double closest_x = min_value;
+    foreach_const_it(it, cdf_values, cat2(std::map<int, double>))
+    {
+      if (it->second > expected_cdf_value)
+        break;
+      closest_x = it->first * precision;
+    }
+    return closest_x;
+  }
+
+  bool inRange(double actual_x) const { return actual_x >= min_value && actual_x < max_value; }
+
+  double precision;
+  int min_value;
+  int max_value;
+  std::map<int, double> cdf_values;
+};
+
+}
+
+bool test_table_lookups()
+{
+  EmpiricalDistribution distrib (0.1);
+  cv::RNG rng (42);
+  for (int i = 0; i < 20000; ++i)
+    distrib.addValueFast(rng.gaussian(3.0) + (i % 3 ? 0 : 10.0));
+  distrib.finalize();
+
+  ReferenceCdf ref (distrib);
+  int num_checked = 0;
+  for (double x = distrib.minValue() - 1.0; x < distrib.maxValue() + 1.0; x += 0.0137)
+  {
+    if (ref.inRange(ntk::math::rnd(x / ref.precision) + 0.5))
+    {
+      ntk_ensure(distrib.cdf(x) == ref.cdf(x), "Different cdf.");
+      ++num_checked;
+    }
+    if (ref.inRange(x / ref.precision + 0.5))
+      ntk_ensure(distrib.logCdf(x) == ref.logCdf(x), "Different logCdf.");
+  }
+  ntk_ensure(num_checked > 0, "Nothing was checked.");
+
+  for (double p = 0; p <= 1.0; p += 0.001)
+  {
+    double closest_x = 0, closest_cdf = 0;
+    distrib.closestValueForCdf(p, &closest_x, &closest_cdf);
+    ntk_ensure(closest_x == ref.closestValueForCdf(p), "Different inverse cdf.");
+  }
+
+  const int num_queries = 1000000;
+  double sum = 0;
+  TimeCount tc_ref ("reference logCdf x1M", 1);
+  for (int i = 0; i < num_queries; ++i)
+    sum += ref.logCdf(2.0 + (i % 1000) * 0.001);
+  tc_ref.stop();
+
+  TimeCount tc_table ("logCdf x1M", 1);
+  for (int i = 0; i < num_queries; ++i)
+    sum -= distrib.logCdf(2.0 + (i % 1000) * 0.001);
+  tc_table.stop();
+  NTK_TEST_FLOAT_EQ(sum, 0);
+  return true;
+}
+
+bool test_incremental_lookups()
+{
+  // About 10^6 cells, addValue must not build a table for each sample.
+  EmpiricalDistribution distrib (0.001);
+  cv::RNG rng (42);
+  TimeCount tc ("addValue x2000", 1);
+  for (int i = 0; i < 2000; ++i)
+    distrib.addValue(rng.uniform(0.0, 1000.0));
+  tc.stop();
+  ntk_ensure(tc.elapsedMsecsNoPrint() < 2000, "addValue is too slow.");
+
+  std::vector<double> log_cdfs, cdfs;
+  for (double x = 1.0; x < 999.0; x += 0.731)
+  {
+    log_cdfs.push_back(distrib.logCdf(x));
+    cdfs.push_back(distrib.cdf(x));
+  }
+
+  // Above the table size limit, finalize builds a guide with wider cells.
+  distrib.finalize();
+  int i = 0;
+  for (double x = 1.0; x < 999.0; x += 0.731, ++i)
+  {
+    ntk_ensure(distrib.logCdf(x) == log_cdfs[i], "finalize changed logCdf.");
+    ntk_ensure(distrib.cdf(x) == cdfs[i], "finalize changed cdf.");
+  }
+  return true;
+}
+
+bool test_fft_mean_distributions()
+{
+  const int max_n = 12;
+
+  EmpiricalDistribution distrib;
+  cv::RNG rng (42);
+  for (int i = 0; i < 5000; ++i)
+    distrib.addValueFast(std::abs(rng.gaussian(2.0)) + 1.0);
+  distrib.finalize();
+
+  std::vector<EmpiricalDistributionPtr> ref_distribs;
+  TimeCount tc_ref ("mean_empirical_distribution for each n", 1);
+  for (int n = 1; n <= max_n; ++n)
+  {
+    EmpiricalDistributionPtr mean_distrib (new EmpiricalDistribution);
+    mean_empirical_distribution(*mean_distrib, distrib, n);
+    ref_distribs.push_back(mean_distrib);
+  }
+  tc_ref.stop();
+
+  EmpiricalMeanDistribution mean_distribs (max_n);
+  TimeCount tc_all ("EmpiricalMeanDistribution::precomputeAll", 1);
+  mean_distribs.reset(distrib);
+  mean_distribs.precomputeAll();
+  tc_all.stop();
+
+  EmpiricalMeanDistribution lazy_mean_distribs (max_n);
+  lazy_mean_distribs.reset(distrib);
+
+  double max_error = 0;
+  for (int n = 1; n <= max_n; ++n)
+  {
+    const EmpiricalDistribution& ref = *ref_distribs[n-1];
+    NTK_TEST_FLOAT_EQ(mean_distribs.rawDistrib(n).mean(), ref.mean());
+    for (double x = 1.0; x < 6.0; x += 0.05)
+    {
+      // Far tails depend on the rounding noise of each transform.
+      if (ref.logCdf(x) < -7)
+        continue;
+      max_error = std::max(max_error, std::abs(mean_distribs.logCdf(n, x) - ref.logCdf(x)));
+      max_error = std::max(max_error, std::abs(lazy_mean_distribs.logCdf(n, x) - ref.logCdf(x)));
+    }
+  }
+  ntk_dbg_print(max_error, 1);
+  ntk_ensure(max_error < 1e-4, "FFT mean distributions differ from the direct computation.");
+
+  // Precomputing must not replace the distributions already computed.
+  const EmpiricalDistribution& lazy_distrib = lazy_mean_distribs.rawDistrib(3);
+  lazy_mean_distribs.precomputeAll();
+  ntk_ensure(&lazy_mean_distribs.rawDistrib(3) == &lazy_distrib, "precomputeAll replaced a distribution.");
+  return true;
+}
+
+bool test_discrete_sampler()
+{
+  const int num_bins = 50;
+  const int num_samples = 1000000;
+
+  cv::RNG rng (42);
+  std::vector<double> distrib (num_bins);
+  foreach_idx(i, distrib)
+    distrib[i] = (i % 7 == 0) ? 0 : rng.uniform(0.0, 1.0);
+  double sum = std::accumulate(stl_bounds(distrib), 0.0);
+  foreach_idx(i, distrib)
+    distrib[i] /= sum;
+
+  std::vector<int> ref_counts (num_bins, 0);
+  TimeCount tc_ref ("draw_from_distrib x1M", 1);
+  for (int i = 0; i < num_samples; ++i)
+    ++ref_counts[draw_from_distrib(distrib, rng)];
+  tc_ref.stop();
+
+  DiscreteSampler sampler (distrib);
+  std::vector<unsigned> samples;
+  TimeCount tc_sampler ("DiscreteSampler x1M", 1);
+  sampler.draw(rng, num_samples, samples);
+  tc_sampler.stop();
+
+  std::vector<int> counts (num_bins, 0);
+  foreach_idx(i, samples)
+    ++counts[samples[i]];
+  for (int i = 0; i < num_samples / 10; ++i)
+    ++counts[sampler.draw(rng)];
+
+  // Pearson chi-square test, the 99.9% quantile for 41 degrees of freedom is about 75.
+  double chi2 = 0;
+  int num_non_empty = 0;
+  const double total = num_samples + num_samples / 10;
+  foreach_idx(i, distrib)
+  {
+    if (distrib[i] == 0)
+    {
+      ntk_ensure(counts[i] == 0, "Drew a zero probability bin.");
+      continue;
+    }
+    double expected = distrib[i] * total;
+    chi2 += ntk::math::sqr(counts[i] - expected) / expected;
+    ++num_non_empty;
+  }
+  ntk_dbg_print(chi2, 1);
+  NTK_TEST_FLOAT_EQ(num_non_empty, 42);
+  ntk_ensure(chi2 < 76, "Samples do not follow the distribution.");
+  return true;
+}
+
 bool test_tail_estimation(const char* filename)
 {
   EmpiricalDistribution distrib(0.01f);
@@ -77,6 +320,10 @@ int main(int argc, char** argv)
 
   ok &= test_tail_extrapolator();
   ok &= test_mean();
+  ok &= test_table_lookups();
+  ok &= test_incremental_lookups();
+  ok &= test_fft_mean_distributions();
+  ok &= test_discrete_sampler();
   //if (argc > 1) ok &= test_tail_estimation(argv[1]);
   return ok != true;
 }
@@ -0,0 +1,216 @@
+
+#include <ntk/ntk.h>
+#include <ntk/thread/event.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+#include <QThread>
+
+#include <map>
+
+using namespace ntk;
+
+namespace
+{
+
+struct IndexEventData : public EventData
+{
+  TYPEDEF_THIS(IndexEventData)
+
+  CLONABLE_EVENT_DATA
+
+  IndexEventData(int index = 0) : index(index) {}
+
+  int index;
+};
+ntk_ptr_typedefs(IndexEventData)
+
+struct Producer : public QThread, public EventBroadcaster
+{
+  Producer(EventListener& listener, int num_events)
+    : listener(listener), num_events(num_events)
+  {}
+
+  virtual void run()
+  {
+    for (int i = 0; i < num_events; ++i)
+      listener.newEvent(this, IndexEventDataPtr(new IndexEventData(i)));
+  }
+
+  EventListener& listener;
+  int num_events;
+};
+
+struct DelayedProducer : public QThread, public EventBroadcaster
+{
+  DelayedProducer(EventListener& listener) : listener(listener) {}
+
+  virtual void run()
+  {
+    ntk::sleep(50);
+    listener.newEvent(this, IndexEventDataPtr(new IndexEventData(0)));
+  }
+
+  EventListener& listener;
+};
+
+// Check that each sender delivers increasing indices, and record the last one.
+bool consume_all(SyncEventListener& listener,
+                 std::vector<Producer*>& producers,
+                 std::map<EventBroadcaster*, int>& last_index,
+                 int& num_received)
+{
+  bool ok = true;
+  num_received = 0;
+  while (true)
+  {
+    // Checked before waiting, so that no event can be missed.
+    bool all_finished = true;
+    foreach_idx(i, producers)
+      all_finished &= producers[i]->isFinished();
+
+    EventListener::Event event = listener.waitForNewEvent(20);
+    if (event.isNull())
+    {
+      if (all_finished)
+        break;
+      continue;
+    }
+
+    IndexEventDataPtr data = dynamic_Ptr_cast<IndexEventData>(event.data);
+    std::map<EventBroadcaster*, int>::iterator it = last_index.find(event.sender);
+    if (it != last_index.end() && data->index <= it->second)
+      ok = false;
+    last_index[event.sender] = data->index;
+    ++num_received;
+  }
+  return ok;
+}
+
+bool run_benchmark(SyncEventListener& listener, const char* name, bool expect_all)
+{
+  const int num_producers = 8;
+  const int num_events = 20000;
+
+  std::vector<Producer*> producers;
+  for (int i = 0; i < num_producers; ++i)
+    producers.push_back(new Producer(listener, num_events));
+
+  TimeCount tc (name, 1);
+  foreach_idx(i, producers)
+    producers[i]->start();
+
+  std::map<EventBroadcaster*, int> last_index;
+  int num_received = 0;
+  bool ordered = consume_all(listener, producers, last_index, num_received);
+  tc.stop();
+
+  ntk_dbg_print(num_received, 1);
+  ntk_dbg_print(listener.numDroppedEvents(), 1);
+  ntk_ensure(ordered, "Events from a sender were not delivered in order.");
+
+  // The latest event of each sender is never dropped.
+  foreach_idx(i, producers)
+  {
+    producers[i]->wait();
+    NTK_TEST_FLOAT_EQ(last_index[producers[i]], num_events-1);
+    delete producers[i];
+  }
+
+  NTK_TEST_FLOAT_EQ(num_received + listener.numDroppedEvents(), num_producers*num_events);
+  if (expect_all)
+    NTK_TEST_FLOAT_EQ(listener.numDroppedEvents(), 0);
+  return true;
+}
+
+}
+
+bool test_latest_value_mailboxes()
+{
+  SyncEventListener listener;
+  return run_benchmark(listener, "SyncEventListener 8x20000 events", false);
+}
+
+bool test_buffered_mailboxes()
+{
+  // Large enough to never drop anything.
+  BufferedSyncEventListener listener (20000);
+  return run_benchmark(listener, "BufferedSyncEventListener 8x20000 events", true);
+}
+
+bool test_delivery_order()
+{
+  BufferedSyncEventListener listener (2);
+  EventBroadcaster s1, s2;
+  listener.newEvent(&s1, IndexEventDataPtr(new IndexEventData(0)));
+  listener.newEvent(&s2, IndexEventDataPtr(new IndexEventData(1)));
+  listener.newEvent(&s1, IndexEventDataPtr(new IndexEventData(2)));
+  // Mailbox of s1 is full, event 0 is dropped.
+  listener.newEvent(&s1, IndexEventDataPtr(new IndexEventData(3)));
+
+  int expected_indices[] = { 2, 1, 3 };
+  EventBroadcaster* expected_senders[] = { &s1, &s2, &s1 };
+  for (int i = 0; i < 3; ++i)
+  {
+    EventListener::Event event = listener.waitForNewEvent(0);
+    ntk_ensure(event.sender == expected_senders[i], "Wrong sender order.");
+    NTK_TEST_FLOAT_EQ(dynamic_Ptr_cast<IndexEventData>(event.data)->index, expected_indices[i]);
+  }
+  ntk_ensure(listener.waitForNewEvent(0).isNull(), "Queue should be empty.");
+  NTK_TEST_FLOAT_EQ(listener.numDroppedEvents(), 1);
+  return true;
+}
+
+bool test_sender_disconnection()
+{
+  SyncEventListener listener;
+  {
+    EventBroadcaster sender;
+    sender.addEventListener(&listener);
+    sender.broadcastEvent(IndexEventDataPtr(new IndexEventData(0)));
+    sender.removeEventListener(&listener);
+    // The pending event went away with the mailbox.
+    ntk_ensure(listener.waitForNewEvent(0).isNull(), "Mailbox was not removed.");
+  }
+
+  // A new sender, possibly at the same address, starts from an empty mailbox.
+  EventBroadcaster sender;
+  listener.newEvent(&sender, IndexEventDataPtr(new IndexEventData(1)));
+  EventListener::Event event = listener.waitForNewEvent(0);
+  ntk_ensure(event.sender == &sender, "Event of the new sender is missing.");
+  NTK_TEST_FLOAT_EQ(dynamic_Ptr_cast<IndexEventData>(event.data)->index, 1);
+  ntk_ensure(listener.waitForNewEvent(0).isNull(), "Queue should be empty.");
+  return true;
+}
+
+bool test_sleeping_waiter()
+{
+  SyncEventListener listener;
+  DelayedProducer producer (listener);
+  producer.start();
+
+  // The waiter must be woken up by the event, not by the timeout.
+  TimeCount tc ("wake up", 1);
+  EventListener::Event event = listener.waitForNewEvent(5000);
+  uint64 elapsed_msecs = tc.elapsedMsecsNoPrint();
+  tc.stop();
+  producer.wait();
+
+  ntk_ensure(event.sender == &producer, "Waiter did not receive the event.");
+  ntk_ensure(elapsed_msecs < 2000, "Waiter was not woken up.");
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_delivery_order();
+  ok &= test_sender_disconnection();
+  ok &= test_sleeping_waiter();
+  ok &= test_latest_value_mailboxes();
+  ok &= test_buffered_mailboxes();
+  return ok != true;
+}
@@ -0,0 +1,188 @@
+
+#include <ntk/ntk.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/geometry/relative_pose_estimator_global.h>
+#include <ntk/mesh/mesh.h>
+#include <ntk/mesh/pcl_utils.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+typedef pcl::PointCloud<pcl::PointNormal> CloudType;
+
+void add_patch(Mesh& mesh, cv::Point3f origin, cv::Point3f u, cv::Point3f v, cv::Point3f normal,
+               int nu, int nv)
+{
+  for (int i = 0; i < nu; ++i)
+  for (int j = 0; j < nv; ++j)
+  {
+    mesh.vertices.push_back(origin + u*(i/float(nu)) + v*(j/float(nv)));
+    mesh.normals.push_back(normal);
+  }
+}
+
+// Corner with a bump, without any symmetry.
+void make_shape(Mesh& mesh)
+{
+  const float step = 0.004f;
+  add_patch(mesh, cv::Point3f(0,0,0), cv::Point3f(0.4f,0,0), cv::Point3f(0,0.3f,0), cv::Point3f(0,0,1),
+            0.4f/step, 0.3f/step);
+  add_patch(mesh, cv::Point3f(0,0,0), cv::Point3f(0,0.3f,0), cv::Point3f(0,0,0.2f), cv::Point3f(1,0,0),
+            0.3f/step, 0.2f/step);
+  add_patch(mesh, cv::Point3f(0,0,0), cv::Point3f(0.15f,0,0), cv::Point3f(0,0,0.1f), cv::Point3f(0,1,0),
+            0.15f/step, 0.1f/step);
+
+  const cv::Point3f center (0.25f, 0.15f, 0);
+  const float radius = 0.08f;
+  for (float theta = 0; theta < M_PI/2; theta += step/radius)
+  for (float phi = 0; phi < 2*M_PI; phi += step/(radius*std::max(sin(theta), 0.05f)))
+  {
+    cv::Point3f n (sin(theta)*cos(phi), sin(theta)*sin(phi), cos(theta));
+    mesh.vertices.push_back(center + n*radius);
+    mesh.normals.push_back(n);
+  }
+}
+
+Pose3D random_motion(cv::RNG& rng)
+{
+  Pose3D pose;
+  pose.applyTransformBefore(cv::Vec3f(rng.uniform(-0.5f, 0.5f), rng.uniform(-0.5f, 0.5f), rng.uniform(-0.5f, 0.5f)),
+                            cv::Vec3f(rng.uniform(-M_PI, M_PI), rng.uniform(-M_PI/2, M_PI/2), rng.uniform(-M_PI, M_PI)));
+  return pose;
+}
+
+double alignment_error(const Mesh& source, const Mesh& target, const Pose3D& estimated_pose)
+{
+  Mesh aligned = source;
+  aligned.applyTransform(estimated_pose.inverted());
+  double sum = 0;
+  foreach_idx(i, aligned.vertices)
+  {
+    cv::Point3f d = aligned.vertices[i] - target.vertices[i];
+    sum += d.dot(d);
+  }
+  return sqrt(sum / aligned.vertices.size());
+}
+
+}
+
+bool test_fpfh_invariance()
+{
+  Mesh mesh;
+  make_shape(mesh);
+  CloudType cloud;
+  meshToPointCloud(cloud, mesh);
+
+  cv::RNG rng (1);
+  Mesh moved_mesh = mesh;
+  moved_mesh.applyTransform(random_motion(rng));
+  CloudType moved_cloud;
+  meshToPointCloud(moved_cloud, moved_mesh);
+
+  cv::Mat1f descriptors, moved_descriptors;
+  TimeCount tc ("computeFPFHDescriptors", 1);
+  computeFPFHDescriptors(cloud, 0.03, descriptors);
+  tc.stop();
+  computeFPFHDescriptors(moved_cloud, 0.03, moved_descriptors);
+
+  NTK_TEST_FLOAT_EQ(descriptors.rows, cloud.points.size());
+  NTK_TEST_FLOAT_EQ(descriptors.cols, 33);
+  // Descriptors only depend on the local geometry, up to a few
+  // values falling in the neighbouring bin after rounding.
+  double mean_difference = cv::norm(descriptors - moved_descriptors, cv::NORM_L1) / descriptors.total();
+  ntk_dbg_print(mean_difference, 1);
+  ntk_ensure(mean_difference < 0.05, "FPFH is not rigid invariant.");
+
+  std::vector<cv::DMatch> matches;
+  findMutualNearestNeighbours(descriptors, moved_descriptors, matches);
+  ntk_dbg_print(matches.size(), 1);
+  ntk_ensure(!matches.empty(), "No mutual matches.");
+  int num_exact = 0;
+  foreach_idx(i, matches)
+    num_exact += matches[i].distance < 1.0;
+  ntk_ensure(num_exact > 0.9 * matches.size(), "Mutual matches should be almost exact here.");
+  return true;
+}
+
+bool test_random_poses()
+{
+  const int num_trials = 10;
+
+  Mesh target_mesh;
+  make_shape(target_mesh);
+  CloudType::Ptr target_cloud (new CloudType);
+  meshToPointCloud(*target_cloud, target_mesh);
+
+  RelativePoseEstimatorGlobal ransac_only;
+  ransac_only.setRefineWithICP(false);
+  ransac_only.setTargetCloud(target_cloud);
+
+  RelativePoseEstimatorGlobal estimator;
+  estimator.setTargetCloud(target_cloud);
+
+  cv::RNG rng (42);
+  int num_success = 0;
+  double ransac_error_sum = 0, refined_error_sum = 0;
+  uint64 ransac_msecs = 0, refined_msecs = 0;
+  for (int trial = 0; trial < num_trials; ++trial)
+  {
+    Mesh source_mesh = target_mesh;
+    source_mesh.applyTransform(random_motion(rng));
+    Mesh noisy_mesh = source_mesh;
+    foreach_idx(i, noisy_mesh.vertices)
+      noisy_mesh.vertices[i] += cv::Point3f(rng.gaussian(0.001), rng.gaussian(0.001), rng.gaussian(0.001));
+    CloudType::Ptr source_cloud (new CloudType);
+    meshToPointCloud(*source_cloud, noisy_mesh);
+
+    TimeCount tc_ransac ("global registration", 2);
+    ransac_only.setSourceCloud(source_cloud);
+    bool ransac_ok = ransac_only.estimateNewPose();
+    ransac_msecs += tc_ransac.elapsedMsecsNoPrint();
+
+    TimeCount tc_refined ("global registration with ICP", 2);
+    estimator.setSourceCloud(source_cloud);
+    bool ok = estimator.estimateNewPose();
+    refined_msecs += tc_refined.elapsedMsecsNoPrint();
+
+    ntk_dbg_print(estimator.numCorrespondences(), 1);
+    ntk_dbg_print(estimator.numInliers(), 1);
+    if (!ok || !ransac_ok)
+      continue;
+
+    double ransac_error = alignment_error(source_mesh, target_mesh, ransac_only.estimatedSourcePose());
+    double refined_error = alignment_error(source_mesh, target_mesh, estimator.estimatedSourcePose());
+    ntk_dbg_print(ransac_error, 1);
+    ntk_dbg_print(refined_error, 1);
+    if (refined_error < 0.01)
+    {
+      ++num_success;
+      ransac_error_sum += ransac_error;
+      refined_error_sum += refined_error;
+    }
+  }
+
+  ntk_dbg_print(num_success, 1);
+  ntk_dbg_print(ransac_msecs / num_trials, 1);
+  ntk_dbg_print(refined_msecs / num_trials, 1);
+  ntk_dbg_print(ransac_error_sum / std::max(num_success, 1), 1);
+  ntk_dbg_print(refined_error_sum / std::max(num_success, 1), 1);
+
+  ntk_ensure(num_success >= 8, "Too many failed registrations.");
+  ntk_ensure(refined_error_sum <= ransac_error_sum, "ICP refinement should not degrade the estimate.");
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_fpfh_invariance();
+  ok &= test_random_poses();
+  return ok != true;
+}
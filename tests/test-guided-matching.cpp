@@ -0,0 +1,200 @@
+
+#include <ntk/ntk.h>
+#include <ntk/image/feature.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 640;
+const int height = 480;
+const int descriptor_size = 64;
+
+Pose3D camera_pose(float tx, float ry)
+{
+  Pose3D pose;
+  pose.setCameraParameters(525, 525, width/2, height/2);
+  pose.applyTransformBefore(cv::Vec3f(tx, 0, 0), cv::Vec3f(0, ry, 0));
+  return pose;
+}
+
+// Random points in front of the camera, each one with its own descriptor.
+// A few descriptors are repeated far away in the image, like textures.
+void make_scene(std::vector<cv::Point3f>& points, cv::Mat1f& descriptors, int num_points)
+{
+  cv::RNG rng (42);
+  Pose3D pose = camera_pose(0, 0);
+  descriptors.create(num_points, descriptor_size);
+  for (int i = 0; i < num_points; ++i)
+  {
+    cv::Point2f p (rng.uniform(0.f, float(width)), rng.uniform(0.f, float(height)));
+    points.push_back(pose.unprojectFromImage(p, rng.uniform(0.8f, 3.f)));
+    cv::Mat1f descriptor = descriptors.row(i);
+    if (i > 0 && i % 10 == 0)
+      descriptors.row(i-1).copyTo(descriptor);
+    else
+      for (int k = 0; k < descriptor_size; ++k)
+        descriptor(0,k) = rng.uniform(0.f, 1.f);
+  }
+}
+
+// Observe the points with the given pose, adding noise to descriptors
+// and locations. Only features within the image are kept.
+void observe(FeatureSet& features,
+             std::vector<int>& point_indices,
+             const std::vector<cv::Point3f>& points,
+             const cv::Mat1f& descriptors,
+             const Pose3D& pose,
+             int seed)
+{
+  cv::RNG rng (seed);
+  std::vector<FeaturePoint> locations;
+  std::vector<int> rows;
+  point_indices.clear();
+  foreach_idx(i, points)
+  {
+    cv::Point3f p = pose.projectToImage(points[i]);
+    if (p.x < 0 || p.y < 0 || p.x >= width || p.y >= height)
+      continue;
+    FeaturePoint loc;
+    loc.pt = cv::Point2f(p.x + rng.gaussian(0.5), p.y + rng.gaussian(0.5));
+    loc.has_depth = true;
+    loc.depth = p.z;
+    locations.push_back(loc);
+    point_indices.push_back(i);
+  }
+
+  cv::Mat1f noisy_descriptors (locations.size(), descriptor_size);
+  foreach_idx(i, locations)
+    for (int k = 0; k < descriptor_size; ++k)
+      noisy_descriptors(i,k) = descriptors(point_indices[i],k) + rng.gaussian(0.02);
+
+  features.setFeatures(FeatureSet::Feature_BRIEF64, locations, noisy_descriptors);
+  features.compute3dLocation(pose);
+}
+
+int num_correct(const std::vector<cv::DMatch>& matches,
+                const std::vector<int>& target_indices,
+                const std::vector<int>& source_indices)
+{
+  int n = 0;
+  foreach_idx(i, matches)
+    n += target_indices[matches[i].trainIdx] == source_indices[matches[i].queryIdx];
+  return n;
+}
+
+}
+
+bool test_guided_sequence()
+{
+  std::vector<cv::Point3f> points;
+  cv::Mat1f descriptors;
+  make_scene(points, descriptors, 3000);
+
+  int total_global = 0, total_guided = 0;
+  int correct_global = 0, correct_guided = 0;
+  double global_msecs = 0, guided_msecs = 0;
+
+  for (int frame = 1; frame < 10; ++frame)
+  {
+    Pose3D target_pose = camera_pose(0.01f*(frame-1), 0.005f*(frame-1));
+    Pose3D source_pose = camera_pose(0.01f*frame, 0.005f*frame);
+    // Constant velocity prediction, slightly off.
+    Pose3D predicted_pose = camera_pose(0.01f*frame + 0.002f, 0.005f*frame);
+
+    FeatureSet target_features, source_features;
+    std::vector<int> target_indices, source_indices;
+    observe(target_features, target_indices, points, descriptors, target_pose, frame);
+    observe(source_features, source_indices, points, descriptors, source_pose, frame+100);
+
+    std::vector<cv::DMatch> global_matches;
+    TimeCount tc_global ("global matching", 2);
+    target_features.matchWith(source_features, global_matches);
+    global_msecs += tc_global.elapsedMsecsNoPrint();
+
+    std::vector<cv::DMatch> guided_matches;
+    TimeCount tc_guided ("guided matching", 2);
+    target_features.matchWithGuided(source_features, predicted_pose, 20, guided_matches);
+    guided_msecs += tc_guided.elapsedMsecsNoPrint();
+
+    total_global += global_matches.size();
+    total_guided += guided_matches.size();
+    correct_global += num_correct(global_matches, target_indices, source_indices);
+    correct_guided += num_correct(guided_matches, target_indices, source_indices);
+  }
+
+  ntk_dbg_print(total_global, 1);
+  ntk_dbg_print(correct_global, 1);
+  ntk_dbg_print(global_msecs, 1);
+  ntk_dbg_print(total_guided, 1);
+  ntk_dbg_print(correct_guided, 1);
+  ntk_dbg_print(guided_msecs, 1);
+
+  // Repeated descriptors are ambiguous globally, but not locally.
+  ntk_ensure(total_guided > total_global, "Guided matching should find more matches.");
+  ntk_ensure(correct_guided > 0.98*total_guided, "Too many wrong guided matches.");
+  return true;
+}
+
+bool test_wrong_prediction()
+{
+  std::vector<cv::Point3f> points;
+  cv::Mat1f descriptors;
+  make_scene(points, descriptors, 1000);
+
+  FeatureSet target_features, source_features;
+  std::vector<int> target_indices, source_indices;
+  observe(target_features, target_indices, points, descriptors, camera_pose(0, 0), 1);
+  observe(source_features, source_indices, points, descriptors, camera_pose(0.01f, 0), 2);
+
+  // Far from the actual motion, almost nothing can be matched
+  // and the caller is expected to fall back to global matching.
+  std::vector<cv::DMatch> matches;
+  target_features.matchWithGuided(source_features, camera_pose(0.3f, 0.2f), 10, matches);
+  ntk_dbg_print(matches.size(), 1);
+  ntk_ensure(matches.size() < 30, "Too many matches with a wrong prediction.");
+
+  // No feature with depth, no match.
+  FeatureSet empty_features;
+  empty_features.setFeatures(FeatureSet::Feature_BRIEF64, std::vector<FeaturePoint>(), cv::Mat1f(0, descriptor_size));
+  matches.clear();
+  empty_features.matchWithGuided(source_features, camera_pose(0.01f, 0), 10, matches);
+  NTK_TEST_FLOAT_EQ(matches.size(), 0);
+  return true;
+}
+
+bool test_single_candidates()
+{
+  std::vector<cv::Point3f> points;
+  cv::Mat1f descriptors;
+  make_scene(points, descriptors, 3000);
+
+  FeatureSet target_features, source_features;
+  std::vector<int> target_indices, source_indices;
+  observe(target_features, target_indices, points, descriptors, camera_pose(0, 0), 1);
+  observe(source_features, source_indices, points, descriptors, camera_pose(0.01f, 0), 2);
+
+  // With such a small window most keypoints have at most one candidate.
+  std::vector<cv::DMatch> matches;
+  target_features.matchWithGuided(source_features, camera_pose(0.01f, 0), 4, matches);
+  ntk_dbg_print(matches.size(), 1);
+  ntk_ensure(matches.size() > 0.5*source_indices.size(), "Single candidates should be matched.");
+  ntk_ensure(num_correct(matches, target_indices, source_indices) > 0.98*matches.size(), "Too many wrong single matches.");
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_guided_sequence();
+  ok &= test_wrong_prediction();
+  ok &= test_single_candidates();
+  return ok != true;
+}
@@ -0,0 +1,172 @@
+
+#include <ntk/ntk.h>
+#include <ntk/stats/image_statistics.h>
+#include <ntk/numeric/utils.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 161; // not a multiple of 4, to exercise the tail.
+const int height = 120;
+const int num_frames = 40;
+
+// Noisy depth-like frames with a few NaNs, and a mask.
+void generate_frames(std::vector<cv::Mat1f>& frames, std::vector<cv::Mat1b>& masks)
+{
+  cv::RNG rng (42);
+  for (int i = 0; i < num_frames; ++i)
+  {
+    cv::Mat1f frame (height, width);
+    cv::Mat1b mask (height, width);
+    for_all_rc(frame)
+    {
+      frame(r,c) = 1.0f + 0.01f * c + rng.gaussian(0.02);
+      if (rng.uniform(0.f, 1.f) < 0.03f)
+        frame(r,c) = std::numeric_limits<float>::quiet_NaN();
+      mask(r,c) = rng.uniform(0.f, 1.f) < 0.9f ? 255 : 0;
+    }
+    frames.push_back(frame);
+    masks.push_back(mask);
+  }
+}
+
+bool is_valid(const cv::Mat1f& frame, const cv::Mat1b& mask, int r, int c)
+{
+  return !ntk_isnan(frame(r,c)) && mask(r,c);
+}
+
+}
+
+bool test_moments()
+{
+  std::vector<cv::Mat1f> frames;
+  std::vector<cv::Mat1b> masks;
+  generate_frames(frames, masks);
+
+  ImageMomentsAccumulator accumulator (cv::Size(width, height));
+  ImageMomentsAccumulator first_half (cv::Size(width, height));
+  ImageMomentsAccumulator second_half (cv::Size(width, height));
+  TimeCount tc ("ImageMomentsAccumulator::addImage", 1);
+  foreach_idx(i, frames)
+    accumulator.addImage(frames[i], masks[i]);
+  tc.stop();
+
+  foreach_idx(i, frames)
+  {
+    if (i < num_frames / 3)
+      first_half.addImage(frames[i], masks[i]);
+    else
+      second_half.addImage(frames[i], masks[i]);
+  }
+  first_half.merge(second_half);
+
+  cv::Mat1f deviation, merged_deviation;
+  accumulator.computeDeviation(deviation);
+  first_half.computeDeviation(merged_deviation);
+
+  for_all_rc(deviation)
+  {
+    // Batch reference.
+    double n = 0, sum = 0, min_value = FLT_MAX, max_value = -FLT_MAX;
+    foreach_idx(i, frames)
+    {
+      if (!is_valid(frames[i], masks[i], r, c))
+        continue;
+      const double v = frames[i](r,c);
+      n += 1; sum += v;
+      min_value = std::min(min_value, v);
+      max_value = std::max(max_value, v);
+    }
+    const double mean = n > 0 ? sum / n : 0;
+    double sq_sum = 0;
+    foreach_idx(i, frames)
+      if (is_valid(frames[i], masks[i], r, c))
+        sq_sum += ntk::math::sqr(frames[i](r,c) - mean);
+    const double dev = n > 0 ? sqrt(sq_sum / n) : 0;
+
+    NTK_TEST_FLOAT_EQ(accumulator.count()(r,c), n);
+    ntk_ensure(std::abs(accumulator.mean()(r,c) - mean) < 1e-5, "Wrong mean.");
+    ntk_ensure(std::abs(deviation(r,c) - dev) < 1e-5, "Wrong deviation.");
+    NTK_TEST_FLOAT_EQ(accumulator.minImage()(r,c), float(min_value));
+    NTK_TEST_FLOAT_EQ(accumulator.maxImage()(r,c), float(max_value));
+
+    NTK_TEST_FLOAT_EQ(first_half.count()(r,c), n);
+    ntk_ensure(std::abs(first_half.mean()(r,c) - mean) < 1e-5, "Wrong merged mean.");
+    ntk_ensure(std::abs(merged_deviation(r,c) - dev) < 1e-5, "Wrong merged deviation.");
+  }
+  return true;
+}
+
+bool test_histograms()
+{
+  std::vector<cv::Mat1f> frames;
+  std::vector<cv::Mat1b> masks;
+  generate_frames(frames, masks);
+
+  const int num_bins = 32;
+  const float min_value = 1.0f;
+  const float max_value = 3.0f;
+  ImageHistogramAccumulator accumulator (cv::Size(width, height), num_bins, min_value, max_value);
+  ImageHistogramAccumulator first_half (cv::Size(width, height), num_bins, min_value, max_value);
+  ImageHistogramAccumulator second_half (cv::Size(width, height), num_bins, min_value, max_value);
+  foreach_idx(i, frames)
+  {
+    accumulator.addImage(frames[i], masks[i]);
+    if (i % 2)
+      first_half.addImage(frames[i], masks[i]);
+    else
+      second_half.addImage(frames[i], masks[i]);
+  }
+  first_half.merge(second_half);
+
+  const float bin_width = (max_value - min_value) / num_bins;
+  std::vector<unsigned> expected (num_bins);
+  for_all_rc(frames[0])
+  {
+    std::fill(stl_bounds(expected), 0);
+    foreach_idx(i, frames)
+    {
+      if (!is_valid(frames[i], masks[i], r, c))
+        continue;
+      int bin = int(floor((frames[i](r,c) - min_value) / bin_width));
+      ++expected[std::max(0, std::min(num_bins - 1, bin))];
+    }
+
+    const unsigned* bins = accumulator.pixelHistogram(r, c);
+    const unsigned* merged_bins = first_half.pixelHistogram(r, c);
+    for (int i = 0; i < num_bins; ++i)
+    {
+      NTK_TEST_FLOAT_EQ(bins[i], expected[i]);
+      NTK_TEST_FLOAT_EQ(merged_bins[i], expected[i]);
+    }
+  }
+
+  // The median must be close to the mean of the gaussian noise.
+  cv::Mat1f median;
+  accumulator.computePercentile(0.5, median);
+  ImageMomentsAccumulator moments (cv::Size(width, height));
+  foreach_idx(i, frames)
+    moments.addImage(frames[i], masks[i]);
+  for_all_rc(median)
+  {
+    if (moments.count()(r,c) < 10)
+      continue;
+    ntk_ensure(std::abs(median(r,c) - moments.mean()(r,c)) < 2*bin_width, "Median too far from the mean.");
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_moments();
+  ok &= test_histograms();
+  return ok != true;
+}
@@ -0,0 +1,225 @@
+
+#include <ntk/ntk.h>
+#include <ntk/geometry/incremental_pose_estimator_from_markers.h>
+#include <ntk/aruco/marker.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+// 3x2 board of markers, 10cm apart.
+void generate_board(std::vector<cv::Point3f>& centers)
+{
+  for (int r = 0; r < 2; ++r)
+    for (int c = 0; c < 3; ++c)
+      centers.push_back(cv::Point3f(c*0.1f, r*0.1f, 0));
+}
+
+// A random subset of the markers, with gaussian noise on their centers.
+void generate_frame(cv::RNG& rng,
+                    const std::vector<cv::Point3f>& centers,
+                    IncrementalMarkerSetupEstimator::FrameObservations& observations)
+{
+  observations.clear();
+  foreach_idx(i, centers)
+  {
+    if (rng.uniform(0.f, 1.f) < 0.3f)
+      continue;
+    cv::Point3f noise (rng.gaussian(0.005), rng.gaussian(0.005), rng.gaussian(0.005));
+    observations.push_back(IncrementalMarkerSetupEstimator::Observation(i, centers[i] + noise, 1.0f));
+  }
+}
+
+// Exposes the setup frame conversions.
+class TestMarkerEstimator : public IncrementalPoseEstimatorFromMarkers
+{
+public:
+  using IncrementalPoseEstimatorFromMarkers::setReferenceMarker;
+  using IncrementalPoseEstimatorFromMarkers::addMarkerObservations;
+};
+
+// Rigid transform in the nestk frame.
+cv::Mat1d rigid_transform(const cv::Vec3d& rotation_vector, const cv::Vec3d& translation)
+{
+  cv::Mat1d H = cv::Mat1d::eye(4,4);
+  cv::Mat1d R;
+  cv::Rodrigues(cv::Mat1d(rotation_vector), R);
+  cv::Mat1d H_rot = H(cv::Rect(0,0,3,3));
+  R.copyTo(H_rot);
+  for (int k = 0; k < 3; ++k)
+    H(k,3) = translation[k];
+  return H;
+}
+
+Pose3D to_pose(const cv::Mat1d& H)
+{
+  Pose3D pose;
+  pose.setCameraTransform(H);
+  return pose;
+}
+
+// Marker as detected by aruco, from its marker to camera transform in the nestk frame.
+aruco::Marker make_marker(int id, const cv::Mat1d& marker_to_camera)
+{
+  // aruco extrinsics are in the opencv frame, y and z flipped on both sides.
+  cv::Mat1d F = cv::Mat1d::eye(4,4);
+  F(1,1) = F(2,2) = -1;
+  cv::Mat1d H = F * marker_to_camera * F;
+
+  cv::Mat1d rotation_vector;
+  cv::Rodrigues(H(cv::Rect(0,0,3,3)), rotation_vector);
+
+  aruco::Marker marker;
+  marker.id = id;
+  marker.ssize = 0.05f;
+  marker.Rvec = cv::Mat1f(3,1);
+  marker.Tvec = cv::Mat1f(3,1);
+  for (int k = 0; k < 3; ++k)
+  {
+    marker.Rvec.at<float>(k,0) = rotation_vector(k);
+    marker.Tvec.at<float>(k,0) = H(k,3);
+  }
+  return marker;
+}
+
+}
+
+bool test_setup_frame_conversions()
+{
+  std::vector<cv::Point3f> centers;
+  generate_board(centers);
+
+  // Camera poses are relative to the first image, in which marker 0
+  // is tilted and shifted. The setup is expected in the frame of marker 0.
+  cv::Mat1d reference_camera = rigid_transform(cv::Vec3d(0.1, -0.2, 0.05), cv::Vec3d(0.02, -0.01, 0.03));
+  cv::Mat1d reference_marker = rigid_transform(cv::Vec3d(0.4, 0.3, -0.2), cv::Vec3d(-0.1, 0.05, -0.7));
+  cv::Mat1d marker0_to_world = reference_camera.inv() * reference_marker;
+
+  TestMarkerEstimator estimator;
+  estimator.setReferenceMarker(to_pose(reference_marker), to_pose(reference_camera));
+
+  for (int frame = 0; frame < 10; ++frame)
+  {
+    cv::Mat1d camera = rigid_transform(cv::Vec3d(0.05*frame, 0.1, -0.03*frame),
+                                       cv::Vec3d(0.01*frame, -0.02, 0.005*frame));
+    std::vector<aruco::Marker> markers;
+    foreach_idx(i, centers)
+    {
+      cv::Mat1d marker_to_camera = camera * marker0_to_world
+          * rigid_transform(cv::Vec3d(0,0,0), cv::Vec3d(centers[i].x, centers[i].y, centers[i].z));
+      markers.push_back(make_marker(i, marker_to_camera));
+    }
+    estimator.addMarkerObservations(to_pose(camera), markers, true /* in world frame */);
+  }
+
+  MarkerSetup setup (0.05f);
+  NTK_TEST_FLOAT_EQ(estimator.setupEstimator().fillMarkerSetup(setup, 10), centers.size());
+  foreach_idx(i, setup.markers)
+  {
+    cv::Point3f delta = setup.markers[i].center() - centers[setup.markers[i].id()];
+    ntk_ensure(cv::norm(delta) < 1e-4, "Marker center not converted to the setup frame.");
+  }
+
+  // Refinement path, camera poses are already relative to the setup.
+  TestMarkerEstimator refining_estimator;
+  for (int frame = 0; frame < 10; ++frame)
+  {
+    cv::Mat1d camera = rigid_transform(cv::Vec3d(-0.02*frame, 0.3, 0.1),
+                                       cv::Vec3d(-0.05, 0.01*frame, -0.6));
+    std::vector<aruco::Marker> markers;
+    for (int i = 1; i < int(centers.size()); i += 2)
+    {
+      cv::Mat1d marker_to_camera = camera
+          * rigid_transform(cv::Vec3d(0,0,0), cv::Vec3d(centers[i].x, centers[i].y, centers[i].z));
+      markers.push_back(make_marker(i, marker_to_camera));
+    }
+    refining_estimator.addMarkerObservations(to_pose(camera), markers, false /* in setup frame */);
+  }
+
+  for (int i = 1; i < int(centers.size()); i += 2)
+  {
+    cv::Point3f center;
+    ntk_ensure(refining_estimator.setupEstimator().estimateCenter(i, center), "Marker not estimated.");
+    ntk_ensure(cv::norm(center - centers[i]) < 1e-4, "Marker center not converted to the setup frame.");
+  }
+  NTK_TEST_FLOAT_EQ(refining_estimator.setupEstimator().numObservations(0), 0);
+  return true;
+}
+
+bool test_setup_accuracy()
+{
+  std::vector<cv::Point3f> centers;
+  generate_board(centers);
+
+  cv::RNG rng (42);
+  IncrementalMarkerSetupEstimator estimator (200);
+  IncrementalMarkerSetupEstimator::FrameObservations observations;
+  for (int i = 0; i < 1000; ++i)
+  {
+    generate_frame(rng, centers, observations);
+    estimator.addFrame(observations);
+  }
+
+  ntk_ensure(estimator.numFrames() == 200, "Window size not respected");
+
+  MarkerSetup setup (0.05f);
+  int num_markers = estimator.fillMarkerSetup(setup, 5);
+  ntk_ensure(num_markers == centers.size(), "Some markers were not estimated");
+
+  foreach_idx(i, setup.markers)
+  {
+    cv::Point3f delta = setup.markers[i].center() - centers[setup.markers[i].id()];
+    ntk_dbg_print(cv::norm(delta), 1);
+    ntk_ensure(cv::norm(delta) < 0.002, "Marker center too far from ground truth");
+  }
+  return true;
+}
+
+// Per-frame cost should not depend on the number of frames already seen.
+bool benchmark_constant_cost()
+{
+  std::vector<cv::Point3f> centers;
+  generate_board(centers);
+
+  cv::RNG rng (42);
+  IncrementalMarkerSetupEstimator estimator (100);
+  IncrementalMarkerSetupEstimator::FrameObservations observations;
+
+  const int num_blocks = 10;
+  const int frames_per_block = 10000;
+  std::vector<double> block_usecs;
+  for (int block = 0; block < num_blocks; ++block)
+  {
+    double start = cv::getTickCount();
+    for (int i = 0; i < frames_per_block; ++i)
+    {
+      generate_frame(rng, centers, observations);
+      estimator.addFrame(observations);
+    }
+    double usecs_per_frame = 1e6 * (cv::getTickCount() - start) / cv::getTickFrequency() / frames_per_block;
+    ntk_dbg(1) << "[BENCH] frames " << block * frames_per_block << "-" << (block+1) * frames_per_block
+               << ": " << usecs_per_frame << " us/frame";
+    block_usecs.push_back(usecs_per_frame);
+  }
+
+  // Allow for timing noise.
+  foreach_idx(i, block_usecs)
+    ntk_ensure(block_usecs[i] < 2*block_usecs[0] + 1.0, "Update cost grows with the number of frames.");
+  NTK_TEST_FLOAT_EQ(estimator.numFrames(), 100);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_setup_frame_conversions();
+  ok &= test_setup_accuracy();
+  ok &= benchmark_constant_cost();
+  return ok != true;
+}
@@ -0,0 +1,242 @@
+
+#include <ntk/ntk.h>
+#include <ntk/aruco/marker.h>
+#include <ntk/camera/rgbd_calibration.h>
+#include <ntk/camera/rgbd_image.h>
+#include <ntk/geometry/relative_pose_estimator_markers.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 640;
+const int height = 480;
+const double focal = 525;
+
+// Board texture, 0.5mm per pixel, centered on the world origin.
+const double texture_resolution = 0.0005;
+const int texture_width = 1000;
+const int texture_height = 800;
+const int marker_pixels = 7*22;
+const float marker_size = marker_pixels * texture_resolution;
+
+RGBDCalibrationPtr make_calibration()
+{
+  RGBDCalibrationPtr calib (new RGBDCalibration);
+  cv::Mat1d K = (cv::Mat1d(3,3) << focal, 0, width/2, 0, focal, height/2, 0, 0, 1);
+  calib->depth_intrinsics = K.clone();
+  calib->rgb_intrinsics = K.clone();
+  calib->setRgbSize(cv::Size(width, height));
+  calib->setRawRgbSize(cv::Size(width, height));
+  return calib;
+}
+
+// Four markers on a white board.
+cv::Mat1b make_board()
+{
+  cv::Mat1b board (texture_height, texture_width);
+  board = 255;
+  const int ids[] = { 10, 125, 300, 777 };
+  const cv::Point corners[] = { cv::Point(150, 150), cv::Point(700, 150), cv::Point(150, 500), cv::Point(700, 500) };
+  for (int i = 0; i < 4; ++i)
+  {
+    cv::Mat marker = aruco::Marker::createMarkerImage(ids[i], marker_pixels);
+    cv::Mat1b roi = board(cv::Rect(corners[i].x, corners[i].y, marker_pixels, marker_pixels));
+    marker.copyTo(roi);
+  }
+  return board;
+}
+
+// Smooth hand-held like motion in front of the board, in the opencv camera frame.
+void camera_motion(int frame, cv::Mat1d& R, cv::Mat1d& t)
+{
+  const double a = 0.05*frame;
+  cv::Mat1d rvec = (cv::Mat1d(3,1) << 0.15*sin(a), 0.2*sin(0.7*a), 0.1*sin(0.5*a));
+  cv::Rodrigues(rvec, R);
+  t = (cv::Mat1d(3,1) << 0.05*sin(a), 0.04*cos(0.8*a), 0.6 + 0.05*sin(0.3*a));
+}
+
+Pose3D camera_pose(int frame)
+{
+  cv::Mat1d R, t;
+  camera_motion(frame, R, t);
+
+  // Pose3D cameras have y and z flipped.
+  cv::Mat1d H = cv::Mat1d::eye(4,4);
+  for (int r = 0; r < 3; ++r)
+  {
+    const double sign = (r == 0) ? 1 : -1;
+    for (int c = 0; c < 3; ++c)
+      H(r,c) = sign*R(r,c);
+    H(r,3) = sign*t(r);
+  }
+
+  Pose3D pose;
+  pose.setCameraParameters(focal, focal, width/2, height/2);
+  pose.setCameraTransform(H);
+  return pose;
+}
+
+void render_image(RGBDImage& image, RGBDCalibrationConstPtr calib, const cv::Mat1b& board, int frame)
+{
+  cv::Mat1d R, t;
+  camera_motion(frame, R, t);
+
+  // Homography from texture pixels to image pixels, pixel centers at integer coordinates.
+  cv::Mat1d texture_to_board = (cv::Mat1d(3,3) << texture_resolution, 0, (0.5-texture_width/2)*texture_resolution,
+                                                  0, texture_resolution, (0.5-texture_height/2)*texture_resolution,
+                                                  0, 0, 1);
+  cv::Mat1d board_to_camera = (cv::Mat1d(3,3) << R(0,0), R(0,1), t(0),
+                                                 R(1,0), R(1,1), t(1),
+                                                 R(2,0), R(2,1), t(2));
+  cv::Mat1d homography = calib->rgb_intrinsics * board_to_camera * texture_to_board;
+
+  cv::Mat1b gray;
+  cv::warpPerspective(board, gray, homography, cv::Size(width, height),
+                      cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(128));
+  cv::GaussianBlur(gray, gray, cv::Size(3,3), 0.6);
+
+  image.setCalibration(calib);
+  cv::cvtColor(gray, image.rgbRef(), CV_GRAY2BGR);
+  image.depthRef() = cv::Mat1f(height, width, float(t(2)));
+}
+
+void pose_error(const Pose3D& p1, const Pose3D& p2, double& translation_error, double& rotation_error)
+{
+  cv::Mat1d delta = p1.cvCameraTransformd() * p2.cvCameraTransformd().inv();
+  cv::Mat1d rotation_vector;
+  cv::Rodrigues(delta(cv::Rect(0,0,3,3)), rotation_vector);
+  rotation_error = cv::norm(rotation_vector);
+  translation_error = cv::norm(p1.cvTranslation() - p2.cvTranslation());
+}
+
+struct SequenceStats
+{
+  SequenceStats() : num_failures(0), max_translation_error(0), max_rotation_error(0), msecs(0) {}
+
+  int num_failures;
+  double max_translation_error;
+  double max_rotation_error;
+  double msecs;
+};
+
+void run_sequence(RelativePoseEstimatorMarkers& estimator,
+                  const std::vector<int>& frames,
+                  SequenceStats& stats)
+{
+  RGBDCalibrationPtr calib = make_calibration();
+  cv::Mat1b board = make_board();
+
+  RGBDImage target_image;
+  render_image(target_image, calib, board, 0);
+  Pose3D target_pose = camera_pose(0);
+
+  foreach_idx(i, frames)
+  {
+    RGBDImage image;
+    if (frames[i] < 0)
+    {
+      // Markers hidden.
+      render_image(image, calib, board, 0);
+      image.rgbRef().setTo(cv::Scalar(128,128,128));
+    }
+    else
+      render_image(image, calib, board, frames[i]);
+
+    estimator.setSourceImage(image);
+    estimator.setTargetImage(target_image);
+    estimator.setTargetPose(target_pose);
+
+    TimeCount tc ("estimateNewPose", 2);
+    bool ok = estimator.estimateNewPose();
+    stats.msecs += tc.elapsedMsecsNoPrint();
+
+    if (frames[i] < 0)
+    {
+      stats.num_failures += ok;
+      continue;
+    }
+
+    if (!ok)
+    {
+      ++stats.num_failures;
+      continue;
+    }
+
+    double translation_error = 0, rotation_error = 0;
+    pose_error(estimator.estimatedSourcePose(), camera_pose(frames[i]), translation_error, rotation_error);
+    stats.max_translation_error = std::max(stats.max_translation_error, translation_error);
+    stats.max_rotation_error = std::max(stats.max_rotation_error, rotation_error);
+  }
+}
+
+}
+
+bool test_tracking_throughput()
+{
+  const int num_frames = 100;
+  std::vector<int> frames;
+  for (int i = 1; i <= num_frames; ++i)
+    frames.push_back(i);
+
+  RelativePoseEstimatorMarkers detection_estimator;
+  detection_estimator.setMarkerSize(marker_size);
+  SequenceStats detection_stats;
+  run_sequence(detection_estimator, frames, detection_stats);
+
+  RelativePoseEstimatorMarkers tracking_estimator;
+  tracking_estimator.setMarkerSize(marker_size);
+  tracking_estimator.setUseCornerTracking(true, 10);
+  SequenceStats tracking_stats;
+  run_sequence(tracking_estimator, frames, tracking_stats);
+
+  ntk_dbg_print(detection_stats.msecs, 1);
+  ntk_dbg_print(detection_stats.num_failures, 1);
+  ntk_dbg_print(tracking_stats.msecs, 1);
+  ntk_dbg_print(tracking_stats.num_failures, 1);
+  ntk_dbg_print(tracking_stats.max_translation_error, 1);
+  ntk_dbg_print(tracking_stats.max_rotation_error, 1);
+  ntk_dbg_print(tracking_estimator.numDetections(), 1);
+
+  NTK_TEST_FLOAT_EQ(tracking_stats.num_failures, 0);
+  // Target marker positions come from single marker estimations, a few mm off.
+  ntk_ensure(tracking_stats.max_translation_error < 0.02, "Tracked poses are not accurate.");
+  ntk_ensure(tracking_stats.max_rotation_error < 0.03, "Tracked poses are not accurate.");
+  NTK_TEST_FLOAT_EQ(tracking_estimator.numDetections(), num_frames/10);
+  ntk_ensure(tracking_stats.msecs < detection_stats.msecs, "Tracking should be faster than detection.");
+  return true;
+}
+
+bool test_track_loss()
+{
+  // Markers disappear after the third frame.
+  const int sequence[] = { 1, 2, 3, -1, 4, 5, 6 };
+  std::vector<int> frames (sequence, sequence + 7);
+
+  RelativePoseEstimatorMarkers estimator;
+  estimator.setMarkerSize(marker_size);
+  estimator.setUseCornerTracking(true, 100);
+  SequenceStats stats;
+  run_sequence(estimator, frames, stats);
+
+  ntk_dbg_print(estimator.numDetections(), 1);
+  NTK_TEST_FLOAT_EQ(stats.num_failures, 0);
+  ntk_ensure(stats.max_translation_error < 0.02, "Poses after track loss are not accurate.");
+  // First frame, lost frame and the one after it.
+  NTK_TEST_FLOAT_EQ(estimator.numDetections(), 3);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_tracking_throughput();
+  ok &= test_track_loss();
+  return ok != true;
+}
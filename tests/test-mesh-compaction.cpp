@@ -0,0 +1,241 @@
+
+#include <ntk/ntk.h>
+#include <ntk/mesh/mesh.h>
+#include <ntk/utils/opencv_utils.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+#include <set>
+
+using namespace ntk;
+
+namespace
+{
+
+// Grid mesh with every stream filled, some NaN vertices and some dead faces.
+void generate_mesh(Mesh& mesh, int grid_size)
+{
+  cv::RNG rng (42);
+  for (int r = 0; r < grid_size; ++r)
+  for (int c = 0; c < grid_size; ++c)
+  {
+    cv::Point3f p (c, r, rng.uniform(0.f, 1.f));
+    if (rng.uniform(0.f, 1.f) < 0.05f)
+      p = cv::Point3f(std::numeric_limits<float>::quiet_NaN(), 0, 0);
+    mesh.vertices.push_back(p);
+    mesh.colors.push_back(cv::Vec3b(r%256, c%256, (r+c)%256));
+    mesh.normals.push_back(cv::Point3f(0, 0, 1));
+    mesh.texcoords.push_back(cv::Point2f(c/float(grid_size), r/float(grid_size)));
+  }
+
+  for (int r = 0; r < grid_size-1; ++r)
+  for (int c = 0; c < grid_size-1; ++c)
+  {
+    int i = r*grid_size+c;
+    Face f1 (i, i+1, i+grid_size);
+    Face f2 (i+1, i+grid_size+1, i+grid_size);
+    float p = rng.uniform(0.f, 1.f);
+    if (p < 0.02f)
+      f1.kill();
+    else if (p < 0.04f)
+      f2.indices[1] = f2.indices[0]; // degenerate.
+    mesh.faces.push_back(f1);
+    mesh.faces.push_back(f2);
+    mesh.face_labels.push_back(i%7);
+    mesh.face_labels.push_back(i%5);
+  }
+
+  // A few duplicates.
+  for (int i = 0; i < mesh.faces.size(); i += 97)
+  {
+    Face f = mesh.faces[i];
+    std::swap(f.indices[0], f.indices[2]);
+    mesh.faces.push_back(f);
+    mesh.face_labels.push_back(mesh.face_labels[i]);
+  }
+}
+
+// What Mesh::removeDeadFaces used to do.
+void reference_remove_dead_faces(Mesh& mesh)
+{
+  std::vector<Face> new_faces;
+  std::vector<int> new_face_labels;
+  foreach_idx(face_i, mesh.faces)
+  {
+    const Face& face = mesh.faces[face_i];
+    if (!face.isValid()
+        || face.indices[0] == face.indices[1]
+        || face.indices[0] == face.indices[2]
+        || face.indices[1] == face.indices[2])
+      continue;
+    new_faces.push_back(face);
+    if (mesh.hasFaceLabels())
+      new_face_labels.push_back(mesh.face_labels[face_i]);
+  }
+  mesh.faces = new_faces;
+  mesh.face_labels = new_face_labels;
+}
+
+// What Mesh::removeNanVertices used to do, including texcoords.
+void reference_remove_nan_vertices(Mesh& mesh)
+{
+  std::vector<int> new_indices (mesh.vertices.size());
+  Mesh new_mesh;
+  foreach_idx(i, mesh.vertices)
+  {
+    if (ntk::isnan(mesh.vertices[i]))
+    {
+      new_indices[i] = -1;
+      continue;
+    }
+    new_indices[i] = new_mesh.vertices.size();
+    new_mesh.vertices.push_back(mesh.vertices[i]);
+    new_mesh.colors.push_back(mesh.colors[i]);
+    new_mesh.normals.push_back(mesh.normals[i]);
+    new_mesh.texcoords.push_back(mesh.texcoords[i]);
+  }
+
+  foreach_idx(face_i, mesh.faces)
+  {
+    Face& face = mesh.faces[face_i];
+    if (!face.isValid())
+      continue;
+    for (int k = 0; k < 3; ++k)
+    {
+      int new_index = new_indices[face.indices[k]];
+      if (new_index < 0)
+      {
+        face.kill();
+        break;
+      }
+      face.indices[k] = new_index;
+    }
+  }
+
+  mesh.vertices = new_mesh.vertices;
+  mesh.colors = new_mesh.colors;
+  mesh.normals = new_mesh.normals;
+  mesh.texcoords = new_mesh.texcoords;
+  reference_remove_dead_faces(mesh);
+}
+
+bool same_faces(const Mesh& m1, const Mesh& m2)
+{
+  if (m1.faces.size() != m2.faces.size())
+    return false;
+  foreach_idx(i, m1.faces)
+    if (!(m1.faces[i] == m2.faces[i]))
+      return false;
+  return m1.face_labels == m2.face_labels;
+}
+
+bool same_vertices(const Mesh& m1, const Mesh& m2)
+{
+  if (m1.vertices.size() != m2.vertices.size())
+    return false;
+  foreach_idx(i, m1.vertices)
+  {
+    if (m1.vertices[i] != m2.vertices[i]) return false;
+    if (m1.colors[i] != m2.colors[i]) return false;
+    if (m1.normals[i] != m2.normals[i]) return false;
+    if (m1.texcoords[i] != m2.texcoords[i]) return false;
+  }
+  return true;
+}
+
+}
+
+bool test_remove_nan_vertices()
+{
+  Mesh input;
+  generate_mesh(input, 512);
+
+  Mesh ref_mesh = input;
+  TimeCount tc_ref ("reference removeNanVertices", 1);
+  reference_remove_nan_vertices(ref_mesh);
+  tc_ref.stop();
+
+  Mesh mesh = input;
+  TimeCount tc_compact ("removeNanVertices", 1);
+  mesh.removeNanVertices();
+  tc_compact.stop();
+
+  ntk_ensure(same_vertices(mesh, ref_mesh), "Vertex streams differ.");
+  ntk_ensure(same_faces(mesh, ref_mesh), "Faces differ.");
+  NTK_TEST_FLOAT_EQ(mesh.texcoords.size(), mesh.vertices.size());
+  return true;
+}
+
+bool test_remove_dead_faces()
+{
+  Mesh input;
+  generate_mesh(input, 512);
+
+  Mesh ref_mesh = input;
+  TimeCount tc_ref ("reference removeDeadFaces", 1);
+  reference_remove_dead_faces(ref_mesh);
+  tc_ref.stop();
+
+  Mesh mesh = input;
+  TimeCount tc_compact ("removeDeadFaces", 1);
+  mesh.removeDeadFaces();
+  tc_compact.stop();
+
+  ntk_ensure(same_faces(mesh, ref_mesh), "Faces differ.");
+  return true;
+}
+
+bool test_remove_duplicated_faces()
+{
+  Mesh mesh;
+  generate_mesh(mesh, 128);
+  mesh.removeDeadFaces();
+
+  std::set< std::vector<int> > unique_faces;
+  foreach_idx(i, mesh.faces)
+  {
+    Face f = mesh.faces[i];
+    f.sort();
+    unique_faces.insert(std::vector<int>(f.indices, f.indices + 3));
+  }
+
+  mesh.removeDuplicatedFaces();
+  NTK_TEST_FLOAT_EQ(mesh.faces.size(), unique_faces.size());
+  NTK_TEST_FLOAT_EQ(mesh.face_labels.size(), mesh.faces.size());
+
+  std::set< std::vector<int> > remaining_faces;
+  foreach_idx(i, mesh.faces)
+    remaining_faces.insert(std::vector<int>(mesh.faces[i].indices, mesh.faces[i].indices + 3));
+  ntk_ensure(remaining_faces == unique_faces, "Wrong set of unique faces.");
+  return true;
+}
+
+bool test_compact_vertices()
+{
+  Mesh mesh;
+  generate_mesh(mesh, 16);
+  mesh.colors.clear(); // not aligned, should stay empty.
+
+  std::vector<unsigned char> keep (mesh.vertices.size(), 1);
+  keep[0] = 0;
+  int n = mesh.compactVertices(keep);
+  NTK_TEST_FLOAT_EQ(n, 16*16-1);
+  NTK_TEST_FLOAT_EQ(mesh.vertices.size(), n);
+  NTK_TEST_FLOAT_EQ(mesh.colors.size(), 0);
+  NTK_TEST_FLOAT_EQ(mesh.normals.size(), n);
+  ntk_ensure(!mesh.faces[0].isValid(), "Face using vertex 0 should be dead.");
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_remove_nan_vertices();
+  ok &= test_remove_dead_faces();
+  ok &= test_remove_duplicated_faces();
+  ok &= test_compact_vertices();
+  return ok != true;
+}
@@ -0,0 +1,233 @@
+
+#include <ntk/ntk.h>
+#include <ntk/mesh/rgbd_modeler.h>
+#include <ntk/camera/rgbd_calibration.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/utils/opencv_utils.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 160;
+const int height = 120;
+
+RGBDCalibrationPtr make_calibration()
+{
+  RGBDCalibrationPtr calib (new RGBDCalibration);
+  cv::Mat1d K = (cv::Mat1d(3,3) << 140, 0, width/2, 0, 140, height/2, 0, 0, 1);
+  calib->depth_intrinsics = K.clone();
+  calib->rgb_intrinsics = K.clone();
+  calib->T = (cv::Mat1d(3,1) << 0.025, 0, 0);
+  calib->setRgbSize(cv::Size(width, height));
+  calib->setRawRgbSize(cv::Size(width, height));
+  return calib;
+}
+
+// Camera looking at a tilted plane. Normals are optional,
+// and some of them are missing.
+void make_image(RGBDImage& image, RGBDCalibrationConstPtr calib, bool with_normals = false)
+{
+  image.setCalibration(calib);
+  image.rgbRef() = cv::Mat3b(height, width);
+  image.depthRef() = cv::Mat1f(height, width);
+  image.depthMaskRef() = cv::Mat1b(height, width);
+  for_all_rc(image.depthRef())
+  {
+    image.depthRef()(r,c) = 1.0f + 0.002f * r;
+    image.depthMaskRef()(r,c) = (r+c) % 17 ? 255 : 0;
+    image.rgbRef()(r,c) = cv::Vec3b(r, c, (r+c)%256);
+  }
+
+  if (!with_normals)
+    return;
+  image.normalRef() = cv::Mat3f(height, width);
+  for_all_rc(image.normalRef())
+  {
+    if ((r*c) % 11 == 0)
+      image.normalRef()(r,c) = cv::Vec3f(0,0,0);
+    else
+      image.normalRef()(r,c) = cv::Vec3f(0.1f*(c%3), -0.3f, -1.f - 0.01f*r);
+  }
+}
+
+// What RGBDModeler::addNewView used to do.
+void reference_add_new_view(Mesh& mesh, const RGBDImage& image, Pose3D& depth_pose)
+{
+  Pose3D rgb_pose = depth_pose;
+  rgb_pose.toRightCamera(image.calibration()->rgb_intrinsics, image.calibration()->R, image.calibration()->T);
+
+  Pose3D world_to_camera_normal_pose;
+  world_to_camera_normal_pose.applyTransformBefore(cv::Vec3f(0,0,0), depth_pose.cvEulerRotation());
+  Pose3D camera_to_world_normal_pose = world_to_camera_normal_pose; camera_to_world_normal_pose.invert();
+
+  const cv::Mat1f& depth_im = image.depth();
+  for_all_rc(depth_im)
+  {
+    if (!image.depthMask()(r,c))
+      continue;
+    float depth = depth_im(r,c);
+    cv::Point3f p3d = depth_pose.unprojectFromImage(cv::Point2f(c,r), depth);
+    cv::Point3f p_rgb = rgb_pose.projectToImage(p3d);
+    if (!is_yx_in_range(image.rgb(), p_rgb.y, p_rgb.x))
+      continue;
+
+    cv::Vec3f camera_normal (0,0,1);
+    if (image.normal().data && cv::norm(image.normal()(r,c)) > 1e-6)
+      camera_normal = image.normal()(r,c);
+    cv::Vec3f world_normal = camera_to_world_normal_pose.cameraTransform(camera_normal);
+    normalize(world_normal);
+
+    mesh.vertices.push_back(p3d);
+    mesh.colors.push_back(bgr_to_rgb(image.rgb()(p_rgb.y, p_rgb.x)));
+    mesh.normals.push_back(world_normal);
+  }
+}
+
+Pose3D camera_pose(int frame)
+{
+  Pose3D pose;
+  pose.setCameraParameters(140, 140, width/2, height/2);
+  pose.applyTransformBefore(cv::Vec3f(0.0002f*frame, 0, 0), cv::Vec3f(0, 0.0005f*frame, 0));
+  return pose;
+}
+
+// Keeps moving over the same volume without ever repeating a pose.
+Pose3D revisiting_camera_pose(int frame)
+{
+  const float tx = 0.01f + 0.01f*sin(0.0731f*frame) + 0.002f*sin(0.31f*frame);
+  const float ry = 0.025f + 0.025f*sin(0.0417f*frame);
+  Pose3D pose;
+  pose.setCameraParameters(140, 140, width/2, height/2);
+  pose.applyTransformBefore(cv::Vec3f(tx, 0, 0), cv::Vec3f(0, ry, 0));
+  return pose;
+}
+
+}
+
+bool test_equivalence()
+{
+  RGBDImage image;
+  make_image(image, make_calibration());
+
+  Mesh ref_mesh;
+  RGBDModeler modeler;
+  for (int frame = 0; frame < 10; ++frame)
+  {
+    Pose3D pose = camera_pose(frame);
+    reference_add_new_view(ref_mesh, image, pose);
+    modeler.addNewView(image, pose);
+  }
+
+  MeshConstPtr mesh_ptr = modeler.currentMesh();
+  const Mesh& mesh = *mesh_ptr;
+  NTK_TEST_FLOAT_EQ(mesh.vertices.size(), ref_mesh.vertices.size());
+  foreach_idx(i, mesh.vertices)
+  {
+    ntk_ensure(cv::norm(mesh.vertices[i] - ref_mesh.vertices[i]) < 1e-4, "Vertices differ.");
+    ntk_ensure(cv::norm(mesh.normals[i] - ref_mesh.normals[i]) < 1e-4, "Normals differ.");
+  }
+
+  // A mesh returned by currentMesh() is not modified by later views.
+  const int num_vertices = mesh.vertices.size();
+  Pose3D pose = camera_pose(10);
+  modeler.addNewView(image, pose);
+  NTK_TEST_FLOAT_EQ(mesh.vertices.size(), num_vertices);
+  ntk_ensure(int(modeler.currentMesh()->vertices.size()) > num_vertices, "New view was not added.");
+  return true;
+}
+
+bool test_equivalence_with_normals()
+{
+  RGBDImage image;
+  make_image(image, make_calibration(), true /* with normals */);
+
+  Mesh ref_mesh;
+  RGBDModeler modeler;
+  for (int frame = 0; frame < 10; ++frame)
+  {
+    Pose3D pose = camera_pose(frame);
+    reference_add_new_view(ref_mesh, image, pose);
+    modeler.addNewView(image, pose);
+  }
+
+  MeshConstPtr mesh = modeler.currentMesh();
+  NTK_TEST_FLOAT_EQ(mesh->vertices.size(), ref_mesh.vertices.size());
+  NTK_TEST_FLOAT_EQ(mesh->colors.size(), ref_mesh.colors.size());
+  foreach_idx(i, mesh->vertices)
+  {
+    const cv::Point3f& n = mesh->normals[i];
+    ntk_ensure(ntk_isfinite(n.x) && ntk_isfinite(n.y) && ntk_isfinite(n.z), "Normal is not finite.");
+    ntk_ensure(cv::norm(mesh->vertices[i] - ref_mesh.vertices[i]) < 1e-4, "Vertices differ.");
+    ntk_ensure(cv::norm(n - ref_mesh.normals[i]) < 1e-4, "Normals differ.");
+    ntk_ensure(mesh->colors[i] == ref_mesh.colors[i], "Colors differ.");
+  }
+  return true;
+}
+
+bool test_bounded_sequence()
+{
+  const int num_frames = 1000;
+
+  RGBDImage image;
+  make_image(image, make_calibration());
+
+  RGBDModeler plain_modeler;
+  Mesh ref_mesh;
+  TimeCount tc_ref ("reference addNewView x100", 1);
+  for (int frame = 0; frame < 100; ++frame)
+  {
+    Pose3D pose = camera_pose(frame);
+    reference_add_new_view(ref_mesh, image, pose);
+  }
+  tc_ref.stop();
+
+  TimeCount tc_plain ("addNewView x100", 1);
+  for (int frame = 0; frame < 100; ++frame)
+  {
+    Pose3D pose = camera_pose(frame);
+    plain_modeler.addNewView(image, pose);
+  }
+  tc_plain.stop();
+
+  RGBDModeler voxel_modeler;
+  voxel_modeler.setVoxelSize(0.005f);
+  std::vector<int> sizes;
+  TimeCount tc_voxels ("addNewView with voxels x1000", 1);
+  for (int frame = 0; frame < num_frames; ++frame)
+  {
+    Pose3D pose = revisiting_camera_pose(frame);
+    voxel_modeler.addNewView(image, pose);
+    sizes.push_back(voxel_modeler.currentMesh()->vertices.size());
+  }
+  tc_voxels.stop();
+
+  const int half_size = sizes[num_frames/2 - 1];
+  ntk_dbg_print(sizes[99], 1);
+  ntk_dbg_print(half_size, 1);
+  ntk_dbg_print(sizes.back(), 1);
+  // New poses keep filling voxels at first, but the volume is bounded,
+  // so the model must almost stop growing.
+  ntk_ensure(half_size > sizes[99], "Poses should not repeat.");
+  ntk_ensure(sizes.back() - half_size < sizes.back() / 100, "Model keeps growing over the same volume.");
+  ntk_ensure(sizes.back() < int(plain_modeler.currentMesh()->vertices.size()), "Voxels did not reduce the model.");
+
+  voxel_modeler.reset();
+  NTK_TEST_FLOAT_EQ(voxel_modeler.currentMesh()->vertices.size(), 0);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_equivalence();
+  ok &= test_equivalence_with_normals();
+  ok &= test_bounded_sequence();
+  return ok != true;
+}
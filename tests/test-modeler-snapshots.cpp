@@ -0,0 +1,193 @@
+
+#include <ntk/ntk.h>
+#include <ntk/mesh/rgbd_modeler.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+#include <QCoreApplication>
+#include <QThread>
+
+using namespace ntk;
+
+namespace
+{
+
+// Each computed mesh has a different size, and all its vertices
+// carry the index of the computation, so torn meshes are easy to spot.
+class CountingModeler : public RGBDModeler
+{
+public:
+  CountingModeler() : m_num_views(0), m_num_meshes(0), m_reset_thread(0) {}
+
+  virtual bool addNewView(const RGBDImage& image, Pose3D& depth_pose)
+  {
+    ++m_num_views;
+    return true;
+  }
+
+  virtual void computeMesh()
+  {
+    ++m_num_meshes;
+    Mesh& mesh = newMesh();
+    int n = 1000 + (m_num_meshes * 37) % 5000;
+    for (int i = 0; i < n; ++i)
+    {
+      mesh.vertices.push_back(cv::Point3f(m_num_meshes, i, 0));
+      mesh.colors.push_back(cv::Vec3b(m_num_meshes % 256, 0, 0));
+    }
+  }
+
+  virtual void reset()
+  {
+    m_reset_thread = QThread::currentThread();
+    RGBDModeler::reset();
+  }
+
+  int numViews() const { return m_num_views; }
+  QThread* resetThread() const { return m_reset_thread; }
+
+private:
+  int m_num_views;
+  int m_num_meshes;
+  QThread* m_reset_thread;
+};
+
+struct SnapshotReader : public QThread
+{
+  SnapshotReader(const RGBDModelerInOwnThread& modeler)
+    : modeler(modeler), should_stop(false), num_reads(0), num_errors(0)
+  {}
+
+  virtual void run()
+  {
+    int last_generation = -1;
+    while (!should_stop)
+    {
+      int generation = -1;
+      MeshConstPtr mesh = modeler.meshSnapshot(&generation);
+      ++num_reads;
+
+      if (!mesh || generation < last_generation)
+      {
+        ++num_errors;
+        continue;
+      }
+      last_generation = generation;
+
+      if (mesh->colors.size() != mesh->vertices.size())
+        ++num_errors;
+
+      for (int i = 0; i < mesh->vertices.size(); ++i)
+        if (mesh->vertices[i].x != mesh->vertices[0].x)
+        {
+          ++num_errors;
+          break;
+        }
+    }
+  }
+
+  const RGBDModelerInOwnThread& modeler;
+  volatile bool should_stop;
+  int num_reads;
+  int num_errors;
+};
+
+}
+
+bool test_concurrent_snapshots()
+{
+  const int num_readers = 4;
+  const int num_frames = 300;
+
+  CountingModeler* child = new CountingModeler;
+  RGBDModelerInOwnThread modeler ("test_modeler", RGBDModelerPtr(child));
+  modeler.start();
+
+  std::vector<SnapshotReader*> readers;
+  for (int i = 0; i < num_readers; ++i)
+  {
+    readers.push_back(new SnapshotReader(modeler));
+    readers.back()->start();
+  }
+
+  RGBDImageConstPtr image (new RGBDImage);
+  Pose3D pose;
+  int last_generation = 0;
+  for (int i = 0; i < num_frames; ++i)
+  {
+    modeler.addNewView(image, pose);
+    modeler.computeMesh();
+    ntk::sleep(1);
+
+    int generation = modeler.meshGeneration();
+    ntk_ensure(generation >= last_generation, "Generation went backwards.");
+    last_generation = generation;
+  }
+
+  // Wait for the last mesh computation.
+  ntk::sleep(100);
+  ntk_ensure(modeler.meshGeneration() > 0, "No mesh was published.");
+
+  int num_errors = 0;
+  int num_reads = 0;
+  for (int i = 0; i < num_readers; ++i)
+  {
+    readers[i]->should_stop = true;
+    readers[i]->wait();
+    num_errors += readers[i]->num_errors;
+    num_reads += readers[i]->num_reads;
+    delete readers[i];
+  }
+
+  modeler.setThreadShouldExit();
+  modeler.wait();
+
+  ntk_dbg_print(num_reads, 1);
+  ntk_dbg_print(modeler.meshGeneration(), 1);
+  NTK_TEST_FLOAT_EQ(num_errors, 0);
+
+  // currentMesh() must return the last published snapshot.
+  int generation = -1;
+  MeshConstPtr last_snapshot = modeler.meshSnapshot(&generation);
+  ntk_ensure(modeler.currentMesh().operator->() == last_snapshot.operator->(), "currentMesh is not the last snapshot.");
+  // Publication shares the child mesh instead of copying it.
+  ntk_ensure(child->currentMesh().operator->() == last_snapshot.operator->(), "Snapshot is a copy of the child mesh.");
+  ntk_ensure(child->numViews() > 0, "No view was processed.");
+  return true;
+}
+
+bool test_voxel_size_in_modeler_thread()
+{
+  CountingModeler* child = new CountingModeler;
+  RGBDModelerInOwnThread modeler ("test_modeler", RGBDModelerPtr(child));
+  modeler.start();
+
+  int generation = modeler.meshGeneration();
+  modeler.setVoxelSize(0.01f);
+  NTK_TEST_FLOAT_EQ(modeler.voxelSize(), 0.01f);
+
+  // The change is published as a new, reset, mesh.
+  for (int i = 0; i < 100 && modeler.meshGeneration() == generation; ++i)
+    ntk::sleep(10);
+
+  modeler.setThreadShouldExit();
+  modeler.wait();
+
+  ntk_ensure(modeler.meshGeneration() > generation, "Voxel size change was not applied.");
+  NTK_TEST_FLOAT_EQ(child->voxelSize(), 0.01f);
+  ntk_ensure(child->resetThread() == &modeler, "Model was not reset by the modeler thread.");
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  QCoreApplication app (argc, argv);
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_concurrent_snapshots();
+  ok &= test_voxel_size_in_modeler_thread();
+  return ok != true;
+}
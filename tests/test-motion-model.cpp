@@ -0,0 +1,332 @@
+
+#include <ntk/ntk.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/geometry/pose_motion_model.h>
+#include <ntk/geometry/incremental_pose_estimator_from_rgb_features.h>
+#include <ntk/camera/rgbd_calibration.h>
+#include <ntk/camera/rgbd_image.h>
+#include <ntk/image/feature.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 640;
+const int height = 480;
+const int descriptor_size = 64;
+
+Pose3D camera_pose(float tx, float ry)
+{
+  Pose3D pose;
+  pose.setCameraParameters(525, 525, width/2, height/2);
+  pose.applyTransformBefore(cv::Vec3f(tx, 0, 0), cv::Vec3f(0, ry, 0));
+  return pose;
+}
+
+// Distance between camera centers and angle between orientations.
+void pose_error(const Pose3D& p1, const Pose3D& p2, double& translation_error, double& rotation_error)
+{
+  cv::Mat1d delta = p1.cvCameraTransformd() * p2.cvCameraTransformd().inv();
+  cv::Mat1d rotation_vector;
+  cv::Rodrigues(delta(cv::Rect(0,0,3,3)), rotation_vector);
+  rotation_error = cv::norm(rotation_vector);
+  translation_error = cv::norm(p1.cvTranslation() - p2.cvTranslation());
+}
+
+// Random points over a wide area in front of the camera, with their own descriptor.
+void make_scene(std::vector<cv::Point3f>& points, cv::Mat1f& descriptors, int num_points)
+{
+  cv::RNG rng (42);
+  Pose3D pose = camera_pose(0, 0);
+  descriptors.create(num_points, descriptor_size);
+  for (int i = 0; i < num_points; ++i)
+  {
+    cv::Point2f p (rng.uniform(-2.f*width, 3.f*width), rng.uniform(0.f, float(height)));
+    points.push_back(pose.unprojectFromImage(p, rng.uniform(0.8f, 3.f)));
+    for (int k = 0; k < descriptor_size; ++k)
+      descriptors(i,k) = rng.uniform(0.f, 1.f);
+  }
+}
+
+void observe(FeatureSet& features,
+             const std::vector<cv::Point3f>& points,
+             const cv::Mat1f& descriptors,
+             const Pose3D& pose,
+             int seed)
+{
+  cv::RNG rng (seed);
+  std::vector<FeaturePoint> locations;
+  std::vector<int> point_indices;
+  foreach_idx(i, points)
+  {
+    cv::Point3f p = pose.projectToImage(points[i]);
+    if (p.z <= 0 || p.x < 0 || p.y < 0 || p.x >= width || p.y >= height)
+      continue;
+    FeaturePoint loc;
+    loc.pt = cv::Point2f(p.x + rng.gaussian(0.5), p.y + rng.gaussian(0.5));
+    loc.has_depth = true;
+    loc.depth = p.z;
+    locations.push_back(loc);
+    point_indices.push_back(i);
+  }
+
+  cv::Mat1f noisy_descriptors (locations.size(), descriptor_size);
+  foreach_idx(i, locations)
+    for (int k = 0; k < descriptor_size; ++k)
+      noisy_descriptors(i,k) = descriptors(point_indices[i],k) + rng.gaussian(0.02);
+
+  features.setFeatures(FeatureSet::Feature_BRIEF64, locations, noisy_descriptors);
+  features.compute3dLocation(pose);
+}
+
+// Random points all around the origin, so that cameras turning in place
+// do not see anything in common once their orientations are far apart.
+void make_ring_scene(std::vector<cv::Point3f>& points, cv::Mat1f& descriptors, int num_points)
+{
+  cv::RNG rng (42);
+  descriptors.create(num_points, descriptor_size);
+  for (int i = 0; i < num_points; ++i)
+  {
+    const float angle = rng.uniform(0.f, float(2*M_PI));
+    const float distance = rng.uniform(1.f, 3.f);
+    points.push_back(cv::Point3f(distance*sin(angle), rng.uniform(-0.5f, 0.5f), distance*cos(angle)));
+    for (int k = 0; k < descriptor_size; ++k)
+      descriptors(i,k) = rng.uniform(0.f, 1.f);
+  }
+}
+
+// Same intrinsics as camera_pose, the rgb and depth cameras are the same.
+RGBDCalibrationPtr make_calibration()
+{
+  RGBDCalibrationPtr calib (new RGBDCalibration);
+  cv::Mat1d K = (cv::Mat1d(3,3) << 525, 0, width/2, 0, 525, height/2, 0, 0, 1);
+  calib->depth_intrinsics = K.clone();
+  calib->rgb_intrinsics = K.clone();
+  calib->setRgbSize(cv::Size(width, height));
+  calib->setRawRgbSize(cv::Size(width, height));
+  calib->depth_pose = new Pose3D;
+  calib->rgb_pose = new Pose3D;
+  calib->updatePoses();
+  return calib;
+}
+
+// Observes the scene from true_pose instead of extracting features from the images.
+class SyntheticFeaturesEstimator : public IncrementalPoseEstimatorFromRgbFeatures
+{
+public:
+  SyntheticFeaturesEstimator(const std::vector<cv::Point3f>& points, const cv::Mat1f& descriptors)
+    : IncrementalPoseEstimatorFromRgbFeatures(FeatureSetParams()),
+      points(points), descriptors(descriptors), frame(0)
+  {}
+
+  Pose3D true_pose;
+
+protected:
+  virtual ntk::Ptr<FeatureSet> extractFeatures(const RGBDImage& image)
+  {
+    ntk::Ptr<FeatureSet> features (new FeatureSet);
+    observe(*features, points, descriptors, true_pose, ++frame);
+    return features;
+  }
+
+private:
+  const std::vector<cv::Point3f>& points;
+  const cv::Mat1f& descriptors;
+  int frame;
+};
+
+}
+
+bool test_constant_velocity()
+{
+  // Screw motion, the same relative motion at each frame.
+  std::vector<Pose3D> trajectory;
+  Pose3D pose = camera_pose(0, 0);
+  for (int frame = 0; frame < 8; ++frame)
+  {
+    trajectory.push_back(pose);
+    pose.applyTransformAfter(cv::Vec3f(0.03f, 0.01f, 0), cv::Vec3f(0, 0.02f, 0.01f));
+  }
+
+  PoseMotionModel model;
+  ntk_ensure(!model.canPredict(), "No velocity without poses.");
+  for (int frame = 0; frame < 5; ++frame)
+    model.update(trajectory[frame], frame);
+  ntk_ensure(model.canPredict(), "Two poses should give a velocity.");
+
+  double translation_error = 0, rotation_error = 0;
+  pose_error(model.predict(5), trajectory[5], translation_error, rotation_error);
+  ntk_dbg_print(translation_error, 1);
+  ntk_dbg_print(rotation_error, 1);
+  ntk_ensure(translation_error < 1e-4 && rotation_error < 1e-4, "Wrong constant velocity prediction.");
+
+  // Skipped frames.
+  pose_error(model.predict(7), trajectory[7], translation_error, rotation_error);
+  ntk_ensure(translation_error < 1e-4 && rotation_error < 1e-4, "Wrong prediction after skipped frames.");
+
+  model.reset();
+  ntk_ensure(!model.canPredict(), "Reset should forget the velocity.");
+  return true;
+}
+
+bool test_accelerating_trajectory()
+{
+  // Relative motion increasing at each frame.
+  std::vector<Pose3D> trajectory;
+  Pose3D pose = camera_pose(0, 0);
+  for (int frame = 0; frame < 20; ++frame)
+  {
+    trajectory.push_back(pose);
+    pose.applyTransformAfter(cv::Vec3f(0.002f*(frame+1), 0, 0.001f*(frame+1)), cv::Vec3f(0, 0.001f*(frame+1), 0));
+  }
+
+  PoseMotionModel velocity_model, acceleration_model;
+  acceleration_model.setUseAcceleration(true);
+
+  double last_pose_error = 0, velocity_error = 0, acceleration_error = 0;
+  foreach_idx(frame, trajectory)
+  {
+    if (frame >= 3)
+    {
+      double translation_error = 0, rotation_error = 0;
+      pose_error(velocity_model.lastPose(), trajectory[frame], translation_error, rotation_error);
+      last_pose_error += translation_error;
+      pose_error(velocity_model.predict(frame), trajectory[frame], translation_error, rotation_error);
+      velocity_error += translation_error;
+      pose_error(acceleration_model.predict(frame), trajectory[frame], translation_error, rotation_error);
+      acceleration_error += translation_error;
+    }
+    velocity_model.update(trajectory[frame], frame);
+    acceleration_model.update(trajectory[frame], frame);
+  }
+
+  ntk_dbg_print(last_pose_error, 1);
+  ntk_dbg_print(velocity_error, 1);
+  ntk_dbg_print(acceleration_error, 1);
+  ntk_ensure(velocity_error < last_pose_error, "Velocity model should beat the last pose.");
+  ntk_ensure(acceleration_error < 0.5*velocity_error, "Acceleration model should beat the velocity model.");
+  return true;
+}
+
+// Guided matching seeded by the last pose or the motion model, at several speeds.
+// Frames with too few guided matches would need a relocalization.
+bool test_tracking_speeds()
+{
+  const int min_matches = 30;
+  const float search_radius = 20;
+
+  std::vector<cv::Point3f> points;
+  cv::Mat1f descriptors;
+  make_scene(points, descriptors, 20000);
+
+  const float speeds[] = { 0.005f, 0.02f, 0.05f, 0.1f };
+  for (int s = 0; s < 4; ++s)
+  {
+    const float speed = speeds[s];
+    PoseMotionModel model;
+    int last_pose_failures = 0, motion_model_failures = 0;
+    double matching_msecs = 0;
+
+    Pose3D pose = camera_pose(0, 0);
+    ntk::Ptr<FeatureSet> previous_features;
+    for (int frame = 0; frame < 12; ++frame)
+    {
+      if (frame > 0)
+        pose.applyTransformAfter(cv::Vec3f(speed, 0, 0), cv::Vec3f(0, 0.5f*speed, 0));
+      ntk::Ptr<FeatureSet> features (new FeatureSet);
+      observe(*features, points, descriptors, pose, frame);
+
+      if (frame >= 2)
+      {
+        std::vector<cv::DMatch> matches;
+        previous_features->matchWithGuided(*features, model.lastPose(), search_radius, matches);
+        last_pose_failures += matches.size() < min_matches;
+
+        matches.clear();
+        TimeCount tc ("guided matching", 2);
+        previous_features->matchWithGuided(*features, model.predict(frame), search_radius, matches);
+        matching_msecs += tc.elapsedMsecsNoPrint();
+        motion_model_failures += matches.size() < min_matches;
+      }
+
+      // Tracking is assumed to recover the actual pose.
+      model.update(pose, frame);
+      previous_features = features;
+    }
+
+    ntk_dbg_print(speed, 1);
+    ntk_dbg_print(last_pose_failures, 1);
+    ntk_dbg_print(motion_model_failures, 1);
+    ntk_dbg_print(matching_msecs, 1);
+    NTK_TEST_FLOAT_EQ(motion_model_failures, 0);
+    if (s == 3)
+      ntk_ensure(last_pose_failures > 0, "Fast motion should defeat the last pose prediction.");
+  }
+  return true;
+}
+
+// Camera turning in place, then jumping back to an orientation the
+// last view does not overlap with.
+bool test_tracking_and_relocalization()
+{
+  std::vector<cv::Point3f> points;
+  cv::Mat1f descriptors;
+  make_ring_scene(points, descriptors, 20000);
+
+  RGBDImage image;
+  image.setCalibration(make_calibration());
+  image.rgbRef() = cv::Mat3b(height, width, cv::Vec3b(0,0,0));
+  image.mappedDepthRef() = cv::Mat1f(height, width, 1.f);
+
+  std::vector<float> yaws;
+  for (int frame = 0; frame < 10; ++frame)
+    yaws.push_back(0.15f*frame);
+  yaws.push_back(0.15f);
+
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    const bool use_motion_model = pass == 1;
+    SyntheticFeaturesEstimator estimator (points, descriptors);
+    estimator.setUseMotionModel(use_motion_model);
+
+    double max_translation_error = 0, max_rotation_error = 0;
+    TimeCount tc ("pose estimation", 1);
+    foreach_idx(frame, yaws)
+    {
+      estimator.true_pose = camera_pose(0, yaws[frame]);
+      estimator.addNewImage(image);
+      ntk_ensure(estimator.estimateCurrentPose(), "Pose estimation failed.");
+
+      double translation_error = 0, rotation_error = 0;
+      pose_error(estimator.currentPose(), estimator.true_pose, translation_error, rotation_error);
+      max_translation_error = std::max(max_translation_error, translation_error);
+      max_rotation_error = std::max(max_rotation_error, rotation_error);
+    }
+    tc.stop();
+
+    ntk_dbg_print(use_motion_model, 1);
+    ntk_dbg_print(max_translation_error, 1);
+    ntk_dbg_print(max_rotation_error, 1);
+    ntk_dbg_print(estimator.numRelocalizations(), 1);
+    ntk_ensure(max_translation_error < 0.01 && max_rotation_error < 0.01, "Wrong estimated pose.");
+    // Only the jump back cannot be tracked from the last view.
+    NTK_TEST_FLOAT_EQ(estimator.numRelocalizations(), use_motion_model ? 1 : 0);
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_constant_velocity();
+  ok &= test_accelerating_trajectory();
+  ok &= test_tracking_speeds();
+  ok &= test_tracking_and_relocalization();
+  return ok != true;
+}
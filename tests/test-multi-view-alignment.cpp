@@ -0,0 +1,282 @@
+
+#include <ntk/ntk.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/geometry/multi_view_aligner.h>
+#include <ntk/geometry/relative_pose_estimator_icp.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+#include <pcl/registration/transforms.h>
+
+using namespace ntk;
+
+namespace
+{
+
+typedef pcl::PointCloud<pcl::PointNormal> CloudType;
+
+struct SurfacePoint
+{
+  SurfacePoint(cv::Vec3d p, cv::Vec3d n) : p(p), n(n) {}
+  cv::Vec3d p, n;
+};
+
+void add_patch(std::vector<SurfacePoint>& points, cv::Vec3d origin, cv::Vec3d u, cv::Vec3d v, cv::Vec3d normal)
+{
+  const double step = 0.004;
+  const int nu = cv::norm(u)/step, nv = cv::norm(v)/step;
+  for (int i = 0; i <= nu; ++i)
+  for (int j = 0; j <= nv; ++j)
+    points.push_back(SurfacePoint(origin + u*(i/double(nu)) + v*(j/double(nv)), normal));
+}
+
+void add_sphere(std::vector<SurfacePoint>& points, cv::Vec3d center, double radius)
+{
+  const double step = 0.004;
+  for (double theta = step/radius; theta < M_PI; theta += step/radius)
+  for (double phi = 0; phi < 2*M_PI; phi += step/(radius*sin(theta)))
+  {
+    cv::Vec3d n (sin(theta)*cos(phi), sin(theta)*sin(phi), cos(theta));
+    points.push_back(SurfacePoint(center + n*radius, n));
+  }
+}
+
+// Box on a turntable, with two spheres of different size.
+void make_object(std::vector<SurfacePoint>& points)
+{
+  const double a = 0.1, b = 0.075, h = 0.1;
+  add_patch(points, cv::Vec3d(-a,-b,h), cv::Vec3d(2*a,0,0), cv::Vec3d(0,2*b,0), cv::Vec3d(0,0,1));
+  add_patch(points, cv::Vec3d(-a,-b,0), cv::Vec3d(2*a,0,0), cv::Vec3d(0,0,h), cv::Vec3d(0,-1,0));
+  add_patch(points, cv::Vec3d(-a,b,0), cv::Vec3d(2*a,0,0), cv::Vec3d(0,0,h), cv::Vec3d(0,1,0));
+  add_patch(points, cv::Vec3d(-a,-b,0), cv::Vec3d(0,2*b,0), cv::Vec3d(0,0,h), cv::Vec3d(-1,0,0));
+  add_patch(points, cv::Vec3d(a,-b,0), cv::Vec3d(0,2*b,0), cv::Vec3d(0,0,h), cv::Vec3d(1,0,0));
+  add_sphere(points, cv::Vec3d(0.04, 0.01, h+0.04), 0.04);
+  add_sphere(points, cv::Vec3d(-0.14, 0.1, 0.03), 0.03);
+}
+
+cv::Mat1d rotation_z(double angle)
+{
+  cv::Mat1d H = cv::Mat1d::eye(4,4);
+  H(0,0) = cos(angle); H(0,1) = -sin(angle);
+  H(1,0) = sin(angle); H(1,1) = cos(angle);
+  return H;
+}
+
+cv::Mat1d small_motion(cv::RNG& rng, double max_angle, double max_translation)
+{
+  cv::Mat1d rotation_vector = (cv::Mat1d(3,1) << rng.uniform(-max_angle, max_angle),
+                               rng.uniform(-max_angle, max_angle), rng.uniform(-max_angle, max_angle));
+  cv::Mat1d R;
+  cv::Rodrigues(rotation_vector, R);
+  cv::Mat1d H = cv::Mat1d::eye(4,4);
+  cv::Mat1d H_rotation = H(cv::Rect(0,0,3,3));
+  R.copyTo(H_rotation);
+  for (int k = 0; k < 3; ++k)
+    H(k,3) = rng.uniform(-max_translation, max_translation);
+  return H;
+}
+
+Eigen::Affine3f to_eigen_transform(const cv::Mat1d& H)
+{
+  Eigen::Affine3f T;
+  for (int r = 0; r < 4; ++r)
+    for (int c = 0; c < 4; ++c)
+      T(r,c) = H(r,c);
+  return T;
+}
+
+Pose3D to_pose(const cv::Mat1d& H)
+{
+  Pose3D pose;
+  pose.setCameraTransform(H);
+  return pose;
+}
+
+cv::Vec3d transform_point(const cv::Mat1d& H, const pcl::PointNormal& p)
+{
+  return cv::Vec3d(H(0,0)*p.x + H(0,1)*p.y + H(0,2)*p.z + H(0,3),
+                   H(1,0)*p.x + H(1,1)*p.y + H(1,2)*p.z + H(1,3),
+                   H(2,0)*p.x + H(2,1)*p.y + H(2,2)*p.z + H(2,3));
+}
+
+struct Sequence
+{
+  std::vector<CloudType::Ptr> clouds;
+  std::vector<cv::Mat1d> true_poses;
+  std::vector<cv::Mat1d> initial_poses;
+};
+
+// View k looks at the object rotated by 2*pi*k/n, from a low camera.
+// Points are expressed in view coordinates, with some noise, and the
+// initial poses drift like an odometry would.
+void make_sequence(Sequence& sequence, int num_views)
+{
+  std::vector<SurfacePoint> object;
+  make_object(object);
+
+  cv::RNG rng (42);
+  cv::Mat1d drift = cv::Mat1d::eye(4,4);
+  for (int k = 0; k < num_views; ++k)
+  {
+    const double angle = 2*M_PI*k/num_views;
+    cv::Mat1d true_pose = rotation_z(angle);
+    cv::Vec3d camera (0.8*cos(angle), 0.8*sin(angle), 0.05);
+
+    CloudType::Ptr cloud (new CloudType);
+    cv::Mat1d to_view = rotation_z(-angle);
+    foreach_idx(i, object)
+    {
+      const SurfacePoint& s = object[i];
+      if (s.n.dot(camera - s.p) <= 0)
+        continue;
+      pcl::PointNormal p;
+      p.x = to_view(0,0)*s.p[0] + to_view(0,1)*s.p[1] + rng.gaussian(0.0005);
+      p.y = to_view(1,0)*s.p[0] + to_view(1,1)*s.p[1] + rng.gaussian(0.0005);
+      p.z = s.p[2] + rng.gaussian(0.0005);
+      p.normal_x = to_view(0,0)*s.n[0] + to_view(0,1)*s.n[1];
+      p.normal_y = to_view(1,0)*s.n[0] + to_view(1,1)*s.n[1];
+      p.normal_z = s.n[2];
+      cloud->points.push_back(p);
+    }
+    cloud->width = cloud->points.size();
+    cloud->height = 1;
+
+    if (k > 0)
+      drift = cv::Mat1d(small_motion(rng, 0.01, 0.003) * drift);
+
+    sequence.clouds.push_back(cloud);
+    sequence.true_poses.push_back(true_pose);
+    sequence.initial_poses.push_back(cv::Mat1d(drift * true_pose));
+  }
+}
+
+// RMS distance between the view points placed with the estimated and true poses.
+double alignment_error(const Sequence& sequence, const std::vector<cv::Mat1d>& poses)
+{
+  double error = 0;
+  int n = 0;
+  foreach_idx(k, sequence.clouds)
+  {
+    const CloudType& cloud = *sequence.clouds[k];
+    for (int i = 0; i < cloud.points.size(); i += 10, ++n)
+    {
+      cv::Vec3d d = transform_point(poses[k], cloud.points[i]) - transform_point(sequence.true_poses[k], cloud.points[i]);
+      error += d.dot(d);
+    }
+  }
+  return sqrt(error / n);
+}
+
+// Baseline: chain of ICP registrations between consecutive views.
+void sequential_alignment(const Sequence& sequence, std::vector<cv::Mat1d>& poses)
+{
+  poses.resize(sequence.clouds.size());
+  poses[0] = sequence.initial_poses[0].clone();
+  for (int k = 1; k < sequence.clouds.size(); ++k)
+  {
+    cv::Mat1d guess = poses[k-1] * sequence.initial_poses[k-1].inv() * sequence.initial_poses[k];
+
+    CloudType::Ptr target (new CloudType);
+    pcl::transformPointCloud(*sequence.clouds[k-1], *target, to_eigen_transform(poses[k-1]));
+    CloudType::Ptr source (new CloudType);
+    pcl::transformPointCloud(*sequence.clouds[k], *source, to_eigen_transform(guess));
+
+    RelativePoseEstimatorICP<pcl::PointNormal> icp;
+    icp.setVoxelSize(0.005);
+    icp.setDistanceThreshold(0.05);
+    icp.setMaxIterations(30);
+    icp.setTargetCloud(target);
+    icp.setSourceCloud(source);
+    if (icp.estimateNewPose())
+      poses[k] = icp.estimatedSourcePose().inverted().cvCameraTransformd() * guess;
+    else
+      poses[k] = guess;
+  }
+}
+
+bool test_loop(int num_views)
+{
+  Sequence sequence;
+  make_sequence(sequence, num_views);
+
+  const double initial_error = alignment_error(sequence, sequence.initial_poses);
+
+  std::vector<cv::Mat1d> sequential_poses;
+  TimeCount tc_sequential ("sequential ICP", 1);
+  sequential_alignment(sequence, sequential_poses);
+  tc_sequential.stop();
+  const double sequential_error = alignment_error(sequence, sequential_poses);
+
+  MultiViewAligner aligner;
+  aligner.setVoxelSize(0.005);
+  aligner.setDistanceThreshold(0.05);
+  TimeCount tc_multi_view ("multi-view alignment", 1);
+  foreach_idx(k, sequence.clouds)
+    aligner.addView(sequence.clouds[k], to_pose(sequence.initial_poses[k]));
+  bool ok = aligner.align();
+  tc_multi_view.stop();
+  ntk_ensure(ok, "Multi-view alignment failed.");
+
+  std::vector<cv::Mat1d> poses (num_views);
+  foreach_idx(k, poses)
+    poses[k] = aligner.viewPose(k).cvCameraTransformd();
+  const double multi_view_error = alignment_error(sequence, poses);
+
+  ntk_dbg_print(num_views, 1);
+  ntk_dbg_print(aligner.pairs().size(), 1);
+  ntk_dbg_print(initial_error, 1);
+  ntk_dbg_print(sequential_error, 1);
+  ntk_dbg_print(multi_view_error, 1);
+  ntk_dbg_print(tc_sequential.elapsedMsecsNoPrint(), 1);
+  ntk_dbg_print(tc_multi_view.elapsedMsecsNoPrint(), 1);
+
+  ntk_ensure(multi_view_error < initial_error, "Alignment made the poses worse.");
+  // Sequential registration accumulates the pairwise errors along the loop.
+  ntk_ensure(multi_view_error < sequential_error, "Multi-view alignment should be more accurate than sequential ICP.");
+  ntk_ensure(multi_view_error < 0.005, "Multi-view alignment is not accurate enough.");
+  return true;
+}
+
+}
+
+bool test_overlapping_pairs()
+{
+  Sequence sequence;
+  make_sequence(sequence, 12);
+
+  MultiViewAligner aligner;
+  aligner.setMaxNeighbours(2);
+  foreach_idx(k, sequence.clouds)
+    aligner.addView(sequence.clouds[k], to_pose(sequence.initial_poses[k]));
+  aligner.computeOverlappingPairs();
+
+  // Each view keeps its best neighbours, without duplicates.
+  const std::vector<MultiViewAligner::ViewPair>& pairs = aligner.pairs();
+  ntk_ensure(pairs.size() >= 6 && pairs.size() <= 24, "Unexpected number of pairs.");
+  foreach_idx(i, pairs)
+  {
+    ntk_ensure(pairs[i].first < pairs[i].second, "Pairs should be ordered.");
+    ntk_ensure(pairs[i].overlap >= 0.3, "Pair below the overlap threshold.");
+  }
+  return true;
+}
+
+bool test_loops()
+{
+  bool ok = true;
+  ok &= test_loop(10);
+  ok &= test_loop(30);
+  ok &= test_loop(100);
+  return ok;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_overlapping_pairs();
+  ok &= test_loops();
+  return ok != true;
+}
@@ -0,0 +1,243 @@
+
+#include <ntk/ntk.h>
+#include <ntk/image/feature.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/geometry/relative_pose_estimator.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 640;
+const int height = 480;
+const int descriptor_size = 64;
+
+Pose3D camera_pose(float tx, float ry)
+{
+  Pose3D pose;
+  pose.setCameraParameters(525, 525, width/2, height/2);
+  pose.applyTransformBefore(cv::Vec3f(tx, 0, 0), cv::Vec3f(0, ry, 0));
+  return pose;
+}
+
+// Random points in front of the camera, each one with its own descriptor.
+void make_scene(std::vector<cv::Point3f>& points, cv::Mat1f& descriptors, int num_points)
+{
+  cv::RNG rng (42);
+  Pose3D pose = camera_pose(0, 0);
+  descriptors.create(num_points, descriptor_size);
+  for (int i = 0; i < num_points; ++i)
+  {
+    cv::Point2f p (rng.uniform(0.f, float(width)), rng.uniform(0.f, float(height)));
+    points.push_back(pose.unprojectFromImage(p, rng.uniform(0.8f, 3.f)));
+    for (int k = 0; k < descriptor_size; ++k)
+      descriptors(i,k) = rng.uniform(0.f, 1.f);
+  }
+}
+
+// Observe the points with the given pose, adding noise to descriptors and
+// locations. num_distractors features copy the descriptor of a random point
+// at a random location, like repeated textures. Their point index is -1.
+void observe(FeatureSet& features,
+             std::vector<int>& point_indices,
+             const std::vector<cv::Point3f>& points,
+             const cv::Mat1f& descriptors,
+             const Pose3D& pose,
+             int num_distractors,
+             int seed)
+{
+  cv::RNG rng (seed);
+  std::vector<FeaturePoint> locations;
+  std::vector<int> descriptor_rows;
+  point_indices.clear();
+  foreach_idx(i, points)
+  {
+    cv::Point3f p = pose.projectToImage(points[i]);
+    if (p.x < 0 || p.y < 0 || p.x >= width || p.y >= height)
+      continue;
+    FeaturePoint loc;
+    loc.pt = cv::Point2f(p.x + rng.gaussian(0.5), p.y + rng.gaussian(0.5));
+    loc.has_depth = true;
+    loc.depth = p.z;
+    locations.push_back(loc);
+    point_indices.push_back(i);
+    descriptor_rows.push_back(i);
+  }
+
+  for (int i = 0; i < num_distractors; ++i)
+  {
+    FeaturePoint loc;
+    loc.pt = cv::Point2f(rng.uniform(0.f, float(width)), rng.uniform(0.f, float(height)));
+    loc.has_depth = true;
+    loc.depth = rng.uniform(0.8f, 3.f);
+    locations.push_back(loc);
+    point_indices.push_back(-1);
+    descriptor_rows.push_back(rng.uniform(0, int(points.size())));
+  }
+
+  cv::Mat1f noisy_descriptors (locations.size(), descriptor_size);
+  foreach_idx(i, locations)
+    for (int k = 0; k < descriptor_size; ++k)
+      noisy_descriptors(i,k) = descriptors(descriptor_rows[i],k) + rng.gaussian(0.02);
+
+  features.setFeatures(FeatureSet::Feature_BRIEF64, locations, noisy_descriptors);
+  features.compute3dLocation(pose);
+}
+
+int num_correct(const std::vector<cv::DMatch>& matches,
+                const std::vector<int>& target_indices,
+                const std::vector<int>& source_indices)
+{
+  int n = 0;
+  foreach_idx(i, matches)
+    n += source_indices[matches[i].queryIdx] >= 0
+         && target_indices[matches[i].trainIdx] == source_indices[matches[i].queryIdx];
+  return n;
+}
+
+// Same setup as IncrementalPoseEstimatorFromRgbFeatures.
+double ransac_msecs(const FeatureSet& target_features,
+                    const FeatureSet& source_features,
+                    const std::vector<cv::DMatch>& matches,
+                    const Pose3D& target_pose)
+{
+  std::vector<cv::Point3f> ref_points, img_points;
+  foreach_idx(i, matches)
+  {
+    const FeaturePoint& ref_loc = target_features.locations()[matches[i].trainIdx];
+    const FeaturePoint& img_loc = source_features.locations()[matches[i].queryIdx];
+    ref_points.push_back(ref_loc.p3d);
+    img_points.push_back(cv::Point3f(img_loc.pt.x, img_loc.pt.y, img_loc.depth));
+  }
+
+  Pose3D pose = target_pose;
+  std::vector<bool> valid_matches;
+  TimeCount tc ("rms_optimize_ransac", 2);
+  rms_optimize_ransac(pose, ref_points, img_points, valid_matches, false);
+  return tc.elapsedMsecsNoPrint();
+}
+
+struct MatchingStats
+{
+  MatchingStats() : total(0), correct(0), matching_msecs(0), ransac_msecs(0) {}
+
+  void print(const char* name) const
+  {
+    ntk_dbg(1) << name << ": " << correct << "/" << total << " correct matches ("
+               << inlierRatio() << "), matching " << matching_msecs
+               << "ms, ransac " << ransac_msecs << "ms";
+  }
+
+  double inlierRatio() const { return total > 0 ? correct/double(total) : 0; }
+
+  int total;
+  int correct;
+  double matching_msecs;
+  double ransac_msecs;
+};
+
+}
+
+bool test_mutual_matching()
+{
+  std::vector<cv::Point3f> points;
+  cv::Mat1f descriptors;
+  make_scene(points, descriptors, 3000);
+
+  MatchingStats plain_stats, mutual_stats, filtered_stats;
+  for (int frame = 1; frame < 6; ++frame)
+  {
+    Pose3D target_pose = camera_pose(0, 0);
+    Pose3D source_pose = camera_pose(0.02f*frame, 0.01f*frame);
+
+    FeatureSet target_features, source_features;
+    std::vector<int> target_indices, source_indices;
+    observe(target_features, target_indices, points, descriptors, target_pose, 300, frame);
+    observe(source_features, source_indices, points, descriptors, source_pose, 600, frame+100);
+
+    std::vector<cv::DMatch> plain_matches;
+    TimeCount tc_plain ("matchWith", 2);
+    target_features.matchWith(source_features, plain_matches);
+    plain_stats.matching_msecs += tc_plain.elapsedMsecsNoPrint();
+
+    std::vector<cv::DMatch> mutual_matches;
+    TimeCount tc_mutual ("matchWithMutual", 2);
+    target_features.matchWithMutual(source_features, mutual_matches);
+    mutual_stats.matching_msecs += tc_mutual.elapsedMsecsNoPrint();
+
+    std::vector<cv::DMatch> filtered_matches;
+    TimeCount tc_filtered ("matchWithMutual with motion filter", 2);
+    target_features.matchWithMutual(source_features, filtered_matches, 0.8*0.8, true);
+    filtered_stats.matching_msecs += tc_filtered.elapsedMsecsNoPrint();
+
+    plain_stats.total += plain_matches.size();
+    mutual_stats.total += mutual_matches.size();
+    filtered_stats.total += filtered_matches.size();
+    plain_stats.correct += num_correct(plain_matches, target_indices, source_indices);
+    mutual_stats.correct += num_correct(mutual_matches, target_indices, source_indices);
+    filtered_stats.correct += num_correct(filtered_matches, target_indices, source_indices);
+
+    plain_stats.ransac_msecs += ransac_msecs(target_features, source_features, plain_matches, target_pose);
+    mutual_stats.ransac_msecs += ransac_msecs(target_features, source_features, mutual_matches, target_pose);
+    filtered_stats.ransac_msecs += ransac_msecs(target_features, source_features, filtered_matches, target_pose);
+  }
+
+  plain_stats.print("matchWith");
+  mutual_stats.print("matchWithMutual");
+  filtered_stats.print("matchWithMutual + motion filter");
+
+  ntk_ensure(mutual_stats.inlierRatio() > plain_stats.inlierRatio(), "Mutual matching should remove outliers.");
+  ntk_ensure(filtered_stats.inlierRatio() >= mutual_stats.inlierRatio(), "Motion filter should not add outliers.");
+  ntk_ensure(filtered_stats.inlierRatio() > 0.95, "Too many outliers after the motion filter.");
+  ntk_ensure(filtered_stats.correct > 0.8*mutual_stats.correct, "Motion filter removed too many inliers.");
+  return true;
+}
+
+bool test_motion_filter()
+{
+  // Consistent translation plus uniformly random matches.
+  cv::RNG rng (7);
+  std::vector<FeaturePoint> query_locations, train_locations;
+  std::vector<cv::DMatch> matches;
+  for (int i = 0; i < 1000; ++i)
+  {
+    FeaturePoint query, train;
+    query.pt = cv::Point2f(rng.uniform(0.f, float(width)), rng.uniform(0.f, float(height)));
+    if (i < 800)
+      train.pt = query.pt + cv::Point2f(30, -10);
+    else
+      train.pt = cv::Point2f(rng.uniform(0.f, float(width)), rng.uniform(0.f, float(height)));
+    query_locations.push_back(query);
+    train_locations.push_back(train);
+    matches.push_back(cv::DMatch(i, i, -1, 0));
+  }
+
+  filter_matches_with_motion_statistics(query_locations, train_locations, matches);
+  int num_inliers = 0;
+  foreach_idx(i, matches)
+    num_inliers += matches[i].queryIdx < 800;
+  ntk_dbg_print(matches.size(), 1);
+  ntk_dbg_print(num_inliers, 1);
+  ntk_ensure(num_inliers > 0.9*800, "Motion filter removed too many inliers.");
+  ntk_ensure(matches.size() - num_inliers < 0.2*200, "Motion filter kept too many outliers.");
+
+  // Too few matches to filter anything.
+  std::vector<cv::DMatch> single_match (1, cv::DMatch(0, 0, -1, 0));
+  filter_matches_with_motion_statistics(query_locations, train_locations, single_match);
+  NTK_TEST_FLOAT_EQ(single_match.size(), 1);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_motion_filter();
+  ok &= test_mutual_matching();
+  return ok != true;
+}
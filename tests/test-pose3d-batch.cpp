@@ -0,0 +1,147 @@
+
+#include <ntk/ntk.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+Pose3D make_pose()
+{
+  Pose3D pose;
+  pose.setCameraParameters(525, 520, 319.5, 239.5);
+  pose.applyTransformBefore(cv::Vec3f(0.3f, -0.2f, 1.5f), cv::Vec3f(0.1f, -0.3f, 0.2f));
+  pose.applyTransformAfter(cv::Vec3f(-0.5f, 0.1f, 0.2f), cv::Vec3f(0.05f, 0.2f, -0.1f));
+  return pose;
+}
+
+// Random pixels with depth in a typical RGBD range.
+void make_pixels(std::vector<cv::Point2f>& pixels, std::vector<float>& depths, int n)
+{
+  cv::RNG rng (42);
+  for (int i = 0; i < n; ++i)
+  {
+    pixels.push_back(cv::Point2f(rng.uniform(0.f, 640.f), rng.uniform(0.f, 480.f)));
+    depths.push_back(rng.uniform(0.4f, 5.f));
+  }
+}
+
+}
+
+bool test_unproject()
+{
+  Pose3D pose = make_pose();
+  std::vector<cv::Point2f> pixels;
+  std::vector<float> depths;
+  make_pixels(pixels, depths, 100003);
+
+  std::vector<cv::Point3f> ref_points (pixels.size());
+  TimeCount tc_ref ("scalar unprojectFromImage", 1);
+  foreach_idx(i, pixels)
+    ref_points[i] = pose.unprojectFromImage(pixels[i], depths[i]);
+  tc_ref.stop();
+
+  std::vector<cv::Point3f> points;
+  TimeCount tc_batch ("batch unprojectFromImage", 1);
+  pose.unprojectFromImage(pixels, depths, points);
+  tc_batch.stop();
+
+  NTK_TEST_FLOAT_EQ(points.size(), ref_points.size());
+  double max_error = 0;
+  foreach_idx(i, points)
+    max_error = std::max(max_error, cv::norm(points[i] - ref_points[i]));
+  ntk_dbg_print(max_error, 1);
+  ntk_ensure(max_error < 1e-5, "Batch unprojection differs from the scalar one.");
+
+  // Same with the depth as z coordinate.
+  std::vector<cv::Point3f> pixels_with_depth (pixels.size());
+  foreach_idx(i, pixels)
+    pixels_with_depth[i] = cv::Point3f(pixels[i].x, pixels[i].y, depths[i]);
+  pose.unprojectFromImage(pixels_with_depth, points);
+  foreach_idx(i, points)
+    ntk_ensure(cv::norm(points[i] - ref_points[i]) < 1e-5, "Batch unprojection with z as depth differs.");
+  return true;
+}
+
+bool test_project()
+{
+  Pose3D pose = make_pose();
+  std::vector<cv::Point2f> pixels;
+  std::vector<float> depths;
+  make_pixels(pixels, depths, 100003);
+
+  std::vector<cv::Point3f> points;
+  pose.unprojectFromImage(pixels, depths, points);
+
+  std::vector<cv::Point3f> ref_pixels (points.size());
+  TimeCount tc_ref ("scalar projectToImage", 1);
+  foreach_idx(i, points)
+    ref_pixels[i] = pose.projectToImage(points[i]);
+  tc_ref.stop();
+
+  std::vector<cv::Point3f> projected;
+  TimeCount tc_batch ("batch projectToImage", 1);
+  pose.projectToImage(points, projected);
+  tc_batch.stop();
+
+  NTK_TEST_FLOAT_EQ(projected.size(), ref_pixels.size());
+  double max_pixel_error = 0, max_depth_error = 0;
+  foreach_idx(i, projected)
+  {
+    max_pixel_error = std::max(max_pixel_error, cv::norm(cv::Point2f(projected[i].x - ref_pixels[i].x,
+                                                                     projected[i].y - ref_pixels[i].y)));
+    max_depth_error = std::max(max_depth_error, double(std::abs(projected[i].z - ref_pixels[i].z)));
+  }
+  ntk_dbg_print(max_pixel_error, 1);
+  ntk_dbg_print(max_depth_error, 1);
+  ntk_ensure(max_pixel_error < 1e-3, "Batch projection differs from the scalar one.");
+  ntk_ensure(max_depth_error < 1e-5, "Batch projection depth differs from the scalar one.");
+
+  // Round trip back to the original pixels.
+  foreach_idx(i, projected)
+    ntk_ensure(std::abs(projected[i].x - pixels[i].x) < 1e-2 && std::abs(projected[i].y - pixels[i].y) < 1e-2,
+               "Projection does not invert unprojection.");
+  return true;
+}
+
+bool test_orthographic_and_empty()
+{
+  Pose3D pose = make_pose();
+  pose.setOrthographic(true);
+
+  std::vector<cv::Point2f> pixels;
+  std::vector<float> depths;
+  make_pixels(pixels, depths, 17);
+
+  std::vector<cv::Point3f> points;
+  pose.unprojectFromImage(pixels, depths, points);
+  foreach_idx(i, points)
+    ntk_ensure(cv::norm(points[i] - pose.unprojectFromImage(pixels[i], depths[i])) < 1e-5,
+               "Orthographic unprojection differs.");
+
+  std::vector<cv::Point3f> projected;
+  pose.projectToImage(points, projected);
+  foreach_idx(i, projected)
+    ntk_ensure(cv::norm(projected[i] - pose.projectToImage(points[i])) < 1e-3,
+               "Orthographic projection differs.");
+
+  pixels.clear(); depths.clear();
+  pose.unprojectFromImage(pixels, depths, points);
+  NTK_TEST_FLOAT_EQ(points.size(), 0);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_unproject();
+  ok &= test_project();
+  ok &= test_orthographic_and_empty();
+  return ok != true;
+}
@@ -0,0 +1,154 @@
+
+#include <ntk/ntk.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/geometry/relative_pose_estimator_icp.h>
+#include <ntk/mesh/mesh.h>
+#include <ntk/mesh/pcl_utils.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+typedef pcl::PointCloud<pcl::PointXYZ> CloudType;
+
+// Wavy surface, curved enough to constrain all the degrees of freedom.
+void make_surface(Mesh& mesh)
+{
+  const int grid_size = 120;
+  for (int r = 0; r < grid_size; ++r)
+  for (int c = 0; c < grid_size; ++c)
+  {
+    float x = c / float(grid_size) - 0.5f;
+    float y = r / float(grid_size) - 0.5f;
+    float z = 1.0f + 0.08f * sin(6*x) * cos(5*y) + 0.04f * sin(13*x*y);
+    mesh.vertices.push_back(cv::Point3f(x, y, z));
+  }
+}
+
+Pose3D identity_pose()
+{
+  Pose3D pose;
+  pose.setCameraParameters(500, 500, 320, 240);
+  return pose;
+}
+
+Pose3D motion(int i)
+{
+  Pose3D pose;
+  pose.applyTransformBefore(cv::Vec3f(0.02f + 0.005f*i, -0.015f, 0.01f*(i%3)),
+                            cv::Vec3f(0.04f, -0.03f + 0.01f*i, 0.03f));
+  return pose;
+}
+
+// Rms distance between the aligned source vertices and the target ones.
+double alignment_error(const Mesh& source, const Mesh& target, const Pose3D& estimated_pose)
+{
+  Mesh aligned = source;
+  aligned.applyTransform(estimated_pose.inverted());
+  double sum = 0;
+  foreach_idx(i, aligned.vertices)
+  {
+    cv::Point3f d = aligned.vertices[i] - target.vertices[i];
+    sum += d.dot(d);
+  }
+  return sqrt(sum / aligned.vertices.size());
+}
+
+bool run_sequence(RelativePoseEstimatorICP<pcl::PointXYZ>& estimator,
+                  const char* name,
+                  const Mesh& target_mesh,
+                  CloudType::ConstPtr target_cloud,
+                  double& max_error)
+{
+  const int num_sources = 6;
+
+  std::vector<Mesh> source_meshes (num_sources, target_mesh);
+  std::vector<CloudType::Ptr> source_clouds;
+  for (int i = 0; i < num_sources; ++i)
+  {
+    source_meshes[i].applyTransform(motion(i));
+    source_clouds.push_back(CloudType::Ptr(new CloudType));
+    meshToPointCloud(*source_clouds.back(), source_meshes[i]);
+  }
+
+  estimator.setVoxelSize(0.01);
+  estimator.setDistanceThreshold(0.1);
+  estimator.setMaxIterations(100);
+  estimator.setTargetCloud(target_cloud);
+  estimator.setTargetPose(identity_pose());
+
+  max_error = 0;
+  TimeCount tc (name, 1);
+  for (int i = 0; i < num_sources; ++i)
+  {
+    estimator.setSourceCloud(source_clouds[i]);
+    estimator.setInitialSourcePoseEstimate(identity_pose());
+    ntk_ensure(estimator.estimateNewPose(), "ICP failed.");
+    double error = alignment_error(source_meshes[i], target_mesh, estimator.estimatedSourcePose());
+    ntk_dbg_print(error, 1);
+    max_error = std::max(max_error, error);
+  }
+  tc.stop();
+  return true;
+}
+
+}
+
+bool test_pyramid_icp()
+{
+  Mesh target_mesh;
+  make_surface(target_mesh);
+  CloudType::Ptr target_cloud (new CloudType);
+  meshToPointCloud(*target_cloud, target_mesh);
+
+  double single_error = 0;
+  RelativePoseEstimatorICP<pcl::PointXYZ> single_level;
+  run_sequence(single_level, "single level ICP x6", target_mesh, target_cloud, single_error);
+
+  double pyramid_error = 0;
+  RelativePoseEstimatorICP<pcl::PointXYZ> pyramid;
+  pyramid.setPyramidLevels(3, 10);
+  run_sequence(pyramid, "3 levels ICP x6", target_mesh, target_cloud, pyramid_error);
+
+  ntk_dbg_print(single_error, 1);
+  ntk_dbg_print(pyramid_error, 1);
+  ntk_ensure(pyramid_error < 0.005, "Pyramid ICP is not accurate enough.");
+  ntk_ensure(pyramid_error < single_error + 0.002, "Pyramid ICP is much worse than single level.");
+  return true;
+}
+
+bool test_target_change()
+{
+  Mesh target_mesh;
+  make_surface(target_mesh);
+  CloudType::Ptr target_cloud (new CloudType);
+  meshToPointCloud(*target_cloud, target_mesh);
+
+  RelativePoseEstimatorICP<pcl::PointXYZ> pyramid;
+  pyramid.setPyramidLevels(3, 10);
+  double error = 0;
+  run_sequence(pyramid, "3 levels ICP x6", target_mesh, target_cloud, error);
+
+  // A new target must invalidate every cached level.
+  Mesh moved_target_mesh = target_mesh;
+  moved_target_mesh.applyTransform(motion(10));
+  CloudType::Ptr moved_target_cloud (new CloudType);
+  meshToPointCloud(*moved_target_cloud, moved_target_mesh);
+  run_sequence(pyramid, "3 levels ICP x6, new target", moved_target_mesh, moved_target_cloud, error);
+  ntk_ensure(error < 0.005, "Cached levels were not updated.");
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_pyramid_icp();
+  ok &= test_target_change();
+  return ok != true;
+}
@@ -0,0 +1,225 @@
+
+#include <ntk/ntk.h>
+#include <ntk/camera/rgbd_calibration.h>
+#include <ntk/camera/rgbd_processor.h>
+#include <ntk/geometry/pose_3d.h>
+#include <ntk/geometry/relative_pose_estimator_from_image.h>
+#include <ntk/mesh/mesh_generator.h>
+#include <ntk/mesh/pcl_utils.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 320;
+const int height = 240;
+
+RGBDCalibrationPtr make_calibration()
+{
+  RGBDCalibrationPtr calib (new RGBDCalibration);
+  cv::Mat1d K = (cv::Mat1d(3,3) << 280, 0, width/2, 0, 280, height/2, 0, 0, 1);
+  calib->depth_intrinsics = K.clone();
+  calib->rgb_intrinsics = K.clone();
+  calib->R = cv::Mat1d::eye(3,3);
+  calib->T = (cv::Mat1d(3,1) << 0.025, 0, 0);
+  calib->setRgbSize(cv::Size(width, height));
+  calib->setRawRgbSize(cv::Size(width, height));
+  calib->depth_pose = new Pose3D;
+  calib->rgb_pose = new Pose3D;
+  calib->updatePoses();
+  return calib;
+}
+
+// Tilted plane with a box in front of it.
+void make_image(RGBDImage& image, RGBDCalibrationConstPtr calib, int frame)
+{
+  cv::RNG rng (frame);
+  image.setCalibration(calib);
+  image.rgbRef() = cv::Mat3b(height, width);
+  image.depthRef() = cv::Mat1f(height, width);
+  image.depthMaskRef() = cv::Mat1b(height, width);
+  for_all_rc(image.depthRef())
+  {
+    float d = 1.5f + 0.002f * r + 0.001f * frame;
+    if (r > 80 && r < 160 && c > 100 && c < 200)
+      d = 1.0f;
+    image.depthRef()(r,c) = d + rng.gaussian(0.002);
+    image.depthMaskRef()(r,c) = 255;
+    image.rgbRef()(r,c) = cv::Vec3b(r, c, (r+c)%256);
+  }
+  image.depth().copyTo(image.mappedDepthRef());
+}
+
+// Features of fixed scene pixels seen from the rgb camera, with the same
+// descriptor in every frame, so that all of them match.
+ntk::Ptr<FeatureSet> make_features(const RGBDImage& image)
+{
+  Pose3D rgb_pose = *image.calibration()->rgb_pose;
+  cv::RNG rng (42);
+  std::vector<FeaturePoint> locations;
+  cv::Mat1f descriptors (0, 64);
+  for (int r = 20; r < height; r += 20)
+  for (int c = 20; c < width; c += 20)
+  {
+    FeaturePoint loc;
+    loc.pt = cv::Point2f(c, r);
+    loc.has_depth = true;
+    loc.depth = (r > 80 && r < 160 && c > 100 && c < 200) ? 1.0f : 1.5f + 0.002f * r;
+    locations.push_back(loc);
+    cv::Mat1f descriptor (1, 64);
+    rng.fill(descriptor, cv::RNG::UNIFORM, 0.f, 1.f);
+    descriptors.push_back(descriptor);
+  }
+  ntk::Ptr<FeatureSet> features (new FeatureSet);
+  features->setFeatures(FeatureSet::Feature_BRIEF64, locations, descriptors);
+  features->compute3dLocation(rgb_pose);
+  return features;
+}
+
+Pose3D align(RelativePoseEstimatorFromRgbFeatures& estimator, const RGBDImage& source)
+{
+  estimator.setSourceImage(source, make_features(source));
+  ntk_ensure(estimator.estimateNewPose(), "Alignment failed.");
+  return estimator.estimatedSourcePose();
+}
+
+RelativePoseEstimatorFromRgbFeatures* new_estimator(const RGBDImage& target)
+{
+  RelativePoseEstimatorFromRgbFeatures* estimator = new RelativePoseEstimatorFromRgbFeatures(FeatureSetParams());
+  estimator->setPostProcessWithRGBDICP(true);
+  estimator->setTargetImage(target, make_features(target));
+  return estimator;
+}
+
+double pose_difference(const Pose3D& p1, const Pose3D& p2)
+{
+  return cv::norm(p1.cvCameraTransform(), p2.cvCameraTransform(), cv::NORM_INF);
+}
+
+// What optimizeWithRGBDICP used to do to prepare both clouds.
+void reference_prepare(const RGBDImage& source, const RGBDImage& target,
+                       pcl::PointCloud<pcl::PointNormal>& source_cloud,
+                       pcl::PointCloud<pcl::PointNormal>& target_cloud)
+{
+  RGBDImage filtered_source_image;
+  source.copyTo(filtered_source_image);
+  RGBDImage filtered_target_image;
+  target.copyTo(filtered_target_image);
+
+  OpenniRGBDProcessor processor;
+  processor.bilateralFilter(filtered_source_image);
+  processor.bilateralFilter(filtered_target_image);
+
+  MeshGenerator generator;
+  generator.setMeshType(MeshGenerator::TriangleMesh);
+  generator.setUseColor(true);
+
+  generator.generate(filtered_source_image);
+  Mesh source_mesh = generator.mesh();
+  source_mesh.computeNormalsFromFaces();
+
+  generator.generate(filtered_target_image);
+  Mesh target_mesh = generator.mesh();
+  target_mesh.computeNormalsFromFaces();
+
+  meshToPointCloud(source_cloud, source_mesh);
+  meshToPointCloud(target_cloud, target_mesh);
+}
+
+}
+
+bool test_preparation_benchmark()
+{
+  const int num_frames = 20;
+  RGBDCalibrationPtr calib = make_calibration();
+
+  RGBDImage target;
+  make_image(target, calib, 0);
+  std::vector<RGBDImage*> sources;
+  for (int i = 1; i <= num_frames; ++i)
+  {
+    sources.push_back(new RGBDImage);
+    make_image(*sources.back(), calib, i);
+  }
+
+  pcl::PointCloud<pcl::PointNormal> ref_source_cloud, ref_target_cloud;
+  TimeCount tc_ref ("reference preparation x20", 1);
+  foreach_idx(i, sources)
+    reference_prepare(*sources[i], target, ref_source_cloud, ref_target_cloud);
+  tc_ref.stop();
+
+  RGBDImage filtered_target, filtered_source;
+  pcl::PointCloud<pcl::PointNormal> target_cloud, source_cloud;
+  TimeCount tc_cached ("cached target preparation x20", 1);
+  prepareRGBDICPCloud(target, filtered_target, target_cloud);
+  foreach_idx(i, sources)
+    prepareRGBDICPCloud(*sources[i], filtered_source, source_cloud, 2);
+  tc_cached.stop();
+
+  ntk_dbg_print(ref_target_cloud.size(), 1);
+  ntk_dbg_print(target_cloud.size(), 1);
+  ntk_dbg_print(source_cloud.size(), 1);
+  ntk_ensure(target_cloud.size() > 0.8 * ref_target_cloud.size(), "Too few target points.");
+  ntk_ensure(source_cloud.size() > 0.2 * ref_source_cloud.size(), "Too few source points.");
+
+  foreach_idx(i, target_cloud.points)
+  {
+    const pcl::PointNormal& p = target_cloud.points[i];
+    float norm = sqrt(p.normal_x*p.normal_x + p.normal_y*p.normal_y + p.normal_z*p.normal_z);
+    ntk_ensure(std::abs(norm - 1.f) < 1e-3, "Normals should be normalized.");
+  }
+
+  foreach_idx(i, sources)
+    delete sources[i];
+  return true;
+}
+
+bool test_cached_target()
+{
+  RGBDCalibrationPtr calib = make_calibration();
+
+  RGBDImage target, source1, source2;
+  make_image(target, calib, 0);
+  make_image(source1, calib, 1);
+  make_image(source2, calib, 2);
+
+  // The second alignment reuses the target cloud of the first one.
+  ntk::Ptr<RelativePoseEstimatorFromRgbFeatures> estimator (new_estimator(target));
+  align(*estimator, source1);
+  TimeCount tc_cached ("cached RGBD-ICP", 1);
+  Pose3D cached_pose = align(*estimator, source2);
+  tc_cached.stop();
+
+  ntk::Ptr<RelativePoseEstimatorFromRgbFeatures> fresh_estimator (new_estimator(target));
+  TimeCount tc_fresh ("uncached RGBD-ICP", 1);
+  Pose3D fresh_pose = align(*fresh_estimator, source2);
+  tc_fresh.stop();
+
+  ntk_dbg_print(pose_difference(cached_pose, fresh_pose), 1);
+  ntk_ensure(pose_difference(cached_pose, fresh_pose) < 1e-5, "Cached target gives a different pose.");
+
+  // Same image object with a new content, the target cloud must be built again.
+  make_image(target, calib, 10);
+  estimator->setTargetImage(target, make_features(target));
+  Pose3D new_target_pose = align(*estimator, source2);
+
+  fresh_estimator = toPtr(new_estimator(target));
+  fresh_pose = align(*fresh_estimator, source2);
+  ntk_dbg_print(pose_difference(new_target_pose, fresh_pose), 1);
+  ntk_ensure(pose_difference(new_target_pose, fresh_pose) < 1e-5, "Target cloud was not rebuilt.");
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_preparation_benchmark();
+  ok &= test_cached_target();
+  return ok != true;
+}
@@ -0,0 +1,142 @@
+
+#include <ntk/ntk.h>
+#include <ntk/gui/screen_grabber.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 320;
+const int height = 240;
+
+QImage make_frame(int index)
+{
+  QImage image (width, height, QImage::Format_RGB32);
+  for (int r = 0; r < height; ++r)
+  {
+    QRgb* row = (QRgb*)image.scanLine(r);
+    for (int c = 0; c < width; ++c)
+      row[c] = qRgb((r + index) % 256, (c + index) % 256, (r + c) % 256);
+  }
+  return image;
+}
+
+QString test_dir(const QString& name)
+{
+  QString path = QDir::temp().absoluteFilePath("ntk_test_screen_grabber_" + name);
+  QDir dir (path);
+  if (dir.exists())
+  {
+    QStringList files = dir.entryList(QDir::Files);
+    foreach_idx(i, files)
+      dir.remove(files[i]);
+  }
+  return path;
+}
+
+}
+
+bool test_caller_cost()
+{
+  const int num_frames = 100;
+
+  std::vector<QImage> frames;
+  for (int i = 0; i < num_frames; ++i)
+    frames.push_back(make_frame(i));
+
+  QString dir = test_dir("png");
+  ScreenGrabber grabber (dir.toStdString(), ScreenGrabber::PngFiles, 2, num_frames);
+
+  TimeCount tc ("saveFrame x100", 1);
+  foreach_idx(i, frames)
+    ntk_ensure(grabber.saveFrame(frames[i]), "Frame should not be dropped.");
+  uint64 caller_msecs = tc.elapsedMsecsNoPrint();
+  tc.stop();
+
+  TimeCount tc_flush ("flush", 1);
+  grabber.flush();
+  tc_flush.stop();
+
+  ntk_dbg_print(caller_msecs, 1);
+  // Encoding happens in the workers, queuing must stay under 1ms per frame.
+  ntk_ensure(caller_msecs < num_frames, "saveFrame is too slow on the caller thread.");
+
+  NTK_TEST_FLOAT_EQ(grabber.numSavedFrames(), num_frames);
+  NTK_TEST_FLOAT_EQ(grabber.numFailedFrames(), 0);
+  NTK_TEST_FLOAT_EQ(grabber.numDroppedFrames(), 0);
+  for (int i = 0; i < num_frames; ++i)
+  {
+    QString filename = QDir(dir).absoluteFilePath(QString("frame%1.png").arg(i, 4, 10, QChar('0')));
+    QImage saved (filename);
+    ntk_ensure(!saved.isNull(), "Saved frame is missing.");
+    ntk_ensure(saved.size() == frames[i].size(), "Saved frame has a wrong size.");
+    ntk_ensure(saved.pixel(7, 5) == frames[i].pixel(7, 5), "Saved frame has wrong content.");
+  }
+  return true;
+}
+
+bool test_raw_stream()
+{
+  const int num_frames = 20;
+
+  QString dir = test_dir("raw");
+  {
+    ScreenGrabber grabber (dir.toStdString(), ScreenGrabber::RawStream, 4);
+    for (int i = 0; i < num_frames; ++i)
+    {
+      // Never drop, so that the stream size is known.
+      while (!grabber.saveFrame(make_frame(i)))
+        ntk::sleep(1);
+    }
+    grabber.flush();
+    NTK_TEST_FLOAT_EQ(grabber.numSavedFrames(), num_frames);
+    NTK_TEST_FLOAT_EQ(grabber.numFailedFrames(), 0);
+  }
+
+  QFileInfo stream (QDir(dir).absoluteFilePath("frames.raw"));
+  ntk_ensure(stream.exists(), "Stream file is missing.");
+  const qint64 frame_size = 4*sizeof(qint32) + make_frame(0).byteCount();
+  NTK_TEST_FLOAT_EQ(stream.size(), num_frames * frame_size);
+  return true;
+}
+
+bool test_failed_saves()
+{
+  // Files cannot be created below a regular file.
+  QString blocker = QDir::temp().absoluteFilePath("ntk_test_screen_grabber_blocker");
+  {
+    QFile file (blocker);
+    file.open(QIODevice::WriteOnly);
+  }
+
+  ScreenGrabber grabber ((blocker + "/frames").toStdString(), ScreenGrabber::PngFiles);
+  for (int i = 0; i < 3; ++i)
+    grabber.saveFrame(make_frame(i));
+  grabber.flush();
+
+  NTK_TEST_FLOAT_EQ(grabber.numSavedFrames(), 0);
+  NTK_TEST_FLOAT_EQ(grabber.numFailedFrames(), 3);
+  QFile::remove(blocker);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  QCoreApplication app (argc, argv);
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_caller_cost();
+  ok &= test_raw_stream();
+  ok &= test_failed_saves();
+  return ok != true;
+}
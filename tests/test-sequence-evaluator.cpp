@@ -0,0 +1,137 @@
+
+#include <ntk/ntk.h>
+#include <ntk/camera/rgbd_sequence_evaluator.h>
+
+#include "test_common.h"
+
+#include <sstream>
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 160;
+const int height = 120;
+
+float clean_depth(int r, int c) { return 1.0f + 0.005f * c; }
+
+void make_sequence(RGBDSequenceEvaluator& evaluator, int num_frames)
+{
+  cv::RNG rng (42);
+  for (int i = 0; i < num_frames; ++i)
+  {
+    RGBDImagePtr image (new RGBDImage);
+    image->rawDepthRef() = cv::Mat1f(height, width);
+    for_all_rc(image->rawDepthRef())
+      image->rawDepthRef()(r,c) = clean_depth(r,c) + rng.gaussian(0.01);
+    image->rawDepth().copyTo(image->depthRef());
+    evaluator.addFrame(image);
+  }
+}
+
+// Box filter on depth, the larger the kernel, the slower and the more accurate.
+class SmoothingPipeline : public RGBDEvaluationPipeline
+{
+public:
+  virtual void configure(const ParameterSet& parameters)
+  {
+    kernel_size = parameters.getParameter("kernel_size").toInt();
+  }
+
+  virtual bool processFrame(const RGBDImage& frame, int frame_index, EvaluationResult& result)
+  {
+    cv::blur(frame.depth(), smoothed, cv::Size(kernel_size, kernel_size));
+    double error = 0;
+    for (int r = 10; r < height-10; ++r)
+    for (int c = 10; c < width-10; ++c)
+      error += std::abs(smoothed(r,c) - clean_depth(r,c));
+    result.addMetric("depth_error", error / ((height-20) * (width-20)));
+    return true;
+  }
+
+private:
+  int kernel_size;
+  cv::Mat1f smoothed;
+};
+
+}
+
+bool test_grid()
+{
+  RGBDSequenceEvaluator evaluator;
+  QList<QVariant> sizes; sizes << 1 << 3 << 5;
+  QList<QVariant> flags; flags << false << true;
+  evaluator.addParameterValues("kernel_size", sizes);
+  evaluator.addParameterValues("flag", flags);
+  NTK_TEST_FLOAT_EQ(evaluator.numConfigurations(), 6);
+
+  ParameterSet parameters;
+  evaluator.getConfiguration(3, parameters);
+  NTK_TEST_FLOAT_EQ(parameters.getParameter("kernel_size").toInt(), 3);
+  NTK_TEST_FLOAT_EQ(parameters.getParameter("flag").toBool(), true);
+  return true;
+}
+
+bool test_smoothing_evaluation()
+{
+  RGBDSequenceEvaluator evaluator;
+  make_sequence(evaluator, 20);
+  QList<QVariant> sizes; sizes << 1 << 3 << 5 << 9 << 15;
+  evaluator.addParameterValues("kernel_size", sizes);
+  evaluator.evaluate(RGBDEvaluationPipelineFactoryOf<SmoothingPipeline>());
+
+  const std::vector<EvaluationResult>& results = evaluator.results();
+  NTK_TEST_FLOAT_EQ(results.size(), 5);
+  foreach_idx(i, results)
+  {
+    NTK_TEST_FLOAT_EQ(results[i].configuration, i);
+    NTK_TEST_FLOAT_EQ(results[i].latencies_ms.size(), 20);
+    NTK_TEST_FLOAT_EQ(results[i].num_failed_frames, 0);
+    ntk_ensure(results[i].latencyPercentile(0.5) <= results[i].latencyPercentile(0.99), "Percentiles not sorted.");
+  }
+
+  // Larger kernels are more accurate on a noisy plane.
+  ntk_ensure(results[0].metricMean("depth_error") > results[2].metricMean("depth_error"), "Smoothing should help.");
+
+  // The unsmoothed configuration cannot meet the quality bar.
+  int best = evaluator.fastestConfiguration("depth_error", results[1].metricMean("depth_error") * 0.9, false);
+  ntk_ensure(best >= 2, "Wrong configuration selected.");
+
+  std::ostringstream csv;
+  evaluator.writeCsv(csv);
+  ntk_dbg(1) << csv.str();
+  std::istringstream lines (csv.str());
+  std::string line;
+  int num_lines = 0;
+  while (std::getline(lines, line))
+    ++num_lines;
+  NTK_TEST_FLOAT_EQ(num_lines, 6);
+  return true;
+}
+
+bool test_processor_evaluation()
+{
+  RGBDSequenceEvaluator evaluator;
+  make_sequence(evaluator, 5);
+  QList<QVariant> min_depths; min_depths << 0.5 << 1.2 << 1.5;
+  evaluator.addParameterValues("min_depth", min_depths);
+  evaluator.setNumParallelRuns(1);
+  evaluator.evaluate(RGBDEvaluationPipelineFactoryOf<RGBDProcessorEvaluationPipeline>());
+
+  const std::vector<EvaluationResult>& results = evaluator.results();
+  ntk_ensure(results[0].metricMean("valid_depth_ratio") > results[1].metricMean("valid_depth_ratio"), "min_depth not applied.");
+  ntk_ensure(results[1].metricMean("valid_depth_ratio") > results[2].metricMean("valid_depth_ratio"), "min_depth not applied.");
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_grid();
+  ok &= test_smoothing_evaluation();
+  ok &= test_processor_evaluation();
+  return ok != true;
+}
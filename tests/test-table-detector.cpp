@@ -0,0 +1,181 @@
+
+#include <ntk/core.h>
+#include <ntk/utils/debug.h>
+#include <ntk/utils/time.h>
+#include <ntk/detection/table_object_detector.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+using pcl::PointXYZ;
+
+namespace
+{
+
+typedef pcl::PointCloud<PointXYZ> Cloud;
+
+void add_point(Cloud& cloud, cv::RNG& rng, float x, float y, float z, float tilt)
+{
+  PointXYZ p;
+  p.x = x + rng.gaussian(0.0005);
+  p.y = y * cos(tilt) - z * sin(tilt) + rng.gaussian(0.0005);
+  p.z = y * sin(tilt) + z * cos(tilt) + rng.gaussian(0.0005);
+  cloud.points.push_back(p);
+}
+
+// A table 30cm below the camera with two boxes, seen with the given tilt.
+Cloud::Ptr make_scene(cv::RNG& rng, float tilt, float second_box_offset = 0.f)
+{
+  Cloud::Ptr cloud (new Cloud);
+  const float step = 0.004f;
+  for (float x = -0.5f; x < 0.5f; x += step)
+  for (float z = -1.5f; z < -0.7f; z += step)
+    add_point(*cloud, rng, x, -0.3f, z, tilt);
+
+  const float box_x[] = { -0.2f, 0.15f + second_box_offset };
+  for (int b = 0; b < 2; ++b)
+  {
+    const float x0 = box_x[b], z0 = -1.1f, size = 0.08f;
+    for (float u = 0; u < size; u += step / 2)
+    for (float v = 0; v < size; v += step / 2)
+    {
+      add_point(*cloud, rng, x0 + u, -0.3f + size, z0 - v, tilt); // top
+      add_point(*cloud, rng, x0 + u, -0.3f + v, z0, tilt); // front
+      add_point(*cloud, rng, x0, -0.3f + v, z0 - u, tilt); // side
+    }
+  }
+
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+  return cloud;
+}
+
+bool run_sequence(const char* name, float tilt_per_frame, bool expect_reuse)
+{
+  const int num_frames = 20;
+
+  TableObjectDetector<PointXYZ> full_detector;
+  TableObjectDetector<PointXYZ> temporal_detector;
+  temporal_detector.setTemporalMode(true);
+
+  std::vector<Cloud::Ptr> frames;
+  cv::RNG rng (42);
+  for (int i = 0; i < num_frames; ++i)
+    frames.push_back(make_scene(rng, 0.3f + tilt_per_frame * i));
+
+  std::vector<int> full_counts;
+  TimeCount tc_full (std::string(name) + " full", 1);
+  foreach_idx(i, frames)
+  {
+    full_detector.detect(frames[i]);
+    full_counts.push_back(full_detector.objectClusters().size());
+  }
+  tc_full.stop();
+
+  int num_reused = 0;
+  TimeCount tc_temporal (std::string(name) + " temporal", 1);
+  foreach_idx(i, frames)
+  {
+    temporal_detector.detect(frames[i]);
+    num_reused += temporal_detector.tableModelWasReused();
+    NTK_TEST_FLOAT_EQ(temporal_detector.objectClusters().size(), full_counts[i]);
+  }
+  tc_temporal.stop();
+
+  ntk_dbg_print(num_reused, 1);
+  if (expect_reuse)
+    NTK_TEST_FLOAT_EQ(num_reused, num_frames - 1);
+  else
+    ntk_ensure(num_reused < num_frames / 2, "Table model should be fitted again when the camera moves.");
+  return true;
+}
+
+}
+
+bool test_partial_reclustering()
+{
+  const int num_frames = 10;
+
+  TableObjectDetector<PointXYZ> full_detector;
+  TableObjectDetector<PointXYZ> temporal_detector;
+  temporal_detector.setTemporalMode(true);
+
+  int num_full_reclustered = 0;
+  int num_temporal_reclustered = 0;
+  for (int i = 0; i < num_frames; ++i)
+  {
+    // Same noise for every frame, only the second box moves.
+    cv::RNG rng (42);
+    Cloud::Ptr frame = make_scene(rng, 0.3f, 0.01f * i);
+
+    full_detector.detect(frame);
+    temporal_detector.detect(frame);
+    NTK_TEST_FLOAT_EQ(temporal_detector.objectClusters().size(), full_detector.objectClusters().size());
+    num_full_reclustered += full_detector.numReclusteredObjects();
+    num_temporal_reclustered += temporal_detector.numReclusteredObjects();
+  }
+
+  ntk_dbg_print(num_full_reclustered, 1);
+  ntk_dbg_print(num_temporal_reclustered, 1);
+  // The static box is only extracted in the first frame.
+  ntk_ensure(num_temporal_reclustered <= num_full_reclustered - (num_frames - 1),
+             "Clusters of the static box should be kept.");
+  return true;
+}
+
+bool test_small_motion()
+{
+  const int num_frames = 10;
+
+  TableObjectDetector<PointXYZ> full_detector;
+  TableObjectDetector<PointXYZ> temporal_detector;
+  temporal_detector.setTemporalMode(true);
+
+  for (int i = 0; i < num_frames; ++i)
+  {
+    // The second box moves by much less than a cell, the kept clusters must follow it.
+    cv::RNG rng (42);
+    Cloud::Ptr frame = make_scene(rng, 0.3f, 0.001f * i);
+
+    full_detector.detect(frame);
+    temporal_detector.detect(frame);
+
+    const std::vector< std::vector<cv::Point3f> >& full_clusters = full_detector.objectClusters();
+    const std::vector< std::vector<cv::Point3f> >& temporal_clusters = temporal_detector.objectClusters();
+    NTK_TEST_FLOAT_EQ(temporal_clusters.size(), full_clusters.size());
+
+    std::vector<float> full_centers, temporal_centers;
+    foreach_idx(k, full_clusters)
+    {
+      full_centers.push_back(cv::mean(cv::Mat(full_clusters[k]))[0]);
+      temporal_centers.push_back(cv::mean(cv::Mat(temporal_clusters[k]))[0]);
+    }
+    std::sort(full_centers.begin(), full_centers.end());
+    std::sort(temporal_centers.begin(), temporal_centers.end());
+    foreach_idx(k, full_centers)
+      ntk_ensure(std::abs(full_centers[k] - temporal_centers[k]) < 1e-5f, "Kept cluster did not follow the object.");
+  }
+  return true;
+}
+
+bool test_static_sequence()
+{
+  return run_sequence("static sequence", 0.f, true);
+}
+
+bool test_moving_sequence()
+{
+  return run_sequence("moving sequence", 0.05f, false);
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_static_sequence();
+  ok &= test_moving_sequence();
+  ok &= test_partial_reclustering();
+  ok &= test_small_motion();
+  return ok != true;
+}
@@ -0,0 +1,140 @@
+
+#include <ntk/ntk.h>
+#include <ntk/camera/tof_frame_processor.h>
+#include <ntk/utils/opencv_utils.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+using namespace ntk;
+
+namespace
+{
+
+const unsigned invalid_flag = 0x1;
+
+void generate_frame(cv::Mat1f& distance, cv::Mat1f& amplitude, cv::Mat_<unsigned>& flags)
+{
+  cv::RNG rng (42);
+  rng.fill(distance, cv::RNG::UNIFORM, 0.2, 3.0);
+  rng.fill(amplitude, cv::RNG::UNIFORM, 0, 5000);
+  for_all_rc(flags)
+    flags(r,c) = rng.uniform(0.f, 1.f) < 0.1f ? invalid_flag : 0;
+}
+
+// What PmdGrabber used to do.
+void reference_processing(const cv::Mat1f& distance_in,
+                          const cv::Mat1f& amplitude,
+                          const cv::Mat_<unsigned>& flags,
+                          cv::Mat1f& depth,
+                          cv::Mat1f& amplitude_out,
+                          cv::Mat3b& gray)
+{
+  cv::Mat1f distance = distance_in.clone();
+  for_all_rc(distance)
+    if (flags(r,c) & invalid_flag)
+      distance(r,c) = 0.f;
+
+  flip(distance, depth, 0);
+  flip(amplitude, amplitude_out, 0);
+  flip(toMat3b(normalize_toMat1b(amplitude)), gray, 0);
+}
+
+}
+
+bool test_pmd_like_processing()
+{
+  cv::Size size (176, 120);
+  cv::Mat1f distance (size), amplitude (size);
+  cv::Mat_<unsigned> flags (size);
+  generate_frame(distance, amplitude, flags);
+
+  cv::Mat1f ref_depth, ref_amplitude;
+  cv::Mat3b ref_gray;
+  TimeCount tc_ref ("reference ToF processing x100", 1);
+  for (int i = 0; i < 100; ++i)
+    reference_processing(distance, amplitude, flags, ref_depth, ref_amplitude, ref_gray);
+  tc_ref.stop();
+
+  ToFFrameProcessor processor;
+  processor.setImageSize(size);
+  processor.setFlipVertically(true);
+  processor.setInvalidFlags(invalid_flag);
+
+  cv::Mat1f depth, amplitude_out;
+  cv::Mat3b gray;
+  TimeCount tc_fused ("fused ToF processing x100", 1);
+  for (int i = 0; i < 100; ++i)
+    processor.process(distance.ptr<float>(), amplitude.ptr<float>(), flags.ptr<unsigned>(),
+                      depth, amplitude_out, &gray);
+  tc_fused.stop();
+
+  NTK_TEST_FLOAT_EQ(float(cv::norm(depth, ref_depth, cv::NORM_INF)), 0.f);
+  NTK_TEST_FLOAT_EQ(float(cv::norm(amplitude_out, ref_amplitude, cv::NORM_INF)), 0.f);
+  // Rounding of the normalization may differ by one gray level.
+  ntk_ensure(cv::norm(gray, ref_gray, cv::NORM_INF) <= 1, "Gray images differ.");
+  return true;
+}
+
+bool test_radial_to_z()
+{
+  cv::Size size (64, 48);
+  cv::Mat1f distance (size), amplitude (size);
+  cv::Mat_<unsigned> flags (size);
+  generate_frame(distance, amplitude, flags);
+
+  cv::Mat1d K = (cv::Mat1d(3,3) << 80, 0, 32, 0, 80, 24, 0, 0, 1);
+
+  ToFFrameProcessor processor;
+  processor.setImageSize(size);
+  processor.setRadialToZ(K);
+
+  cv::Mat1f depth, amplitude_out;
+  processor.process(distance.ptr<float>(), amplitude.ptr<float>(), 0, depth, amplitude_out, 0);
+
+  // Same formula as RGBDProcessor::fixDepthGeometry.
+  for_all_rc(depth)
+  {
+    cv::Point3f v ((c-32)/80.0, (r-24)/80.0, 1);
+    float expected = distance(r,c) / sqrt(v.dot(v));
+    ntk_ensure(flt_eq(depth(r,c), expected, 1e-4f), "Wrong Z conversion.");
+  }
+  return true;
+}
+
+bool test_int16_processing()
+{
+  cv::Size size (160, 120);
+  cv::Mat_<short> raw_depth (size), confidence (size);
+  cv::RNG rng (42);
+  rng.fill(raw_depth, cv::RNG::UNIFORM, 0, 32767);
+  rng.fill(confidence, cv::RNG::UNIFORM, 0, 1000);
+
+  ToFFrameProcessor processor;
+  processor.setImageSize(size);
+  processor.setRawDepthScale(1.f/1000.f);
+  processor.setMaxRawDepth(31999);
+
+  cv::Mat1f depth, amplitude;
+  cv::Mat3b gray;
+  processor.process(raw_depth.ptr<short>(), confidence.ptr<short>(), depth, amplitude, &gray);
+
+  for_all_rc(depth)
+  {
+    float expected = raw_depth(r,c) > 31999 ? 0.f : raw_depth(r,c) / 1000.f;
+    ntk_ensure(flt_eq(depth(r,c), expected, 1e-6f), "Wrong depth conversion.");
+    ntk_ensure(amplitude(r,c) == confidence(r,c), "Wrong confidence copy.");
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_pmd_like_processing();
+  ok &= test_radial_to_z();
+  ok &= test_int16_processing();
+  return ok != true;
+}
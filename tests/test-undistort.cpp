@@ -0,0 +1,176 @@
+
+#include <ntk/ntk.h>
+#include <ntk/image/fixed_point_remap.h>
+#include <ntk/utils/time.h>
+
+#include "test_common.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace ntk;
+
+namespace
+{
+
+const int width = 640;
+const int height = 480;
+
+void make_maps(cv::Mat& map1, cv::Mat& map2)
+{
+  cv::Mat1d K = (cv::Mat1d(3,3) << 525, 0, width/2, 0, 525, height/2, 0, 0, 1);
+  cv::Mat1d distortion = (cv::Mat1d(1,5) << 0.2, -0.6, 0.001, -0.002, 0.5);
+  cv::initUndistortRectifyMap(K, distortion, cv::Mat(), K, cv::Size(width, height),
+                              CV_16SC2, map1, map2);
+}
+
+// Two planes at 1m and 2m with a vertical discontinuity, and some holes.
+void make_planes(cv::Mat1f& depth, cv::Mat1f& amplitude, cv::Mat3b& rgb)
+{
+  cv::RNG rng (42);
+  depth.create(height, width);
+  amplitude.create(height, width);
+  rgb.create(height, width);
+  for_all_rc(depth)
+  {
+    depth(r,c) = c < width/2 ? 1.0f + 0.0005f*r : 2.0f + 0.0005f*c;
+    if (rng.uniform(0.f, 1.f) < 0.01f)
+      depth(r,c) = 0.f;
+    amplitude(r,c) = rng.uniform(0.f, 1000.f);
+    rgb(r,c) = cv::Vec3b(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+  }
+}
+
+// Source depth, or 0 outside of the image.
+float depth_at(const cv::Mat1f& depth, int x, int y)
+{
+  if (x < 0 || y < 0 || x >= depth.cols || y >= depth.rows)
+    return 0.f;
+  return depth(y,x);
+}
+
+}
+
+bool test_color_and_amplitude()
+{
+  cv::Mat map1, map2;
+  make_maps(map1, map2);
+  cv::Mat1f depth, amplitude;
+  cv::Mat3b rgb;
+  make_planes(depth, amplitude, rgb);
+
+  cv::Mat3b ref_rgb;
+  cv::Mat1f ref_amplitude;
+  cv::remap(rgb, ref_rgb, map1, map2, CV_INTER_LINEAR);
+  cv::remap(amplitude, ref_amplitude, map1, map2, CV_INTER_LINEAR);
+
+  cv::Mat3b undistorted_rgb;
+  cv::Mat1f undistorted_depth, undistorted_amplitude, no_intensity;
+  remapColor(map1, map2, rgb, undistorted_rgb);
+  remapDepthPlanes(map1, map2, depth, undistorted_depth,
+                   amplitude, undistorted_amplitude,
+                   cv::Mat1f(), no_intensity);
+  ntk_ensure(no_intensity.empty(), "Intensity should be skipped.");
+
+  for_all_rc(ref_rgb)
+  {
+    for (int k = 0; k < 3; ++k)
+      ntk_ensure(std::abs(ref_rgb(r,c)[k] - undistorted_rgb(r,c)[k]) <= 1, "Color differs.");
+    ntk_ensure(std::abs(ref_amplitude(r,c) - undistorted_amplitude(r,c)) < 1e-2, "Amplitude differs.");
+  }
+  return true;
+}
+
+bool test_depth_discontinuities()
+{
+  cv::Mat map1, map2;
+  make_maps(map1, map2);
+  cv::Mat1f depth, amplitude;
+  cv::Mat3b rgb;
+  make_planes(depth, amplitude, rgb);
+
+  cv::Mat1f undistorted_depth, no_amplitude, no_intensity;
+  remapDepthPlanes(map1, map2, depth, undistorted_depth,
+                   cv::Mat1f(), no_amplitude, cv::Mat1f(), no_intensity);
+
+  int num_interpolated = 0;
+  for_all_rc(undistorted_depth)
+  {
+    const cv::Vec2s xy = map1.at<cv::Vec2s>(r,c);
+    if (xy[0] < -1 || xy[1] < -1 || xy[0] >= width || xy[1] >= height)
+    {
+      NTK_TEST_FLOAT_EQ(undistorted_depth(r,c), 0);
+      continue;
+    }
+
+    float values[] = { depth_at(depth, xy[0], xy[1]), depth_at(depth, xy[0]+1, xy[1]),
+                       depth_at(depth, xy[0], xy[1]+1), depth_at(depth, xy[0]+1, xy[1]+1) };
+    float min_value = *std::min_element(values, values+4);
+    float max_value = *std::max_element(values, values+4);
+
+    const float d = undistorted_depth(r,c);
+    ntk_ensure(d >= min_value - 1e-5f && d <= max_value + 1e-5f, "Depth out of the neighbourhood range.");
+
+    if (min_value < 1e-5f || max_value - min_value > 0.5f)
+    {
+      // Across a discontinuity or a hole, one of the source values must be kept.
+      ntk_ensure(std::find(values, values+4, d) != values+4, "Depth interpolated across a discontinuity.");
+    }
+    else
+    {
+      ++num_interpolated;
+    }
+  }
+  ntk_ensure(num_interpolated > width*height/2, "Too few interpolated pixels.");
+  return true;
+}
+
+bool test_benchmark()
+{
+  cv::Mat map1, map2;
+  make_maps(map1, map2);
+  cv::Mat1f depth, amplitude, intensity;
+  cv::Mat3b rgb;
+  make_planes(depth, amplitude, rgb);
+  amplitude.copyTo(intensity);
+
+  const int num_iterations = 50;
+
+  // What RGBDProcessor::undistortImages used to do.
+  cv::Mat3b tmp3b, rgb_im;
+  cv::Mat1f ref_depth, ref_amplitude, ref_intensity;
+  TimeCount tc_ref ("cv::remap per plane", 1);
+  for (int i = 0; i < num_iterations; ++i)
+  {
+    rgb.copyTo(rgb_im);
+    cv::remap(rgb_im, tmp3b, map1, map2, CV_INTER_LINEAR);
+    tmp3b.copyTo(rgb_im);
+    cv::remap(depth, ref_depth, map1, map2, CV_INTER_LINEAR);
+    cv::remap(amplitude, ref_amplitude, map1, map2, CV_INTER_LINEAR);
+    cv::remap(intensity, ref_intensity, map1, map2, CV_INTER_LINEAR);
+  }
+  tc_ref.stop();
+
+  cv::Mat3b undistorted_rgb;
+  cv::Mat1f undistorted_depth, undistorted_amplitude, undistorted_intensity;
+  TimeCount tc_fused ("fixed-point single pass", 1);
+  for (int i = 0; i < num_iterations; ++i)
+  {
+    remapColor(map1, map2, rgb, undistorted_rgb);
+    remapDepthPlanes(map1, map2, depth, undistorted_depth,
+                     amplitude, undistorted_amplitude,
+                     intensity, undistorted_intensity);
+  }
+  tc_fused.stop();
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ntk::ntk_debug_level = 1;
+
+  bool ok = true;
+  ok &= test_color_and_amplitude();
+  ok &= test_depth_discontinuities();
+  ok &= test_benchmark();
+  return ok != true;
+}